@@ -10,11 +10,12 @@
 # name of the target OS on which the built artifacts will run
 # and the toolchain prefix
 set(CMAKE_SYSTEM_NAME Windows)
-set(TOOLCHAIN_PREFIX i586-mingw32msvc)
+set(TOOLCHAIN_PREFIX i686-w64-mingw32)
 
 # cross compilers to use for C and C++
-set(CMAKE_C_COMPILER ${TOOLCHAIN_PREFIX}-gcc)
-set(CMAKE_CXX_COMPILER ${TOOLCHAIN_PREFIX}-g++)
+# (the -posix variants provide std::thread, used by the writers)
+set(CMAKE_C_COMPILER ${TOOLCHAIN_PREFIX}-gcc-posix)
+set(CMAKE_CXX_COMPILER ${TOOLCHAIN_PREFIX}-g++-posix)
 set(CMAKE_RC_COMPILER ${TOOLCHAIN_PREFIX}-windres)
 
 # here is the target environment located
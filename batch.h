@@ -0,0 +1,260 @@
+#ifndef SKP2TRI_BATCH_H
+#define SKP2TRI_BATCH_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <stdint.h>
+#include <dirent.h>
+#ifndef _WIN32
+#include <csignal>
+#endif
+#include "parallel.h"
+#include "worker_process.h"
+#include "scene_volume.h"
+
+// skp2tri --batch: many models converted by a pool of worker processes,
+// each one started once (and the SketchUp SDK initialized once in it) for
+// all the files it is handed. The files go largest first, so the longest
+// conversions do not end up last, one at a time. A worker that dies, or is
+// killed past the time limit of a file, only fails the file it was
+// converting and is started again for the next one.
+//
+// The workers are skp2tri itself with --batch-worker. They read one request
+// per line, "<input>\t<output>", followed by the options of that conversion
+// only, if any, each as "\t<argument>". They answer each request with one
+// line, "ok\t<seconds>\t<triangles>" or "error\t<seconds>\t<message>".
+// skp2tri --daemon (daemon.h) keeps such workers too.
+
+struct BatchJob {
+    std::string input;
+    std::string output;
+    uint64_t size;      // of the input, in bytes
+    bool converted;
+    double seconds;     // as measured by the worker, or until it died
+    uint64_t triangles; // in the output
+    std::string error;
+
+    BatchJob() : size(0), converted(false), seconds(0.0), triangles(0) {}
+};
+
+// '*' any run of characters, '?' any one.
+inline bool wildcard_match(const char* pattern, const char* name) {
+    if (*pattern == '\0')
+        return *name == '\0';
+    if (*pattern == '*')
+        return wildcard_match(pattern + 1, name) || (*name != '\0' && wildcard_match(pattern, name + 1));
+    return *name != '\0' && (*pattern == '?' || *pattern == *name) && wildcard_match(pattern + 1, name + 1);
+}
+
+// Appends the files matching `pattern`, whose wildcards may only be in the
+// file name (as shells that do not expand them, cmd.exe, leave them), or
+// the path itself when it has none.
+inline void expand_input(const std::string& pattern, std::vector<std::string>& paths) {
+    size_t slash = pattern.find_last_of("/\\");
+    std::string directory = slash == std::string::npos ? "" : pattern.substr(0, slash + 1);
+    std::string name = pattern.substr(directory.size());
+    if (name.find_first_of("*?") == std::string::npos) {
+        paths.push_back(pattern);
+        return;
+    }
+    std::vector<std::string> matches;
+    if (DIR* listing = opendir(directory.empty() ? "." : directory.c_str())) {
+        while (dirent* entry = readdir(listing)) {
+            std::string file = entry->d_name;
+            if (file != "." && file != ".." && wildcard_match(name.c_str(), file.c_str()))
+                matches.push_back(directory + file);
+        }
+        closedir(listing);
+    }
+    std::sort(matches.begin(), matches.end());
+    paths.insert(paths.end(), matches.begin(), matches.end());
+}
+
+// One input (or pattern) per line; empty lines and lines starting with '#'
+// are skipped.
+inline bool read_batch_list(const std::string& path, std::vector<std::string>& inputs, std::string* error) {
+    std::ifstream list(path.c_str());
+    if (!list) {
+        *error = "file " + path + " impossible to open";
+        return false;
+    }
+    std::string line;
+    while (std::getline(list, line)) {
+        if (!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        if (!line.empty() && line[0] != '#')
+            expand_input(line, inputs);
+    }
+    return true;
+}
+
+// <directory>/<input name><format>, next to the input when `directory` is
+// empty.
+inline std::string batch_output_path(const std::string& input, const std::string& directory,
+                                     const std::string& format) {
+    size_t slash = input.find_last_of("/\\");
+    size_t dot = input.find_last_of(".");
+    size_t begin = slash == std::string::npos ? 0 : slash + 1;
+    size_t end = dot == std::string::npos || dot < begin ? input.size() : dot;
+    std::string stem = input.substr(begin, end - begin);
+    if (directory.empty())
+        return input.substr(0, begin) + stem + format;
+    char last = directory[directory.size() - 1];
+    return directory + (last == '/' || last == '\\' ? "" : "/") + stem + format;
+}
+
+// The jobs of `inputs`, each input once, largest first. Inputs that cannot
+// be opened are kept, the workers report them like any other failure. An
+// input whose output is already that of an input listed before it (a/x.skp
+// and b/x.skp with --output-dir) is failed here, never converted, rather
+// than overwriting it.
+inline std::vector<BatchJob> batch_jobs(const std::vector<std::string>& inputs, const std::string& directory,
+                                        const std::string& format) {
+    std::vector<BatchJob> jobs;
+    std::set<std::string> listed;
+    std::map<std::string, std::string> outputs; // the input writing each output
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        if (!listed.insert(inputs[i]).second)
+            continue;
+        BatchJob job;
+        job.input = inputs[i];
+        job.output = batch_output_path(inputs[i], directory, format);
+        std::string key = job.output;
+#ifdef _WIN32
+        // The file names of Windows are not case sensitive.
+        for (size_t c = 0; c < key.size(); ++c)
+            key[c] = (char)std::tolower((unsigned char)key[c]);
+#endif
+        std::pair<std::map<std::string, std::string>::iterator, bool> taken =
+            outputs.insert(std::make_pair(key, job.input));
+        if (!taken.second)
+            job.error = "output collides with " + taken.first->second;
+        std::ifstream probe(inputs[i].c_str(), std::ios::binary | std::ios::ate);
+        job.size = probe ? (uint64_t)probe.tellg() : 0;
+        jobs.push_back(job);
+    }
+    std::stable_sort(jobs.begin(), jobs.end(), [](const BatchJob& a, const BatchJob& b) { return a.size > b.size; });
+    return jobs;
+}
+
+// The input, the output and the options of a request.
+inline bool parse_batch_request(const std::string& line, std::vector<std::string>& fields) {
+    fields.clear();
+    size_t begin = 0;
+    for (;;) {
+        size_t tab = line.find('\t', begin);
+        fields.push_back(line.substr(begin, tab == std::string::npos ? std::string::npos : tab - begin));
+        if (tab == std::string::npos)
+            break;
+        begin = tab + 1;
+    }
+    return fields.size() >= 2;
+}
+
+inline std::string batch_reply(bool converted, double seconds, uint64_t triangles, const std::string& error) {
+    std::ostringstream reply;
+    reply << (converted ? "ok" : "error") << "\t" << seconds << "\t";
+    if (converted)
+        reply << triangles;
+    else
+        reply << error;
+    return reply.str();
+}
+
+inline bool parse_batch_reply(const std::string& line, BatchJob& job) {
+    size_t first = line.find('\t');
+    size_t second = first == std::string::npos ? first : line.find('\t', first + 1);
+    if (second == std::string::npos)
+        return false;
+    std::string status = line.substr(0, first);
+    job.seconds = std::atof(line.substr(first + 1, second - first - 1).c_str());
+    job.converted = status == "ok";
+    if (job.converted)
+        job.triangles = std::strtoull(line.substr(second + 1).c_str(), 0, 10);
+    else
+        job.error = line.substr(second + 1);
+    return status == "ok" || status == "error";
+}
+
+// A worker that died is noticed by its missing answer, not by a signal.
+inline void ignore_broken_pipes() {
+#ifndef _WIN32
+    std::signal(SIGPIPE, SIG_IGN);
+#endif
+}
+
+// Converts `job` with `options` on `worker`, which is started with
+// `worker_args` first if it is not running. A worker that dies or answers
+// nonsense is stopped, the job failed; one still converting after `timeout`
+// seconds (if over 0) is killed, the job failed as timed out.
+inline void convert_on_worker(WorkerProcess& worker, const std::string& program,
+                              const std::vector<std::string>& worker_args, const std::vector<std::string>& options,
+                              double timeout, BatchJob& job) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::string request = job.input + "\t" + job.output;
+    for (size_t o = 0; o < options.size(); ++o)
+        request += "\t" + options[o];
+    // Each field has to stay one field, on the one line.
+    size_t tabs = (size_t)std::count(request.begin(), request.end(), '\t');
+    std::string reply;
+    if (request.find_first_of("\r\n") != std::string::npos || tabs != 1 + options.size())
+        job.error = "tabs and line breaks are not supported in the file names and options";
+    else if (!worker.running() && !worker.start(program, worker_args))
+        job.error = "worker process impossible to start";
+    else if (!worker.send(request) || !worker.receive(reply, timeout)) {
+        if (worker.timed_out()) {
+            std::ostringstream message;
+            message << "timed out after " << timeout << " s";
+            job.error = message.str();
+            worker.kill();
+        }
+        else
+            job.error = "worker process ended (" + worker.stop() + ") while converting";
+        job.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    else if (!parse_batch_reply(reply, job)) {
+        job.error = "unexpected answer of the worker process : " + reply;
+        worker.stop();
+    }
+}
+
+// Converts the jobs on `processes` workers, `program` started with
+// `worker_args`, each within `timeout` seconds (if over 0), and calls
+// done(job) as each one ends (from the thread that watches its worker, so
+// `done` must be thread safe).
+template <class Done>
+void run_batch(const std::string& program, const std::vector<std::string>& worker_args, std::vector<BatchJob>& jobs,
+               unsigned processes, double timeout, Done done) {
+    ignore_broken_pipes();
+    if (processes == 0)
+        processes = default_thread_count();
+    std::vector<WorkerProcess> workers(std::max(1u, std::min<unsigned>(processes, (unsigned)jobs.size())));
+    parallel_for(jobs.size(), processes, [&](size_t j, unsigned w) {
+        if (jobs[j].error.empty()) // else failed before any conversion
+            convert_on_worker(workers[w], program, worker_args, std::vector<std::string>(), timeout, jobs[j]);
+        done(jobs[j]);
+    });
+    for (size_t w = 0; w < workers.size(); ++w)
+        workers[w].stop();
+}
+
+// One line per job, in the order of the jobs.
+inline void write_batch_csv(std::ostream& out, const std::vector<BatchJob>& jobs) {
+    out << "input,output,size,status,seconds,triangles,error\n";
+    for (size_t j = 0; j < jobs.size(); ++j) {
+        const BatchJob& job = jobs[j];
+        out << csv_field(job.input) << "," << csv_field(job.output) << "," << job.size << ","
+            << (job.converted ? "ok" : "failed") << "," << job.seconds << "," << job.triangles << ","
+            << csv_field(job.error) << "\n";
+    }
+}
+
+#endif // SKP2TRI_BATCH_H
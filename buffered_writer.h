@@ -0,0 +1,73 @@
+#ifndef SKP2TRI_BUFFERED_WRITER_H
+#define SKP2TRI_BUFFERED_WRITER_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+// Sequential output through large blocks, for the formats whose size is only
+// known once they have been formatted (text .tri). Small writes are gathered
+// in memory and the file only sees block-sized fwrite calls.
+class BufferedWriter {
+public:
+    explicit BufferedWriter(size_t block_size = 4 << 20)
+        : file_(0), block_size_(block_size), written_(0), failed_(false) {}
+
+    ~BufferedWriter() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+        file_ = std::fopen(path.c_str(), "wb");
+        written_ = 0;
+        failed_ = file_ == 0;
+        buffer_.reserve(block_size_);
+        return file_ != 0;
+    }
+
+    void write(const char* data, size_t size) {
+        written_ += size;
+        if (buffer_.size() + size > block_size_)
+            flush();
+        if (size >= block_size_) {
+            if (file_ && std::fwrite(data, 1, size, file_) != size)
+                failed_ = true;
+            return;
+        }
+        buffer_.insert(buffer_.end(), data, data + size);
+    }
+
+    void write(const std::string& data) { write(data.data(), data.size()); }
+
+    // Bytes handed to write() so far, i.e. the offset of the next byte.
+    uint64_t offset() const { return written_; }
+
+    void flush() {
+        if (file_ && !buffer_.empty() && std::fwrite(&buffer_[0], 1, buffer_.size(), file_) != buffer_.size())
+            failed_ = true;
+        buffer_.clear();
+    }
+
+    bool close() {
+        if (file_ == 0)
+            return !failed_;
+        flush();
+        if (std::fclose(file_) != 0)
+            failed_ = true;
+        file_ = 0;
+        return !failed_;
+    }
+
+private:
+    BufferedWriter(const BufferedWriter&);
+    BufferedWriter& operator=(const BufferedWriter&);
+
+    std::FILE* file_;
+    std::vector<char> buffer_;
+    size_t block_size_;
+    uint64_t written_;
+    bool failed_;
+};
+
+#endif // SKP2TRI_BUFFERED_WRITER_H
@@ -0,0 +1,131 @@
+#include "tri_bvh.h"
+#include "synthetic_triangles.h"
+#include "parallel.h"
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+// Build time of the hierarchy on synthetic triangles (see synthetic_triangles.h)
+// for 1, 2, 4... threads. Every tree is checked: each triangle in exactly
+// one leaf, children inside their parent, and the same tree whatever the
+// thread count.
+
+void display_usage(int argc, char** argv) {
+    cout << "Usage is :" << endl;
+    cout << argv[0] << " [options]" << endl;
+    cout << "Options :" << endl;
+    cout << "  --millions <n>      triangles, in millions (default: 4)" << endl;
+    cout << "  -t, --threads <n>   most threads tried (default: one per core)" << endl;
+    cout << "  --leaf <n>          most triangles per leaf (default: 8)" << endl;
+    cout << "  --bins <n>          SAH bins per axis (default: 16)" << endl;
+}
+
+bool inside(const TriBvhNode& child, const TriBvhNode& parent) {
+    for (int d = 0; d < 3; ++d)
+        if (child.min[d] < parent.min[d] || child.max[d] > parent.max[d])
+            return false;
+    return true;
+}
+
+// Walks the tree from the root; returns an empty string when it is sound.
+string check(const Bvh& bvh, const TriangleArrays& triangles) {
+    vector<uint8_t> seen(triangles.size(), 0);
+    vector<uint32_t> stack(1, 0);
+    size_t visited = 0;
+    while (!stack.empty()) {
+        uint32_t n = stack.back();
+        stack.pop_back();
+        if (n >= bvh.nodes.size())
+            return "child out of range";
+        ++visited;
+        const TriBvhNode& node = bvh.nodes[n];
+        if (node.count == 0) {
+            if (!inside(bvh.nodes[n + 1], node) || !inside(bvh.nodes[node.first], node))
+                return "child outside its parent";
+            stack.push_back(node.first);
+            stack.push_back(n + 1);
+            continue;
+        }
+        for (uint32_t e = node.first; e < node.first + node.count; ++e) {
+            uint32_t t = bvh.triangles[e];
+            if (seen[t]++)
+                return "triangle in two leaves";
+            for (int k = 0; k < 3; ++k)
+                if (triangles.x[k][t] < node.min[0] || triangles.x[k][t] > node.max[0]
+                    || triangles.y[k][t] < node.min[1] || triangles.y[k][t] > node.max[1]
+                    || triangles.z[k][t] < node.min[2] || triangles.z[k][t] > node.max[2])
+                    return "triangle outside its leaf";
+        }
+    }
+    if (visited != bvh.nodes.size())
+        return "unreachable nodes";
+    for (size_t t = 0; t < seen.size(); ++t)
+        if (!seen[t])
+            return "triangle missing";
+    return "";
+}
+
+int main(int argc, char** argv) {
+
+    double millions = 4.0;
+    unsigned threads = 0;
+    BvhOptions options;
+    for (int i = 1; i < argc; ++i) {
+        string arg(argv[i]);
+        if (arg == "-h" || arg == "--help") {
+            display_usage(argc, argv);
+            return 0;
+        }
+        else if (arg == "--millions" && i + 1 < argc)
+            millions = atof(argv[++i]);
+        else if ((arg == "-t" || arg == "--threads") && i + 1 < argc)
+            threads = (unsigned)atoi(argv[++i]);
+        else if (arg == "--leaf" && i + 1 < argc)
+            options.leaf_size = (unsigned)atoi(argv[++i]);
+        else if (arg == "--bins" && i + 1 < argc)
+            options.bins = (unsigned)atoi(argv[++i]);
+        else {
+            display_usage(argc, argv);
+            return 1;
+        }
+    }
+    if (threads == 0)
+        threads = default_thread_count();
+
+    TriangleArrays triangles;
+    synthetic_triangles((size_t)(millions * 1e6), triangles, threads);
+    cout << triangles.size() << " synthetic triangles, leaves of up to " << options.leaf_size << ", "
+         << options.bins << " bins" << endl;
+
+    Bvh reference;
+    double single = 0.0;
+    int status = 0;
+    for (unsigned t = 1;; t = min(2 * t, threads)) {
+        options.threads = t;
+        Bvh bvh;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        build_bvh(triangles, options, bvh);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (t == 1)
+            single = seconds;
+
+        string error = check(bvh, triangles);
+        if (error.empty() && t > 1
+            && (bvh.nodes.size() != reference.nodes.size() || bvh.triangles != reference.triangles
+                || memcmp(&bvh.nodes[0], &reference.nodes[0], bvh.nodes.size() * sizeof(TriBvhNode)) != 0))
+            error = "not the same tree as with one thread";
+        cout << "  " << t << " thread(s) : " << seconds << " s, " << 1e3 * seconds / (triangles.size() / 1e6)
+             << " ms per million triangles, x" << single / seconds << ", " << bvh.nodes.size()
+             << " nodes, SAH cost " << bvh_sah_cost(bvh) << (error.empty() ? "" : ", ERROR : ") << error << endl;
+        if (!error.empty())
+            status = 1;
+        if (t == 1)
+            reference.nodes.swap(bvh.nodes), reference.triangles.swap(bvh.triangles);
+        if (t >= threads)
+            break;
+    }
+    return status;
+}
@@ -0,0 +1,417 @@
+#ifndef SKP2TRI_DAEMON_H
+#define SKP2TRI_DAEMON_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <set>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "batch.h"
+#include "json.h"
+
+// skp2tri --daemon : conversions served over a Unix domain socket by warm
+// workers, the batch's (batch.h), started with the daemon and started again
+// as soon as one dies, so that a request never waits for the SDK to
+// initialize. skp2tri_client sends the requests.
+//
+// Every message is a frame : its length in 4 bytes, little endian, then its
+// content. A request is made of fields separated by '\0' : "convert", the
+// input, the output and the options of that conversion (as on the command
+// line), or only "status". The answer is one JSON object. A conversion is
+// queued, up to the capacity of the queue : past it, the request is turned
+// down at once ("status": "busy") rather than left waiting, and so is a
+// connection past the number served at once. The socket is only open to
+// the user running the daemon.
+
+const uint32_t DAEMON_FRAME_LIMIT = 1 << 20;
+
+inline bool write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = ::write(fd, data, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        data += written;
+        size -= (size_t)written;
+    }
+    return true;
+}
+
+inline bool read_all(int fd, char* data, size_t size) {
+    while (size > 0) {
+        ssize_t count = ::read(fd, data, size);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        data += count;
+        size -= (size_t)count;
+    }
+    return true;
+}
+
+inline bool write_frame(int fd, const std::string& content) {
+    uint32_t size = (uint32_t)content.size();
+    unsigned char length[4] = { (unsigned char)size, (unsigned char)(size >> 8), (unsigned char)(size >> 16),
+                                (unsigned char)(size >> 24) };
+    return write_all(fd, (const char*)length, 4) && write_all(fd, content.data(), content.size());
+}
+
+// False at the end of the connection, or for a frame over the limit.
+inline bool read_frame(int fd, std::string& content) {
+    unsigned char length[4];
+    if (!read_all(fd, (char*)length, 4))
+        return false;
+    uint32_t size = length[0] | (uint32_t)length[1] << 8 | (uint32_t)length[2] << 16 | (uint32_t)length[3] << 24;
+    if (size > DAEMON_FRAME_LIMIT)
+        return false;
+    content.resize(size);
+    return size == 0 || read_all(fd, &content[0], size);
+}
+
+inline std::string join_fields(const std::vector<std::string>& fields) {
+    std::string content;
+    for (size_t f = 0; f < fields.size(); ++f) {
+        if (f > 0)
+            content += '\0';
+        content += fields[f];
+    }
+    return content;
+}
+
+inline std::vector<std::string> split_fields(const std::string& content) {
+    std::vector<std::string> fields;
+    size_t begin = 0;
+    for (;;) {
+        size_t end = content.find('\0', begin);
+        fields.push_back(content.substr(begin, end == std::string::npos ? std::string::npos : end - begin));
+        if (end == std::string::npos)
+            return fields;
+        begin = end + 1;
+    }
+}
+
+inline bool socket_address(const std::string& path, sockaddr_un& address, std::string* error) {
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        *error = "socket path " + path + " empty or too long";
+        return false;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+// The sockets are closed on exec from their creation : a worker started by
+// another thread meanwhile would otherwise inherit them, and keep a
+// connection open past its end here.
+inline int cloexec_socket() {
+#ifdef SOCK_CLOEXEC
+    return socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+#else
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0)
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+#endif
+}
+
+inline int accept_cloexec(int listener) {
+#if defined(__linux__) || defined(__FreeBSD__)
+    int fd = accept4(listener, 0, 0, SOCK_CLOEXEC);
+#else
+    int fd = accept(listener, 0, 0);
+    if (fd >= 0)
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+    return fd;
+}
+
+// A connection to the daemon listening on `path`, -1 if there is none.
+inline int connect_daemon(const std::string& path, std::string* error) {
+    sockaddr_un address;
+    if (!socket_address(path, address, error))
+        return -1;
+    int fd = cloexec_socket();
+    if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+        *error = "no daemon listening on " + path + " (" + std::strerror(errno) + ")";
+        if (fd >= 0)
+            ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+namespace daemon_detail {
+
+inline volatile std::sig_atomic_t& stop_requested() {
+    static volatile std::sig_atomic_t requested = 0;
+    return requested;
+}
+
+extern "C" inline void request_stop(int) { stop_requested() = 1; }
+
+} // namespace daemon_detail
+
+struct DaemonOptions {
+    std::string socket_path;
+    unsigned workers;  // 0: one per core
+    size_t queue;      // conversions waiting for a worker, at most
+    double timeout;    // seconds a conversion may take, its worker then killed; 0: no limit
+    size_t connections; // served at once, at most
+
+    DaemonOptions() : workers(0), queue(64), timeout(600.0), connections(256) {}
+};
+
+class ConversionDaemon {
+public:
+    ConversionDaemon(const std::string& program, const std::vector<std::string>& worker_args,
+                     const DaemonOptions& options)
+        : program_(program), worker_args_(worker_args), options_(options), stopping_(false), running_(0),
+          accepted_(0), rejected_(0), converted_(0), failed_(0), next_connection_(0) {
+        if (options_.workers == 0)
+            options_.workers = default_thread_count();
+    }
+
+    // Serves until SIGINT or SIGTERM, then finishes the queued conversions.
+    bool run(std::ostream& log, std::string* error) {
+        sockaddr_un address;
+        if (!socket_address(options_.socket_path, address, error))
+            return false;
+        int listener = cloexec_socket();
+        // A socket left by a daemon that did not stop cleanly is replaced.
+        ::unlink(options_.socket_path.c_str());
+        // Created read and write for its owner only, 0600 (no thread runs
+        // yet to be affected by the umask).
+        mode_t umask_before = umask(0177);
+        bool bound = listener >= 0 && bind(listener, (sockaddr*)&address, sizeof(address)) == 0;
+        umask(umask_before);
+        if (!bound || listen(listener, 64) != 0) {
+            *error = "socket " + options_.socket_path + " impossible to listen on (" + std::strerror(errno) + ")";
+            if (listener >= 0)
+                ::close(listener);
+            return false;
+        }
+        ignore_broken_pipes();
+        std::signal(SIGINT, daemon_detail::request_stop);
+        std::signal(SIGTERM, daemon_detail::request_stop);
+
+        std::vector<std::thread> workers;
+        for (unsigned w = 0; w < options_.workers; ++w)
+            workers.push_back(std::thread(&ConversionDaemon::work, this, w));
+        log << "daemon : listening on " << options_.socket_path << ", " << options_.workers << " workers, "
+            << options_.queue << " queued conversions at most" << std::endl;
+
+        // The thread of each connection, by number, joined once it has ended.
+        std::map<uint64_t, std::thread> serving;
+        while (!daemon_detail::stop_requested()) {
+            join_ended(serving);
+            pollfd ready = { listener, POLLIN, 0 };
+            if (poll(&ready, 1, 250) <= 0)
+                continue;
+            int connection = accept_cloexec(listener);
+            if (connection < 0)
+                continue;
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (connections_.size() >= options_.connections) {
+                // Turned down before its request is read : that answer is
+                // read by the client once its request is sent, or fails.
+                ++rejected_;
+                std::string answer = busy("too many connections");
+                lock.unlock();
+                write_frame(connection, answer + "\n");
+                ::close(connection);
+                continue;
+            }
+            connections_.insert(connection);
+            uint64_t number = next_connection_++;
+            serving[number] = std::thread(&ConversionDaemon::serve, this, connection, number);
+        }
+
+        log << "daemon : stopping, " << queue_.size() << " queued conversions left to finish" << std::endl;
+        ::close(listener);
+        ::unlink(options_.socket_path.c_str());
+        std::unique_lock<std::mutex> lock(mutex_);
+        stopping_ = true;
+        queued_.notify_all();
+        // Connections waiting for a request are ended, those waiting for a
+        // conversion get its answer first.
+        for (std::set<int>::iterator c = connections_.begin(); c != connections_.end(); ++c)
+            shutdown(*c, SHUT_RD);
+        finished_.wait(lock, [&]() { return connections_.empty(); });
+        lock.unlock();
+        for (std::map<uint64_t, std::thread>::iterator t = serving.begin(); t != serving.end(); ++t)
+            t->second.join();
+        for (size_t w = 0; w < workers.size(); ++w)
+            workers[w].join();
+        return true;
+    }
+
+private:
+    struct Job {
+        std::vector<std::string> options;
+        BatchJob result;
+        std::chrono::steady_clock::time_point submitted;
+        double queued_seconds;
+        unsigned worker;
+        bool done;
+    };
+
+    // One worker process, kept warm : started before any request and again
+    // as soon as it has died.
+    void work(unsigned w) {
+        WorkerProcess worker;
+        worker.start(program_, worker_args_);
+        for (;;) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            queued_.wait(lock, [&]() { return stopping_ || !queue_.empty(); });
+            if (queue_.empty())
+                break;
+            Job* job = queue_.front();
+            queue_.pop_front();
+            ++running_;
+            lock.unlock();
+
+            job->worker = w;
+            job->queued_seconds =
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - job->submitted).count();
+            convert_on_worker(worker, program_, worker_args_, job->options, options_.timeout, job->result);
+            if (!worker.running())
+                worker.start(program_, worker_args_);
+
+            lock.lock();
+            --running_;
+            ++(job->result.converted ? converted_ : failed_);
+            job->done = true;
+            finished_.notify_all();
+        }
+        worker.stop();
+    }
+
+    // Joins the threads of the connections that have ended.
+    void join_ended(std::map<uint64_t, std::thread>& serving) {
+        std::vector<uint64_t> ended;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ended.swap(ended_);
+        }
+        for (size_t e = 0; e < ended.size(); ++e) {
+            serving[ended[e]].join();
+            serving.erase(ended[e]);
+        }
+    }
+
+    // The requests of connection `number`, answered in order.
+    void serve(int connection, uint64_t number) {
+        std::string request;
+        while (read_frame(connection, request)) {
+            std::vector<std::string> fields = split_fields(request);
+            std::string answer;
+            if (fields[0] == "status" && fields.size() == 1)
+                answer = status();
+            else if (fields[0] == "convert" && fields.size() >= 3)
+                answer = convert(fields);
+            else
+                answer = "{\"status\": \"error\", \"error\": \"unexpected request\"}";
+            if (!write_frame(connection, answer + "\n"))
+                break;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        connections_.erase(connection);
+        ended_.push_back(number);
+        ::close(connection);
+        finished_.notify_all();
+    }
+
+    std::string convert(const std::vector<std::string>& fields) {
+        Job job;
+        job.result.input = fields[1];
+        job.result.output = fields[2];
+        job.options.assign(fields.begin() + 3, fields.end());
+        job.submitted = std::chrono::steady_clock::now();
+        job.queued_seconds = 0.0;
+        job.worker = 0;
+        job.done = false;
+        {
+            // Admission : a full queue turns the request down at once.
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (stopping_ || queue_.size() >= options_.queue) {
+                ++rejected_;
+                return busy(stopping_ ? "the daemon is stopping" : "the queue is full");
+            }
+            ++accepted_;
+            queue_.push_back(&job);
+            queued_.notify_one();
+            finished_.wait(lock, [&]() { return job.done; });
+        }
+        const BatchJob& result = job.result;
+        double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - job.submitted).count();
+        std::ostringstream answer;
+        answer << "{\"status\": \"" << (result.converted ? "ok" : "failed") << "\", \"input\": "
+               << json_string(result.input) << ", \"output\": " << json_string(result.output)
+               << ", \"triangles\": " << result.triangles << ", \"worker\": " << job.worker
+               << ", \"queued_seconds\": " << json_number(job.queued_seconds)
+               << ", \"convert_seconds\": " << json_number(result.seconds)
+               << ", \"total_seconds\": " << json_number(total);
+        if (!result.converted)
+            answer << ", \"error\": " << json_string(result.error);
+        answer << "}";
+        return answer.str();
+    }
+
+    // The answer turning a request down, mutex_ held.
+    std::string busy(const std::string& reason) const {
+        std::ostringstream answer;
+        answer << "{\"status\": \"busy\", \"queued\": " << queue_.size() << ", \"running\": " << running_
+               << ", \"error\": " << json_string(reason) << "}";
+        return answer.str();
+    }
+
+    std::string status() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::ostringstream answer;
+        answer << "{\"status\": \"ok\", \"workers\": " << options_.workers << ", \"queue\": " << options_.queue
+               << ", \"queued\": " << queue_.size() << ", \"running\": " << running_
+               << ", \"connections\": " << connections_.size() << ", \"accepted\": " << accepted_
+               << ", \"rejected\": " << rejected_ << ", \"converted\": " << converted_
+               << ", \"failed\": " << failed_ << "}";
+        return answer.str();
+    }
+
+    std::string program_;
+    std::vector<std::string> worker_args_;
+    DaemonOptions options_;
+
+    std::mutex mutex_;                  // guards everything below
+    std::condition_variable queued_;    // a job was queued, or stopping_ set
+    std::condition_variable finished_;  // a job is done, or a connection ended
+    std::deque<Job*> queue_;            // owned by the connections waiting for them
+    std::set<int> connections_;
+    std::vector<uint64_t> ended_;       // connections whose thread is yet to be joined
+    bool stopping_;
+    size_t running_;
+    uint64_t accepted_;
+    uint64_t rejected_;
+    uint64_t converted_;
+    uint64_t failed_;
+    uint64_t next_connection_;
+};
+
+#endif // SKP2TRI_DAEMON_H
@@ -0,0 +1,168 @@
+#ifndef SKP2TRI_FAST_FLOAT_H
+#define SKP2TRI_FAST_FLOAT_H
+
+#include <stdint.h>
+#include <cstring>
+#include <cstdlib>
+#include <limits>
+#include <string>
+
+// Decimal number parsing for the text readers, in the spirit of fast_float:
+// digits are accumulated eight at a time with SWAR arithmetic on a 64-bit
+// word, and the value is built exactly whenever the mantissa fits in 53 bits
+// and the power of ten is small (Clinger's fast path), which covers every
+// number printed with "%g". Anything else falls back to strtod.
+
+inline bool is_eight_digits(uint64_t word) {
+    return ((word & 0xF0F0F0F0F0F0F0F0ULL) == 0x3030303030303030ULL)
+        && (((word + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) == 0x3030303030303030ULL);
+}
+
+// Value of eight ASCII digits stored little endian in `word`.
+inline uint32_t parse_eight_digits(uint64_t word) {
+    word -= 0x3030303030303030ULL;
+    word = (word * 10) + (word >> 8);
+    word = (((word & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32)))
+          + (((word >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+    return (uint32_t)word;
+}
+
+inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+// Parses the number starting at `p` (no leading blanks) and ending before
+// `end`. Returns the position after it, or 0 if there is no number there.
+inline const char* parse_double(const char* p, const char* end, double& value) {
+    static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                     1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    const char* start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0;       // significant digits accumulated in mantissa
+    int exponent = 0;
+    bool truncated = false;
+    const char* first_digit = p;
+
+    while (p < end && *p == '0')
+        ++p;
+    while (end - p >= 8 && digits <= 11) {
+        uint64_t word;
+        std::memcpy(&word, p, 8);
+        if (!is_eight_digits(word))
+            break;
+        mantissa = mantissa * 100000000 + parse_eight_digits(word);
+        digits += mantissa > 0 ? 8 : 0;
+        p += 8;
+    }
+    for (; p < end && is_digit(*p); ++p) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            if (mantissa > 0)
+                ++digits;
+        }
+        else {
+            ++exponent;
+            truncated = true;
+        }
+    }
+    bool has_digits = p > first_digit;
+
+    if (p < end && *p == '.') {
+        ++p;
+        const char* fraction = p;
+        if (mantissa == 0) {
+            while (p < end && *p == '0')
+                ++p;
+            exponent -= (int)(p - fraction);
+        }
+        while (end - p >= 8 && digits <= 11) {
+            uint64_t word;
+            std::memcpy(&word, p, 8);
+            if (!is_eight_digits(word))
+                break;
+            mantissa = mantissa * 100000000 + parse_eight_digits(word);
+            digits += 8;
+            exponent -= 8;
+            p += 8;
+        }
+        for (; p < end && is_digit(*p); ++p) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                if (mantissa > 0)
+                    ++digits;
+                --exponent;
+            }
+            else
+                truncated = true;
+        }
+        has_digits = has_digits || p > fraction;
+    }
+
+    if (!has_digits) {
+        // "%g" writes non-finite values as inf / nan.
+        p = start + (p > start && (start[0] == '-' || start[0] == '+') ? 1 : 0);
+        if (end - p >= 3 && (std::memcmp(p, "inf", 3) == 0 || std::memcmp(p, "INF", 3) == 0)) {
+            value = negative ? -std::numeric_limits<double>::infinity() : std::numeric_limits<double>::infinity();
+            p += 3;
+            if (end - p >= 5 && std::memcmp(p, "inity", 5) == 0)
+                p += 5;
+            return p;
+        }
+        if (end - p >= 3 && (std::memcmp(p, "nan", 3) == 0 || std::memcmp(p, "NAN", 3) == 0)) {
+            value = std::numeric_limits<double>::quiet_NaN();
+            return p + 3;
+        }
+        return 0;
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* e = p + 1;
+        bool negative_exponent = false;
+        if (e < end && (*e == '-' || *e == '+')) {
+            negative_exponent = *e == '-';
+            ++e;
+        }
+        if (e < end && is_digit(*e)) {
+            int explicit_exponent = 0;
+            for (; e < end && is_digit(*e); ++e)
+                if (explicit_exponent < 100000)
+                    explicit_exponent = explicit_exponent * 10 + (*e - '0');
+            exponent += negative_exponent ? -explicit_exponent : explicit_exponent;
+            p = e;
+        }
+    }
+
+    if (!truncated && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+        double result = (double)mantissa;
+        result = exponent < 0 ? result / powers[-exponent] : result * powers[exponent];
+        value = negative ? -result : result;
+        return p;
+    }
+
+    // Slow path: let the C library round the rare long or extreme numbers.
+    // The text is not null terminated, so it is copied first.
+    size_t length = (size_t)(p - start);
+    if (length < 128) {
+        char buffer[128];
+        std::memcpy(buffer, start, length);
+        buffer[length] = 0;
+        value = std::strtod(buffer, 0);
+    }
+    else
+        value = std::strtod(std::string(start, length).c_str(), 0);
+    return p;
+}
+
+inline const char* parse_float(const char* p, const char* end, float& value) {
+    double parsed;
+    p = parse_double(p, end, parsed);
+    if (p)
+        value = (float)parsed;
+    return p;
+}
+
+#endif // SKP2TRI_FAST_FLOAT_H
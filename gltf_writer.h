@@ -0,0 +1,415 @@
+#ifndef SKP2TRI_GLTF_WRITER_H
+#define SKP2TRI_GLTF_WRITER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include "scene.h"
+#include "scene_writers.h"
+#include "json.h"
+
+// glTF 2.0 binary (.glb) writer.
+//
+// Every scene mesh becomes one glTF mesh shared by all the nodes that
+// instance it, with one primitive per material. Faces painted with the
+// default material take the material of their group or instance, so a mesh
+// containing such faces gets one glTF mesh per inherited material actually
+// used. Nodes keep the group and instance transformations; the root node
+// converts SketchUp inches / Z up to glTF meters / Y up.
+//
+// The layout of the binary chunk is planned first, then the file is mapped
+// at its final size and the primitives are written by the worker threads.
+
+struct GltfPrimitive {
+    size_t mesh;
+    size_t material;
+    std::vector<size_t> faces;
+    size_t vertex_count;
+    size_t index_count;
+    bool has_uvs;
+    float min[3];
+    float max[3];
+    uint64_t positions;  // byte offsets in the binary chunk
+    uint64_t normals;
+    uint64_t uvs;
+    uint64_t indices;
+};
+
+struct GltfMesh {
+    std::string name;
+    std::vector<size_t> primitives;
+};
+
+class GltfWriter {
+public:
+    GltfWriter(const Scene& scene, const WriteOptions& options)
+        : scene_(scene), options_(options), bin_size_(0) {}
+
+    bool write(const std::string& path) {
+        plan_meshes();
+        plan_buffers();
+        std::string json = make_json();
+        while (json.size() % 4 != 0)
+            json += ' ';
+
+        uint64_t total = 12 + 8 + json.size();
+        if (bin_size_ > 0)
+            total += 8 + bin_size_;
+
+        MappedFile file;
+        if (!file.create(path, total))
+            return false;
+        char* out = file.data();
+        put_u32(out, 0x46546C67); // "glTF"
+        put_u32(out + 4, 2);
+        put_u32(out + 8, (uint32_t)total);
+        put_u32(out + 12, (uint32_t)json.size());
+        put_u32(out + 16, 0x4E4F534A); // "JSON"
+        std::memcpy(out + 20, json.data(), json.size());
+        if (bin_size_ > 0) {
+            char* chunk = out + 20 + json.size();
+            put_u32(chunk, (uint32_t)bin_size_);
+            put_u32(chunk + 4, 0x004E4942); // "BIN"
+            char* bin = chunk + 8;
+            parallel_for(primitives_.size(), options_.threads, [&](size_t p, unsigned) {
+                write_primitive(primitives_[p], bin);
+            });
+        }
+        return file.close();
+    }
+
+private:
+    static void put_u32(char* out, uint32_t value) { std::memcpy(out, &value, 4); }
+
+    size_t effective_material(const SceneFace& face, size_t node_material) const {
+        return face.material != NO_MATERIAL ? face.material : node_material;
+    }
+
+    bool mesh_inherits(const SceneMesh& mesh) const {
+        for (size_t f = 0; f < mesh.faces.size(); ++f)
+            if (mesh.faces[f].material == NO_MATERIAL && mesh.faces[f].triangle_count > 0)
+                return true;
+        return false;
+    }
+
+    // Assigns a glTF mesh to every node, creating it on first use.
+    void plan_meshes() {
+        std::map<std::pair<size_t, size_t>, size_t> meshes;
+        std::vector<signed char> inherits(scene_.meshes.size(), -1);
+        node_meshes_.assign(scene_.nodes.size(), -1);
+
+        for (size_t n = 0; n < scene_.nodes.size(); ++n) {
+            const SceneNode& node = scene_.nodes[n];
+            const SceneMesh& mesh = scene_.meshes[node.mesh];
+            if (mesh.triangle_count() == 0)
+                continue;
+            if (inherits[node.mesh] < 0)
+                inherits[node.mesh] = mesh_inherits(mesh) ? 1 : 0;
+            size_t inherited = inherits[node.mesh] ? node.material : NO_MATERIAL;
+
+            std::pair<size_t, size_t> key(node.mesh, inherited);
+            std::map<std::pair<size_t, size_t>, size_t>::const_iterator found = meshes.find(key);
+            if (found != meshes.end()) {
+                node_meshes_[n] = (long)found->second;
+                continue;
+            }
+
+            GltfMesh gltf_mesh;
+            gltf_mesh.name = mesh.name;
+            std::map<size_t, size_t> by_material;
+            for (size_t f = 0; f < mesh.faces.size(); ++f) {
+                const SceneFace& face = mesh.faces[f];
+                if (face.triangle_count == 0)
+                    continue;
+                size_t material = effective_material(face, inherited);
+                std::map<size_t, size_t>::const_iterator primitive = by_material.find(material);
+                if (primitive == by_material.end()) {
+                    GltfPrimitive new_primitive;
+                    new_primitive.mesh = node.mesh;
+                    new_primitive.material = material;
+                    new_primitive.has_uvs = material != NO_MATERIAL
+                        && !scene_.materials[material].texture.empty() && !mesh.uvs.empty();
+                    primitive = by_material.insert(std::make_pair(material, primitives_.size())).first;
+                    gltf_mesh.primitives.push_back(primitives_.size());
+                    primitives_.push_back(new_primitive);
+                }
+                primitives_[primitive->second].faces.push_back(f);
+            }
+            meshes[key] = meshes_.size();
+            node_meshes_[n] = (long)meshes_.size();
+            meshes_.push_back(gltf_mesh);
+        }
+    }
+
+    // Counts and bounds each primitive, then lays the binary chunk out.
+    void plan_buffers() {
+        parallel_for(primitives_.size(), options_.threads, [&](size_t p, unsigned) {
+            GltfPrimitive& primitive = primitives_[p];
+            const SceneMesh& mesh = scene_.meshes[primitive.mesh];
+            primitive.vertex_count = 0;
+            primitive.index_count = 0;
+            for (int k = 0; k < 3; ++k) {
+                primitive.min[k] = HUGE_VALF;
+                primitive.max[k] = -HUGE_VALF;
+            }
+            for (size_t f = 0; f < primitive.faces.size(); ++f) {
+                const SceneFace& face = mesh.faces[primitive.faces[f]];
+                primitive.vertex_count += face.vertex_count;
+                primitive.index_count += 3 * face.triangle_count;
+                for (size_t v = face.first_vertex; v < face.first_vertex + face.vertex_count; ++v) {
+                    float point[3] = { (float)mesh.vertices[v].x, (float)mesh.vertices[v].y, (float)mesh.vertices[v].z };
+                    for (int k = 0; k < 3; ++k) {
+                        primitive.min[k] = std::min(primitive.min[k], point[k]);
+                        primitive.max[k] = std::max(primitive.max[k], point[k]);
+                    }
+                }
+            }
+        });
+
+        // Every attribute is made of 4 byte components, so packing the
+        // views back to back keeps all of them correctly aligned.
+        bin_size_ = 0;
+        for (size_t p = 0; p < primitives_.size(); ++p) {
+            GltfPrimitive& primitive = primitives_[p];
+            const SceneMesh& mesh = scene_.meshes[primitive.mesh];
+            primitive.positions = bin_size_;
+            bin_size_ += 12 * (uint64_t)primitive.vertex_count;
+            primitive.normals = bin_size_;
+            if (!mesh.normals.empty())
+                bin_size_ += 12 * (uint64_t)primitive.vertex_count;
+            primitive.uvs = bin_size_;
+            if (primitive.has_uvs)
+                bin_size_ += 8 * (uint64_t)primitive.vertex_count;
+            primitive.indices = bin_size_;
+            bin_size_ += 4 * (uint64_t)primitive.index_count;
+        }
+    }
+
+    void write_primitive(const GltfPrimitive& primitive, char* bin) const {
+        const SceneMesh& mesh = scene_.meshes[primitive.mesh];
+        float* positions = (float*)(bin + primitive.positions);
+        float* normals = (float*)(bin + primitive.normals);
+        float* uvs = (float*)(bin + primitive.uvs);
+        uint32_t* indices = (uint32_t*)(bin + primitive.indices);
+        double s_scale = 1.0, t_scale = 1.0;
+        if (primitive.has_uvs) {
+            s_scale = scene_.materials[primitive.material].s_scale;
+            t_scale = scene_.materials[primitive.material].t_scale;
+        }
+
+        uint32_t written = 0;
+        for (size_t f = 0; f < primitive.faces.size(); ++f) {
+            const SceneFace& face = mesh.faces[primitive.faces[f]];
+            for (size_t v = face.first_vertex; v < face.first_vertex + face.vertex_count; ++v) {
+                *positions++ = (float)mesh.vertices[v].x;
+                *positions++ = (float)mesh.vertices[v].y;
+                *positions++ = (float)mesh.vertices[v].z;
+                if (!mesh.normals.empty()) {
+                    *normals++ = (float)mesh.normals[v].x;
+                    *normals++ = (float)mesh.normals[v].y;
+                    *normals++ = (float)mesh.normals[v].z;
+                }
+                if (primitive.has_uvs) {
+                    *uvs++ = (float)(mesh.uvs[v].x * s_scale);
+                    *uvs++ = (float)(1.0 - mesh.uvs[v].y * t_scale);
+                }
+            }
+            // Mesh indices are global to the scene mesh; rebase them on the
+            // primitive's own vertex block.
+            for (size_t i = 3 * face.first_triangle; i < 3 * (face.first_triangle + face.triangle_count); ++i)
+                *indices++ = (uint32_t)(mesh.indices[i] - face.first_vertex) + written;
+            written += (uint32_t)face.vertex_count;
+        }
+    }
+
+    static std::string matrix_json(const SUTransformation& transform) {
+        // SUTransformation is column-major like glTF, with w = 1 / scale.
+        double w = transform.values[15] != 0.0 ? transform.values[15] : 1.0;
+        std::string json("[");
+        for (int i = 0; i < 16; ++i) {
+            if (i > 0)
+                json += ",";
+            json += json_number(transform.values[i] / w, 17);
+        }
+        return json + "]";
+    }
+
+    static bool is_identity(const SUTransformation& transform) {
+        SUTransformation identity = identity_transform();
+        return std::memcmp(identity.values, transform.values, sizeof(identity.values)) == 0;
+    }
+
+    static std::string base_name(const std::string& path) {
+        size_t slash = path.find_last_of("/\\");
+        return slash == std::string::npos ? path : path.substr(slash + 1);
+    }
+
+    static double srgb_to_linear(SUByte value) {
+        double c = value / 255.0;
+        return c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+    }
+
+    void add_view(std::ostringstream& views, std::ostringstream& accessors, size_t& count,
+                  uint64_t offset, uint64_t length, int component, size_t elements,
+                  const char* type, bool indices, const GltfPrimitive* bounds) {
+        if (count > 0) {
+            views << ",";
+            accessors << ",";
+        }
+        views << "{\"buffer\":0,\"byteOffset\":" << offset << ",\"byteLength\":" << length
+              << ",\"target\":" << (indices ? 34963 : 34962) << "}";
+        accessors << "{\"bufferView\":" << count << ",\"componentType\":" << component
+                  << ",\"count\":" << elements << ",\"type\":\"" << type << "\"";
+        if (bounds) {
+            accessors << ",\"min\":[" << json_number(bounds->min[0]) << "," << json_number(bounds->min[1])
+                      << "," << json_number(bounds->min[2]) << "],\"max\":[" << json_number(bounds->max[0])
+                      << "," << json_number(bounds->max[1]) << "," << json_number(bounds->max[2]) << "]";
+        }
+        accessors << "}";
+        ++count;
+    }
+
+    std::string make_json() {
+        std::ostringstream json;
+        json << "{\"asset\":{\"version\":\"2.0\",\"generator\":\"skp2tri\"},\"scene\":0,\"scenes\":[{\"nodes\":[0]}]";
+
+        // Nodes, in scene order so that node i is scene node i.
+        json << ",\"nodes\":[";
+        for (size_t n = 0; n < scene_.nodes.size(); ++n) {
+            const SceneNode& node = scene_.nodes[n];
+            if (n > 0)
+                json << ",";
+            json << "{";
+            bool first = true;
+            if (!node.name.empty()) {
+                json << "\"name\":" << json_string(node.name);
+                first = false;
+            }
+            if (node.kind == SceneNode::ROOT) {
+                json << (first ? "" : ",") << "\"matrix\":[0.0254,0,0,0,0,0,-0.0254,0,0,0.0254,0,0,0,0,0,1]";
+                first = false;
+            }
+            else if (!is_identity(node.transform)) {
+                json << (first ? "" : ",") << "\"matrix\":" << matrix_json(node.transform);
+                first = false;
+            }
+            if (node_meshes_[n] >= 0) {
+                json << (first ? "" : ",") << "\"mesh\":" << node_meshes_[n];
+                first = false;
+            }
+            if (!node.children.empty()) {
+                json << (first ? "" : ",") << "\"children\":[";
+                for (size_t c = 0; c < node.children.size(); ++c)
+                    json << (c > 0 ? "," : "") << node.children[c];
+                json << "]";
+            }
+            json << "}";
+        }
+        json << "]";
+
+        // Accessors and buffer views, four per primitive at most.
+        std::ostringstream views, accessors, meshes;
+        size_t count = 0;
+        for (size_t m = 0; m < meshes_.size(); ++m) {
+            if (m > 0)
+                meshes << ",";
+            meshes << "{";
+            if (!meshes_[m].name.empty())
+                meshes << "\"name\":" << json_string(meshes_[m].name) << ",";
+            meshes << "\"primitives\":[";
+            for (size_t p = 0; p < meshes_[m].primitives.size(); ++p) {
+                const GltfPrimitive& primitive = primitives_[meshes_[m].primitives[p]];
+                const SceneMesh& mesh = scene_.meshes[primitive.mesh];
+                if (p > 0)
+                    meshes << ",";
+                meshes << "{\"attributes\":{\"POSITION\":" << count;
+                add_view(views, accessors, count, primitive.positions, 12 * (uint64_t)primitive.vertex_count,
+                         5126, primitive.vertex_count, "VEC3", false, &primitive);
+                if (!mesh.normals.empty()) {
+                    meshes << ",\"NORMAL\":" << count;
+                    add_view(views, accessors, count, primitive.normals, 12 * (uint64_t)primitive.vertex_count,
+                             5126, primitive.vertex_count, "VEC3", false, 0);
+                }
+                if (primitive.has_uvs) {
+                    meshes << ",\"TEXCOORD_0\":" << count;
+                    add_view(views, accessors, count, primitive.uvs, 8 * (uint64_t)primitive.vertex_count,
+                             5126, primitive.vertex_count, "VEC2", false, 0);
+                }
+                meshes << "},\"indices\":" << count;
+                add_view(views, accessors, count, primitive.indices, 4 * (uint64_t)primitive.index_count,
+                         5125, primitive.index_count, "SCALAR", true, 0);
+                if (primitive.material != NO_MATERIAL)
+                    meshes << ",\"material\":" << primitive.material;
+                meshes << "}";
+            }
+            meshes << "]}";
+        }
+        if (!meshes_.empty()) {
+            json << ",\"meshes\":[" << meshes.str() << "]";
+            json << ",\"accessors\":[" << accessors.str() << "]";
+            json << ",\"bufferViews\":[" << views.str() << "]";
+        }
+        if (bin_size_ > 0)
+            json << ",\"buffers\":[{\"byteLength\":" << bin_size_ << "}]";
+
+        // Materials keep their scene index; textures are referenced by the
+        // file name written next to the output.
+        std::ostringstream textures, images;
+        size_t texture_count = 0;
+        if (!scene_.materials.empty()) {
+            json << ",\"materials\":[";
+            for (size_t i = 0; i < scene_.materials.size(); ++i) {
+                const SceneMaterial& material = scene_.materials[i];
+                double alpha = material.use_opacity ? material.opacity : 1.0;
+                if (i > 0)
+                    json << ",";
+                json << "{\"name\":" << json_string(material.name)
+                     << ",\"pbrMetallicRoughness\":{\"baseColorFactor\":["
+                     << json_number(srgb_to_linear(material.color.red)) << ","
+                     << json_number(srgb_to_linear(material.color.green)) << ","
+                     << json_number(srgb_to_linear(material.color.blue)) << ","
+                     << json_number(alpha) << "]";
+                if (!material.texture.empty()) {
+                    json << ",\"baseColorTexture\":{\"index\":" << texture_count << "}";
+                    if (texture_count > 0) {
+                        textures << ",";
+                        images << ",";
+                    }
+                    textures << "{\"sampler\":0,\"source\":" << texture_count << "}";
+                    images << "{\"uri\":" << json_string(base_name(material.texture)) << "}";
+                    ++texture_count;
+                }
+                json << ",\"metallicFactor\":0,\"roughnessFactor\":1}";
+                if (alpha < 1.0)
+                    json << ",\"alphaMode\":\"BLEND\"";
+                json << ",\"doubleSided\":true}";
+            }
+            json << "]";
+        }
+        if (texture_count > 0) {
+            json << ",\"samplers\":[{\"wrapS\":10497,\"wrapT\":10497}]";
+            json << ",\"textures\":[" << textures.str() << "]";
+            json << ",\"images\":[" << images.str() << "]";
+        }
+        json << "}";
+        return json.str();
+    }
+
+    const Scene& scene_;
+    WriteOptions options_;
+    std::vector<GltfPrimitive> primitives_;
+    std::vector<GltfMesh> meshes_;
+    std::vector<long> node_meshes_;
+    uint64_t bin_size_;
+};
+
+inline bool write_glb(const Scene& scene, const std::string& path, const WriteOptions& options) {
+    GltfWriter writer(scene, options);
+    return writer.write(path);
+}
+
+#endif // SKP2TRI_GLTF_WRITER_H
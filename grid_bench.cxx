@@ -0,0 +1,195 @@
+#include "tri_grid.h"
+#include "synthetic_triangles.h"
+#include "parallel.h"
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <cmath>
+
+using namespace std;
+
+// Build time of the grid on the synthetic city of synthetic_triangles.h, and the
+// throughput of its queries (nearest triangle, triangles within a radius,
+// triangles crossing a box) from random points around the scene, for 1, 2,
+// 4... threads. The grid must not depend on the thread count, and a sample
+// of every query is checked against a brute force scan.
+
+void display_usage(int argc, char** argv) {
+    cout << "Usage is :" << endl;
+    cout << argv[0] << " [options]" << endl;
+    cout << "Options :" << endl;
+    cout << "  --millions <n>      triangles, in millions (default: 1)" << endl;
+    cout << "  --queries <n>       queries per set, in millions (default: 1)" << endl;
+    cout << "  --density <d>       cells per triangle (default: 1)" << endl;
+    cout << "  -t, --threads <n>   most threads tried (default: one per core)" << endl;
+    cout << "  --check <n>         queries of each set checked by brute force (default: 64)" << endl;
+}
+
+double uniform(uint64_t& state) {
+    state = synthetic_detail::mix(state);
+    return (double)(state >> 11) / 9007199254740992.0;
+}
+
+// Squared distance to the closest triangle, in double precision.
+double brute_nearest(const TriangleArrays& triangles, const float* point) {
+    double p[3] = { point[0], point[1], point[2] }, best = HUGE_VAL;
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        double v[3][3], q[3];
+        grid_detail::corners_of(triangles, i, v);
+        best = min(best, grid_detail::closest_point(p, v, q));
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+
+    double millions = 1.0, query_millions = 1.0;
+    unsigned threads = 0;
+    size_t checked = 64;
+    GridOptions options;
+    for (int i = 1; i < argc; ++i) {
+        string arg(argv[i]);
+        if (arg == "-h" || arg == "--help") {
+            display_usage(argc, argv);
+            return 0;
+        }
+        else if (arg == "--millions" && i + 1 < argc)
+            millions = atof(argv[++i]);
+        else if (arg == "--queries" && i + 1 < argc)
+            query_millions = atof(argv[++i]);
+        else if (arg == "--density" && i + 1 < argc)
+            options.density = atof(argv[++i]);
+        else if ((arg == "-t" || arg == "--threads") && i + 1 < argc)
+            threads = (unsigned)atoi(argv[++i]);
+        else if (arg == "--check" && i + 1 < argc)
+            checked = (size_t)atol(argv[++i]);
+        else {
+            display_usage(argc, argv);
+            return 1;
+        }
+    }
+    if (threads == 0)
+        threads = default_thread_count();
+
+    TriangleArrays triangles;
+    synthetic_city((size_t)(millions * 1e6), triangles, threads);
+    cout << triangles.size() << " triangles of a synthetic city, " << options.density << " cells per triangle" << endl;
+
+    int status = 0;
+    Grid grid;
+    double single = 0.0;
+    for (unsigned t = 1;; t = min(2 * t, threads)) {
+        options.threads = t;
+        Grid built;
+        string error;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (!build_grid(triangles, options, built, &error)) {
+            cerr << "Error : " << error << endl;
+            return 1;
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (t == 1)
+            single = seconds;
+        bool same = t == 1 || (built.offsets == grid.offsets && built.triangles == grid.triangles);
+        cout << "  build, " << t << " thread(s) : " << seconds << " s, x" << single / seconds << ", "
+             << built.header.resolution[0] << " x " << built.header.resolution[1] << " x "
+             << built.header.resolution[2] << " cells, " << (double)built.triangles.size() / triangles.size()
+             << " entries per triangle" << (same ? "" : ", ERROR : not the same grid as with one thread") << endl;
+        if (!same)
+            status = 1;
+        if (t == 1)
+            grid = built;
+        if (t >= threads)
+            break;
+    }
+
+    GridIndex index;
+    string error;
+    if (!index.build(triangles, grid, threads, &error)) {
+        cerr << "Error : " << error << endl;
+        return 1;
+    }
+
+    // Points anywhere in the scene's bounds (and a little around), a radius
+    // and a box size of about a building.
+    size_t count = (size_t)(query_millions * 1e6);
+    const TriGridHeader& header = grid.header;
+    vector<float> points(3 * count), boxes(6 * count);
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t state = i;
+        for (int d = 0; d < 3; ++d) {
+            float size = header.cell[d] * header.resolution[d];
+            points[3 * i + d] = header.min[d] + (float)(uniform(state) * 1.2 - 0.1) * size;
+            boxes[6 * i + d] = points[3 * i + d];
+            boxes[6 * i + 3 + d] = points[3 * i + d] + 100.0f * (float)uniform(state);
+        }
+    }
+    const float radius = 100.0f;
+
+    vector<GridHit> hits(count);
+    vector<size_t> offsets;
+    vector<uint32_t> found;
+    const char* names[3] = { "nearest", "within radius", "crossing box" };
+    for (int q = 0; q < 3; ++q) {
+        single = 0.0;
+        for (unsigned t = 1;; t = min(2 * t, threads)) {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            size_t results;
+            if (q == 0)
+                results = nearest_triangles(index, &points[0], count, HUGE_VALF, &hits[0], t);
+            else {
+                if (q == 1)
+                    triangles_within(index, &points[0], count, radius, offsets, found, t);
+                else
+                    triangles_overlapping(index, &boxes[0], count, offsets, found, t);
+                results = found.size();
+            }
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            if (t == 1)
+                single = seconds;
+            cout << "  " << names[q] << ", " << t << " thread(s) : " << count / seconds / 1e6 << " Mqueries/s, x"
+                 << single / seconds << ", " << (double)results / max((size_t)1, count) << " triangles per query"
+                 << endl;
+            if (t >= threads)
+                break;
+        }
+
+        // A sample against every triangle.
+        size_t sample = min(checked, count), wrong = 0;
+        size_t stride = count / max((size_t)1, sample);
+        for (size_t s = 0; s < sample; ++s) {
+            size_t i = s * stride;
+            if (q == 0) {
+                double expected = sqrt(brute_nearest(triangles, &points[3 * i]));
+                wrong += fabs(hits[i].distance - expected) > 1e-4 * max(1.0, expected);
+                continue;
+            }
+            vector<uint32_t> expected;
+            for (size_t n = 0; n < triangles.size(); ++n) {
+                double v[3][3], r[3];
+                grid_detail::corners_of(triangles, n, v);
+                bool match;
+                if (q == 1) {
+                    double p[3] = { points[3 * i], points[3 * i + 1], points[3 * i + 2] };
+                    match = grid_detail::closest_point(p, v, r) <= (double)radius * radius;
+                }
+                else {
+                    double center[3], half[3];
+                    for (int d = 0; d < 3; ++d) {
+                        center[d] = 0.5 * ((double)boxes[6 * i + d] + boxes[6 * i + 3 + d]);
+                        half[d] = 0.5 * ((double)boxes[6 * i + 3 + d] - boxes[6 * i + d]);
+                    }
+                    match = grid_detail::crosses_box(center, half, v);
+                }
+                if (match)
+                    expected.push_back((uint32_t)n);
+            }
+            wrong += expected != vector<uint32_t>(found.begin() + offsets[i], found.begin() + offsets[i + 1]);
+        }
+        cout << "  " << names[q] << " : " << sample - wrong << " of " << sample << " match a brute force scan"
+             << endl;
+        if (wrong > 0)
+            status = 1;
+    }
+    return status;
+}
@@ -0,0 +1,43 @@
+#ifndef SKP2TRI_JSON_H
+#define SKP2TRI_JSON_H
+
+#include <string>
+#include <cstdio>
+
+// Quotes and escapes `value` as a JSON string. Names coming from the model
+// are UTF-8 already, so only the mandatory escapes are applied.
+inline std::string json_string(const std::string& value) {
+    std::string quoted("\"");
+    for (size_t i = 0; i < value.size(); ++i) {
+        unsigned char c = (unsigned char)value[i];
+        switch (c) {
+        case '"': quoted += "\\\""; break;
+        case '\\': quoted += "\\\\"; break;
+        case '\n': quoted += "\\n"; break;
+        case '\r': quoted += "\\r"; break;
+        case '\t': quoted += "\\t"; break;
+        default:
+            if (c < 0x20) {
+                char escaped[8];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                quoted += escaped;
+            }
+            else
+                quoted += (char)c;
+        }
+    }
+    quoted += "\"";
+    return quoted;
+}
+
+// Formats a number with `digits` significant digits; JSON has no NaN or
+// infinity, so those are written as 0.
+inline std::string json_number(double value, int digits = 9) {
+    if (value != value || value - value != 0.0)
+        return "0";
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.*g", digits, value);
+    return buffer;
+}
+
+#endif // SKP2TRI_JSON_H
@@ -0,0 +1,255 @@
+#ifndef SKP2TRI_MAPPED_FILE_H
+#define SKP2TRI_MAPPED_FILE_H
+
+#include <string>
+#include <stdint.h>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+// Output file sized up front and written through a shared writable mapping.
+// Used by the binary writers: once the triangle count is known the final
+// size is too, so every worker thread can fill its own disjoint region and
+// the kernel writes the pages back without any intermediate copy.
+class MappedFile {
+public:
+    MappedFile() : data_(0), size_(0) {
+#ifdef _WIN32
+        file_ = INVALID_HANDLE_VALUE;
+        mapping_ = 0;
+#else
+        fd_ = -1;
+#endif
+    }
+
+    ~MappedFile() { close(); }
+
+    // Creates or truncates `path`, sizes it to `size` bytes and maps it.
+    bool create(const std::string& path, uint64_t size) {
+        close();
+        size_ = size;
+#ifdef _WIN32
+        file_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                            CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file_ == INVALID_HANDLE_VALUE)
+            return false;
+        if (size == 0)
+            return true;
+        mapping_ = CreateFileMappingA(file_, NULL, PAGE_READWRITE,
+                                      (DWORD)(size >> 32), (DWORD)(size & 0xffffffff), NULL);
+        if (mapping_ == 0)
+            return fail();
+        data_ = (char*)MapViewOfFile(mapping_, FILE_MAP_WRITE, 0, 0, (SIZE_T)size);
+        if (data_ == 0)
+            return fail();
+#else
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0)
+            return false;
+        if (size == 0)
+            return true;
+        if (ftruncate(fd_, (off_t)size) != 0)
+            return fail();
+#ifdef __linux__
+        // Reserve the blocks now: a sparse file that runs out of space while
+        // pages are flushed would otherwise raise SIGBUS in the middle of a
+        // worker's memcpy instead of failing here.
+        int reserved = posix_fallocate(fd_, 0, (off_t)size);
+        if (reserved != 0 && reserved != EOPNOTSUPP && reserved != EINVAL)
+            return fail();
+#endif
+        void* mapped = mmap(0, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (mapped == MAP_FAILED)
+            return fail();
+        data_ = (char*)mapped;
+        // Every region is written exactly once, front to back.
+        madvise(data_, (size_t)size, MADV_SEQUENTIAL);
+#endif
+        return true;
+    }
+
+    char* data() const { return data_; }
+    uint64_t size() const { return size_; }
+    bool is_open() const {
+#ifdef _WIN32
+        return file_ != INVALID_HANDLE_VALUE;
+#else
+        return fd_ >= 0;
+#endif
+    }
+
+    // Schedules write-back of a finished region without waiting for it, so
+    // the disk is busy while other workers are still filling their ranges.
+    void flush_range(uint64_t offset, uint64_t length) {
+        if (data_ == 0 || length == 0)
+            return;
+#ifdef _WIN32
+        FlushViewOfFile(data_ + offset, (SIZE_T)length);
+#else
+        // msync wants a page aligned start address.
+        uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+        uint64_t begin = offset - offset % page;
+        msync(data_ + begin, (size_t)(offset + length - begin), MS_ASYNC);
+#endif
+    }
+
+    // Unmaps and closes the file. With `sync` the call returns only once the
+    // data has reached the disk; otherwise the page cache writes it back.
+    bool close(bool sync = false) {
+        bool ok = true;
+#ifdef _WIN32
+        if (data_ != 0) {
+            if (sync)
+                ok = FlushViewOfFile(data_, 0) && FlushFileBuffers(file_);
+            UnmapViewOfFile(data_);
+        }
+        if (mapping_ != 0)
+            CloseHandle(mapping_);
+        if (file_ != INVALID_HANDLE_VALUE)
+            CloseHandle(file_);
+        mapping_ = 0;
+        file_ = INVALID_HANDLE_VALUE;
+#else
+        if (data_ != 0) {
+            if (sync)
+                ok = msync(data_, (size_t)size_, MS_SYNC) == 0;
+            munmap(data_, (size_t)size_);
+        }
+        if (fd_ >= 0)
+            ok = (::close(fd_) == 0) && ok;
+        fd_ = -1;
+#endif
+        data_ = 0;
+        return ok;
+    }
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    bool fail() {
+        close();
+        return false;
+    }
+
+    char* data_;
+    uint64_t size_;
+#ifdef _WIN32
+    HANDLE file_;
+    HANDLE mapping_;
+#else
+    int fd_;
+#endif
+};
+
+// Existing file mapped read-only, for the readers: the parsers work on the
+// page cache directly instead of copying the file into a buffer first.
+class MappedInput {
+public:
+    MappedInput() : data_(0), size_(0) {
+#ifdef _WIN32
+        file_ = INVALID_HANDLE_VALUE;
+        mapping_ = 0;
+#else
+        fd_ = -1;
+#endif
+    }
+
+    ~MappedInput() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+#ifdef _WIN32
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file_ == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file_, &size))
+            return fail();
+        size_ = (uint64_t)size.QuadPart;
+        if (size_ == 0)
+            return true;
+        mapping_ = CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping_ == 0)
+            return fail();
+        data_ = (const char*)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+        if (data_ == 0)
+            return fail();
+#else
+        fd_ = ::open(path.c_str(), O_RDONLY);
+        if (fd_ < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd_, &info) != 0)
+            return fail();
+        size_ = (uint64_t)info.st_size;
+        if (size_ == 0)
+            return true;
+        void* mapped = mmap(0, (size_t)size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+        if (mapped == MAP_FAILED)
+            return fail();
+        data_ = (const char*)mapped;
+        // Workers each scan their own part of the file, front to back.
+        madvise((void*)data_, (size_t)size_, MADV_WILLNEED);
+#endif
+        return true;
+    }
+
+    const char* data() const { return data_; }
+    uint64_t size() const { return size_; }
+
+    void close() {
+#ifdef _WIN32
+        if (data_ != 0)
+            UnmapViewOfFile(data_);
+        if (mapping_ != 0)
+            CloseHandle(mapping_);
+        if (file_ != INVALID_HANDLE_VALUE)
+            CloseHandle(file_);
+        mapping_ = 0;
+        file_ = INVALID_HANDLE_VALUE;
+#else
+        if (data_ != 0)
+            munmap((void*)data_, (size_t)size_);
+        if (fd_ >= 0)
+            ::close(fd_);
+        fd_ = -1;
+#endif
+        data_ = 0;
+        size_ = 0;
+    }
+
+private:
+    MappedInput(const MappedInput&);
+    MappedInput& operator=(const MappedInput&);
+
+    bool fail() {
+        close();
+        return false;
+    }
+
+    const char* data_;
+    uint64_t size_;
+#ifdef _WIN32
+    HANDLE file_;
+    HANDLE mapping_;
+#else
+    int fd_;
+#endif
+};
+
+#endif // SKP2TRI_MAPPED_FILE_H
@@ -0,0 +1,49 @@
+#ifndef SKP2TRI_PARALLEL_H
+#define SKP2TRI_PARALLEL_H
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+inline unsigned default_thread_count() {
+    unsigned count = std::thread::hardware_concurrency();
+    return count > 0 ? count : 1;
+}
+
+// Calls fn(i, worker) for every i in [0, count) on up to `threads` threads
+// (0 means one per core). Indices are handed out one at a time, so items of
+// very different cost still balance. `worker` is in [0, threads) and can be
+// used to index per-thread accumulators.
+template <class Fn>
+void parallel_for(size_t count, unsigned threads, Fn fn) {
+    if (threads == 0)
+        threads = default_thread_count();
+    if (threads > count)
+        threads = (unsigned)count;
+
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; ++i)
+            fn(i, 0u);
+        return;
+    }
+
+    std::atomic<size_t> next(0);
+    auto work = [&](unsigned worker) {
+        for (;;) {
+            size_t i = next++;
+            if (i >= count)
+                break;
+            fn(i, worker);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned w = 1; w < threads; ++w)
+        pool.push_back(std::thread(work, w));
+    work(0);
+    for (size_t w = 0; w < pool.size(); ++w)
+        pool[w].join();
+}
+
+#endif // SKP2TRI_PARALLEL_H
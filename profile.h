@@ -0,0 +1,403 @@
+#ifndef SKP2TRI_PROFILE_H
+#define SKP2TRI_PROFILE_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <algorithm>
+#include <cstdio>
+#include <stdint.h>
+#include "json.h"
+
+// Stage timers and counters behind skp2tri --stats, and the timeline of
+// skp2tri --trace. Each thread adds to its own slots, which are merged into
+// the totals when the thread ends (the worker threads of parallel_for end
+// with each call), so the hot paths never share a cache line or take a lock.
+// Nothing is measured until profile_enable(): the macros then only test a
+// flag. Built with SKP2TRI_NO_PROFILE, PROFILE_SCOPE, TRACE_SCOPE and
+// PROFILE_COUNT expand to nothing and profile_enabled() is a constant false.
+//
+// A stage timer counts wherever it runs: the seconds of a stage run by
+// several workers are summed over them, and nested stages are counted inside
+// their parent too (tessellate inside traverse, format inside write).
+//
+// When tracing, every timed scope also leaves an event in its thread's ring
+// (the oldest are overwritten past TRACE_RING_SIZE), and the rings are
+// gathered like the counters. write_trace_json() writes them in the Chrome
+// trace event format, which chrome://tracing and Perfetto open.
+
+enum ProfileStage {
+    STAGE_OPEN,          // SUModelCreateFromFile
+    STAGE_SDK_MERGE,     // SUModelMergeCoplanarFaces
+    STAGE_TRAVERSE,      // build_scene, the SDK pass filling the Scene
+    STAGE_TESSELLATE,    //   SUMeshHelper, per face
+    STAGE_MATERIALS,     //   materials and their textures
+    STAGE_GENERATE,      // build_synthetic_scene
+    STAGE_CLEAN,
+    STAGE_MERGE_COPLANAR,
+    STAGE_WRITE,         // the output, whole or split
+    STAGE_FORMAT,        //   text formatting, per window of ranges
+    STAGE_DISK,          //   writes and flushes of the output files
+    STAGE_TOPOLOGY,      // --topology and --adjacency
+    STAGE_VOLUMES,
+    STAGE_LODS,
+    STAGE_VOXELS,
+    STAGE_REPORT,
+    STAGE_COUNT
+};
+
+enum ProfileCounter {
+    COUNT_DEFINITIONS,       // entities collections tessellated
+    COUNT_FACES,
+    COUNT_TRIANGLES,         // of the definitions
+    COUNT_GROUPS,
+    COUNT_INSTANCES,
+    COUNT_MESH_CACHE_HITS,   // instances of a definition already tessellated
+    COUNT_MATERIAL_CACHE_HITS,
+    COUNT_LAYER_CACHE_HITS,
+    COUNT_TEXTURES,
+    COUNT_OUTPUT_TRIANGLES,
+    COUNT_FILES_WRITTEN,
+    COUNT_BYTES_WRITTEN,
+    COUNTER_COUNT
+};
+
+// The timeline events that are not stages.
+enum TraceKind {
+    TRACE_DEFINITION = STAGE_COUNT, // one definition tessellated or generated: its mesh, its faces
+    TRACE_BATCH                     // one batch of the output: its first range, its triangles
+};
+
+enum ProfileMode { PROFILE_STATS = 1, PROFILE_TRACE = 2 };
+
+inline const char* profile_stage_name(int stage) {
+    static const char* names[STAGE_COUNT] = {
+        "open", "sdk merge coplanar", "traverse", "tessellate", "materials", "generate", "clean",
+        "merge coplanar", "write", "format", "disk", "topology", "volumes", "lods", "voxels", "report"
+    };
+    return names[stage];
+}
+
+// Nested stages are indented under their parent in the text summary.
+inline int profile_stage_depth(int stage) {
+    return stage == STAGE_TESSELLATE || stage == STAGE_MATERIALS || stage == STAGE_FORMAT || stage == STAGE_DISK;
+}
+
+inline const char* profile_counter_name(int counter) {
+    static const char* names[COUNTER_COUNT] = {
+        "definitions", "faces", "triangles", "groups", "instances", "mesh_cache_hits", "material_cache_hits",
+        "layer_cache_hits", "textures", "output_triangles", "files_written", "bytes_written"
+    };
+    return names[counter];
+}
+
+struct ProfileTotals {
+    double seconds; // since profile_enable()
+    uint64_t calls[STAGE_COUNT];
+    uint64_t nanoseconds[STAGE_COUNT];
+    uint64_t counts[COUNTER_COUNT];
+
+    ProfileTotals() : seconds(0.0) { clear(); }
+
+    void clear() {
+        for (int s = 0; s < STAGE_COUNT; ++s)
+            calls[s] = nanoseconds[s] = 0;
+        for (int c = 0; c < COUNTER_COUNT; ++c)
+            counts[c] = 0;
+    }
+
+    void add(const ProfileTotals& other) {
+        for (int s = 0; s < STAGE_COUNT; ++s) {
+            calls[s] += other.calls[s];
+            nanoseconds[s] += other.nanoseconds[s];
+        }
+        for (int c = 0; c < COUNTER_COUNT; ++c)
+            counts[c] += other.counts[c];
+    }
+};
+
+struct TraceEvent {
+    uint32_t kind;    // a ProfileStage or a TraceKind
+    uint32_t lane;    // timeline row, shared by threads that never overlap
+    uint64_t begin;   // steady clock nanoseconds
+    uint64_t end;
+    uint64_t args[2]; // of the TraceKind
+};
+
+const size_t TRACE_RING_SIZE = 1 << 16; // events kept per thread
+
+struct ProfileTrace {
+    uint64_t start; // steady clock nanoseconds at profile_enable()
+    std::vector<TraceEvent> events;
+    uint64_t dropped; // overwritten in full rings
+
+    ProfileTrace() : start(0), dropped(0) {}
+};
+
+#ifndef SKP2TRI_NO_PROFILE
+
+#include <atomic>
+#include <mutex>
+#include <chrono>
+
+namespace profile_detail {
+
+inline uint64_t now_nanoseconds() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct Shared {
+    std::atomic<unsigned> modes; // ProfileMode flags, 0 until profile_enable()
+    std::mutex mutex;
+    ProfileTotals totals;        // of the threads that have been flushed
+    ProfileTrace trace;
+    std::vector<bool> lanes;     // in use by a live thread
+
+    Shared() : modes(0) {}
+};
+
+inline Shared& shared() {
+    static Shared instance;
+    return instance;
+}
+
+// The slots of one thread, handed to the totals when it ends. A thread takes
+// the lowest free lane, so the short-lived workers of successive
+// parallel_for calls end up on the same few timeline rows.
+struct Slots : ProfileTotals {
+    uint32_t lane;
+    std::vector<TraceEvent> ring;
+    uint64_t recorded;
+
+    Slots() : recorded(0) {
+        Shared& all = shared();
+        std::lock_guard<std::mutex> lock(all.mutex);
+        lane = (uint32_t)(std::find(all.lanes.begin(), all.lanes.end(), false) - all.lanes.begin());
+        if (lane == all.lanes.size())
+            all.lanes.push_back(true);
+        all.lanes[lane] = true;
+    }
+
+    ~Slots() {
+        flush();
+        Shared& all = shared();
+        std::lock_guard<std::mutex> lock(all.mutex);
+        all.lanes[lane] = false;
+    }
+
+    void record(const TraceEvent& event) {
+        if (ring.empty())
+            ring.resize(TRACE_RING_SIZE);
+        TraceEvent& slot = ring[recorded++ % TRACE_RING_SIZE];
+        slot = event;
+        slot.lane = lane;
+    }
+
+    void flush() {
+        Shared& all = shared();
+        std::lock_guard<std::mutex> lock(all.mutex);
+        all.totals.add(*this);
+        clear();
+        uint64_t kept = std::min<uint64_t>(recorded, TRACE_RING_SIZE);
+        all.trace.dropped += recorded - kept;
+        for (uint64_t e = recorded - kept; e < recorded; ++e)
+            all.trace.events.push_back(ring[e % TRACE_RING_SIZE]);
+        recorded = 0;
+    }
+};
+
+inline Slots& slots() {
+    static thread_local Slots thread_slots;
+    return thread_slots;
+}
+
+} // namespace profile_detail
+
+inline bool profile_enabled() {
+    return profile_detail::shared().modes.load(std::memory_order_relaxed) != 0;
+}
+
+inline bool trace_enabled() {
+    return (profile_detail::shared().modes.load(std::memory_order_relaxed) & PROFILE_TRACE) != 0;
+}
+
+// Starts measuring, from zero; `modes` are ProfileMode flags.
+inline void profile_enable(unsigned modes = PROFILE_STATS) {
+    profile_detail::Shared& all = profile_detail::shared();
+    profile_detail::Slots& slots = profile_detail::slots();
+    slots.clear();
+    slots.recorded = 0;
+    std::lock_guard<std::mutex> lock(all.mutex);
+    all.totals.clear();
+    all.trace = ProfileTrace();
+    all.trace.start = profile_detail::now_nanoseconds();
+    all.modes.store(modes);
+}
+
+inline void profile_add(ProfileCounter counter, uint64_t amount) {
+    profile_detail::slots().counts[counter] += amount;
+}
+
+// The totals so far, the calling thread's included. The other threads that
+// are still running are not (the workers have all ended between stages).
+inline ProfileTotals profile_totals() {
+    profile_detail::Shared& all = profile_detail::shared();
+    profile_detail::slots().flush();
+    std::lock_guard<std::mutex> lock(all.mutex);
+    ProfileTotals totals = all.totals;
+    totals.seconds = (profile_detail::now_nanoseconds() - all.trace.start) * 1e-9;
+    return totals;
+}
+
+// The events recorded so far, in the same way as profile_totals().
+inline ProfileTrace profile_trace() {
+    profile_detail::Shared& all = profile_detail::shared();
+    profile_detail::slots().flush();
+    std::lock_guard<std::mutex> lock(all.mutex);
+    return all.trace;
+}
+
+// Times its scope as one call of a stage, or as one TraceKind event, which
+// only the timeline has.
+class ProfileScope {
+public:
+    explicit ProfileScope(uint32_t kind, uint64_t arg0 = 0, uint64_t arg1 = 0)
+        : kind_(kind), start_(profile_enabled() ? profile_detail::now_nanoseconds() : 0) {
+        args_[0] = arg0;
+        args_[1] = arg1;
+    }
+
+    ~ProfileScope() {
+        if (start_ == 0)
+            return;
+        uint64_t end = profile_detail::now_nanoseconds();
+        profile_detail::Slots& slots = profile_detail::slots();
+        if (kind_ < STAGE_COUNT) {
+            slots.calls[kind_] += 1;
+            slots.nanoseconds[kind_] += end - start_;
+        }
+        if (trace_enabled()) {
+            TraceEvent event = { kind_, 0, start_, end, { args_[0], args_[1] } };
+            slots.record(event);
+        }
+    }
+
+private:
+    ProfileScope(const ProfileScope&);
+    ProfileScope& operator=(const ProfileScope&);
+
+    uint32_t kind_;
+    uint64_t start_;
+    uint64_t args_[2];
+};
+
+#define PROFILE_JOIN_(a, b) a##b
+#define PROFILE_JOIN(a, b) PROFILE_JOIN_(a, b)
+#define PROFILE_SCOPE(stage) ProfileScope PROFILE_JOIN(profile_scope_, __LINE__)(stage)
+#define TRACE_SCOPE(kind, arg0, arg1) ProfileScope PROFILE_JOIN(profile_scope_, __LINE__)(kind, arg0, arg1)
+// `amount` is only evaluated when measuring.
+#define PROFILE_COUNT(counter, amount) \
+    do { \
+        if (profile_enabled()) \
+            profile_add(counter, amount); \
+    } while (0)
+
+#else // SKP2TRI_NO_PROFILE
+
+inline bool profile_enabled() { return false; }
+inline bool trace_enabled() { return false; }
+inline void profile_enable(unsigned = PROFILE_STATS) {}
+inline ProfileTotals profile_totals() { return ProfileTotals(); }
+inline ProfileTrace profile_trace() { return ProfileTrace(); }
+
+#define PROFILE_SCOPE(stage) do {} while (0)
+#define TRACE_SCOPE(kind, arg0, arg1) do {} while (0)
+#define PROFILE_COUNT(counter, amount) do {} while (0)
+
+#endif // SKP2TRI_NO_PROFILE
+
+// The stages that ran, then the counters, one per line.
+inline void write_profile_text(std::ostream& out, const ProfileTotals& totals) {
+    char line[128];
+    std::snprintf(line, sizeof(line), "stats : %.3f s", totals.seconds);
+    out << line << "\n";
+    for (int s = 0; s < STAGE_COUNT; ++s) {
+        if (totals.calls[s] == 0)
+            continue;
+        std::string name = std::string(2 * profile_stage_depth(s), ' ') + profile_stage_name(s);
+        std::snprintf(line, sizeof(line), "  %-22s %10.3f s %12llu call(s)", name.c_str(),
+                      totals.nanoseconds[s] * 1e-9, (unsigned long long)totals.calls[s]);
+        out << line << "\n";
+    }
+    for (int c = 0; c < COUNTER_COUNT; ++c) {
+        std::snprintf(line, sizeof(line), "  %-22s %14llu", profile_counter_name(c),
+                      (unsigned long long)totals.counts[c]);
+        out << line << "\n";
+    }
+}
+
+inline void write_profile_json(std::ostream& out, const ProfileTotals& totals) {
+    out << "{\n  \"seconds\": " << json_number(totals.seconds) << ",\n  \"stages\": [";
+    bool first = true;
+    for (int s = 0; s < STAGE_COUNT; ++s) {
+        if (totals.calls[s] == 0)
+            continue;
+        out << (first ? "" : ",") << "\n    {\"name\": " << json_string(profile_stage_name(s))
+            << ", \"calls\": " << totals.calls[s] << ", \"seconds\": " << json_number(totals.nanoseconds[s] * 1e-9)
+            << "}";
+        first = false;
+    }
+    out << "\n  ],\n  \"counters\": {";
+    for (int c = 0; c < COUNTER_COUNT; ++c)
+        out << (c > 0 ? "," : "") << "\n    " << json_string(profile_counter_name(c)) << ": " << totals.counts[c];
+    out << "\n  }\n}\n";
+}
+
+// The events as Chrome trace "complete" events, times in microseconds from
+// profile_enable(), one row per lane. `definitions` names the meshes of the
+// TRACE_DEFINITION events.
+inline void write_trace_json(std::ostream& out, const ProfileTrace& trace,
+                             const std::vector<std::string>& definitions) {
+    std::vector<TraceEvent> events = trace.events;
+    std::stable_sort(events.begin(), events.end(),
+                     [](const TraceEvent& a, const TraceEvent& b) { return a.begin < b.begin; });
+    uint32_t lanes = 0;
+    for (size_t e = 0; e < events.size(); ++e)
+        lanes = std::max(lanes, events[e].lane + 1);
+
+    out << "{\n  \"displayTimeUnit\": \"ms\",\n  \"otherData\": {\"dropped_events\": " << trace.dropped
+        << "},\n  \"traceEvents\": [";
+    for (uint32_t l = 0; l < lanes; ++l)
+        out << (l > 0 ? "," : "") << "\n    {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << l
+            << ", \"args\": {\"name\": \"" << (l == 0 ? "main" : "worker ") << (l == 0 ? "" : std::to_string(l))
+            << "\"}}";
+    for (size_t e = 0; e < events.size(); ++e) {
+        const TraceEvent& event = events[e];
+        std::string name, category, args;
+        if (event.kind == TRACE_DEFINITION) {
+            name = event.args[0] < definitions.size() && !definitions[event.args[0]].empty()
+                ? definitions[event.args[0]] : "definition";
+            category = "definition";
+            args = "\"definition\": " + std::to_string(event.args[0]) + ", \"faces\": "
+                + std::to_string(event.args[1]);
+        }
+        else if (event.kind == TRACE_BATCH) {
+            name = "batch";
+            category = "output";
+            args = "\"first_range\": " + std::to_string(event.args[0]) + ", \"triangles\": "
+                + std::to_string(event.args[1]);
+        }
+        else {
+            name = profile_stage_name(event.kind);
+            category = "stage";
+        }
+        out << ",\n    {\"name\": " << json_string(name)
+            << ", \"cat\": \"" << category << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << event.lane
+            << ", \"ts\": " << json_number((event.begin - trace.start) * 1e-3, 15)
+            << ", \"dur\": " << json_number((event.end - event.begin) * 1e-3, 15) << ", \"args\": {" << args << "}}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+#endif // SKP2TRI_PROFILE_H
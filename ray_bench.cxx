@@ -0,0 +1,260 @@
+#include "tri_ray.h"
+#include "tri_bvh.h"
+#include "synthetic_triangles.h"
+#include "parallel.h"
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <cmath>
+
+using namespace std;
+
+// Ray throughput on the synthetic scenes of synthetic_triangles.h (a city of
+// box buildings, and the overlapping triangles of the other benchmarks):
+// coherent rays from a camera outside the scene and incoherent rays from
+// random points in random directions, closest and any hit, with packets of
+// 4 and 8 triangles, for 1, 2, 4... threads. A sample of the rays is
+// checked against a brute force scan of every triangle.
+
+void display_usage(int argc, char** argv) {
+    cout << "Usage is :" << endl;
+    cout << argv[0] << " [options]" << endl;
+    cout << "Options :" << endl;
+    cout << "  --scene <name>      city, soup or both (default: both)" << endl;
+    cout << "  --millions <n>      triangles, in millions (default: 1)" << endl;
+    cout << "  --rays <n>          rays per set, in millions (default: 1)" << endl;
+    cout << "  --width <4|8>       triangles per packet (default: both)" << endl;
+    cout << "  -t, --threads <n>   most threads tried (default: one per core)" << endl;
+    cout << "  --check <n>         rays of each set checked by brute force (default: 64)" << endl;
+}
+
+double uniform(uint64_t& state) {
+    state = synthetic_detail::mix(state);
+    return (double)(state >> 11) / 9007199254740992.0;
+}
+
+// A camera looking down at the scene from one side, its rays through a
+// square grid across it.
+void camera_rays(size_t count, const TriBvhNode& root, vector<Ray>& rays) {
+    size_t side = max((size_t)1, (size_t)sqrt((double)count));
+    rays.resize(count);
+    float center[3], size = 0.0f;
+    for (int d = 0; d < 3; ++d) {
+        center[d] = 0.5f * (root.min[d] + root.max[d]);
+        size = max(size, root.max[d] - root.min[d]);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        Ray& ray = rays[i];
+        ray.origin[0] = center[0];
+        ray.origin[1] = center[1] - 1.5f * size;
+        ray.origin[2] = center[2] + size;
+        float x = ((float)(i % side) + 0.5f) / side - 0.5f;
+        float y = ((float)(i / side % side) + 0.5f) / side - 0.5f;
+        ray.direction[0] = x * size;
+        ray.direction[1] = center[1] + y * size - ray.origin[1];
+        ray.direction[2] = center[2] - ray.origin[2];
+        ray.tmin = 0.0f;
+        ray.tmax = 1e30f;
+    }
+}
+
+// Random origins inside the scene's box, uniform directions.
+void random_rays(size_t count, const TriBvhNode& root, vector<Ray>& rays) {
+    rays.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t state = i;
+        Ray& ray = rays[i];
+        for (int d = 0; d < 3; ++d)
+            ray.origin[d] = root.min[d] + (float)uniform(state) * (root.max[d] - root.min[d]);
+        double z = 2.0 * uniform(state) - 1.0, angle = 6.283185307179586 * uniform(state);
+        double r = sqrt(max(0.0, 1.0 - z * z));
+        ray.direction[0] = (float)(r * cos(angle));
+        ray.direction[1] = (float)(r * sin(angle));
+        ray.direction[2] = (float)z;
+        ray.tmin = 0.0f;
+        ray.tmax = 1e30f;
+    }
+}
+
+// Closest hit by testing every triangle, in double precision.
+double brute_force(const TriangleArrays& triangles, const Ray& ray) {
+    double best = ray.tmax;
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        double c[3], e1[3], e2[3], o[3], d[3];
+        for (int k = 0; k < 3; ++k) {
+            const vector<float>* axis = k == 0 ? triangles.x : k == 1 ? triangles.y : triangles.z;
+            c[k] = axis[0][i];
+            e1[k] = axis[1][i] - c[k];
+            e2[k] = axis[2][i] - c[k];
+            o[k] = ray.origin[k] - c[k];
+            d[k] = ray.direction[k];
+        }
+        double p[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0] };
+        double det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+        if (det == 0.0)
+            continue;
+        double u = (o[0] * p[0] + o[1] * p[1] + o[2] * p[2]) / det;
+        double q[3] = { o[1] * e1[2] - o[2] * e1[1], o[2] * e1[0] - o[0] * e1[2], o[0] * e1[1] - o[1] * e1[0] };
+        double v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) / det;
+        double t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) / det;
+        if (u >= 0.0 && v >= 0.0 && u + v <= 1.0 && t >= ray.tmin && t < best)
+            best = t;
+    }
+    return best;
+}
+
+// Times the queries on one of the scenes and checks them; false when a
+// check fails.
+bool run(bool city, double millions, double ray_millions, unsigned only_width, unsigned threads, size_t checked) {
+    TriangleArrays triangles;
+    if (city)
+        synthetic_city((size_t)(millions * 1e6), triangles, threads);
+    else
+        synthetic_triangles((size_t)(millions * 1e6), triangles, threads);
+    BvhOptions options;
+    options.threads = threads;
+    Bvh bvh;
+    build_bvh(triangles, options, bvh);
+    if (bvh.nodes.empty()) {
+        cerr << "Error : no triangles" << endl;
+        return false;
+    }
+    size_t count = (size_t)(ray_millions * 1e6);
+    cout << (city ? "City" : "Soup") << " : " << triangles.size() << " triangles, " << count << " rays per set"
+         << endl;
+
+    const char* set_names[2] = { "camera", "random" };
+    vector<Ray> sets[2];
+    camera_rays(count, bvh.nodes[0], sets[0]);
+    random_rays(count, bvh.nodes[0], sets[1]);
+
+    bool ok = true;
+    vector<RayHit> hits(count), any(count);
+    vector<float> first_t[2];
+    for (unsigned width = 4; width <= 8; width += 4) {
+        if (only_width != 0 && width != only_width)
+            continue;
+        // Leaves sized for the packets.
+        options.packet_width = width;
+        Bvh packed;
+        build_bvh(triangles, options, packed);
+        RayScene scene;
+        string error;
+        if (!scene.build(triangles, packed, width, threads, &error)) {
+            cerr << "Error : " << error << endl;
+            return false;
+        }
+        cout << "  " << width << " wide : " << packed.nodes.size() << " nodes" << endl;
+        for (int s = 0; s < 2; ++s) {
+            const vector<Ray>& rays = sets[s];
+            for (int q = 0; q < 2; ++q) {
+                RayQuery query = q == 0 ? RAY_CLOSEST_HIT : RAY_ANY_HIT;
+                vector<RayHit>& out = q == 0 ? hits : any;
+                double single = 0.0;
+                size_t found = 0;
+                for (unsigned t = 1;; t = min(2 * t, threads)) {
+                    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                    found = cast_rays(scene, &rays[0], count, query, &out[0], t);
+                    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+                    if (t == 1)
+                        single = seconds;
+                    cout << "  " << width << " wide, " << set_names[s] << " rays, "
+                         << (q == 0 ? "closest hit" : "any hit    ") << ", " << t << " thread(s) : "
+                         << count / seconds / 1e6 << " Mrays/s, x" << single / seconds << ", "
+                         << 100.0 * found / max((size_t)1, count) << " % hit" << endl;
+                    if (t >= threads)
+                        break;
+                }
+            }
+
+            // Any hit finds a triangle exactly when closest hit does, and
+            // both widths give the same closest hits (but for rounding, when
+            // a ray meets an edge shared by two triangles).
+            size_t errors = 0;
+            for (size_t i = 0; i < count; ++i)
+                errors += (hits[i].triangle == RAY_NO_HIT) != (any[i].triangle == RAY_NO_HIT);
+            if (first_t[s].empty()) {
+                first_t[s].resize(count);
+                for (size_t i = 0; i < count; ++i)
+                    first_t[s][i] = hits[i].t;
+            }
+            else
+                for (size_t i = 0; i < count; ++i)
+                    errors += fabs(first_t[s][i] - hits[i].t) > 1e-5f * max(1.0f, first_t[s][i]);
+            if (errors > 0) {
+                cout << "  ERROR : " << errors << " " << set_names[s] << " rays disagree" << endl;
+                ok = false;
+            }
+        }
+    }
+
+    // The closest hits of a sample against every triangle, with a tree of
+    // single triangle leaves this time.
+    RayScene scene;
+    scene.build(triangles, bvh, only_width == 4 ? 4 : 8, threads);
+    for (int s = 0; s < 2; ++s) {
+        size_t sample = min(checked, count), wrong = 0;
+        vector<double> expected(sample);
+        parallel_for(sample, threads, [&](size_t k, unsigned) {
+            expected[k] = brute_force(triangles, sets[s][k * (count / max((size_t)1, sample))]);
+        });
+        for (size_t k = 0; k < sample; ++k) {
+            RayHit hit;
+            scene.intersect(sets[s][k * (count / max((size_t)1, sample))], RAY_CLOSEST_HIT, hit);
+            if (fabs(hit.t - expected[k]) > 1e-4 * max(1.0, expected[k]))
+                ++wrong;
+        }
+        cout << "  " << set_names[s] << " rays : " << sample - wrong << " of " << sample
+             << " closest hits match a brute force scan" << endl;
+        if (wrong > 0)
+            ok = false;
+    }
+    return ok;
+}
+
+int main(int argc, char** argv) {
+
+    string scene_name = "both";
+    double millions = 1.0, ray_millions = 1.0;
+    unsigned threads = 0, only_width = 0;
+    size_t checked = 64;
+    for (int i = 1; i < argc; ++i) {
+        string arg(argv[i]);
+        if (arg == "-h" || arg == "--help") {
+            display_usage(argc, argv);
+            return 0;
+        }
+        else if (arg == "--scene" && i + 1 < argc)
+            scene_name = argv[++i];
+        else if (arg == "--millions" && i + 1 < argc)
+            millions = atof(argv[++i]);
+        else if (arg == "--rays" && i + 1 < argc)
+            ray_millions = atof(argv[++i]);
+        else if (arg == "--width" && i + 1 < argc)
+            only_width = (unsigned)atoi(argv[++i]);
+        else if ((arg == "-t" || arg == "--threads") && i + 1 < argc)
+            threads = (unsigned)atoi(argv[++i]);
+        else if (arg == "--check" && i + 1 < argc)
+            checked = (size_t)atol(argv[++i]);
+        else {
+            display_usage(argc, argv);
+            return 1;
+        }
+    }
+    if ((only_width != 0 && only_width != 4 && only_width != 8)
+        || (scene_name != "city" && scene_name != "soup" && scene_name != "both")) {
+        display_usage(argc, argv);
+        return 1;
+    }
+    if (threads == 0)
+        threads = default_thread_count();
+
+    int status = 0;
+    for (int city = 1; city >= 0; --city) {
+        if (scene_name != "both" && (scene_name == "city") != (city == 1))
+            continue;
+        if (!run(city == 1, millions, ray_millions, only_width, threads, checked))
+            status = 1;
+    }
+    return status;
+}
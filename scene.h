@@ -0,0 +1,199 @@
+#ifndef SKP2TRI_SCENE_H
+#define SKP2TRI_SCENE_H
+
+#include <slapi/geometry.h>
+#include <slapi/transformation.h>
+#include <slapi/color.h>
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <stdint.h>
+
+// In-memory copy of the tessellated model. It is filled once by a serial
+// pass over SLAPI (see build_scene in skp_parser.h) so that the writers can
+// run on several threads without touching the SDK.
+
+const size_t NO_MATERIAL = (size_t)-1;
+const size_t NO_LAYER = (size_t)-1; // the default layer, Layer0
+
+struct SceneMaterial {
+    std::string name;
+    SUColor color;
+    double opacity;       // 0 - 1, only meaningful with use_opacity
+    bool use_opacity;
+    std::string texture;  // file written next to the output, empty if none
+    double s_scale;       // texture scales from SUTextureGetDimensions
+    double t_scale;
+};
+
+// One SUFaceRef as tessellated by SUMeshHelper. Faces without triangles are
+// kept because the text .tri format still emits a line for them. The face
+// owns the vertices [first_vertex, first_vertex + vertex_count).
+struct SceneFace {
+    size_t first_vertex;
+    size_t vertex_count;
+    size_t first_triangle;
+    size_t triangle_count;
+    size_t material; // front material, NO_MATERIAL when inherited from the node
+    size_t layer;    // NO_LAYER when on Layer0, which means the node's layer
+};
+
+// Tessellated faces of one entities collection, shared by every node that
+// points to the same component definition.
+struct SceneMesh {
+    std::string name;               // definition (or group) name
+    std::vector<SUPoint3D> vertices;
+    std::vector<SUVector3D> normals; // per vertex, only with SceneOptions::normals
+    std::vector<SUPoint2D> uvs;      // front texture coordinates, only with SceneOptions::uvs
+    std::vector<uint32_t> indices;   // 3 per triangle, relative to the whole mesh
+    std::vector<SceneFace> faces;
+
+    size_t triangle_count() const { return indices.size() / 3; }
+};
+
+struct SceneNode {
+    enum Kind { ROOT, GROUP, INSTANCE };
+
+    Kind kind;
+    std::string name;
+    int32_t entity_id;            // SUEntityGetID of the group / instance, 0 for the root
+    size_t mesh;
+    size_t material;              // applied to the faces without a material of their own
+    size_t layer;                 // its own layer, or its parent's when on Layer0; for the faces on Layer0
+    SUTransformation transform;   // relative to the parent node
+    std::vector<size_t> children; // groups first, then instances
+};
+
+inline SUTransformation identity_transform() {
+    SUTransformation transform;
+    for (int i = 0; i < 16; ++i)
+        transform.values[i] = (i % 5 == 0) ? 1.0 : 0.0;
+    return transform;
+}
+
+struct Scene {
+    std::vector<SceneMaterial> materials;
+    std::vector<std::string> layers; // names of the layers used, other than Layer0
+    std::vector<SceneMesh> meshes;
+    std::vector<SceneNode> nodes; // nodes[0] is the model root
+};
+
+// A run of faces of one node, in the order the triangles appear in the
+// flattened output. `output_triangle` is the number of triangles written
+// before the range, so fixed-size records can be placed without a scan.
+struct SceneRange {
+    size_t node;
+    size_t first_face;
+    size_t face_count;
+    size_t first_triangle;
+    size_t triangle_count;
+    uint64_t output_triangle;
+};
+
+inline void flatten_node(const Scene& scene, size_t node_index, size_t max_triangles, bool recursive,
+                         std::vector<SceneRange>& ranges, uint64_t& written) {
+    const SceneNode& node = scene.nodes[node_index];
+    const SceneMesh& mesh = scene.meshes[node.mesh];
+
+    // Split the node's faces into ranges of at most max_triangles triangles
+    // (a single bigger face still gets a range of its own).
+    size_t face = 0;
+    while (face < mesh.faces.size()) {
+        SceneRange range;
+        range.node = node_index;
+        range.first_face = face;
+        range.first_triangle = mesh.faces[face].first_triangle;
+        range.triangle_count = 0;
+        range.output_triangle = written;
+        do {
+            range.triangle_count += mesh.faces[face].triangle_count;
+            ++face;
+        } while (face < mesh.faces.size() && range.triangle_count + mesh.faces[face].triangle_count <= max_triangles);
+        range.face_count = face - range.first_face;
+        written += range.triangle_count;
+        ranges.push_back(range);
+    }
+
+    if (!recursive)
+        return;
+    for (size_t c = 0; c < node.children.size(); ++c)
+        flatten_node(scene, node.children[c], max_triangles, recursive, ranges, written);
+}
+
+// Lists the ranges of the subtree below `root` in output order, or only the
+// root's own faces when not `recursive`.
+inline std::vector<SceneRange> flatten_scene(const Scene& scene, size_t root = 0,
+                                             bool recursive = true, size_t max_triangles = 65536) {
+    std::vector<SceneRange> ranges;
+    uint64_t written = 0;
+    if (!scene.nodes.empty())
+        flatten_node(scene, root, max_triangles, recursive, ranges, written);
+    return ranges;
+}
+
+inline size_t extract_node(const Scene& scene, size_t node_index, bool recursive,
+                           std::vector<size_t>& mesh_map, Scene& part) {
+    const SceneNode& node = scene.nodes[node_index];
+    size_t index = part.nodes.size();
+    part.nodes.push_back(node);
+    part.nodes[index].children.clear();
+    if (mesh_map[node.mesh] == (size_t)-1) {
+        mesh_map[node.mesh] = part.meshes.size();
+        part.meshes.push_back(scene.meshes[node.mesh]);
+    }
+    part.nodes[index].mesh = mesh_map[node.mesh];
+    if (recursive) {
+        for (size_t c = 0; c < node.children.size(); ++c) {
+            size_t child = extract_node(scene, node.children[c], recursive, mesh_map, part);
+            part.nodes[index].children.push_back(child);
+        }
+    }
+    return index;
+}
+
+// Copies the subtree below `root` into `part` as a scene of its own, for the
+// writers that always take a whole scene. The copied root becomes the part's
+// root node, so the part is expressed in the root's local coordinates.
+inline void extract_scene(const Scene& scene, size_t root, bool recursive, Scene& part) {
+    part.materials = scene.materials;
+    part.layers = scene.layers;
+    part.meshes.clear();
+    part.nodes.clear();
+    std::vector<size_t> mesh_map(scene.meshes.size(), (size_t)-1);
+    extract_node(scene, root, recursive, mesh_map, part);
+    part.nodes[0].kind = SceneNode::ROOT;
+    part.nodes[0].transform = identity_transform();
+}
+
+inline uint64_t ranges_triangle_count(const std::vector<SceneRange>& ranges) {
+    if (ranges.empty())
+        return 0;
+    return ranges.back().output_triangle + ranges.back().triangle_count;
+}
+
+// Bounding box of the triangles of the ranges, in output coordinates.
+// Returns false (and leaves the box untouched) when there are none.
+inline bool ranges_bounds(const Scene& scene, const std::vector<SceneRange>& ranges, SUBoundingBox3D& box) {
+    bool found = false;
+    for (size_t r = 0; r < ranges.size(); ++r) {
+        const SceneRange& range = ranges[r];
+        const SceneMesh& mesh = scene.meshes[scene.nodes[range.node].mesh];
+        for (size_t i = 3 * range.first_triangle; i < 3 * (range.first_triangle + range.triangle_count); ++i) {
+            const SUPoint3D& point = mesh.vertices[mesh.indices[i]];
+            if (!found) {
+                box.min_point = box.max_point = point;
+                found = true;
+                continue;
+            }
+            if (point.x < box.min_point.x) box.min_point.x = point.x;
+            if (point.y < box.min_point.y) box.min_point.y = point.y;
+            if (point.z < box.min_point.z) box.min_point.z = point.z;
+            if (point.x > box.max_point.x) box.max_point.x = point.x;
+            if (point.y > box.max_point.y) box.max_point.y = point.y;
+            if (point.z > box.max_point.z) box.max_point.z = point.z;
+        }
+    }
+    return found;
+}
+
+#endif // SKP2TRI_SCENE_H
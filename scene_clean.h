@@ -0,0 +1,112 @@
+#ifndef SKP2TRI_SCENE_CLEAN_H
+#define SKP2TRI_SCENE_CLEAN_H
+
+#include <vector>
+#include "scene.h"
+#include "tri_clean.h"
+#include "parallel.h"
+
+// The corners of triangle i of `mesh`.
+inline void mesh_corners(const SceneMesh& mesh, size_t i, double* c) {
+    for (int k = 0; k < 3; ++k) {
+        const SUPoint3D& point = mesh.vertices[mesh.indices[3 * i + k]];
+        c[3 * k] = point.x;
+        c[3 * k + 1] = point.y;
+        c[3 * k + 2] = point.z;
+    }
+}
+
+// The checks of flag_triangles on one mesh, straight from its vertices and
+// indices rather than through a structure of arrays view of the whole mesh:
+// each vertex is hashed once for all the triangles using it, and the
+// corners of a triangle are read once for both checks.
+// `hashes` and `table` are the worker's, reused from mesh to mesh.
+inline void flag_mesh_triangles(const SceneMesh& mesh, const CleanOptions& options, std::vector<uint8_t>& flags,
+                                std::vector<uint64_t>& hashes, CleanTable& table) {
+    size_t count = mesh.triangle_count();
+    flags.assign(count, CLEAN_KEEP);
+    if (options.duplicates) {
+        hashes.resize(mesh.vertices.size());
+        for (size_t v = 0; v < mesh.vertices.size(); ++v)
+            hashes[v] = clean_corner_hash(mesh.vertices[v].x, mesh.vertices[v].y, mesh.vertices[v].z);
+        table.reset(count);
+    }
+    const double tolerance2 = options.tolerance * options.tolerance;
+    for (size_t i = 0; i < count; ++i) {
+        double c[9];
+        mesh_corners(mesh, i, c);
+        if (options.degenerate) {
+            flags[i] = clean_degenerate_flag(c, tolerance2);
+            if (flags[i] != CLEAN_KEEP)
+                continue;
+        }
+        if (!options.duplicates)
+            continue;
+        const uint32_t* index = &mesh.indices[3 * i];
+        uint32_t hash = clean_triangle_hash(hashes[index[0]], hashes[index[1]], hashes[index[2]]);
+        CleanKey<double> key;
+        bool built = false, odd = false, first_odd = false;
+        uint32_t first = table.insert(hash, (uint32_t)i, [&](uint32_t earlier) {
+            if (!built) {
+                key = clean_key(c, odd);
+                built = true;
+            }
+            double e[9];
+            mesh_corners(mesh, earlier, e);
+            return clean_key(e, first_odd) == key;
+        });
+        if (first != i)
+            flags[i] = first_odd == odd ? CLEAN_DUPLICATE : CLEAN_FLIPPED;
+    }
+}
+
+// --clean: runs the checks of tri_clean.h on every scene mesh before the
+// writers, in double precision, and drops the bad triangles from their
+// faces. Each definition is cleaned once, whatever its number of
+// instances; repeats are only looked for inside a mesh, since the same
+// triangles in two instances are the point of instancing.
+inline CleanStats clean_scene(Scene& scene, const CleanOptions& options, unsigned threads) {
+    std::vector<CleanStats> stats(scene.meshes.size());
+    if (threads == 0)
+        threads = default_thread_count();
+    // The flags, vertex hashes and table of each worker, reused from mesh to
+    // mesh.
+    std::vector<std::vector<uint8_t> > worker_flags(threads);
+    std::vector<std::vector<uint64_t> > worker_hashes(threads);
+    std::vector<CleanTable> worker_tables(threads);
+    parallel_for(scene.meshes.size(), threads, [&](size_t m, unsigned worker) {
+        SceneMesh& mesh = scene.meshes[m];
+        if (mesh.triangle_count() == 0)
+            return;
+        std::vector<uint8_t>& flags = worker_flags[worker];
+        flag_mesh_triangles(mesh, options, flags, worker_hashes[worker], worker_tables[worker]);
+        stats[m].count(flags);
+        if (stats[m].removed() == 0)
+            return;
+
+        // Compact the indices face by face; faces keep their vertices, and
+        // an emptied face stays (it is an empty line in the text format).
+        size_t kept = 0;
+        for (size_t f = 0; f < mesh.faces.size(); ++f) {
+            SceneFace& face = mesh.faces[f];
+            size_t first = kept;
+            for (size_t t = face.first_triangle; t < face.first_triangle + face.triangle_count; ++t) {
+                if (flags[t] != CLEAN_KEEP)
+                    continue;
+                for (int k = 0; k < 3; ++k)
+                    mesh.indices[3 * kept + k] = mesh.indices[3 * t + k];
+                ++kept;
+            }
+            face.first_triangle = first;
+            face.triangle_count = kept - first;
+        }
+        mesh.indices.resize(3 * kept);
+    });
+
+    CleanStats total;
+    for (size_t m = 0; m < stats.size(); ++m)
+        total.add(stats[m]);
+    return total;
+}
+
+#endif // SKP2TRI_SCENE_CLEAN_H
@@ -0,0 +1,550 @@
+#ifndef SKP2TRI_SCENE_COPLANAR_H
+#define SKP2TRI_SCENE_COPLANAR_H
+
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <cmath>
+#include "scene.h"
+#include "scene_lod.h"
+#include "parallel.h"
+
+// --merge-coplanar: joins the adjacent triangles of a mesh that lie in the
+// same plane and have the same material and layer into regions, whatever
+// the faces they came from, and triangulates each region again from its
+// outline.
+// The vertices inside a region go away, and so do those on its outline
+// that are on a straight edge and not used outside the region (the others
+// would leave cracks against the neighbouring triangles). A region keeps
+// its new triangles only when they are fewer. Each definition is merged
+// once, whatever its number of instances, and the meshes are spread over
+// the worker threads.
+
+struct CoplanarOptions {
+    double angle;       // largest angle between the normals of joined triangles, in degrees
+    double distance;    // largest distance to the plane, relative to the size of the mesh
+    size_t max_outline; // regions with a longer outline are left as they are
+
+    CoplanarOptions() : angle(0.01), distance(1e-6), max_outline(4096) {}
+};
+
+struct CoplanarStats {
+    uint64_t input;   // triangles of the meshes
+    uint64_t output;
+    uint64_t regions; // regions triangulated again
+    uint64_t faces;   // faces they replaced
+
+    CoplanarStats() : input(0), output(0), regions(0), faces(0) {}
+
+    void add(const CoplanarStats& other) {
+        input += other.input;
+        output += other.output;
+        regions += other.regions;
+        faces += other.faces;
+    }
+};
+
+namespace coplanar_detail {
+
+const uint32_t SHARED = 0xffffffffu;
+
+struct Point2 {
+    double x, y;
+    uint32_t vertex; // welded vertex
+};
+
+inline double cross2(const Point2& a, const Point2& b, const Point2& c) {
+    return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+}
+
+inline double loop_area(const std::vector<Point2>& loop) {
+    double area = 0.0;
+    for (size_t i = 0, j = loop.size() - 1; i < loop.size(); j = i++)
+        area += loop[j].x * loop[i].y - loop[i].x * loop[j].y;
+    return 0.5 * area;
+}
+
+// Joins a hole (clockwise) to the polygon (counter clockwise) by a pair of
+// edges from the hole's rightmost point to a vertex of the polygon that it
+// sees, found as in Eberly, "Triangulation by Ear Clipping".
+inline bool bridge_hole(std::vector<Point2>& polygon, const std::vector<Point2>& hole) {
+    size_t m = 0;
+    for (size_t i = 1; i < hole.size(); ++i)
+        if (hole[i].x > hole[m].x || (hole[i].x == hole[m].x && hole[i].y < hole[m].y))
+            m = i;
+    const Point2& M = hole[m];
+
+    // Closest crossing of the ray to +x with an edge of the polygon; the
+    // inside is on the left of the edges, so only upward edges face M.
+    double best = HUGE_VAL;
+    size_t edge = polygon.size();
+    for (size_t i = 0; i < polygon.size(); ++i) {
+        const Point2& a = polygon[i];
+        const Point2& b = polygon[(i + 1) % polygon.size()];
+        if (!(a.y <= M.y && M.y <= b.y && a.y < b.y))
+            continue;
+        double x = a.x + (M.y - a.y) * (b.x - a.x) / (b.y - a.y);
+        if (x >= M.x && x - M.x < best) {
+            best = x - M.x;
+            edge = a.x > b.x ? i : (i + 1) % polygon.size();
+        }
+    }
+    if (edge == polygon.size())
+        return false;
+    size_t p = edge;
+    Point2 I = M;
+    I.x = M.x + best;
+
+    // A reflex vertex inside (M, I, P) hides P: take the one closest in angle.
+    if (polygon[p].x != I.x || polygon[p].y != I.y) {
+        double best_angle = HUGE_VAL, best_distance = HUGE_VAL;
+        size_t chosen = p;
+        Point2 a = M, b = I, c = polygon[p];
+        if (cross2(a, b, c) < 0.0)
+            std::swap(b, c);
+        for (size_t i = 0; i < polygon.size(); ++i) {
+            const Point2& v = polygon[i];
+            const Point2& prev = polygon[(i + polygon.size() - 1) % polygon.size()];
+            const Point2& next = polygon[(i + 1) % polygon.size()];
+            if (i == p || cross2(prev, v, next) > 0.0)
+                continue;
+            if (cross2(a, b, v) < 0.0 || cross2(b, c, v) < 0.0 || cross2(c, a, v) < 0.0)
+                continue;
+            double dx = v.x - M.x, dy = v.y - M.y;
+            double length = std::sqrt(dx * dx + dy * dy);
+            double angle = length > 0.0 ? std::fabs(dy) / length : 0.0;
+            if (angle < best_angle || (angle == best_angle && length < best_distance)) {
+                best_angle = angle;
+                best_distance = length;
+                chosen = i;
+            }
+        }
+        p = chosen;
+    }
+
+    std::vector<Point2> joined;
+    joined.reserve(polygon.size() + hole.size() + 2);
+    joined.insert(joined.end(), polygon.begin(), polygon.begin() + p + 1);
+    for (size_t i = 0; i <= hole.size(); ++i)
+        joined.push_back(hole[(m + i) % hole.size()]);
+    joined.insert(joined.end(), polygon.begin() + p, polygon.end());
+    polygon.swap(joined);
+    return true;
+}
+
+inline bool same_place(const Point2& a, const Point2& b) { return a.x == b.x && a.y == b.y; }
+
+// Ear clipping of a counter clockwise polygon into triangles of welded
+// vertices; false when no ear is left before the end (bad input).
+inline bool clip_ears(const std::vector<Point2>& polygon, std::vector<uint32_t>& triangles) {
+    size_t n = polygon.size();
+    std::vector<size_t> prev(n), next(n);
+    for (size_t i = 0; i < n; ++i) {
+        prev[i] = (i + n - 1) % n;
+        next[i] = (i + 1) % n;
+    }
+    size_t current = 0, left = n, stalled = 0;
+    while (left > 3) {
+        size_t a = prev[current], b = current, c = next[current];
+        bool ear = cross2(polygon[a], polygon[b], polygon[c]) > 0.0;
+        for (size_t i = next[c]; ear && i != a; i = next[i]) {
+            const Point2& v = polygon[i];
+            if (same_place(v, polygon[a]) || same_place(v, polygon[b]) || same_place(v, polygon[c]))
+                continue;
+            if (cross2(polygon[a], polygon[b], v) >= 0.0 && cross2(polygon[b], polygon[c], v) >= 0.0
+                && cross2(polygon[c], polygon[a], v) >= 0.0)
+                ear = false;
+        }
+        if (!ear) {
+            current = next[current];
+            if (++stalled > left)
+                return false;
+            continue;
+        }
+        triangles.push_back(polygon[a].vertex);
+        triangles.push_back(polygon[b].vertex);
+        triangles.push_back(polygon[c].vertex);
+        next[a] = c;
+        prev[c] = a;
+        current = c;
+        --left;
+        stalled = 0;
+    }
+    size_t b = current;
+    triangles.push_back(polygon[prev[b]].vertex);
+    triangles.push_back(polygon[b].vertex);
+    triangles.push_back(polygon[next[b]].vertex);
+    return true;
+}
+
+inline void sub(const SUPoint3D& a, const SUPoint3D& b, double* out) {
+    out[0] = a.x - b.x;
+    out[1] = a.y - b.y;
+    out[2] = a.z - b.z;
+}
+
+inline void cross(const double* a, const double* b, double* out) {
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+inline double dot(const double* a, const double* b) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; }
+
+inline size_t find_root(std::vector<uint32_t>& parent, size_t i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+// The new triangles of one region (welded vertices), or false to keep it.
+inline bool retriangulate(const std::vector<double>& positions, const std::vector<uint32_t>& welded_indices,
+                          const std::vector<uint32_t>& members, const double* normal,
+                          const std::vector<uint32_t>& owner, uint32_t region, const CoplanarOptions& options,
+                          std::vector<uint32_t>& triangles) {
+    // Outline: the directed edges whose reverse is not in the region.
+    std::unordered_map<uint64_t, int> edges;
+    for (size_t i = 0; i < members.size(); ++i) {
+        const uint32_t* t = &welded_indices[3 * members[i]];
+        for (int k = 0; k < 3; ++k)
+            ++edges[((uint64_t)t[k] << 32) | t[(k + 1) % 3]];
+    }
+    std::unordered_map<uint32_t, uint32_t> outgoing;
+    for (std::unordered_map<uint64_t, int>::const_iterator e = edges.begin(); e != edges.end(); ++e) {
+        uint32_t a = (uint32_t)(e->first >> 32), b = (uint32_t)e->first;
+        if (e->second != 1)
+            return false;
+        if (edges.count(((uint64_t)b << 32) | a))
+            continue;
+        if (!outgoing.insert(std::make_pair(a, b)).second)
+            return false; // the outline touches itself
+    }
+    if (outgoing.size() > options.max_outline)
+        return false;
+
+    // Loops, without the straight vertices used by this region only.
+    int axis = std::fabs(normal[0]) > std::fabs(normal[1])
+        ? (std::fabs(normal[0]) > std::fabs(normal[2]) ? 0 : 2) : (std::fabs(normal[1]) > std::fabs(normal[2]) ? 1 : 2);
+    int u = (axis + 1) % 3, v = (axis + 2) % 3;
+    std::vector<std::vector<Point2> > loops;
+    while (!outgoing.empty()) {
+        std::vector<uint32_t> loop;
+        uint32_t start = outgoing.begin()->first, at = start;
+        do {
+            std::unordered_map<uint32_t, uint32_t>::iterator found = outgoing.find(at);
+            if (found == outgoing.end())
+                return false;
+            loop.push_back(at);
+            at = found->second;
+            outgoing.erase(found);
+        } while (at != start);
+
+        std::vector<Point2> kept;
+        for (size_t i = 0; i < loop.size(); ++i) {
+            const double* p = &positions[3 * loop[(i + loop.size() - 1) % loop.size()]];
+            const double* q = &positions[3 * loop[i]];
+            const double* r = &positions[3 * loop[(i + 1) % loop.size()]];
+            if (owner[loop[i]] == region) {
+                double a[3] = { q[0] - p[0], q[1] - p[1], q[2] - p[2] };
+                double b[3] = { r[0] - q[0], r[1] - q[1], r[2] - q[2] };
+                double c[3];
+                cross(a, b, c);
+                if (dot(a, b) > 0.0 && dot(c, c) <= 1e-18 * dot(a, a) * dot(b, b))
+                    continue;
+            }
+            Point2 point;
+            point.x = q[u];
+            point.y = q[v];
+            point.vertex = loop[i];
+            kept.push_back(point);
+        }
+        if (kept.size() < 3)
+            return false;
+        loops.push_back(kept);
+    }
+
+    // The outer loop turns the other way round from the holes.
+    size_t outer = 0;
+    std::vector<double> areas(loops.size());
+    for (size_t l = 0; l < loops.size(); ++l) {
+        areas[l] = loop_area(loops[l]);
+        if (std::fabs(areas[l]) > std::fabs(areas[outer]))
+            outer = l;
+    }
+    double side = areas[outer] < 0.0 ? -1.0 : 1.0;
+    size_t vertex_count = 0;
+    for (size_t l = 0; l < loops.size(); ++l) {
+        if (l != outer && areas[l] * side >= 0.0)
+            return false; // several pieces: not one polygon
+        if (side < 0.0)
+            for (size_t i = 0; i < loops[l].size(); ++i)
+                loops[l][i].x = -loops[l][i].x;
+        vertex_count += loops[l].size();
+    }
+    if (vertex_count + 2 * (loops.size() - 1) - 2 >= members.size())
+        return false;
+
+    std::vector<size_t> holes;
+    for (size_t l = 0; l < loops.size(); ++l)
+        if (l != outer)
+            holes.push_back(l);
+    std::sort(holes.begin(), holes.end(), [&](size_t a, size_t b) {
+        double xa = -HUGE_VAL, xb = -HUGE_VAL;
+        for (size_t i = 0; i < loops[a].size(); ++i)
+            xa = std::max(xa, loops[a][i].x);
+        for (size_t i = 0; i < loops[b].size(); ++i)
+            xb = std::max(xb, loops[b][i].x);
+        return xa > xb;
+    });
+    std::vector<Point2> polygon = loops[outer];
+    for (size_t h = 0; h < holes.size(); ++h)
+        if (!bridge_hole(polygon, loops[holes[h]]))
+            return false;
+    triangles.clear();
+    return clip_ears(polygon, triangles) && triangles.size() / 3 < members.size();
+}
+
+} // namespace coplanar_detail
+
+// Merges the regions of one mesh in place.
+inline CoplanarStats merge_coplanar_mesh(const Scene& scene, SceneMesh& mesh, const CoplanarOptions& options) {
+    using namespace coplanar_detail;
+    CoplanarStats stats;
+    size_t count = mesh.triangle_count();
+    stats.input = stats.output = count;
+    if (count < 2)
+        return stats;
+
+    // Weld the vertices by position: the faces own theirs.
+    std::unordered_map<PointKey, uint32_t, PointKeyHash> welded;
+    std::vector<uint32_t> vertex_of(mesh.vertices.size());
+    std::vector<uint32_t> original; // an original vertex of each welded one
+    std::vector<double> positions;
+    double low[3] = { HUGE_VAL, HUGE_VAL, HUGE_VAL }, high[3] = { -HUGE_VAL, -HUGE_VAL, -HUGE_VAL };
+    for (size_t v = 0; v < mesh.vertices.size(); ++v) {
+        std::pair<std::unordered_map<PointKey, uint32_t, PointKeyHash>::iterator, bool> inserted =
+            welded.insert(std::make_pair(point_key(mesh.vertices[v]), (uint32_t)original.size()));
+        if (inserted.second) {
+            original.push_back((uint32_t)v);
+            const SUPoint3D& p = mesh.vertices[v];
+            double xyz[3] = { p.x, p.y, p.z };
+            for (int d = 0; d < 3; ++d) {
+                positions.push_back(xyz[d]);
+                low[d] = std::min(low[d], xyz[d]);
+                high[d] = std::max(high[d], xyz[d]);
+            }
+        }
+        vertex_of[v] = inserted.first->second;
+    }
+    double extent = std::sqrt((high[0] - low[0]) * (high[0] - low[0]) + (high[1] - low[1]) * (high[1] - low[1])
+                              + (high[2] - low[2]) * (high[2] - low[2]));
+    double distance = options.distance * extent;
+    double cos_angle = std::cos(options.angle * 3.14159265358979323846 / 180.0);
+
+    // Planes and materials; the textured triangles keep their faces, whose
+    // texture coordinates do not carry over.
+    std::vector<uint32_t> indices(3 * count);
+    std::vector<double> normals(3 * count, 0.0);
+    std::vector<size_t> materials(count);
+    std::vector<size_t> face_of(count);
+    std::vector<char> mergeable(count, 0);
+    for (size_t f = 0; f < mesh.faces.size(); ++f) {
+        const SceneFace& face = mesh.faces[f];
+        bool textured = !mesh.uvs.empty() && (face.material == NO_MATERIAL
+                                              || !scene.materials[face.material].texture.empty());
+        for (size_t t = face.first_triangle; t < face.first_triangle + face.triangle_count; ++t) {
+            face_of[t] = f;
+            materials[t] = face.material;
+            for (int k = 0; k < 3; ++k)
+                indices[3 * t + k] = vertex_of[mesh.indices[3 * t + k]];
+            double a[3], b[3], n[3];
+            sub(mesh.vertices[mesh.indices[3 * t + 1]], mesh.vertices[mesh.indices[3 * t]], a);
+            sub(mesh.vertices[mesh.indices[3 * t + 2]], mesh.vertices[mesh.indices[3 * t]], b);
+            cross(a, b, n);
+            double length = std::sqrt(dot(n, n));
+            if (!(length > 0.0) || length - length != 0.0 || textured)
+                continue;
+            for (int d = 0; d < 3; ++d)
+                normals[3 * t + d] = n[d] / length;
+            mergeable[t] = indices[3 * t] != indices[3 * t + 1] && indices[3 * t + 1] != indices[3 * t + 2]
+                && indices[3 * t + 2] != indices[3 * t];
+        }
+    }
+
+    // Regions: triangles joined across the edges they share, two by two,
+    // in opposite directions, in the same plane and with the same material
+    // and layer.
+    std::unordered_map<uint64_t, uint32_t> edge_owner;
+    std::unordered_map<uint64_t, int> edge_uses;
+    for (size_t t = 0; t < count; ++t) {
+        for (int k = 0; k < 3; ++k) {
+            uint32_t a = indices[3 * t + k], b = indices[3 * t + (k + 1) % 3];
+            uint64_t key = a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+            ++edge_uses[key];
+            if (mergeable[t])
+                edge_owner.insert(std::make_pair(((uint64_t)a << 32) | b, (uint32_t)t));
+        }
+    }
+    std::vector<uint32_t> parent(count);
+    for (size_t t = 0; t < count; ++t)
+        parent[t] = (uint32_t)t;
+    for (size_t t = 0; t < count; ++t) {
+        if (!mergeable[t])
+            continue;
+        for (int k = 0; k < 3; ++k) {
+            uint32_t a = indices[3 * t + k], b = indices[3 * t + (k + 1) % 3];
+            if (edge_uses[a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a] != 2)
+                continue;
+            std::unordered_map<uint64_t, uint32_t>::const_iterator other = edge_owner.find(((uint64_t)b << 32) | a);
+            if (other == edge_owner.end() || other->second <= t)
+                continue;
+            size_t s = other->second;
+            if (materials[s] != materials[t] || mesh.faces[face_of[s]].layer != mesh.faces[face_of[t]].layer
+                || dot(&normals[3 * s], &normals[3 * t]) < cos_angle)
+                continue;
+            double offset = dot(&normals[3 * t], &positions[3 * indices[3 * t]]);
+            uint32_t apex = indices[3 * s] != a && indices[3 * s] != b ? indices[3 * s]
+                : indices[3 * s + 1] != a && indices[3 * s + 1] != b ? indices[3 * s + 1] : indices[3 * s + 2];
+            if (std::fabs(dot(&normals[3 * t], &positions[3 * apex]) - offset) > distance)
+                continue;
+            size_t rs = find_root(parent, s), rt = find_root(parent, t);
+            if (rs != rt)
+                parent[std::max(rs, rt)] = (uint32_t)std::min(rs, rt);
+        }
+    }
+
+    // Members of each region of two triangles or more, and the region that
+    // uses each welded vertex (SHARED when several do).
+    std::vector<uint32_t> region_of(count);
+    std::vector<std::vector<uint32_t> > regions;
+    std::vector<uint32_t> region_index(count, SHARED);
+    for (size_t t = 0; t < count; ++t) {
+        size_t root = find_root(parent, t);
+        if (region_index[root] == SHARED) {
+            region_index[root] = (uint32_t)regions.size();
+            regions.push_back(std::vector<uint32_t>());
+        }
+        region_of[t] = region_index[root];
+        regions[region_of[t]].push_back((uint32_t)t);
+    }
+    std::vector<uint32_t> owner(original.size(), SHARED - 1);
+    for (size_t t = 0; t < count; ++t) {
+        for (int k = 0; k < 3; ++k) {
+            uint32_t& o = owner[indices[3 * t + k]];
+            o = o == SHARED - 1 ? region_of[t] : o == region_of[t] ? o : SHARED;
+        }
+    }
+
+    std::vector<std::vector<uint32_t> > replaced(regions.size());
+    std::vector<char> done(regions.size(), 0);
+    bool any = false;
+    for (size_t r = 0; r < regions.size(); ++r) {
+        const std::vector<uint32_t>& members = regions[r];
+        if (members.size() < 2 || !mergeable[members[0]])
+            continue;
+        double normal[3] = { 0.0, 0.0, 0.0 };
+        for (size_t i = 0; i < members.size(); ++i)
+            for (int d = 0; d < 3; ++d)
+                normal[d] += normals[3 * members[i] + d];
+        if (retriangulate(positions, indices, members, normal, owner, (uint32_t)r, options, replaced[r])) {
+            any = true;
+            ++stats.regions;
+            std::vector<size_t> faces;
+            for (size_t i = 0; i < members.size(); ++i)
+                faces.push_back(face_of[members[i]]);
+            std::sort(faces.begin(), faces.end());
+            stats.faces += std::unique(faces.begin(), faces.end()) - faces.begin();
+            stats.output -= members.size() - replaced[r].size() / 3;
+        }
+        else
+            replaced[r].clear();
+    }
+    if (!any)
+        return stats;
+
+    // The faces again: each region becomes a face where its first triangle
+    // was, the triangles left stay in their face, and the faces emptied by
+    // the merge go.
+    SceneMesh merged;
+    merged.name = mesh.name;
+    bool has_normals = mesh.normals.size() == mesh.vertices.size();
+    bool has_uvs = mesh.uvs.size() == mesh.vertices.size();
+    std::vector<uint32_t> renumbered(original.size(), SHARED);
+    for (size_t f = 0; f < mesh.faces.size(); ++f) {
+        const SceneFace& face = mesh.faces[f];
+        std::vector<uint32_t> starts, left;
+        for (size_t t = face.first_triangle; t < face.first_triangle + face.triangle_count; ++t) {
+            uint32_t r = region_of[t];
+            if (replaced[r].empty())
+                left.push_back((uint32_t)t);
+            else if (!done[r]) {
+                done[r] = 1;
+                starts.push_back(r);
+            }
+        }
+        for (size_t i = 0; i < starts.size(); ++i) {
+            const std::vector<uint32_t>& triangles = replaced[starts[i]];
+            SceneFace region = face;
+            region.first_vertex = merged.vertices.size();
+            region.first_triangle = merged.indices.size() / 3;
+            for (size_t k = 0; k < triangles.size(); ++k) {
+                uint32_t w = triangles[k];
+                if (renumbered[w] == SHARED) {
+                    renumbered[w] = (uint32_t)merged.vertices.size();
+                    merged.vertices.push_back(mesh.vertices[original[w]]);
+                    if (has_normals)
+                        merged.normals.push_back(mesh.normals[original[w]]);
+                    if (has_uvs)
+                        merged.uvs.push_back(mesh.uvs[original[w]]);
+                }
+                merged.indices.push_back(renumbered[w]);
+            }
+            for (size_t k = 0; k < triangles.size(); ++k)
+                renumbered[triangles[k]] = SHARED;
+            region.vertex_count = merged.vertices.size() - region.first_vertex;
+            region.triangle_count = triangles.size() / 3;
+            merged.faces.push_back(region);
+        }
+        if (left.empty() && face.triangle_count > 0)
+            continue;
+        SceneFace kept = face;
+        kept.first_vertex = merged.vertices.size();
+        kept.first_triangle = merged.indices.size() / 3;
+        kept.triangle_count = left.size();
+        for (size_t v = face.first_vertex; v < face.first_vertex + face.vertex_count; ++v) {
+            merged.vertices.push_back(mesh.vertices[v]);
+            if (has_normals)
+                merged.normals.push_back(mesh.normals[v]);
+            if (has_uvs)
+                merged.uvs.push_back(mesh.uvs[v]);
+        }
+        for (size_t i = 0; i < left.size(); ++i)
+            for (int k = 0; k < 3; ++k)
+                merged.indices.push_back(
+                    (uint32_t)(kept.first_vertex + mesh.indices[3 * left[i] + k] - face.first_vertex));
+        merged.faces.push_back(kept);
+    }
+    std::swap(mesh, merged);
+    return stats;
+}
+
+inline CoplanarStats merge_coplanar_scene(Scene& scene, const CoplanarOptions& options, unsigned threads) {
+    std::vector<CoplanarStats> stats(scene.meshes.size());
+    std::vector<size_t> meshes(scene.meshes.size());
+    for (size_t m = 0; m < meshes.size(); ++m)
+        meshes[m] = m;
+    std::stable_sort(meshes.begin(), meshes.end(), [&](size_t a, size_t b) {
+        return scene.meshes[a].triangle_count() > scene.meshes[b].triangle_count();
+    });
+    parallel_for(meshes.size(), threads, [&](size_t i, unsigned) {
+        stats[meshes[i]] = merge_coplanar_mesh(scene, scene.meshes[meshes[i]], options);
+    });
+    CoplanarStats total;
+    for (size_t m = 0; m < stats.size(); ++m)
+        total.add(stats[m]);
+    return total;
+}
+
+#endif // SKP2TRI_SCENE_COPLANAR_H
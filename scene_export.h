@@ -0,0 +1,242 @@
+#ifndef SKP2TRI_SCENE_EXPORT_H
+#define SKP2TRI_SCENE_EXPORT_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include "scene.h"
+#include "scene_source.h"
+#include "scene_output.h"
+#include "scene_clean.h"
+#include "tri_reader.h"
+#include "scene_coplanar.h"
+#include "scene_stats.h"
+#include "scene_lod.h"
+#include "scene_voxel.h"
+#include "scene_topology.h"
+#include "scene_volume.h"
+
+// skp2tri's conversion of a loaded scene, whatever its source: the cleaning
+// passes, the output (whole or split), then the sidecars, reports, levels of
+// detail and voxels asked for. The summaries go to `log`, the reports asked
+// for on the standard output (-) to std::cout.
+
+struct ExportOptions {
+    WriteOptions write;
+    SplitMode split;
+    bool clean;
+    bool merge_coplanar;
+    std::string report;   // --report, - for the standard output
+    std::string topology; // --topology
+    std::string volumes;  // --volumes, CSV when it ends in .csv
+    bool adjacency;
+    std::vector<double> lods;
+    VoxelOptions voxels;  // none when voxels.size is 0
+
+    ExportOptions() : split(SPLIT_NONE), clean(false), merge_coplanar(false), adjacency(false) {}
+};
+
+// Unknown extensions keep getting the text format.
+inline std::string export_format(const std::string& output_path) {
+    std::string extension = lower_extension(output_path);
+    return is_scene_format(extension) ? extension : ".tri";
+}
+
+// What the source has to fill in the scene for the output.
+inline SceneOptions export_scene_options(const std::string& output_path, const ExportOptions& options) {
+    std::string format = export_format(output_path);
+    std::string stem = output_path.substr(0, output_path.size() - lower_extension(output_path).size());
+    SceneOptions scene_options;
+    scene_options.normals = format == ".glb" || (format == ".ply" && options.write.normals);
+    scene_options.uvs = format == ".glb";
+    if (format == ".glb") // textures are written next to the output as <name>_<n>_<file>
+        scene_options.texture_prefix = stem + "_";
+    return scene_options;
+}
+
+// Writes a report to `path`, or to the standard output for -.
+template <class Write>
+bool write_report(const std::string& path, Write write) {
+    if (path == "-") {
+        write(std::cout);
+        return true;
+    }
+    std::ofstream out(path.c_str());
+    write(out);
+    out.close();
+    return !out.fail();
+}
+
+inline bool export_scene(Scene& scene, const std::string& output_path, const ExportOptions& export_options,
+                         std::ostream& log, std::string* error) {
+    WriteOptions options = export_options.write;
+    SplitMode split = export_options.split;
+    std::string extension = lower_extension(output_path);
+    std::string format = export_format(output_path);
+    std::string stem = output_path.substr(0, output_path.size() - extension.size());
+
+    if (export_options.clean) {
+        PROFILE_SCOPE(STAGE_CLEAN);
+        CleanStats stats = clean_scene(scene, CleanOptions(), options.threads);
+        log << "clean : " << stats.removed() << " of " << stats.input << " triangles removed ("
+            << stats.non_finite << " non finite, " << stats.zero_area << " zero area, "
+            << stats.duplicates << " repeated, " << stats.flipped << " repeated with flipped winding)" << "\n";
+    }
+    if (export_options.merge_coplanar) {
+        PROFILE_SCOPE(STAGE_MERGE_COPLANAR);
+        uint64_t before = ranges_triangle_count(flatten_scene(scene));
+        CoplanarStats stats = merge_coplanar_scene(scene, CoplanarOptions(), options.threads);
+        uint64_t after = ranges_triangle_count(flatten_scene(scene));
+        log << "merge-coplanar : " << stats.input - stats.output << " of " << stats.input
+            << " triangles of the definitions removed (" << stats.regions << " regions from " << stats.faces
+            << " faces), " << before << " -> " << after << " triangles in the output" << "\n";
+    }
+
+    // The range writers gather the statistics while writing.
+    SceneStats stats;
+    bool writer_stats = split == SPLIT_NONE && format != ".glb";
+    if (!export_options.report.empty() && writer_stats)
+        options.stats = &stats;
+
+    {
+        PROFILE_SCOPE(STAGE_WRITE);
+        if (split != SPLIT_NONE) {
+            std::vector<SplitPart> parts = split_scene(scene, split, stem + "_", extension);
+            if (!write_split(scene, parts, format, stem + ".index.json", options)) {
+                *error = "some parts of " + output_path + " could not be written";
+                return false;
+            }
+        }
+        else {
+            std::string refused;
+            options.error = &refused;
+            if (!write_scene_output(scene, 0, true, output_path, format, options)) {
+                *error = refused.empty() ? "file " + output_path + " impossible to write"
+                                         : "file " + output_path + " not written : " + refused;
+                return false;
+            }
+            options.error = 0;
+        }
+    }
+
+    // Connectivity of the definitions, and of the output triangles.
+    const std::string& topology = export_options.topology;
+    if (!topology.empty() || export_options.adjacency) {
+        PROFILE_SCOPE(STAGE_TOPOLOGY);
+        std::vector<HalfEdges> meshes;
+        std::vector<TopologyGroup> groups;
+        scene_topology(scene, options.threads, meshes, groups);
+        if (export_options.adjacency && (split != SPLIT_NONE || format == ".glb"))
+            std::cerr << "Warning : --adjacency is only written for a single .tri, .trb, .stl or .ply output" << "\n";
+        else if (export_options.adjacency) {
+            MappedInput written;
+            uint64_t data_size = written.open(output_path) ? written.size() : 0;
+            written.close();
+            if (!write_scene_adjacency(scene, flatten_scene(scene), meshes, output_path + ".adj", data_size,
+                                       options.threads)) {
+                *error = "file " + output_path + ".adj impossible to write";
+                return false;
+            }
+        }
+        if (!topology.empty()
+            && !write_report(topology, [&](std::ostream& out) { write_topology_json(out, groups); })) {
+            *error = "file " + topology + " impossible to write";
+            return false;
+        }
+    }
+
+    // Areas and volumes of the full resolution output, from the definitions.
+    const std::string& volumes = export_options.volumes;
+    if (!volumes.empty()) {
+        PROFILE_SCOPE(STAGE_VOLUMES);
+        VolumeReport volume_report;
+        scene_volumes(scene, options.threads, volume_report);
+        bool csv = volumes != "-" && lower_extension(volumes) == ".csv";
+        if (!write_report(volumes, [&](std::ostream& out) {
+                if (csv)
+                    write_volumes_csv(out, volume_report);
+                else
+                    write_volumes_json(out, volume_report);
+            })) {
+            *error = "file " + volumes + " impossible to write";
+            return false;
+        }
+    }
+
+    // The levels of detail, each written like the full resolution output.
+    const std::vector<double>& lods = export_options.lods;
+    if (!lods.empty()) {
+        PROFILE_SCOPE(STAGE_LODS);
+        std::vector<Scene> levels;
+        lod_scenes(scene, lods, options.threads, levels);
+        WriteOptions lod_options = options;
+        lod_options.stats = 0;
+        for (size_t l = 0; l < levels.size(); ++l) {
+            std::ostringstream name;
+            name << stem << "_lod" << l + 1;
+            bool written;
+            if (split != SPLIT_NONE) {
+                std::vector<SplitPart> parts = split_scene(levels[l], split, name.str() + "_", extension);
+                written = write_split(levels[l], parts, format, name.str() + ".index.json", lod_options);
+            }
+            else
+                written = write_scene_output(levels[l], 0, true, name.str() + extension, format, lod_options);
+            if (!written) {
+                *error = "level of detail " + name.str() + " impossible to write";
+                return false;
+            }
+            size_t triangles = 0, full = 0;
+            for (size_t m = 0; m < scene.meshes.size(); ++m) {
+                triangles += levels[l].meshes[m].triangle_count();
+                full += scene.meshes[m].triangle_count();
+            }
+            log << "lod " << l + 1 << " (" << lods[l] << ") : " << triangles << " of " << full
+                << " triangles in the definitions" << "\n";
+        }
+    }
+
+    // The voxels of the full resolution output, straight from the scene.
+    if (export_options.voxels.size > 0.0) {
+        PROFILE_SCOPE(STAGE_VOXELS);
+        VoxelOptions voxel_options = export_options.voxels;
+        voxel_options.threads = options.threads;
+        VoxelGrid voxels;
+        std::string voxel_error;
+        if (!voxelize_scene(scene, voxel_options, voxels, &voxel_error)) {
+            *error = "--voxelize : " + voxel_error;
+            return false;
+        }
+        if (!write_voxels(stem + ".vox", voxels)) {
+            *error = "file " + stem + ".vox impossible to write";
+            return false;
+        }
+        const TriVoxelHeader& header = voxels.header;
+        log << "voxels : " << header.resolution[0] << " x " << header.resolution[1] << " x "
+            << header.resolution[2] << ", " << header.occupied << " occupied";
+        if (voxel_options.solid && voxels.open_rows > 0)
+            log << " (" << voxels.open_rows << " rows left unfilled, not closed)";
+        log << "\n";
+    }
+
+    if (!export_options.report.empty()) {
+        PROFILE_SCOPE(STAGE_REPORT);
+        std::vector<SceneRange> ranges = flatten_scene(scene);
+        if (!writer_stats)
+            collect_scene_stats(scene, ranges, options.threads, stats);
+        TriStats total;
+        EdgeHistogram edges;
+        std::vector<TriStatsGroup> groups;
+        scene_stats_report(scene, ranges, stats, total, edges, groups);
+        if (!write_report(export_options.report,
+                          [&](std::ostream& out) { write_stats_json(out, total, edges, groups); })) {
+            *error = "file " + export_options.report + " impossible to write";
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif // SKP2TRI_SCENE_EXPORT_H
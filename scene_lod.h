@@ -0,0 +1,160 @@
+#ifndef SKP2TRI_SCENE_LOD_H
+#define SKP2TRI_SCENE_LOD_H
+
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <cmath>
+#include <cstring>
+#include "scene.h"
+#include "tri_decimate.h"
+#include "parallel.h"
+
+// --lod: levels of detail of the scene, with every mesh simplified by
+// tri_decimate.h to a ratio of its triangles. Meshes are per component
+// definition, so a definition is simplified once whatever its number of
+// instances; the definitions are spread over the worker threads, biggest
+// first, and each one gives all its levels in a single run.
+
+// Corners with the same coordinates, -0 folded into +0.
+struct PointKey {
+    uint64_t bits[3];
+
+    bool operator==(const PointKey& other) const {
+        return bits[0] == other.bits[0] && bits[1] == other.bits[1] && bits[2] == other.bits[2];
+    }
+};
+
+struct PointKeyHash {
+    size_t operator()(const PointKey& key) const {
+        uint64_t h = key.bits[0] * 0x9E3779B97F4A7C15ULL;
+        h = (h ^ (h >> 29) ^ key.bits[1]) * 0xBF58476D1CE4E5B9ULL;
+        h = (h ^ (h >> 32) ^ key.bits[2]) * 0x94D049BB133111EBULL;
+        return (size_t)(h ^ (h >> 31));
+    }
+};
+
+inline PointKey point_key(const SUPoint3D& point) {
+    PointKey key;
+    double values[3] = { point.x + 0.0, point.y + 0.0, point.z + 0.0 };
+    std::memcpy(key.bits, values, sizeof(key.bits));
+    return key;
+}
+
+// The levels of `mesh`, one per ratio (decreasing). Faces keep their
+// material and their place, with the vertices their remaining triangles
+// use; a face left without triangles stays, empty.
+inline void decimate_scene_mesh(const SceneMesh& mesh, const std::vector<double>& ratios,
+                                std::vector<SceneMesh>& levels) {
+    levels.assign(ratios.size(), SceneMesh());
+    size_t count = mesh.triangle_count();
+
+    // The faces own their vertices: weld them by position, so that the
+    // simplification sees the surface across the faces.
+    std::unordered_map<PointKey, uint32_t, PointKeyHash> welded;
+    std::vector<uint32_t> vertex_of(mesh.vertices.size());
+    std::vector<double> positions;
+    for (size_t v = 0; v < mesh.vertices.size(); ++v) {
+        std::pair<std::unordered_map<PointKey, uint32_t, PointKeyHash>::iterator, bool> inserted =
+            welded.insert(std::make_pair(point_key(mesh.vertices[v]), (uint32_t)(positions.size() / 3)));
+        if (inserted.second) {
+            positions.push_back(mesh.vertices[v].x);
+            positions.push_back(mesh.vertices[v].y);
+            positions.push_back(mesh.vertices[v].z);
+        }
+        vertex_of[v] = inserted.first->second;
+    }
+    std::vector<uint32_t> indices(3 * count), groups(count);
+    for (size_t f = 0; f < mesh.faces.size(); ++f) {
+        const SceneFace& face = mesh.faces[f];
+        for (size_t t = face.first_triangle; t < face.first_triangle + face.triangle_count; ++t) {
+            groups[t] = (uint32_t)face.material;
+            for (int k = 0; k < 3; ++k)
+                indices[3 * t + k] = vertex_of[mesh.indices[3 * t + k]];
+        }
+    }
+    std::vector<size_t> targets(ratios.size());
+    for (size_t l = 0; l < ratios.size(); ++l)
+        targets[l] = (size_t)std::ceil(ratios[l] * count);
+    std::vector<DecimateLevel> decimated;
+    decimate_mesh(positions, indices, groups, targets, decimated);
+
+    bool normals = mesh.normals.size() == mesh.vertices.size();
+    bool uvs = mesh.uvs.size() == mesh.vertices.size();
+    std::vector<uint32_t> renumbered(mesh.vertices.size(), 0xffffffffu);
+    for (size_t l = 0; l < ratios.size(); ++l) {
+        const DecimateLevel& level = decimated[l];
+        SceneMesh& out = levels[l];
+        out.name = mesh.name;
+        size_t next = 0;
+        for (size_t f = 0; f < mesh.faces.size(); ++f) {
+            const SceneFace& face = mesh.faces[f];
+            SceneFace kept = face;
+            kept.first_vertex = out.vertices.size();
+            kept.first_triangle = out.indices.size() / 3;
+            for (; next < level.triangles.size() && level.triangles[next] < face.first_triangle + face.triangle_count;
+                 ++next) {
+                const uint32_t* corners = &mesh.indices[3 * level.triangles[next]];
+                for (int k = 0; k < 3; ++k) {
+                    uint32_t v = corners[k];
+                    if (renumbered[v] == 0xffffffffu) {
+                        renumbered[v] = (uint32_t)out.vertices.size();
+                        const double* p = &level.positions[3 * vertex_of[v]];
+                        SUPoint3D point;
+                        point.x = p[0];
+                        point.y = p[1];
+                        point.z = p[2];
+                        out.vertices.push_back(point);
+                        if (normals)
+                            out.normals.push_back(mesh.normals[v]);
+                        if (uvs)
+                            out.uvs.push_back(mesh.uvs[v]);
+                    }
+                    out.indices.push_back(renumbered[v]);
+                }
+            }
+            kept.vertex_count = out.vertices.size() - kept.first_vertex;
+            kept.triangle_count = out.indices.size() / 3 - kept.first_triangle;
+            for (size_t v = face.first_vertex; v < face.first_vertex + face.vertex_count; ++v)
+                renumbered[v] = 0xffffffffu;
+            out.faces.push_back(kept);
+        }
+    }
+}
+
+// One scene per ratio, in the order given: the same nodes and materials,
+// with the simplified meshes. `ratios` are in (0, 1].
+inline void lod_scenes(const Scene& scene, const std::vector<double>& ratios, unsigned threads,
+                       std::vector<Scene>& lods) {
+    // Simplified from the finest level to the coarsest.
+    std::vector<size_t> order(ratios.size());
+    for (size_t l = 0; l < order.size(); ++l)
+        order[l] = l;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return ratios[a] > ratios[b]; });
+    std::vector<double> sorted(ratios.size());
+    for (size_t l = 0; l < order.size(); ++l)
+        sorted[l] = ratios[order[l]];
+
+    lods.assign(ratios.size(), Scene());
+    for (size_t l = 0; l < lods.size(); ++l) {
+        lods[l].materials = scene.materials;
+        lods[l].layers = scene.layers;
+        lods[l].nodes = scene.nodes;
+        lods[l].meshes.resize(scene.meshes.size());
+    }
+    std::vector<size_t> meshes(scene.meshes.size());
+    for (size_t m = 0; m < meshes.size(); ++m)
+        meshes[m] = m;
+    std::stable_sort(meshes.begin(), meshes.end(), [&](size_t a, size_t b) {
+        return scene.meshes[a].triangle_count() > scene.meshes[b].triangle_count();
+    });
+    parallel_for(meshes.size(), threads, [&](size_t i, unsigned) {
+        size_t m = meshes[i];
+        std::vector<SceneMesh> levels;
+        decimate_scene_mesh(scene.meshes[m], sorted, levels);
+        for (size_t l = 0; l < levels.size(); ++l)
+            std::swap(lods[order[l]].meshes[m], levels[l]);
+    });
+}
+
+#endif // SKP2TRI_SCENE_LOD_H
@@ -0,0 +1,224 @@
+#ifndef SKP2TRI_SCENE_OUTPUT_H
+#define SKP2TRI_SCENE_OUTPUT_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include "scene.h"
+#include "scene_writers.h"
+#include "gltf_writer.h"
+#include "tri_index.h"
+#include "json.h"
+
+// Format dispatch and split output, on top of the individual writers.
+
+inline bool is_scene_format(const std::string& extension) {
+    return extension == ".tri" || extension == ".trb" || extension == ".stl"
+        || extension == ".ply" || extension == ".glb";
+}
+
+// The size of a file just written, for --stats.
+inline uint64_t written_file_size(const std::string& path) {
+    MappedInput written;
+    return written.open(path) ? written.size() : 0;
+}
+
+// Writes the subtree below `root` (only its own faces when not `recursive`)
+// in the format selected by `extension`, and its sidecar index when asked
+// for and the format has one.
+inline bool write_scene_file(const Scene& scene, size_t root, bool recursive, const std::string& path,
+                             const std::string& extension, const WriteOptions& options) {
+    if (extension == ".glb") {
+        if (root == 0 && recursive)
+            return write_glb(scene, path, options);
+        Scene part;
+        extract_scene(scene, root, recursive, part);
+        return write_glb(part, path, options);
+    }
+
+    std::vector<SceneRange> ranges = flatten_scene(scene, root, recursive);
+    if (extension == ".ply")
+        return write_ply(scene, ranges, path, options);
+
+    std::vector<uint64_t> offsets;
+    uint32_t format;
+    bool written;
+    if (extension == ".trb") {
+        written = write_trb(scene, ranges, path, options);
+        offsets = fixed_range_offsets(ranges, TRB_HEADER_SIZE, TRB_TRIANGLE_SIZE);
+        format = TRI_INDEX_TRB;
+    }
+    else if (extension == ".stl") {
+        written = write_stl(scene, ranges, path, options);
+        offsets = fixed_range_offsets(ranges, STL_HEADER_SIZE, STL_TRIANGLE_SIZE);
+        format = TRI_INDEX_STL;
+    }
+    else {
+        WriteOptions text_options = options;
+        text_options.range_offsets = options.index ? &offsets : 0;
+        written = write_tri(scene, ranges, path, text_options);
+        format = TRI_INDEX_TEXT;
+    }
+    if (written && options.index)
+        written = write_tri_index(scene, root, recursive, ranges, offsets, format, path + ".idx", options.threads);
+    return written;
+}
+
+inline bool write_scene_output(const Scene& scene, size_t root, bool recursive, const std::string& path,
+                               const std::string& extension, const WriteOptions& options) {
+    bool written = write_scene_file(scene, root, recursive, path, extension, options);
+    PROFILE_COUNT(COUNT_FILES_WRITTEN, written);
+    PROFILE_COUNT(COUNT_BYTES_WRITTEN, written ? written_file_size(path) : 0);
+    PROFILE_COUNT(COUNT_OUTPUT_TRIANGLES, ranges_triangle_count(flatten_scene(scene, root, recursive)));
+    return written;
+}
+
+enum SplitMode { SPLIT_NONE, SPLIT_GROUPS, SPLIT_DEFINITIONS };
+
+// One output file of a split export.
+struct SplitPart {
+    std::string name;
+    std::string kind;     // "faces", "group", "instance" or "definition"
+    size_t root;          // scene node written as the part
+    bool recursive;
+    std::string path;
+    uint64_t triangle_count;
+    bool has_bounds;
+    SUBoundingBox3D bounds;
+    bool written;
+};
+
+// Keeps file names portable: anything but letters, digits, '-', '_' and '.'
+// becomes '_'.
+inline std::string part_file_name(const std::string& name) {
+    std::string file;
+    for (size_t i = 0; i < name.size(); ++i) {
+        char c = name[i];
+        bool keep = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+            || c == '-' || c == '_' || c == '.';
+        file += keep ? c : '_';
+    }
+    return file.empty() ? "part" : file;
+}
+
+// Lists the parts of a split export. SPLIT_GROUPS writes each top-level
+// group and instance, plus the loose faces of the model; SPLIT_DEFINITIONS
+// writes each component definition once, in its own coordinates. Parts are
+// written to <prefix><name><extension>.
+inline std::vector<SplitPart> split_scene(const Scene& scene, SplitMode mode,
+                                          const std::string& prefix, const std::string& extension) {
+    std::vector<SplitPart> parts;
+    if (scene.nodes.empty())
+        return parts;
+
+    SplitPart part;
+    part.triangle_count = 0;
+    part.has_bounds = false;
+    part.written = false;
+    if (mode == SPLIT_GROUPS) {
+        const SceneNode& root = scene.nodes[0];
+        if (scene.meshes[root.mesh].triangle_count() > 0) {
+            part.name = "model";
+            part.kind = "faces";
+            part.root = 0;
+            part.recursive = false;
+            parts.push_back(part);
+        }
+        for (size_t c = 0; c < root.children.size(); ++c) {
+            const SceneNode& child = scene.nodes[root.children[c]];
+            part.name = child.name.empty() ? scene.meshes[child.mesh].name : child.name;
+            part.kind = child.kind == SceneNode::GROUP ? "group" : "instance";
+            part.root = root.children[c];
+            part.recursive = true;
+            parts.push_back(part);
+        }
+    }
+    else if (mode == SPLIT_DEFINITIONS) {
+        // The first instance of each definition stands for all of them.
+        std::vector<bool> seen(scene.meshes.size(), false);
+        for (size_t n = 0; n < scene.nodes.size(); ++n) {
+            const SceneNode& node = scene.nodes[n];
+            if (node.kind != SceneNode::INSTANCE || seen[node.mesh])
+                continue;
+            seen[node.mesh] = true;
+            part.name = scene.meshes[node.mesh].name;
+            part.kind = "definition";
+            part.root = n;
+            part.recursive = true;
+            parts.push_back(part);
+        }
+    }
+
+    std::set<std::string> used;
+    for (size_t p = 0; p < parts.size(); ++p) {
+        std::string file = part_file_name(parts[p].name);
+        std::string unique = file;
+        for (int suffix = 2; used.count(unique) > 0; ++suffix) {
+            std::ostringstream numbered;
+            numbered << file << "_" << suffix;
+            unique = numbered.str();
+        }
+        used.insert(unique);
+        parts[p].path = prefix + unique + extension;
+    }
+    return parts;
+}
+
+// Writes every part to its own file on the worker threads, biggest parts
+// first, then the JSON index listing names, files, bounds and triangle
+// counts. The scene (and so every definition's tessellation) is shared by
+// all the parts.
+inline bool write_split(const Scene& scene, std::vector<SplitPart>& parts, const std::string& extension,
+                        const std::string& index_path, const WriteOptions& options) {
+    for (size_t p = 0; p < parts.size(); ++p) {
+        std::vector<SceneRange> ranges = flatten_scene(scene, parts[p].root, parts[p].recursive);
+        parts[p].triangle_count = ranges_triangle_count(ranges);
+    }
+    std::vector<size_t> order(parts.size());
+    for (size_t p = 0; p < order.size(); ++p)
+        order[p] = p;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return parts[a].triangle_count > parts[b].triangle_count;
+    });
+
+    // Parallelism comes from the parts, each one is written on one thread.
+    WriteOptions part_options = options;
+    part_options.threads = 1;
+    part_options.stats = 0;
+    part_options.error = 0;
+    parallel_for(order.size(), options.threads, [&](size_t i, unsigned) {
+        SplitPart& part = parts[order[i]];
+        std::vector<SceneRange> ranges = flatten_scene(scene, part.root, part.recursive);
+        part.has_bounds = ranges_bounds(scene, ranges, part.bounds);
+        part.written = write_scene_output(scene, part.root, part.recursive, part.path, extension, part_options);
+    });
+
+    std::ofstream index(index_path.c_str());
+    index << "{\n  \"parts\": [";
+    bool ok = true;
+    for (size_t p = 0; p < parts.size(); ++p) {
+        const SplitPart& part = parts[p];
+        ok = ok && part.written;
+        size_t slash = part.path.find_last_of("/\\");
+        index << (p > 0 ? "," : "") << "\n    {\"name\": " << json_string(part.name)
+              << ", \"kind\": " << json_string(part.kind)
+              << ", \"file\": " << json_string(slash == std::string::npos ? part.path : part.path.substr(slash + 1))
+              << ", \"triangles\": " << part.triangle_count;
+        if (part.has_bounds) {
+            const SUBoundingBox3D& box = part.bounds;
+            index << ", \"bounds\": {\"min\": [" << json_number(box.min_point.x, 17) << ", "
+                  << json_number(box.min_point.y, 17) << ", " << json_number(box.min_point.z, 17)
+                  << "], \"max\": [" << json_number(box.max_point.x, 17) << ", "
+                  << json_number(box.max_point.y, 17) << ", " << json_number(box.max_point.z, 17) << "]}";
+        }
+        index << "}";
+    }
+    index << "\n  ]\n}\n";
+    index.close();
+    return ok && !index.fail();
+}
+
+#endif // SKP2TRI_SCENE_OUTPUT_H
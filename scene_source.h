@@ -0,0 +1,33 @@
+#ifndef SKP2TRI_SCENE_SOURCE_H
+#define SKP2TRI_SCENE_SOURCE_H
+
+#include <string>
+#include "scene.h"
+#include "profile.h"
+
+// Where the Scene comes from. Everything after it (cleaning, writers,
+// reports) only sees the Scene, so a source is the one part that needs the
+// SketchUp SDK: SkpSource (skp_parser.h) reads a model through it, while
+// SyntheticSource (scene_synthetic.h) generates one and builds anywhere.
+
+struct SceneOptions {
+    bool normals;                // fill SceneMesh::normals
+    bool uvs;                    // fill SceneMesh::uvs
+    std::string texture_prefix;  // textures are written to <prefix><file name>, none if empty
+
+    SceneOptions() : normals(false), uvs(false) {}
+};
+
+class SceneSource {
+public:
+    virtual ~SceneSource() {}
+
+    // Replaces the content of `scene`. Returns false and sets `error` when
+    // there is no scene to be had.
+    virtual bool load(const SceneOptions& options, Scene& scene, std::string* error) = 0;
+
+    // The input, as the messages name it.
+    virtual std::string name() const = 0;
+};
+
+#endif // SKP2TRI_SCENE_SOURCE_H
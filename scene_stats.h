@@ -0,0 +1,82 @@
+#ifndef SKP2TRI_SCENE_STATS_H
+#define SKP2TRI_SCENE_STATS_H
+
+#include <vector>
+#include "scene.h"
+#include "tri_stats.h"
+#include "parallel.h"
+
+// --report: the statistics of tri_stats.h gathered by the writers. Each
+// worker adds the range it has just written, so the report costs no pass
+// of its own over the triangles; the groups are the top-level groups and
+// instances, as for --split groups, plus the model's own faces.
+struct SceneStats {
+    std::vector<TriStats> ranges;       // one per range, in output order
+    std::vector<EdgeHistogram> workers; // one per writer thread
+
+    void prepare(size_t range_count, unsigned threads) {
+        ranges.assign(range_count, TriStats());
+        workers.assign(threads > 0 ? threads : default_thread_count(), EdgeHistogram());
+    }
+
+    void add_range(const Scene& scene, const SceneRange& range, size_t r, unsigned worker) {
+        const SceneMesh& mesh = scene.meshes[scene.nodes[range.node].mesh];
+        const uint32_t* index = range.triangle_count > 0 ? &mesh.indices[3 * range.first_triangle] : 0;
+        for (size_t t = 0; t < range.triangle_count; ++t, index += 3) {
+            const SUPoint3D& a = mesh.vertices[index[0]];
+            const SUPoint3D& b = mesh.vertices[index[1]];
+            const SUPoint3D& c = mesh.vertices[index[2]];
+            double corners[3][3] = { { a.x, a.y, a.z }, { b.x, b.y, b.z }, { c.x, c.y, c.z } };
+            ranges[r].add(corners[0], corners[1], corners[2], workers[worker]);
+        }
+    }
+};
+
+// For the outputs whose writer does not go through the ranges (.glb and
+// --split), the same sums on their own pass.
+inline void collect_scene_stats(const Scene& scene, const std::vector<SceneRange>& ranges, unsigned threads,
+                                SceneStats& stats) {
+    stats.prepare(ranges.size(), threads);
+    parallel_for(ranges.size(), threads, [&](size_t r, unsigned worker) {
+        stats.add_range(scene, ranges[r], r, worker);
+    });
+}
+
+inline void mark_stats_group(const Scene& scene, size_t node, size_t group, std::vector<size_t>& group_of) {
+    group_of[node] = group;
+    for (size_t c = 0; c < scene.nodes[node].children.size(); ++c)
+        mark_stats_group(scene, scene.nodes[node].children[c], group, group_of);
+}
+
+// Merges the ranges of a whole scene export into the totals and the groups.
+inline void scene_stats_report(const Scene& scene, const std::vector<SceneRange>& ranges, const SceneStats& stats,
+                               TriStats& total, EdgeHistogram& edges, std::vector<TriStatsGroup>& groups) {
+    groups.clear();
+    if (scene.nodes.empty())
+        return;
+    const SceneNode& root = scene.nodes[0];
+    std::vector<size_t> group_of(scene.nodes.size(), 0);
+    groups.push_back(TriStatsGroup());
+    groups[0].name = "model";
+    groups[0].kind = "faces";
+    for (size_t c = 0; c < root.children.size(); ++c) {
+        const SceneNode& child = scene.nodes[root.children[c]];
+        TriStatsGroup group;
+        group.name = child.name.empty() ? scene.meshes[child.mesh].name : child.name;
+        group.kind = child.kind == SceneNode::GROUP ? "group" : "instance";
+        group.entity_id = child.entity_id;
+        mark_stats_group(scene, root.children[c], groups.size(), group_of);
+        groups.push_back(group);
+    }
+
+    for (size_t r = 0; r < ranges.size(); ++r) {
+        total.add(stats.ranges[r]);
+        groups[group_of[ranges[r].node]].stats.add(stats.ranges[r]);
+    }
+    for (size_t w = 0; w < stats.workers.size(); ++w)
+        edges.add(stats.workers[w]);
+    if (groups[0].stats.triangles == 0)
+        groups.erase(groups.begin());
+}
+
+#endif // SKP2TRI_SCENE_STATS_H
@@ -0,0 +1,309 @@
+#ifndef SKP2TRI_SCENE_SYNTHETIC_H
+#define SKP2TRI_SCENE_SYNTHETIC_H
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <stdint.h>
+#include "scene.h"
+#include "scene_source.h"
+#include "synthetic_triangles.h"
+#include "parallel.h"
+
+// --synthetic: a generated model, to run and benchmark the exporter where
+// the SketchUp SDK is not available. The same options give the same scene,
+// whatever the thread count.
+//
+// Each definition is a closed shell: a cube whose sides are cut into g x g
+// quads (two triangles each, g^2 * 6 about `faces`), pushed out onto an
+// ellipsoid of its own size. Like SketchUp faces, the quads own their
+// vertices, so the shell is closed once the corners are welded by position.
+// The instances are spread evenly over the leaf groups of a tree of nested
+// groups, `depth` - 1 levels deep (depth 1: under the model directly), each
+// placed on a grid and turned about z. Some definitions leave their faces
+// without a material, which the instance then gives; the instances are on
+// Layer0 or one of the `layers`.
+
+struct SyntheticOptions {
+    size_t definitions;
+    size_t instances; // in the output: instances are not nested in one another
+    size_t depth;     // levels of nesting of an instance, itself included
+    size_t faces;     // per definition
+    size_t branching; // subgroups per group
+    size_t materials;
+    size_t layers;    // besides Layer0
+    uint64_t seed;
+    unsigned threads; // definitions are generated in parallel
+
+    SyntheticOptions()
+        : definitions(100), instances(1000), depth(2), faces(600), branching(8), materials(8), layers(4), seed(1),
+          threads(0) {}
+
+    // Sides of the quads of each side of a definition's cube.
+    size_t grid() const { return std::max<size_t>(1, (size_t)(std::sqrt(faces / 6.0) + 0.5)); }
+
+    uint64_t triangle_count() const { return instances * 12 * grid() * grid(); }
+};
+
+// Reads "definitions=100,instances=1000,depth=2,faces=600": any of the
+// fields, in any order, the others keeping their defaults.
+inline bool parse_synthetic_options(const std::string& text, SyntheticOptions& options, std::string* error) {
+    std::istringstream fields(text);
+    std::string field;
+    while (std::getline(fields, field, ',')) {
+        size_t equal = field.find('=');
+        std::string key = field.substr(0, equal);
+        char* stop = 0;
+        const char* value = equal == std::string::npos ? "" : field.c_str() + equal + 1;
+        unsigned long long number = std::strtoull(value, &stop, 10);
+        bool valid = *value != '\0' && *stop == '\0';
+        if (key == "definitions")
+            options.definitions = (size_t)number, valid = valid && number > 0;
+        else if (key == "instances")
+            options.instances = (size_t)number;
+        else if (key == "depth")
+            options.depth = (size_t)number, valid = valid && number > 0;
+        else if (key == "faces")
+            options.faces = (size_t)number;
+        else if (key == "branching")
+            options.branching = (size_t)number, valid = valid && number > 0;
+        else if (key == "materials")
+            options.materials = (size_t)number;
+        else if (key == "layers")
+            options.layers = (size_t)number;
+        else if (key == "seed")
+            options.seed = (uint64_t)number;
+        else
+            valid = false;
+        if (!valid) {
+            if (error)
+                *error = "invalid synthetic scene field '" + field + "'";
+            return false;
+        }
+    }
+    return true;
+}
+
+namespace synthetic_detail {
+
+// A number in [0, 1) from the seed and up to two more values.
+inline double uniform(uint64_t seed, uint64_t a, uint64_t b = 0) {
+    return (double)(mix(mix(mix(seed) ^ a) ^ b) >> 11) / 9007199254740992.0;
+}
+
+// Cube side s (+x, -x, +y, -y, +z, -z): the axis of its outward normal n,
+// then those of u and v with u x v = n.
+const int SIDE_AXES[6][3] = { { 0, 1, 2 }, { 0, 2, 1 }, { 1, 2, 0 }, { 1, 0, 2 }, { 2, 0, 1 }, { 2, 1, 0 } };
+
+inline void shell_point(size_t grid, int side, size_t i, size_t j, const double* radius, SUPoint3D& point) {
+    double cube[3];
+    cube[SIDE_AXES[side][0]] = side % 2 == 0 ? 1.0 : -1.0;
+    cube[SIDE_AXES[side][1]] = -1.0 + 2.0 * (double)i / (double)grid;
+    cube[SIDE_AXES[side][2]] = -1.0 + 2.0 * (double)j / (double)grid;
+    double length = std::sqrt(cube[0] * cube[0] + cube[1] * cube[1] + cube[2] * cube[2]);
+    point.x = radius[0] * cube[0] / length;
+    point.y = radius[1] * cube[1] / length;
+    point.z = radius[2] * cube[2] / length + radius[2];
+}
+
+inline void definition_mesh(const SyntheticOptions& options, const SceneOptions& scene_options, size_t d,
+                            size_t material, SceneMesh& mesh) {
+    size_t grid = options.grid();
+    double radius[3];
+    for (int k = 0; k < 3; ++k)
+        radius[k] = 12.0 + 108.0 * uniform(options.seed, 3 * d + k, 1);
+    std::ostringstream name;
+    name << "Definition " << d;
+    mesh.name = name.str();
+    size_t faces = 6 * grid * grid;
+    mesh.vertices.reserve(4 * faces);
+    mesh.indices.reserve(6 * faces);
+    mesh.faces.reserve(faces);
+    if (scene_options.normals)
+        mesh.normals.reserve(4 * faces);
+    if (scene_options.uvs)
+        mesh.uvs.reserve(4 * faces);
+    for (int side = 0; side < 6; ++side)
+        for (size_t j = 0; j < grid; ++j)
+            for (size_t i = 0; i < grid; ++i) {
+                SceneFace face;
+                face.first_vertex = mesh.vertices.size();
+                face.vertex_count = 4;
+                face.first_triangle = mesh.triangle_count();
+                face.triangle_count = 2;
+                face.material = material;
+                face.layer = NO_LAYER;
+                // Counterclockwise seen from outside.
+                const size_t corners[4][2] = { { i, j }, { i + 1, j }, { i + 1, j + 1 }, { i, j + 1 } };
+                SUPoint3D points[4];
+                for (int c = 0; c < 4; ++c) {
+                    shell_point(grid, side, corners[c][0], corners[c][1], radius, points[c]);
+                    mesh.vertices.push_back(points[c]);
+                }
+                if (scene_options.normals) {
+                    double a[3] = { points[2].x - points[0].x, points[2].y - points[0].y, points[2].z - points[0].z };
+                    double b[3] = { points[3].x - points[1].x, points[3].y - points[1].y, points[3].z - points[1].z };
+                    SUVector3D normal = { a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2],
+                                          a[0] * b[1] - a[1] * b[0] };
+                    double length = std::sqrt(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+                    if (length > 0.0)
+                        normal.x /= length, normal.y /= length, normal.z /= length;
+                    for (int c = 0; c < 4; ++c)
+                        mesh.normals.push_back(normal);
+                }
+                if (scene_options.uvs)
+                    for (int c = 0; c < 4; ++c) {
+                        SUPoint2D uv = { (double)corners[c][0] / grid, (double)corners[c][1] / grid };
+                        mesh.uvs.push_back(uv);
+                    }
+                const uint32_t triangles[6] = { 0, 1, 2, 0, 2, 3 };
+                for (int k = 0; k < 6; ++k)
+                    mesh.indices.push_back((uint32_t)face.first_vertex + triangles[k]);
+                mesh.faces.push_back(face);
+            }
+}
+
+// Item n is on Layer0 or on one of the layers, in turn.
+inline size_t layer_of(size_t n, size_t layers) {
+    return layers > 0 && n % (layers + 1) > 0 ? n % (layers + 1) - 1 : NO_LAYER;
+}
+
+inline SUTransformation placement(double x, double y, double angle) {
+    SUTransformation transform = identity_transform();
+    transform.values[0] = std::cos(angle);
+    transform.values[1] = std::sin(angle);
+    transform.values[4] = -std::sin(angle);
+    transform.values[5] = std::cos(angle);
+    transform.values[12] = x;
+    transform.values[13] = y;
+    return transform;
+}
+
+} // namespace synthetic_detail
+
+// Replaces the content of `scene` with the generated model.
+inline void build_synthetic_scene(const SyntheticOptions& options, const SceneOptions& scene_options,
+                                  Scene& scene) {
+    using namespace synthetic_detail;
+    scene = Scene();
+    for (size_t m = 0; m < options.materials; ++m) {
+        SceneMaterial material;
+        std::ostringstream name;
+        name << "Material " << m;
+        material.name = name.str();
+        SUColor color = { (SUByte)(64 + 191 * uniform(options.seed, m, 2)),
+                          (SUByte)(64 + 191 * uniform(options.seed, m, 3)),
+                          (SUByte)(64 + 191 * uniform(options.seed, m, 4)), 255 };
+        material.color = color;
+        material.opacity = 1.0;
+        material.use_opacity = false;
+        material.s_scale = material.t_scale = 1.0;
+        scene.materials.push_back(material);
+    }
+    for (size_t l = 0; l < options.layers; ++l) {
+        std::ostringstream name;
+        name << "Layer " << l + 1;
+        scene.layers.push_back(name.str());
+    }
+
+    // The model's own faces: none. Then the definitions, one in four
+    // leaving the material to its instances.
+    scene.meshes.resize(1 + options.definitions);
+    std::vector<size_t> definition_material(options.definitions, NO_MATERIAL);
+    for (size_t d = 0; d < options.definitions; ++d)
+        if (options.materials > 0 && d % 4 != 3)
+            definition_material[d] = (size_t)(mix(options.seed ^ mix(d)) % options.materials);
+    parallel_for(options.definitions, options.threads, [&](size_t d, unsigned) {
+        TRACE_SCOPE(TRACE_DEFINITION, 1 + d, 6 * options.grid() * options.grid());
+        definition_mesh(options, scene_options, d, definition_material[d], scene.meshes[1 + d]);
+    });
+
+    SceneNode root;
+    root.kind = SceneNode::ROOT;
+    root.entity_id = 0;
+    root.mesh = 0;
+    root.material = NO_MATERIAL;
+    root.layer = NO_LAYER;
+    root.transform = identity_transform();
+    scene.nodes.push_back(root);
+
+    // The groups, level by level: no more leaves than instances.
+    int32_t entity_id = 0;
+    std::vector<size_t> level(1, 0);
+    for (size_t depth = 1; depth < options.depth && level.size() * options.branching <= options.instances; ++depth) {
+        std::vector<size_t> next;
+        for (size_t p = 0; p < level.size(); ++p)
+            for (size_t b = 0; b < options.branching; ++b) {
+                SceneNode group = root;
+                group.kind = SceneNode::GROUP;
+                std::ostringstream name;
+                name << "Group " << next.size() + 1;
+                group.name = name.str();
+                group.entity_id = ++entity_id;
+                group.mesh = scene.meshes.size();
+                scene.meshes.push_back(SceneMesh());
+                scene.meshes.back().name = group.name;
+                group.layer = layer_of(next.size(), options.layers);
+                scene.nodes[level[p]].children.push_back(scene.nodes.size());
+                next.push_back(scene.nodes.size());
+                scene.nodes.push_back(group);
+            }
+        level.swap(next);
+    }
+
+    // The instances on a grid, 20 feet apart, in order of their leaf group.
+    size_t side = std::max<size_t>(1, (size_t)std::ceil(std::sqrt((double)options.instances)));
+    for (size_t n = 0; n < options.instances; ++n) {
+        size_t leaf = n * level.size() / std::max<size_t>(1, options.instances);
+        size_t d = (size_t)(mix(options.seed + mix(n)) % options.definitions);
+        SceneNode instance;
+        instance.kind = SceneNode::INSTANCE;
+        instance.name = scene.meshes[1 + d].name;
+        instance.entity_id = ++entity_id;
+        instance.mesh = 1 + d;
+        instance.material = options.materials > 0 ? n % options.materials : NO_MATERIAL;
+        instance.layer = layer_of(n, options.layers);
+        instance.transform = placement(240.0 * (n % side), 240.0 * (n / side),
+                                       6.283185307179586 * uniform(options.seed, n, 5));
+        scene.nodes[level[leaf]].children.push_back(scene.nodes.size());
+        scene.nodes.push_back(instance);
+    }
+}
+
+class SyntheticSource : public SceneSource {
+public:
+    explicit SyntheticSource(const SyntheticOptions& options) : options_(options) {}
+
+    bool load(const SceneOptions& options, Scene& scene, std::string*) {
+        PROFILE_SCOPE(STAGE_GENERATE);
+        build_synthetic_scene(options_, options, scene);
+        // What the SketchUp source counts as it reads, counted once built.
+        if (profile_enabled()) {
+            for (size_t m = 0; m < scene.meshes.size(); ++m) {
+                PROFILE_COUNT(COUNT_DEFINITIONS, 1);
+                PROFILE_COUNT(COUNT_FACES, scene.meshes[m].faces.size());
+                PROFILE_COUNT(COUNT_TRIANGLES, scene.meshes[m].triangle_count());
+            }
+            for (size_t n = 1; n < scene.nodes.size(); ++n)
+                PROFILE_COUNT(scene.nodes[n].kind == SceneNode::GROUP ? COUNT_GROUPS : COUNT_INSTANCES, 1);
+            // As SceneBuilder::mesh_for, a hit for each node whose mesh an
+            // earlier node already had.
+            std::vector<bool> built(scene.meshes.size(), false);
+            for (size_t n = 0; n < scene.nodes.size(); ++n) {
+                PROFILE_COUNT(COUNT_MESH_CACHE_HITS, built[scene.nodes[n].mesh]);
+                built[scene.nodes[n].mesh] = true;
+            }
+        }
+        return true;
+    }
+
+    std::string name() const { return "synthetic scene"; }
+
+private:
+    SyntheticOptions options_;
+};
+
+#endif // SKP2TRI_SCENE_SYNTHETIC_H
@@ -0,0 +1,98 @@
+#ifndef SKP2TRI_SCENE_TOPOLOGY_H
+#define SKP2TRI_SCENE_TOPOLOGY_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include "scene.h"
+#include "scene_lod.h"
+#include "tri_halfedge.h"
+#include "mapped_file.h"
+#include "parallel.h"
+
+// --topology and --adjacency: the half-edges of every definition (scene
+// mesh), built once whatever its number of instances, with the vertices
+// welded by position since the faces own theirs. The meshes are spread over
+// the worker threads, biggest first, the biggest getting the threads left
+// over when there are fewer meshes than threads.
+
+// The half-edges of every mesh and one report entry per definition used
+// in the output.
+inline void scene_topology(const Scene& scene, unsigned threads, std::vector<HalfEdges>& meshes,
+                           std::vector<TopologyGroup>& groups) {
+    if (threads == 0)
+        threads = default_thread_count();
+    meshes.assign(scene.meshes.size(), HalfEdges());
+    std::vector<TopologyStats> stats(scene.meshes.size());
+    std::vector<size_t> order(scene.meshes.size());
+    for (size_t m = 0; m < order.size(); ++m)
+        order[m] = m;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return scene.meshes[a].triangle_count() > scene.meshes[b].triangle_count();
+    });
+    unsigned jobs = std::max(1u, std::min(threads, (unsigned)order.size()));
+    parallel_for(order.size(), jobs, [&](size_t i, unsigned) {
+        const SceneMesh& mesh = scene.meshes[order[i]];
+        std::unordered_map<PointKey, uint32_t, PointKeyHash> welded;
+        std::vector<uint32_t> vertex_of(mesh.vertices.size());
+        for (size_t v = 0; v < mesh.vertices.size(); ++v)
+            vertex_of[v] = welded.insert(std::make_pair(point_key(mesh.vertices[v]), (uint32_t)welded.size()))
+                               .first->second;
+        std::vector<uint32_t> indices(mesh.indices.size());
+        for (size_t c = 0; c < indices.size(); ++c)
+            indices[c] = vertex_of[mesh.indices[c]];
+        unsigned mesh_threads = i == 0 ? threads - jobs + 1 : 1;
+        build_half_edges(indices.empty() ? 0 : &indices[0], mesh.triangle_count(), mesh_threads, meshes[order[i]],
+                         stats[order[i]]);
+    });
+
+    std::vector<uint64_t> instances(scene.meshes.size(), 0);
+    for (size_t n = 0; n < scene.nodes.size(); ++n)
+        ++instances[scene.nodes[n].mesh];
+    groups.clear();
+    for (size_t m = 0; m < scene.meshes.size(); ++m) {
+        if (instances[m] == 0 || scene.meshes[m].triangle_count() == 0)
+            continue;
+        TopologyGroup group;
+        group.name = scene.meshes[m].name.empty() ? "model" : scene.meshes[m].name;
+        group.kind = "definition";
+        group.instances = instances[m];
+        group.stats = stats[m];
+        groups.push_back(group);
+    }
+}
+
+// Writes the adjacency buffer of the flattened output: the neighbors of a
+// triangle are in the same group or instance, numbered as in the output.
+inline bool write_scene_adjacency(const Scene& scene, const std::vector<SceneRange>& ranges,
+                                  const std::vector<HalfEdges>& meshes, const std::string& path,
+                                  uint64_t data_size, unsigned threads) {
+    uint64_t triangle_count = ranges_triangle_count(ranges);
+    TriAdjacencyHeader header = make_tri_adjacency_header(triangle_count, data_size);
+    MappedFile file;
+    if (!file.create(path, tri_adjacency_file_size(header)))
+        return false;
+    std::memcpy(file.data(), &header, sizeof(header));
+
+    // A node's faces are written back to back: local triangle t of the
+    // node's mesh is output triangle start + t.
+    std::vector<uint64_t> starts(scene.nodes.size(), 0);
+    for (size_t r = ranges.size(); r-- > 0;)
+        starts[ranges[r].node] = ranges[r].output_triangle - ranges[r].first_triangle;
+    parallel_for(ranges.size(), threads, [&](size_t r, unsigned) {
+        const SceneRange& range = ranges[r];
+        const HalfEdges& mesh = meshes[scene.nodes[range.node].mesh];
+        uint64_t start = starts[range.node];
+        uint32_t* out = (uint32_t*)(file.data() + TRI_ADJACENCY_HEADER_SIZE) + 3 * range.output_triangle;
+        for (size_t t = range.first_triangle; t < range.first_triangle + range.triangle_count; ++t) {
+            for (int k = 0; k < 3; ++k) {
+                uint32_t neighbor = mesh.neighbor(t, k);
+                *out++ = neighbor >= TRI_ADJACENCY_NON_MANIFOLD ? neighbor : (uint32_t)(start + neighbor);
+            }
+        }
+    });
+    return file.close();
+}
+
+#endif // SKP2TRI_SCENE_TOPOLOGY_H
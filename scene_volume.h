@@ -0,0 +1,458 @@
+#ifndef SKP2TRI_SCENE_VOLUME_H
+#define SKP2TRI_SCENE_VOLUME_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <ostream>
+#include <stdint.h>
+#include "scene.h"
+#include "json.h"
+#include "parallel.h"
+#include "tri_clean.h"
+
+// --volumes: surface area and enclosed volume of every group and instance,
+// in model coordinates (square and cubic inches), summed by definition name,
+// material and layer. The volume is the divergence theorem's sum over the
+// triangles of p0 . (p1 x p2) / 6, exact for closed, consistently oriented
+// shells (--topology tells which are) and signed: holes and inward facing
+// shells count negative.
+//
+// Each definition (scene mesh) goes through its triangles once, whatever its
+// number of instances, in batches of the vector lanes of tri_clean.h, and
+// keeps per material and layer the sums of the local volume and of the
+// doubled triangle normals n = (p1 - p0) x (p2 - p0). Under an instance's
+// affine transform p -> A p + t, n becomes cof(A) n, so the world volume is
+// det(A) V + t' . cof(A) sum(n) / 6 without touching the triangles again.
+// The area is |cof(A) n| / 2 per triangle: a rotation and a uniform scale s
+// only scale it by s^2, any other transform gets a vectorized pass over
+// the definition's normals.
+
+struct VolumeTotals {
+    uint64_t triangles;
+    double area;
+    double volume;
+
+    VolumeTotals() : triangles(0), area(0.0), volume(0.0) {}
+
+    void add(const VolumeTotals& other) {
+        triangles += other.triangles;
+        area += other.area;
+        volume += other.volume;
+    }
+};
+
+// A line of the report. `count` is 1 for a group or instance, the number
+// of instances for a definition and the number of faces in the output for
+// a material or layer.
+struct VolumeEntry {
+    std::string kind; // "model", "group", "instance", "definition", "material" or "layer"
+    std::string name;
+    std::string definition; // groups and instances
+    std::string layer;      // groups and instances
+    int32_t entity_id;
+    uint64_t count;
+    VolumeTotals totals;    // groups and instances: with everything nested in them
+
+    VolumeEntry() : entity_id(0), count(0) {}
+};
+
+struct VolumeReport {
+    VolumeEntry model;
+    std::vector<VolumeEntry> nodes;       // in scene order, parents before their children
+    std::vector<VolumeEntry> definitions; // in order of first instance
+    std::vector<VolumeEntry> materials;
+    std::vector<VolumeEntry> layers;
+};
+
+namespace volume_detail {
+
+const size_t BATCH = 1 << 16;
+
+// The triangles of the faces of one mesh with the same material and layer,
+// [begin, end) in the mesh's sorted normals.
+struct FaceGroup {
+    size_t material; // as in SceneFace, resolved against the node
+    size_t layer;
+    size_t begin;
+    size_t end;
+    uint64_t faces;
+    double volume;    // sum of (p0 - center) . n / 6
+    double normal[3]; // sum of n
+    double area;      // sum of |n| / 2
+
+    FaceGroup() : material(NO_MATERIAL), layer(NO_LAYER), begin(0), end(0), faces(0), volume(0.0), area(0.0) {
+        normal[0] = normal[1] = normal[2] = 0.0;
+    }
+};
+
+struct MeshSums {
+    double center[3]; // of the bounds: the volumes are taken about it, for precision
+    std::vector<FaceGroup> groups;
+    std::vector<double> nx, ny, nz;
+};
+
+typedef CleanLanes<double>::Vector Vector;
+const size_t WIDTH = CleanLanes<double>::WIDTH;
+
+// Normals, volumes and areas of the sorted triangles [begin, end).
+inline void triangle_batch(const SceneMesh& mesh, const std::vector<uint32_t>& order, const double* center,
+                           size_t begin, size_t end, MeshSums& sums, double* volumes, double* areas) {
+    size_t i = begin;
+    for (; i < end; i += WIDTH) {
+        size_t lanes = std::min(WIDTH, end - i);
+        Vector c[9];
+        for (size_t l = 0; l < WIDTH; ++l) {
+            // The last batch repeats its last triangle in the missing lanes.
+            const uint32_t* index = &mesh.indices[3 * (size_t)order[i + std::min(l, lanes - 1)]];
+            for (int k = 0; k < 3; ++k) {
+                const SUPoint3D& point = mesh.vertices[index[k]];
+                c[3 * k][l] = point.x - center[0];
+                c[3 * k + 1][l] = point.y - center[1];
+                c[3 * k + 2][l] = point.z - center[2];
+            }
+        }
+        Vector ux = c[3] - c[0], uy = c[4] - c[1], uz = c[5] - c[2];
+        Vector vx = c[6] - c[0], vy = c[7] - c[1], vz = c[8] - c[2];
+        Vector nx = uy * vz - uz * vy, ny = uz * vx - ux * vz, nz = ux * vy - uy * vx;
+        Vector volume = (c[0] * nx + c[1] * ny + c[2] * nz) / 6.0;
+        Vector length2 = nx * nx + ny * ny + nz * nz;
+        for (size_t l = 0; l < lanes; ++l) {
+            sums.nx[i + l] = nx[l];
+            sums.ny[i + l] = ny[l];
+            sums.nz[i + l] = nz[l];
+            volumes[i + l] = volume[l];
+            areas[i + l] = 0.5 * std::sqrt(length2[l]);
+        }
+    }
+}
+
+inline void mesh_sums(const SceneMesh& mesh, unsigned threads, MeshSums& sums) {
+    sums.center[0] = sums.center[1] = sums.center[2] = 0.0;
+    if (!mesh.vertices.empty()) {
+        SUPoint3D low = mesh.vertices[0], high = mesh.vertices[0];
+        for (size_t v = 1; v < mesh.vertices.size(); ++v) {
+            const SUPoint3D& p = mesh.vertices[v];
+            low.x = std::min(low.x, p.x), low.y = std::min(low.y, p.y), low.z = std::min(low.z, p.z);
+            high.x = std::max(high.x, p.x), high.y = std::max(high.y, p.y), high.z = std::max(high.z, p.z);
+        }
+        sums.center[0] = 0.5 * (low.x + high.x);
+        sums.center[1] = 0.5 * (low.y + high.y);
+        sums.center[2] = 0.5 * (low.z + high.z);
+    }
+
+    // The faces' triangles sorted by material and layer, groups in order
+    // of first face.
+    std::map<std::pair<size_t, size_t>, size_t> group_index;
+    std::vector<size_t> group_of(mesh.faces.size());
+    sums.groups.clear();
+    for (size_t f = 0; f < mesh.faces.size(); ++f) {
+        const SceneFace& face = mesh.faces[f];
+        std::pair<std::map<std::pair<size_t, size_t>, size_t>::iterator, bool> inserted =
+            group_index.insert(std::make_pair(std::make_pair(face.material, face.layer), sums.groups.size()));
+        if (inserted.second) {
+            sums.groups.push_back(FaceGroup());
+            sums.groups.back().material = face.material;
+            sums.groups.back().layer = face.layer;
+        }
+        group_of[f] = inserted.first->second;
+        FaceGroup& group = sums.groups[group_of[f]];
+        group.end += face.triangle_count;
+        ++group.faces;
+    }
+    size_t count = 0;
+    for (size_t g = 0; g < sums.groups.size(); ++g) {
+        sums.groups[g].begin = count;
+        count += sums.groups[g].end;
+        sums.groups[g].end = sums.groups[g].begin;
+    }
+    std::vector<uint32_t> order(count);
+    for (size_t f = 0; f < mesh.faces.size(); ++f) {
+        const SceneFace& face = mesh.faces[f];
+        FaceGroup& group = sums.groups[group_of[f]];
+        for (size_t t = face.first_triangle; t < face.first_triangle + face.triangle_count; ++t)
+            order[group.end++] = (uint32_t)t;
+    }
+
+    sums.nx.resize(count);
+    sums.ny.resize(count);
+    sums.nz.resize(count);
+    std::vector<double> volumes(count), areas(count);
+    parallel_for((count + BATCH - 1) / BATCH, threads, [&](size_t batch, unsigned) {
+        triangle_batch(mesh, order, sums.center, batch * BATCH, std::min(count, (batch + 1) * BATCH), sums,
+                       volumes.empty() ? 0 : &volumes[0], areas.empty() ? 0 : &areas[0]);
+    });
+    for (size_t g = 0; g < sums.groups.size(); ++g) {
+        FaceGroup& group = sums.groups[g];
+        for (size_t i = group.begin; i < group.end; ++i) {
+            group.volume += volumes[i];
+            group.area += areas[i];
+            group.normal[0] += sums.nx[i];
+            group.normal[1] += sums.ny[i];
+            group.normal[2] += sums.nz[i];
+        }
+    }
+}
+
+// Sum of |cof n| / 2 over the group's triangles, cof column-major.
+inline double transformed_area(const MeshSums& sums, const FaceGroup& group, const double* cof) {
+    Vector lanes[9];
+    for (int k = 0; k < 9; ++k)
+        for (size_t l = 0; l < WIDTH; ++l)
+            lanes[k][l] = cof[k];
+    double area = 0.0;
+    size_t i = group.begin;
+    for (; i + WIDTH <= group.end; i += WIDTH) {
+        Vector nx, ny, nz;
+        std::memcpy(&nx, &sums.nx[i], sizeof(Vector));
+        std::memcpy(&ny, &sums.ny[i], sizeof(Vector));
+        std::memcpy(&nz, &sums.nz[i], sizeof(Vector));
+        Vector x = lanes[0] * nx + lanes[3] * ny + lanes[6] * nz;
+        Vector y = lanes[1] * nx + lanes[4] * ny + lanes[7] * nz;
+        Vector z = lanes[2] * nx + lanes[5] * ny + lanes[8] * nz;
+        Vector length2 = x * x + y * y + z * z;
+        for (size_t l = 0; l < WIDTH; ++l)
+            area += std::sqrt(length2[l]);
+    }
+    for (; i < group.end; ++i) {
+        double x = cof[0] * sums.nx[i] + cof[3] * sums.ny[i] + cof[6] * sums.nz[i];
+        double y = cof[1] * sums.nx[i] + cof[4] * sums.ny[i] + cof[7] * sums.nz[i];
+        double z = cof[2] * sums.nx[i] + cof[5] * sums.ny[i] + cof[8] * sums.nz[i];
+        area += std::sqrt(x * x + y * y + z * z);
+    }
+    return 0.5 * area;
+}
+
+// `world` composed with `local`, both column-major and affine once divided
+// by their w (SUTransformation keeps 1 / scale there).
+inline void compose(const double* world, const SUTransformation& local, double* result) {
+    double w = local.values[15] != 0.0 ? local.values[15] : 1.0;
+    for (int c = 0; c < 4; ++c)
+        for (int r = 0; r < 4; ++r) {
+            double value = 0.0;
+            for (int k = 0; k < 4; ++k)
+                value += world[4 * k + r] * local.values[4 * c + k] / w;
+            result[4 * c + r] = value;
+        }
+}
+
+inline void cross(const double* a, const double* b, double* result) {
+    result[0] = a[1] * b[2] - a[2] * b[1];
+    result[1] = a[2] * b[0] - a[0] * b[2];
+    result[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+inline double dot(const double* a, const double* b) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; }
+
+// The totals of one node's own faces, per face group of its mesh.
+inline void node_totals(const MeshSums& sums, const double* world, std::vector<VolumeTotals>& totals) {
+    // cof(A) has columns a1 x a2, a2 x a0 and a0 x a1 for the columns a of A.
+    const double* a[3] = { world, world + 4, world + 8 };
+    double cof[9];
+    cross(a[1], a[2], cof);
+    cross(a[2], a[0], cof + 3);
+    cross(a[0], a[1], cof + 6);
+    double det = dot(a[0], cof);
+    // A mirroring instance reverses the winding, not the sides of the
+    // faces: its volume keeps the sign of the definition's.
+    double sign = det < 0.0 ? -1.0 : 1.0;
+    double origin[3];
+    for (int r = 0; r < 3; ++r)
+        origin[r] = world[r] * sums.center[0] + world[4 + r] * sums.center[1] + world[8 + r] * sums.center[2]
+            + world[12 + r];
+
+    double scale2 = dot(a[0], a[0]);
+    double tolerance = 1e-9 * scale2;
+    bool similar = std::fabs(dot(a[1], a[1]) - scale2) <= tolerance && std::fabs(dot(a[2], a[2]) - scale2) <= tolerance
+        && std::fabs(dot(a[0], a[1])) <= tolerance && std::fabs(dot(a[1], a[2])) <= tolerance
+        && std::fabs(dot(a[2], a[0])) <= tolerance;
+
+    totals.assign(sums.groups.size(), VolumeTotals());
+    for (size_t g = 0; g < sums.groups.size(); ++g) {
+        const FaceGroup& group = sums.groups[g];
+        double normal[3];
+        for (int r = 0; r < 3; ++r)
+            normal[r] = cof[r] * group.normal[0] + cof[3 + r] * group.normal[1] + cof[6 + r] * group.normal[2];
+        totals[g].triangles = group.end - group.begin;
+        totals[g].volume = sign * (det * group.volume + dot(origin, normal) / 6.0);
+        totals[g].area = similar ? scale2 * group.area : transformed_area(sums, group, cof);
+    }
+}
+
+inline size_t entry_for(std::map<std::string, size_t>& index, std::vector<VolumeEntry>& entries,
+                        const std::string& kind, const std::string& name) {
+    std::pair<std::map<std::string, size_t>::iterator, bool> inserted =
+        index.insert(std::make_pair(name, entries.size()));
+    if (inserted.second) {
+        entries.push_back(VolumeEntry());
+        entries.back().kind = kind;
+        entries.back().name = name;
+    }
+    return inserted.first->second;
+}
+
+} // namespace volume_detail
+
+inline std::string volume_material_name(const Scene& scene, size_t material) {
+    return material == NO_MATERIAL ? "Default" : scene.materials[material].name;
+}
+
+inline std::string volume_layer_name(const Scene& scene, size_t layer) {
+    return layer == NO_LAYER ? "Layer0" : scene.layers[layer];
+}
+
+// Fills the report for the whole scene. The meshes are spread over the
+// worker threads, biggest first, the biggest getting the threads left over
+// when there are fewer meshes than threads; then the nodes are.
+inline void scene_volumes(const Scene& scene, unsigned threads, VolumeReport& report) {
+    using namespace volume_detail;
+    if (threads == 0)
+        threads = default_thread_count();
+    std::vector<MeshSums> meshes(scene.meshes.size());
+    std::vector<size_t> order(scene.meshes.size());
+    for (size_t m = 0; m < order.size(); ++m)
+        order[m] = m;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return scene.meshes[a].triangle_count() > scene.meshes[b].triangle_count();
+    });
+    unsigned jobs = std::max(1u, std::min(threads, (unsigned)order.size()));
+    parallel_for(order.size(), jobs, [&](size_t i, unsigned) {
+        mesh_sums(scene.meshes[order[i]], i == 0 ? threads - jobs + 1 : 1, meshes[order[i]]);
+    });
+
+    // World transforms, parents first (a node's children come after it).
+    size_t node_count = scene.nodes.size();
+    std::vector<double> worlds(16 * node_count);
+    std::vector<size_t> parents(node_count, (size_t)-1);
+    for (size_t n = 0; n < node_count; ++n) {
+        static const double identity[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+        const double* parent = parents[n] == (size_t)-1 ? identity : &worlds[16 * parents[n]];
+        compose(parent, scene.nodes[n].transform, &worlds[16 * n]);
+        for (size_t c = 0; c < scene.nodes[n].children.size(); ++c)
+            parents[scene.nodes[n].children[c]] = n;
+    }
+    std::vector<std::vector<VolumeTotals> > own(node_count);
+    parallel_for(node_count, threads, [&](size_t n, unsigned) {
+        node_totals(meshes[scene.nodes[n].mesh], &worlds[16 * n], own[n]);
+    });
+
+    // The nodes with what is nested in them, then the sums.
+    std::vector<VolumeTotals> subtree(node_count);
+    std::map<std::string, size_t> materials, layers, definitions;
+    report = VolumeReport();
+    for (size_t n = 0; n < node_count; ++n) {
+        const SceneNode& node = scene.nodes[n];
+        const MeshSums& sums = meshes[node.mesh];
+        for (size_t g = 0; g < sums.groups.size(); ++g) {
+            const FaceGroup& group = sums.groups[g];
+            subtree[n].add(own[n][g]);
+            size_t material = group.material == NO_MATERIAL ? node.material : group.material;
+            size_t layer = group.layer == NO_LAYER ? node.layer : group.layer;
+            VolumeEntry& by_material = report.materials[entry_for(materials, report.materials, "material",
+                                                                  volume_material_name(scene, material))];
+            by_material.count += group.faces;
+            by_material.totals.add(own[n][g]);
+            VolumeEntry& by_layer = report.layers[entry_for(layers, report.layers, "layer",
+                                                            volume_layer_name(scene, layer))];
+            by_layer.count += group.faces;
+            by_layer.totals.add(own[n][g]);
+        }
+    }
+    for (size_t n = node_count; n-- > 1;)
+        if (parents[n] != (size_t)-1)
+            subtree[parents[n]].add(subtree[n]);
+
+    report.model.kind = "model";
+    report.model.count = 1;
+    if (node_count > 0)
+        report.model.totals = subtree[0];
+    for (size_t n = 1; n < node_count; ++n) {
+        const SceneNode& node = scene.nodes[n];
+        VolumeEntry entry;
+        entry.kind = node.kind == SceneNode::GROUP ? "group" : "instance";
+        entry.name = node.name;
+        entry.definition = scene.meshes[node.mesh].name;
+        entry.layer = volume_layer_name(scene, node.layer);
+        entry.entity_id = node.entity_id;
+        entry.count = 1;
+        entry.totals = subtree[n];
+        report.nodes.push_back(entry);
+        VolumeEntry& definition = report.definitions[entry_for(definitions, report.definitions, "definition",
+                                                               entry.definition)];
+        ++definition.count;
+        definition.totals.add(subtree[n]);
+    }
+}
+
+inline void write_volume_totals_json(std::ostream& out, const VolumeTotals& totals) {
+    out << "\"triangles\": " << totals.triangles << ", \"area\": " << json_number(totals.area, 17)
+        << ", \"volume\": " << json_number(totals.volume, 17);
+}
+
+inline void write_volume_entries_json(std::ostream& out, const char* name, const std::vector<VolumeEntry>& entries,
+                                      bool nodes) {
+    out << ",\n  \"" << name << "\": [";
+    for (size_t e = 0; e < entries.size(); ++e) {
+        const VolumeEntry& entry = entries[e];
+        out << (e > 0 ? "," : "") << "\n    {";
+        if (nodes)
+            out << "\"kind\": " << json_string(entry.kind) << ", ";
+        out << "\"name\": " << json_string(entry.name) << ", ";
+        if (nodes)
+            out << "\"definition\": " << json_string(entry.definition) << ", \"layer\": " << json_string(entry.layer)
+                << ", \"entity_id\": " << entry.entity_id << ", ";
+        out << "\"count\": " << entry.count << ", ";
+        write_volume_totals_json(out, entry.totals);
+        out << "}";
+    }
+    out << "\n  ]";
+}
+
+inline void write_volumes_json(std::ostream& out, const VolumeReport& report) {
+    out << "{\n  \"units\": \"inches\",\n  ";
+    write_volume_totals_json(out, report.model.totals);
+    write_volume_entries_json(out, "nodes", report.nodes, true);
+    write_volume_entries_json(out, "definitions", report.definitions, false);
+    write_volume_entries_json(out, "materials", report.materials, false);
+    write_volume_entries_json(out, "layers", report.layers, false);
+    out << "\n}\n";
+}
+
+// A CSV field, quoted when it has to be.
+inline std::string csv_field(const std::string& value) {
+    if (value.find_first_of(",\"\r\n") == std::string::npos)
+        return value;
+    std::string quoted("\"");
+    for (size_t i = 0; i < value.size(); ++i) {
+        if (value[i] == '"')
+            quoted += '"';
+        quoted += value[i];
+    }
+    return quoted + "\"";
+}
+
+// One table, the `kind` column telling the lines apart: the model first,
+// then the groups and instances, definitions, materials and layers.
+inline void write_volumes_csv(std::ostream& out, const VolumeReport& report) {
+    out << "kind,name,definition,layer,entity_id,count,triangles,area,volume\n";
+    std::vector<const std::vector<VolumeEntry>*> lists;
+    std::vector<VolumeEntry> model(1, report.model);
+    lists.push_back(&model);
+    lists.push_back(&report.nodes);
+    lists.push_back(&report.definitions);
+    lists.push_back(&report.materials);
+    lists.push_back(&report.layers);
+    for (size_t l = 0; l < lists.size(); ++l)
+        for (size_t e = 0; e < lists[l]->size(); ++e) {
+            const VolumeEntry& entry = (*lists[l])[e];
+            out << entry.kind << "," << csv_field(entry.name) << "," << csv_field(entry.definition) << ","
+                << csv_field(entry.layer) << "," << entry.entity_id << "," << entry.count << ","
+                << entry.totals.triangles << "," << json_number(entry.totals.area, 17) << ","
+                << json_number(entry.totals.volume, 17) << "\n";
+        }
+}
+
+#endif // SKP2TRI_SCENE_VOLUME_H
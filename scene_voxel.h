@@ -0,0 +1,42 @@
+#ifndef SKP2TRI_SCENE_VOXEL_H
+#define SKP2TRI_SCENE_VOXEL_H
+
+#include <string>
+#include <vector>
+#include "scene.h"
+#include "tri_reader.h"
+#include "tri_voxel.h"
+#include "parallel.h"
+
+// --voxelize: the triangles of the export, as the writers output them,
+// voxelized straight from the tessellated model (no round trip through a
+// file).
+
+// The triangles of the ranges, in output order.
+inline void scene_triangle_arrays(const Scene& scene, const std::vector<SceneRange>& ranges, unsigned threads,
+                                  TriangleArrays& triangles) {
+    triangles.resize((size_t)ranges_triangle_count(ranges));
+    parallel_for(ranges.size(), threads, [&](size_t r, unsigned) {
+        const SceneRange& range = ranges[r];
+        const SceneMesh& mesh = scene.meshes[scene.nodes[range.node].mesh];
+        const uint32_t* index = range.triangle_count > 0 ? &mesh.indices[3 * range.first_triangle] : 0;
+        for (size_t t = 0; t < range.triangle_count; ++t, index += 3) {
+            float corners[9];
+            for (int c = 0; c < 3; ++c) {
+                const SUPoint3D& point = mesh.vertices[index[c]];
+                corners[3 * c] = (float)point.x;
+                corners[3 * c + 1] = (float)point.y;
+                corners[3 * c + 2] = (float)point.z;
+            }
+            triangles.set((size_t)range.output_triangle + t, corners);
+        }
+    });
+}
+
+inline bool voxelize_scene(const Scene& scene, const VoxelOptions& options, VoxelGrid& grid, std::string* error = 0) {
+    TriangleArrays triangles;
+    scene_triangle_arrays(scene, flatten_scene(scene), options.threads, triangles);
+    return voxelize(triangles, options, grid, error);
+}
+
+#endif // SKP2TRI_SCENE_VOXEL_H
@@ -0,0 +1,318 @@
+#ifndef SKP2TRI_SCENE_WRITERS_H
+#define SKP2TRI_SCENE_WRITERS_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cmath>
+#include <sstream>
+#include <cstdio>
+#include "scene.h"
+#include "parallel.h"
+#include "mapped_file.h"
+#include "buffered_writer.h"
+#include "tri_format.h"
+#include "scene_stats.h"
+#include "profile.h"
+
+struct WriteOptions {
+    unsigned threads; // 0: one per core
+    bool normals;     // per vertex normals (PLY), the scene must have them
+    bool colors;      // per vertex material colors (PLY)
+    bool index;       // write the <output>.idx sidecar (.tri, .trb and .stl)
+    std::vector<uint64_t>* range_offsets; // filled by write_tri with the byte offset of each range
+    SceneStats* stats; // filled by the range writers with the statistics of each range
+    std::string* error; // set by a writer when the scene does not fit its format
+
+    WriteOptions()
+        : threads(0), normals(false), colors(false), index(false), range_offsets(0), stats(0), error(0) {}
+};
+
+// Appends the text .tri lines of `range`, byte for byte what operator<< in
+// skp_parser.h writes: one line per triangle, an empty line for a face
+// without triangles, numbers as printed by a default ostream ("%g"), lines
+// ended as a text mode stream ends them (TRI_LINE_END).
+inline void format_tri_range(const Scene& scene, const SceneRange& range, std::string& out) {
+    const SceneMesh& mesh = scene.meshes[scene.nodes[range.node].mesh];
+    char line[256];
+    for (size_t f = range.first_face; f < range.first_face + range.face_count; ++f) {
+        const SceneFace& face = mesh.faces[f];
+        if (face.triangle_count == 0) {
+            out += TRI_LINE_END;
+            continue;
+        }
+        const uint32_t* index = &mesh.indices[3 * face.first_triangle];
+        for (size_t t = 0; t < face.triangle_count; ++t, index += 3) {
+            const SUPoint3D& a = mesh.vertices[index[0]];
+            const SUPoint3D& b = mesh.vertices[index[1]];
+            const SUPoint3D& c = mesh.vertices[index[2]];
+            int length = std::snprintf(line, sizeof(line), "%g %g %g %g %g %g %g %g %g" TRI_LINE_END,
+                                       a.x, a.y, a.z, b.x, b.y, b.z, c.x, c.y, c.z);
+            out.append(line, length);
+        }
+    }
+}
+
+// Writes the ranges as a text .tri file. Ranges are formatted in parallel a
+// window at a time, then appended in order through the buffered writer,
+// whose byte counter gives the offset of each range for the sidecar index.
+inline bool write_tri(const Scene& scene, const std::vector<SceneRange>& ranges,
+                      const std::string& path, const WriteOptions& options) {
+    BufferedWriter writer;
+    if (!writer.open(path))
+        return false;
+    if (options.range_offsets)
+        options.range_offsets->assign(ranges.size() + 1, 0);
+
+    unsigned threads = options.threads > 0 ? options.threads : default_thread_count();
+    if (options.stats)
+        options.stats->prepare(ranges.size(), threads);
+    const size_t window_triangles = (size_t)threads * 65536;
+    std::vector<std::string> texts;
+    size_t begin = 0;
+    while (begin < ranges.size()) {
+        size_t end = begin, triangles = 0;
+        while (end < ranges.size() && (end == begin || triangles < window_triangles))
+            triangles += ranges[end++].triangle_count;
+        if (texts.size() < end - begin)
+            texts.resize(end - begin);
+        TRACE_SCOPE(TRACE_BATCH, begin, triangles);
+
+        parallel_for(end - begin, threads, [&](size_t i, unsigned worker) {
+            PROFILE_SCOPE(STAGE_FORMAT);
+            texts[i].clear();
+            format_tri_range(scene, ranges[begin + i], texts[i]);
+            if (options.stats)
+                options.stats->add_range(scene, ranges[begin + i], begin + i, worker);
+        });
+        PROFILE_SCOPE(STAGE_DISK);
+        for (size_t i = 0; i < end - begin; ++i) {
+            if (options.range_offsets)
+                (*options.range_offsets)[begin + i] = writer.offset();
+            writer.write(texts[i]);
+        }
+        begin = end;
+    }
+    if (options.range_offsets)
+        options.range_offsets->back() = writer.offset();
+    PROFILE_SCOPE(STAGE_DISK);
+    return writer.close();
+}
+
+// Writes the ranges as a .trb file. The size is known from the range table,
+// so the file is mapped once and each range is converted straight into its
+// own slot by whichever worker picks it up.
+inline bool write_trb(const Scene& scene, const std::vector<SceneRange>& ranges,
+                      const std::string& path, const WriteOptions& options) {
+    uint64_t triangle_count = ranges_triangle_count(ranges);
+    MappedFile file;
+    if (!file.create(path, TRB_HEADER_SIZE + triangle_count * TRB_TRIANGLE_SIZE))
+        return false;
+
+    TrbHeader header = make_trb_header(triangle_count);
+    std::memcpy(file.data(), &header, sizeof(header));
+
+    if (options.stats)
+        options.stats->prepare(ranges.size(), options.threads);
+    parallel_for(ranges.size(), options.threads, [&](size_t r, unsigned worker) {
+        const SceneRange& range = ranges[r];
+        TRACE_SCOPE(TRACE_BATCH, r, range.triangle_count);
+        if (options.stats)
+            options.stats->add_range(scene, range, r, worker);
+        if (range.triangle_count == 0)
+            return;
+        const SceneMesh& mesh = scene.meshes[scene.nodes[range.node].mesh];
+        uint64_t offset = TRB_HEADER_SIZE + range.output_triangle * TRB_TRIANGLE_SIZE;
+        float* out = (float*)(file.data() + offset);
+        const uint32_t* index = &mesh.indices[3 * range.first_triangle];
+        for (size_t i = 0; i < 3 * range.triangle_count; ++i) {
+            const SUPoint3D& point = mesh.vertices[index[i]];
+            *out++ = (float)point.x;
+            *out++ = (float)point.y;
+            *out++ = (float)point.z;
+        }
+        {
+            PROFILE_SCOPE(STAGE_DISK);
+            file.flush_range(offset, range.triangle_count * TRB_TRIANGLE_SIZE);
+        }
+    });
+    PROFILE_SCOPE(STAGE_DISK);
+    return file.close();
+}
+
+const uint64_t STL_HEADER_SIZE = 84;
+const uint64_t STL_TRIANGLE_SIZE = 50;
+
+// Writes the ranges as a binary STL file: an 80 byte header, the triangle
+// count and a 50 byte record per triangle with its facet normal.
+inline bool write_stl(const Scene& scene, const std::vector<SceneRange>& ranges,
+                      const std::string& path, const WriteOptions& options) {
+    uint64_t triangle_count = ranges_triangle_count(ranges);
+    // The header count is 32 bits.
+    if (triangle_count > 0xffffffffull) {
+        if (options.error)
+            *options.error = "too many triangles for binary STL";
+        return false;
+    }
+    MappedFile file;
+    if (!file.create(path, STL_HEADER_SIZE + triangle_count * STL_TRIANGLE_SIZE))
+        return false;
+
+    std::memset(file.data(), 0, STL_HEADER_SIZE);
+    std::strncpy(file.data(), "binary STL written by skp2tri", 80);
+    uint32_t count = (uint32_t)triangle_count;
+    std::memcpy(file.data() + 80, &count, 4);
+
+    if (options.stats)
+        options.stats->prepare(ranges.size(), options.threads);
+    parallel_for(ranges.size(), options.threads, [&](size_t r, unsigned worker) {
+        const SceneRange& range = ranges[r];
+        TRACE_SCOPE(TRACE_BATCH, r, range.triangle_count);
+        if (options.stats)
+            options.stats->add_range(scene, range, r, worker);
+        if (range.triangle_count == 0)
+            return;
+        const SceneMesh& mesh = scene.meshes[scene.nodes[range.node].mesh];
+        uint64_t offset = STL_HEADER_SIZE + range.output_triangle * STL_TRIANGLE_SIZE;
+        char* out = file.data() + offset;
+        const uint32_t* index = &mesh.indices[3 * range.first_triangle];
+        for (size_t t = 0; t < range.triangle_count; ++t, index += 3) {
+            const SUPoint3D& a = mesh.vertices[index[0]];
+            const SUPoint3D& b = mesh.vertices[index[1]];
+            const SUPoint3D& c = mesh.vertices[index[2]];
+            double ux = b.x - a.x, uy = b.y - a.y, uz = b.z - a.z;
+            double vx = c.x - a.x, vy = c.y - a.y, vz = c.z - a.z;
+            double nx = uy * vz - uz * vy, ny = uz * vx - ux * vz, nz = ux * vy - uy * vx;
+            double length = std::sqrt(nx * nx + ny * ny + nz * nz);
+            if (length > 0.0) {
+                nx /= length;
+                ny /= length;
+                nz /= length;
+            }
+            // Records are 50 bytes long, so nothing past the header is
+            // float aligned: assemble each one and copy it in.
+            float record[12] = { (float)nx, (float)ny, (float)nz,
+                                 (float)a.x, (float)a.y, (float)a.z,
+                                 (float)b.x, (float)b.y, (float)b.z,
+                                 (float)c.x, (float)c.y, (float)c.z };
+            std::memcpy(out, record, sizeof(record));
+            out[48] = out[49] = 0;
+            out += STL_TRIANGLE_SIZE;
+        }
+        {
+            PROFILE_SCOPE(STAGE_DISK);
+            file.flush_range(offset, range.triangle_count * STL_TRIANGLE_SIZE);
+        }
+    });
+    PROFILE_SCOPE(STAGE_DISK);
+    return file.close();
+}
+
+// Writes the ranges as an indexed binary little endian PLY file. Each range
+// keeps the vertices of its faces (SUMeshHelper does not share vertices
+// between faces), so a per-vertex color is exactly the face color.
+inline bool write_ply(const Scene& scene, const std::vector<SceneRange>& ranges,
+                      const std::string& path, const WriteOptions& options) {
+    // Vertex blocks are only known per range: place them with a prefix sum.
+    std::vector<uint64_t> first_vertex(ranges.size() + 1, 0);
+    for (size_t r = 0; r < ranges.size(); ++r) {
+        const SceneRange& range = ranges[r];
+        const SceneMesh& mesh = scene.meshes[scene.nodes[range.node].mesh];
+        const SceneFace& first = mesh.faces[range.first_face];
+        const SceneFace& last = mesh.faces[range.first_face + range.face_count - 1];
+        first_vertex[r + 1] = first_vertex[r] + (last.first_vertex + last.vertex_count - first.first_vertex);
+    }
+    uint64_t vertex_count = first_vertex.back();
+    uint64_t triangle_count = ranges_triangle_count(ranges);
+    // The vertex indices are 32 bits.
+    if (vertex_count > 0x100000000ull) {
+        if (options.error)
+            *options.error = "too many vertices for PLY uint32 indices";
+        return false;
+    }
+    bool normals = options.normals;
+    for (size_t m = 0; m < scene.meshes.size() && normals; ++m)
+        if (scene.meshes[m].normals.size() != scene.meshes[m].vertices.size())
+            normals = false;
+
+    std::ostringstream header;
+    header << "ply\n"
+           << "format binary_little_endian 1.0\n"
+           << "comment written by skp2tri\n"
+           << "element vertex " << vertex_count << "\n"
+           << "property float x\nproperty float y\nproperty float z\n";
+    if (normals)
+        header << "property float nx\nproperty float ny\nproperty float nz\n";
+    if (options.colors)
+        header << "property uchar red\nproperty uchar green\nproperty uchar blue\nproperty uchar alpha\n";
+    header << "element face " << triangle_count << "\n"
+           << "property list uchar uint vertex_indices\n"
+           << "end_header\n";
+    std::string text = header.str();
+
+    const uint64_t vertex_size = 12 + (normals ? 12 : 0) + (options.colors ? 4 : 0);
+    const uint64_t face_size = 13;
+    const uint64_t faces_offset = text.size() + vertex_count * vertex_size;
+
+    MappedFile file;
+    if (!file.create(path, faces_offset + triangle_count * face_size))
+        return false;
+    std::memcpy(file.data(), text.data(), text.size());
+
+    if (options.stats)
+        options.stats->prepare(ranges.size(), options.threads);
+    parallel_for(ranges.size(), options.threads, [&](size_t r, unsigned worker) {
+        const SceneRange& range = ranges[r];
+        TRACE_SCOPE(TRACE_BATCH, r, range.triangle_count);
+        if (options.stats)
+            options.stats->add_range(scene, range, r, worker);
+        const SceneNode& node = scene.nodes[range.node];
+        const SceneMesh& mesh = scene.meshes[node.mesh];
+        size_t base = mesh.faces[range.first_face].first_vertex;
+
+        char* out = file.data() + text.size() + first_vertex[r] * vertex_size;
+        for (size_t f = range.first_face; f < range.first_face + range.face_count; ++f) {
+            const SceneFace& face = mesh.faces[f];
+            SUByte rgba[4] = { 255, 255, 255, 255 };
+            size_t material = face.material != NO_MATERIAL ? face.material : node.material;
+            if (material != NO_MATERIAL) {
+                const SceneMaterial& scene_material = scene.materials[material];
+                rgba[0] = scene_material.color.red;
+                rgba[1] = scene_material.color.green;
+                rgba[2] = scene_material.color.blue;
+                rgba[3] = scene_material.use_opacity ? (SUByte)(scene_material.opacity * 255.0 + 0.5) : 255;
+            }
+            for (size_t v = face.first_vertex; v < face.first_vertex + face.vertex_count; ++v) {
+                float position[3] = { (float)mesh.vertices[v].x, (float)mesh.vertices[v].y, (float)mesh.vertices[v].z };
+                std::memcpy(out, position, 12);
+                out += 12;
+                if (normals) {
+                    float normal[3] = { (float)mesh.normals[v].x, (float)mesh.normals[v].y, (float)mesh.normals[v].z };
+                    std::memcpy(out, normal, 12);
+                    out += 12;
+                }
+                if (options.colors) {
+                    std::memcpy(out, rgba, 4);
+                    out += 4;
+                }
+            }
+        }
+
+        if (range.triangle_count > 0) {
+            out = file.data() + faces_offset + range.output_triangle * face_size;
+            const uint32_t* index = &mesh.indices[3 * range.first_triangle];
+            for (size_t t = 0; t < range.triangle_count; ++t) {
+                *out++ = 3;
+                for (int k = 0; k < 3; ++k, ++index) {
+                    uint32_t vertex = (uint32_t)(first_vertex[r] + (*index - base));
+                    std::memcpy(out, &vertex, 4);
+                    out += 4;
+                }
+            }
+        }
+    });
+    PROFILE_SCOPE(STAGE_DISK);
+    return file.close();
+}
+
+#endif // SKP2TRI_SCENE_WRITERS_H
@@ -1,50 +1,486 @@
+// Built with SKP2TRI_NO_SLAPI (as on Linux), skp2tri only has the synthetic
+// scenes: the SketchUp SDK is left out altogether.
+#ifndef SKP2TRI_NO_SLAPI
 #include "skp_parser.h"
+#endif
+#include "scene_export.h"
+#include "scene_synthetic.h"
+#include "batch.h"
+#ifndef _WIN32
+#include "daemon.h"
+#endif
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <cstdio>
+#include <csignal>
 
 using namespace std;
 
 void display_usage(int argc, char** argv) {
     cout << "Usage is :" << endl;
-    cout << argv[0] << " <input-skp-file> [<output-tri-file>]" << endl;
+    cout << argv[0] << " [options] <input-skp-file> [<output-file>]" << endl;
+    cout << argv[0] << " [options] --synthetic <fields> <output-file>" << endl;
+    cout << argv[0] << " [options] --batch <list-file> | <input-skp-file>... (--batch with several inputs)" << endl;
+    cout << argv[0] << " [options] --daemon <socket>" << endl;
+    cout << "An <output-file> ending in .skp is taken as a second input, so a batch." << endl;
+    cout << "The output format follows the extension of the output file :" << endl;
+    cout << "  .tri   text, one triangle per line (default)" << endl;
+    cout << "  .trb   binary, float32 triangles (see tri_format.h)" << endl;
+    cout << "  .stl   binary STL with facet normals" << endl;
+    cout << "  .ply   binary indexed PLY" << endl;
+    cout << "  .glb   glTF 2.0 binary, with instancing and materials" << endl;
+    cout << "Options :" << endl;
+    cout << "  -t, --threads <n>   worker threads used by the writers (default: one per core)" << endl;
+    cout << "  --normals           PLY : write vertex normals" << endl;
+    cout << "  --colors            PLY : write vertex colors from the face materials" << endl;
+    cout << "  --index             write the sidecar index <output>.idx (.tri, .trb and .stl)" << endl;
+    cout << "  --clean             drop non finite, zero area and repeated triangles, and report them" << endl;
+    cout << "  --merge-coplanar    join adjacent coplanar triangles of the same material and triangulate them" << endl;
+    cout << "                      again with fewer triangles, and report the reduction" << endl;
+    cout << "  --sdk-merge-coplanar  first merge the coplanar faces of the model with the SketchUp API" << endl;
+    cout << "  --report <file>     write geometry statistics as JSON (- for the standard output)" << endl;
+    cout << "  --topology <file>   write the boundary and non-manifold edges, components and closedness of" << endl;
+    cout << "                      each definition as JSON (- for the standard output)" << endl;
+    cout << "  --volumes <file>    write the area and volume of each group and instance, and their sums by" << endl;
+    cout << "                      definition, material and layer, as CSV (.csv) or JSON (- for the standard" << endl;
+    cout << "                      output)" << endl;
+    cout << "  --adjacency         write the triangle adjacency buffer <output>.adj (.tri, .trb, .stl, .ply)" << endl;
+    cout << "  --lod <r1,r2,...>   also write levels of detail with these ratios of the triangles, in (0, 1)," << endl;
+    cout << "                      as <output-name>_lod<n><extension>" << endl;
+    cout << "  --voxelize <size>   also write the voxels of this edge (model units) the surface crosses," << endl;
+    cout << "                      as <output-name>.vox" << endl;
+    cout << "  --solid             --voxelize : also fill the inside of the closed shells" << endl;
+    cout << "  --synthetic <fields>  convert a generated scene instead of a model, the fields (comma" << endl;
+    cout << "                      separated) among definitions=100, instances=1000, depth=2, faces=600," << endl;
+    cout << "                      branching=8, materials=8, layers=4 and seed=1 (their defaults)" << endl;
+    cout << "  --stats[=json]      print the time of each stage and the counts of faces, triangles, instances," << endl;
+    cout << "                      cache hits and bytes written to the standard error, as text or JSON" << endl;
+    cout << "  --trace <file>      write the timeline of the stages, definitions and output batches of each" << endl;
+    cout << "                      thread in the Chrome trace event format (chrome://tracing, Perfetto)" << endl;
+    cout << "  --split <mode>      one file per part, written in parallel, plus <output-name>.index.json :" << endl;
+    cout << "                        groups       each top-level group / instance (and the loose faces)" << endl;
+    cout << "                        definitions  each component definition, once" << endl;
+    cout << "Batch options (--batch <list-file>, one input or pattern per line, and any inputs given) :" << endl;
+    cout << "  -j, --jobs <n>      worker processes converting the files (default: one per core)" << endl;
+    cout << "  --format <ext>      format of the outputs (default: tri)" << endl;
+    cout << "  --output-dir <dir>  directory of the outputs (default: next to each input)" << endl;
+    cout << "  --batch-results <file>  also write the result of each file as CSV" << endl;
+    cout << "  --timeout <s>       seconds a file may take, its worker then killed (default: 600, 0: no limit)" << endl;
+    cout << "Daemon options (--daemon <socket>, conversions requested with skp2tri_client) :" << endl;
+    cout << "  -j, --jobs <n>      worker processes, kept running (default: one per core)" << endl;
+    cout << "  --queue <n>         conversions waiting for a worker at most, others turned down (default: 64)" << endl;
+    cout << "  --timeout <s>       seconds a conversion may take, its worker then killed (default: 600)" << endl;
+    cout << "  --connections <n>   connections served at once, others turned down (default: 256)" << endl;
 }
 
-int main(int argc, char** argv) {
+// Comma separated ratios, each in (0, 1).
+bool parse_ratios(const string& text, vector<double>& ratios) {
+    size_t begin = 0;
+    while (begin <= text.size()) {
+        size_t end = text.find(',', begin);
+        if (end == string::npos)
+            end = text.size();
+        string field = text.substr(begin, end - begin);
+        char* stop = 0;
+        double ratio = strtod(field.c_str(), &stop);
+        if (field.empty() || *stop != '\0' || !(ratio > 0.0 && ratio < 1.0))
+            return false;
+        ratios.push_back(ratio);
+        begin = end + 1;
+    }
+    return !ratios.empty();
+}
 
-    if(argc < 2 || argc > 3) {
-        display_usage(argc,argv);
+enum OptionRead { OPTION_UNKNOWN, OPTION_READ, OPTION_INVALID };
+
+// The options of the conversion itself, which the requests of --batch and
+// --daemon may carry too : reads args[i], and its value, into `options`.
+OptionRead read_export_option(const vector<string>& args, size_t& i, ExportOptions& options,
+                              bool& sdk_merge_coplanar) {
+    const string& arg = args[i];
+    bool value = i + 1 < args.size();
+    if ((arg == "-t" || arg == "--threads") && value)
+        options.write.threads = (unsigned)atoi(args[++i].c_str());
+    else if (arg == "--normals")
+        options.write.normals = true;
+    else if (arg == "--colors")
+        options.write.colors = true;
+    else if (arg == "--index")
+        options.write.index = true;
+    else if (arg == "--clean")
+        options.clean = true;
+    else if (arg == "--merge-coplanar")
+        options.merge_coplanar = true;
+    else if (arg == "--sdk-merge-coplanar")
+        sdk_merge_coplanar = true;
+    else if (arg == "--report" && value)
+        options.report = args[++i];
+    else if (arg == "--topology" && value)
+        options.topology = args[++i];
+    else if (arg == "--volumes" && value)
+        options.volumes = args[++i];
+    else if (arg == "--adjacency")
+        options.adjacency = true;
+    else if (arg == "--lod" && value) {
+        if (!parse_ratios(args[++i], options.lods))
+            return OPTION_INVALID;
+    }
+    else if (arg == "--voxelize" && value) {
+        options.voxels.size = atof(args[++i].c_str());
+        if (!(options.voxels.size > 0.0))
+            return OPTION_INVALID;
+    }
+    else if (arg == "--solid")
+        options.voxels.solid = true;
+    else if (arg == "--split" && value) {
+        string mode(args[++i]);
+        if (mode == "groups")
+            options.split = SPLIT_GROUPS;
+        else if (mode == "definitions")
+            options.split = SPLIT_DEFINITIONS;
+        else
+            return OPTION_INVALID;
+    }
+    else
+        return OPTION_UNKNOWN;
+    return OPTION_READ;
+}
+
+// --batch-worker : converts the files the batch or the daemon sends, one
+// per line, for as long as its input lasts, the SDK initialized once
+// (batch.h). The options of a request apply on top of the worker's own.
+int run_batch_worker(const ExportOptions& worker_options, bool worker_sdk_merge_coplanar) {
+    // A worker ends when its input does: an interrupt of the whole process
+    // group (Ctrl-C) or a SIGTERM to it is for the batch or the daemon, which
+    // then lets the conversions under way finish.
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTERM, SIG_IGN);
+    FILE* answers = take_standard_output();
+    if (answers == 0) {
+        std::cerr << "Error : standard output impossible to duplicate" << "\n";
         return 1;
     }
+#ifndef SKP2TRI_NO_SLAPI
+    SUInitialize();
+#endif
+    string request;
+    vector<string> fields;
+    while (getline(cin, request)) {
+        if (!request.empty() && request[request.size() - 1] == '\r')
+            request.erase(request.size() - 1);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        ExportOptions options = worker_options;
+        bool sdk_merge_coplanar = worker_sdk_merge_coplanar;
+        bool synthetic = false;
+        SyntheticOptions synthetic_options;
+        string error;
+        if (!parse_batch_request(request, fields))
+            error = "unexpected request : " + request;
+        for (size_t i = 2; i < fields.size() && error.empty(); ++i) {
+            string arg = fields[i];
+            OptionRead read = read_export_option(fields, i, options, sdk_merge_coplanar);
+            if (read == OPTION_UNKNOWN && arg == "--synthetic" && i + 1 < fields.size()) {
+                synthetic = true;
+                parse_synthetic_options(fields[++i], synthetic_options, &error);
+            }
+            else if (read != OPTION_READ)
+                error = "option " + arg + " invalid or not available for a single conversion";
+        }
 
-    if( argv[1] == "-h" || argv[1] == "--help") {
-        display_usage(argc,argv);
+        Scene scene;
+        bool converted = false;
+        if (error.empty()) {
+            synthetic_options.threads = options.write.threads;
+            SyntheticSource synthetic_source(synthetic_options);
+            SceneSource* source = &synthetic_source;
+#ifndef SKP2TRI_NO_SLAPI
+            SkpSource skp_source(fields[0], sdk_merge_coplanar);
+            if (!synthetic)
+                source = &skp_source;
+#else
+            if (!synthetic)
+                error = "this skp2tri is built without the SketchUp SDK, only --synthetic is available";
+#endif
+            // The summaries go to the standard error, as anything else the
+            // conversion writes to the standard output.
+            converted = error.empty() && source->load(export_scene_options(fields[1], options), scene, &error)
+                && export_scene(scene, fields[1], options, std::cerr, &error);
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        uint64_t triangles = converted ? ranges_triangle_count(flatten_scene(scene)) : 0;
+        cout.flush();
+        fflush(stdout);
+        fprintf(answers, "%s\n", batch_reply(converted, seconds, triangles, error).c_str());
+        fflush(answers);
+    }
+    return 0;
+}
+
+// The arguments of the workers : the options forwarded and, unless -t is
+// given, the cores shared between the `processes` workers.
+vector<string> worker_arguments(const vector<string>& forwarded, const ExportOptions& options, unsigned processes) {
+    vector<string> worker_args(1, "--batch-worker");
+    worker_args.insert(worker_args.end(), forwarded.begin(), forwarded.end());
+    if (options.write.threads == 0) {
+        ostringstream threads;
+        threads << max(1u, default_thread_count() / processes);
+        worker_args.push_back("-t");
+        worker_args.push_back(threads.str());
+    }
+    return worker_args;
+}
+
+int main(int argc, char** argv) {
+
+    ExportOptions options;
+    string stats, trace;
+    bool sdk_merge_coplanar = false;
+    bool synthetic = false;
+    SyntheticOptions synthetic_options;
+    vector<string> paths;
+    // Batch and daemon modes, and the conversion options their workers are given.
+    bool batch = false, batch_worker = false;
+    string batch_list, batch_format = ".tri", output_dir, batch_results, daemon_socket;
+    unsigned jobs = 0;
+    size_t queue = 64;
+    double timeout = 600.0;
+    size_t connections = 256;
+    vector<string> forwarded;
+    vector<string> args(argv, argv + argc);
+    for (size_t i = 1; i < args.size(); ++i) {
+        string arg(args[i]);
+        size_t first = i;
+        bool forward = true;
+        OptionRead read = read_export_option(args, i, options, sdk_merge_coplanar);
+        if (read != OPTION_UNKNOWN) {
+            if (read == OPTION_INVALID) {
+                display_usage(argc,argv);
+                return 1;
+            }
+        }
+        else if (arg == "-h" || arg == "--help") {
+            display_usage(argc,argv);
+            return 0;
+        }
+        else if (arg == "--stats" || arg == "--stats=text" || arg == "--stats=json")
+            stats = arg == "--stats=json" ? "json" : "text";
+        else if (arg == "--trace" && i + 1 < args.size())
+            trace = args[++i];
+        else if (arg == "--synthetic" && i + 1 < args.size()) {
+            string error;
+            synthetic = true;
+            if (!parse_synthetic_options(args[++i], synthetic_options, &error)) {
+                std::cerr << "Error : " << error << "\n";
+                return 1;
+            }
+        }
+        else if (arg == "--batch" && i + 1 < args.size())
+            batch_list = args[++i];
+        else if ((arg == "-j" || arg == "--jobs") && i + 1 < args.size())
+            jobs = (unsigned)atoi(args[++i].c_str());
+        else if (arg == "--format" && i + 1 < args.size()) {
+            batch_format = args[++i];
+            if (batch_format.empty() || batch_format[0] != '.')
+                batch_format = "." + batch_format;
+            batch_format = lower_extension(batch_format);
+            if (!is_scene_format(batch_format)) {
+                display_usage(argc,argv);
+                return 1;
+            }
+        }
+        else if (arg == "--output-dir" && i + 1 < args.size())
+            output_dir = args[++i];
+        else if (arg == "--batch-results" && i + 1 < args.size())
+            batch_results = args[++i];
+        else if (arg == "--batch-worker")
+            batch_worker = true;
+        else if (arg == "--daemon" && i + 1 < args.size())
+            daemon_socket = args[++i];
+        else if (arg == "--queue" && i + 1 < args.size())
+            queue = (size_t)atoi(args[++i].c_str());
+        else if (arg == "--timeout" && i + 1 < args.size())
+            timeout = atof(args[++i].c_str());
+        else if (arg == "--connections" && i + 1 < args.size())
+            connections = (size_t)atoi(args[++i].c_str());
+        else if (!arg.empty() && arg[0] == '-') {
+            display_usage(argc,argv);
+            return 1;
+        }
+        else
+            paths.push_back(arg);
+        // The batch and daemon options and the inputs are not the workers'.
+        bool batch_option = arg == "--batch" || arg == "--format" || arg == "--output-dir" || arg == "--batch-results";
+        if (batch_option || arg == "-j" || arg == "--jobs" || arg == "--daemon" || arg == "--queue"
+            || arg == "--timeout" || arg == "--connections")
+            forward = false;
+        batch = batch || batch_option;
+        if (forward && first == i && !arg.empty() && arg[0] != '-')
+            forward = false;
+        if (forward)
+            forwarded.insert(forwarded.end(), args.begin() + first, args.begin() + i + 1);
+    }
+    if (batch_worker)
+        return run_batch_worker(options, sdk_merge_coplanar);
+
+    // Several inputs, or patterns, make a batch too. A second .skp path is
+    // an input as well, never an output to overwrite with triangles.
+    batch = batch || paths.size() > 2;
+    batch = batch || (!synthetic && paths.size() == 2 && lower_extension(paths[1]) == ".skp");
+    for (size_t p = 0; p < paths.size(); ++p)
+        batch = batch || paths[p].find_first_of("*?") != string::npos;
+    bool daemon = !daemon_socket.empty();
+    if (batch || daemon) {
+        string refused = synthetic ? "--synthetic" : !options.report.empty() ? "--report"
+            : !options.topology.empty() ? "--topology" : !options.volumes.empty() ? "--volumes"
+            : !stats.empty() ? "--stats" : !trace.empty() ? "--trace" : "";
+        if (!refused.empty()) {
+            std::cerr << "Error : " << refused << " is not available with a " << (daemon ? "daemon" : "batch") << "\n";
+            return 1;
+        }
+    }
+    if (daemon) {
+#ifdef _WIN32
+        std::cerr << "Error : --daemon is not available on Windows" << "\n";
+        return 1;
+#else
+        if (batch || !paths.empty()) {
+            display_usage(argc,argv);
+            return 1;
+        }
+        // The requests carry their inputs, outputs and options, the workers
+        // are given the ones of the daemon.
+        DaemonOptions daemon_options;
+        daemon_options.socket_path = daemon_socket;
+        daemon_options.workers = jobs > 0 ? jobs : default_thread_count();
+        daemon_options.queue = queue;
+        daemon_options.timeout = timeout;
+        daemon_options.connections = connections;
+        ConversionDaemon conversions(current_program(argv[0]),
+                                     worker_arguments(forwarded, options, daemon_options.workers), daemon_options);
+        string error;
+        if (!conversions.run(cout, &error)) {
+            std::cerr << "Error : " << error << "\n";
+            return 1;
+        }
         return 0;
+#endif
     }
+    if (batch) {
+#ifdef SKP2TRI_NO_SLAPI
+        std::cerr << "Error : this skp2tri is built without the SketchUp SDK, only --synthetic is available" << "\n";
+        return 1;
+#endif
+        vector<string> inputs;
+        string error;
+        if (!batch_list.empty() && !read_batch_list(batch_list, inputs, &error)) {
+            std::cerr << "Error : " << error << "\n";
+            return 1;
+        }
+        for (size_t p = 0; p < paths.size(); ++p)
+            expand_input(paths[p], inputs);
+        if (inputs.empty()) {
+            std::cerr << "Error : no file to convert" << "\n";
+            return 1;
+        }
 
-    string input_path(argv[1]);
-    string output_path;
+        // The cores are shared between the workers.
+        unsigned processes = jobs > 0 ? jobs : default_thread_count();
+        vector<string> worker_args = worker_arguments(forwarded, options, processes);
 
-    if(argc == 3) //output file has been provided
-        output_path = string(argv[2]);
-    else {
-        int lastindex = input_path.find_last_of(".");
-        output_path = input_path.substr(0, lastindex) + ".tri";
+        vector<BatchJob> batch_jobs_list = batch_jobs(inputs, output_dir, batch_format);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        mutex printing;
+        size_t failed = 0;
+        auto print_job = [&](const BatchJob& job) {
+            lock_guard<mutex> lock(printing);
+            char seconds[32];
+            snprintf(seconds, sizeof(seconds), "%9.3f s", job.seconds);
+            if (job.converted)
+                cout << "ok     " << seconds << "  " << job.input << " -> " << job.output << ", " << job.triangles
+                     << " triangles" << endl;
+            else {
+                cout << "failed " << seconds << "  " << job.input << " : " << job.error << endl;
+                ++failed;
+            }
+        };
+        run_batch(current_program(argv[0]), worker_args, batch_jobs_list, processes, timeout, print_job);
+        cout << "batch : " << batch_jobs_list.size() - failed << " of " << batch_jobs_list.size()
+             << " files converted in " << chrono::duration<double>(chrono::steady_clock::now() - start).count()
+             << " s, " << failed << " failed" << endl;
+        if (!batch_results.empty()
+            && !write_report(batch_results, [&](ostream& out) { write_batch_csv(out, batch_jobs_list); })) {
+            std::cerr << "Error : file " << batch_results << " impossible to write" << "\n";
+            return 1;
+        }
+        return failed > 0 ? 1 : 0;
     }
 
-    SUInitialize();
-    SUModelRef model = SU_INVALID;
-    SUResult res = SUModelCreateFromFile(&model, input_path.c_str());
-    // Check file opening
-    if (res != SU_ERROR_NONE) {
-        std::cerr << "Error : file " << input_path << " impossible to open" << "\n";
+    // A model and its output, or only the output of a synthetic scene.
+    size_t inputs = synthetic ? 0 : 1;
+    if(paths.size() < max<size_t>(inputs, 1) || paths.size() > inputs + 1) {
+        display_usage(argc,argv);
         return 1;
     }
 
-    // Get the entity container of the model.
-    SUEntitiesRef entities = SU_INVALID;
-    SUModelGetEntities(model, &entities);
+    string output_path;
+    if(paths.size() == inputs + 1) //output file has been provided
+        output_path = paths[inputs];
+    else {
+        int lastindex = paths[0].find_last_of(".");
+        output_path = paths[0].substr(0, lastindex) + ".tri";
+    }
 
-    std::ofstream myfile(output_path.c_str());
-    myfile << entities;
-    myfile.close();
+#ifdef SKP2TRI_NO_PROFILE
+    if (!stats.empty() || !trace.empty())
+        std::cerr << "Warning : this skp2tri is built without --stats and --trace" << "\n";
+    stats.clear();
+    trace.clear();
+#endif
+    if (!stats.empty() || !trace.empty())
+        profile_enable((stats.empty() ? 0 : PROFILE_STATS) | (trace.empty() ? 0 : PROFILE_TRACE));
+
+    // Tessellate once, then let the workers format and write the output.
+    synthetic_options.threads = options.write.threads;
+    SyntheticSource synthetic_source(synthetic_options);
+    SceneSource* source = &synthetic_source;
+#ifndef SKP2TRI_NO_SLAPI
+    SkpSource skp_source(synthetic ? string() : paths[0], sdk_merge_coplanar);
+    if (!synthetic) {
+        SUInitialize();
+        source = &skp_source;
+    }
+#else
+    if (!synthetic) {
+        std::cerr << "Error : this skp2tri is built without the SketchUp SDK, only --synthetic is available" << "\n";
+        return 1;
+    }
+#endif
+    Scene scene;
+    string error;
+    bool converted = source->load(export_scene_options(output_path, options), scene, &error)
+        && export_scene(scene, output_path, options, std::cout, &error);
+    if (!converted)
+        std::cerr << "Error : " << error << "\n";
+    if (stats == "json")
+        write_profile_json(std::cerr, profile_totals());
+    else if (!stats.empty())
+        write_profile_text(std::cerr, profile_totals());
+    if (!trace.empty()) {
+        vector<string> definitions(scene.meshes.size());
+        for (size_t m = 0; m < scene.meshes.size(); ++m)
+            definitions[m] = scene.meshes[m].name;
+        ProfileTrace events = profile_trace();
+        if (!write_report(trace, [&](ostream& out) { write_trace_json(out, events, definitions); })) {
+            std::cerr << "Error : file " << trace << " impossible to write" << "\n";
+            return 1;
+        }
+    }
+    if (!converted)
+        return 1;
 
     //std::cout << entities << "\n";
     return 0;
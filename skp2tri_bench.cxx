@@ -0,0 +1,312 @@
+#include "scene_export.h"
+#include "scene_synthetic.h"
+#include "tri_weld.h"
+#include "json.h"
+#include "parallel.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+using namespace std;
+
+// The exporter on synthetic scenes (scene_synthetic.h) of several sizes,
+// for 1, 2, 4... threads: the kernels on their own (text formatting in
+// memory, the mapped .trb writer, placing the instances in world
+// coordinates, welding the placed corners), then whole conversions through
+// export_scene, as skp2tri runs them. Each measure keeps the best of its
+// runs. The results can also be written as JSON, to compare releases.
+
+void display_usage(int argc, char** argv) {
+    cout << "Usage is :" << endl;
+    cout << argv[0] << " [options]" << endl;
+    cout << "Options :" << endl;
+    cout << "  --sizes <n1,n2,...>  instances of the synthetic scenes (default: 1000,10000)" << endl;
+    cout << "  --scene <fields>    other fields of the scenes, as skp2tri --synthetic (default: none)" << endl;
+    cout << "  --formats <f1,...>  formats of the whole conversions (default: trb,tri,glb)" << endl;
+    cout << "  -t, --threads <n>   most threads tried (default: one per core)" << endl;
+    cout << "  --repeat <n>        runs of each measure, the best one kept (default: 1)" << endl;
+    cout << "  --file <path>       base name of the files written (default: skp2tri_bench)" << endl;
+    cout << "  --json <file>       also write the results as JSON (- for the standard output)" << endl;
+}
+
+// Triangles placed and welded at most, from the start of the output.
+const size_t WORLD_TRIANGLES = 16 << 20;
+
+struct BenchResult {
+    string name;
+    uint64_t instances;
+    uint64_t triangles;
+    unsigned threads;
+    double seconds;
+    double amount; // in `unit`s times seconds
+    string unit;
+};
+
+double seconds_since(const chrono::steady_clock::time_point& start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Best time of `repeat` runs of fn(), which returns false on failure.
+template <class Fn>
+double best_of(unsigned repeat, Fn fn) {
+    double best = -1.0;
+    for (unsigned r = 0; r < repeat; ++r) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (!fn())
+            return -1.0;
+        double seconds = seconds_since(start);
+        if (best < 0.0 || seconds < best)
+            best = seconds;
+    }
+    return best;
+}
+
+vector<string> split_list(const string& text) {
+    vector<string> items;
+    istringstream fields(text);
+    string item;
+    while (getline(fields, item, ','))
+        if (!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+uint64_t file_size(const string& path) {
+    ifstream probe(path.c_str(), ios::binary | ios::ate);
+    return probe ? (uint64_t)probe.tellg() : 0;
+}
+
+// The world transform of every node, column-major, w divided out.
+void world_transforms(const Scene& scene, vector<double>& worlds) {
+    worlds.assign(16 * scene.nodes.size(), 0.0);
+    vector<size_t> parents(scene.nodes.size(), (size_t)-1);
+    for (size_t n = 0; n < scene.nodes.size(); ++n) {
+        const SUTransformation& local = scene.nodes[n].transform;
+        double w = local.values[15] != 0.0 ? local.values[15] : 1.0;
+        double* world = &worlds[16 * n];
+        for (int c = 0; c < 4; ++c)
+            for (int r = 0; r < 4; ++r) {
+                if (parents[n] == (size_t)-1) {
+                    world[4 * c + r] = local.values[4 * c + r] / w;
+                    continue;
+                }
+                const double* parent = &worlds[16 * parents[n]];
+                for (int k = 0; k < 4; ++k)
+                    world[4 * c + r] += parent[4 * k + r] * local.values[4 * c + k] / w;
+            }
+        for (size_t c = 0; c < scene.nodes[n].children.size(); ++c)
+            parents[scene.nodes[n].children[c]] = n;
+    }
+}
+
+// The transform kernel: the output triangles placed by their node's world
+// transform, as float arrays, which the writers skip by keeping each
+// definition in its own coordinates.
+void place_triangles(const Scene& scene, const vector<SceneRange>& ranges, const vector<double>& worlds,
+                     unsigned threads, TriangleArrays& triangles) {
+    triangles.resize((size_t)ranges_triangle_count(ranges));
+    parallel_for(ranges.size(), threads, [&](size_t r, unsigned) {
+        const SceneRange& range = ranges[r];
+        const SceneMesh& mesh = scene.meshes[scene.nodes[range.node].mesh];
+        const double* m = &worlds[16 * range.node];
+        const uint32_t* index = range.triangle_count > 0 ? &mesh.indices[3 * range.first_triangle] : 0;
+        for (size_t t = 0; t < range.triangle_count; ++t, index += 3) {
+            size_t i = (size_t)range.output_triangle + t;
+            for (int c = 0; c < 3; ++c) {
+                const SUPoint3D& p = mesh.vertices[index[c]];
+                triangles.x[c][i] = (float)(m[0] * p.x + m[4] * p.y + m[8] * p.z + m[12]);
+                triangles.y[c][i] = (float)(m[1] * p.x + m[5] * p.y + m[9] * p.z + m[13]);
+                triangles.z[c][i] = (float)(m[2] * p.x + m[6] * p.y + m[10] * p.z + m[14]);
+            }
+        }
+    });
+}
+
+void write_results_json(ostream& out, unsigned threads, const string& scene_fields,
+                        const vector<BenchResult>& results) {
+    out << "{\n  \"benchmark\": \"skp2tri_bench\",\n  \"threads\": " << threads
+        << ",\n  \"scene\": " << json_string(scene_fields) << ",\n  \"results\": [";
+    for (size_t r = 0; r < results.size(); ++r) {
+        const BenchResult& result = results[r];
+        out << (r > 0 ? "," : "") << "\n    {\"name\": " << json_string(result.name)
+            << ", \"instances\": " << result.instances << ", \"triangles\": " << result.triangles
+            << ", \"threads\": " << result.threads << ", \"seconds\": " << json_number(result.seconds)
+            << ", \"rate\": " << json_number(result.amount / result.seconds) << ", \"unit\": "
+            << json_string(result.unit) << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+int main(int argc, char** argv) {
+
+    vector<uint64_t> sizes;
+    sizes.push_back(1000);
+    sizes.push_back(10000);
+    string scene_fields;
+    vector<string> formats = split_list("trb,tri,glb");
+    unsigned threads = 0, repeat = 1;
+    string base = "skp2tri_bench", json;
+    for (int i = 1; i < argc; ++i) {
+        string arg(argv[i]);
+        if (arg == "-h" || arg == "--help") {
+            display_usage(argc, argv);
+            return 0;
+        }
+        else if (arg == "--sizes" && i + 1 < argc) {
+            vector<string> items = split_list(argv[++i]);
+            sizes.clear();
+            for (size_t s = 0; s < items.size(); ++s)
+                sizes.push_back(strtoull(items[s].c_str(), 0, 10));
+        }
+        else if (arg == "--scene" && i + 1 < argc)
+            scene_fields = argv[++i];
+        else if (arg == "--formats" && i + 1 < argc)
+            formats = split_list(argv[++i]);
+        else if ((arg == "-t" || arg == "--threads") && i + 1 < argc)
+            threads = (unsigned)atoi(argv[++i]);
+        else if (arg == "--repeat" && i + 1 < argc)
+            repeat = max(1, atoi(argv[++i]));
+        else if (arg == "--file" && i + 1 < argc)
+            base = argv[++i];
+        else if (arg == "--json" && i + 1 < argc)
+            json = argv[++i];
+        else {
+            display_usage(argc, argv);
+            return 1;
+        }
+    }
+    if (threads == 0)
+        threads = default_thread_count();
+    SyntheticOptions synthetic;
+    string error;
+    if (!parse_synthetic_options(scene_fields, synthetic, &error)) {
+        cerr << "Error : " << error << endl;
+        return 1;
+    }
+    // The table goes to the standard error when the JSON takes the output.
+    ostream& table = json == "-" ? cerr : cout;
+
+    vector<BenchResult> results;
+    int status = 0;
+    for (size_t s = 0; s < sizes.size(); ++s) {
+        synthetic.instances = sizes[s];
+        synthetic.threads = threads;
+        SceneOptions scene_options;
+        scene_options.normals = scene_options.uvs = true; // for .glb and .ply --normals
+        Scene scene;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        build_synthetic_scene(synthetic, scene_options, scene);
+        vector<SceneRange> ranges = flatten_scene(scene);
+        uint64_t triangles = ranges_triangle_count(ranges);
+        table << synthetic.instances << " instances of " << synthetic.definitions << " definitions, " << triangles
+              << " triangles, generated in " << seconds_since(start) << " s" << endl;
+
+        // The first ranges, for the kernels that hold the triangles in memory.
+        vector<SceneRange> world_ranges;
+        for (size_t r = 0; r < ranges.size() && ranges[r].output_triangle < WORLD_TRIANGLES; ++r)
+            world_ranges.push_back(ranges[r]);
+        uint64_t world_count = ranges_triangle_count(world_ranges);
+        vector<double> worlds;
+        world_transforms(scene, worlds);
+        TriangleArrays placed;
+        place_triangles(scene, world_ranges, worlds, threads, placed);
+
+        vector<string> texts(ranges.size());
+        uint64_t text_bytes = 0;
+        for (unsigned t = 1;; t = min(2 * t, threads)) {
+            vector<BenchResult> runs;
+            BenchResult result;
+            result.instances = synthetic.instances;
+            result.threads = t;
+
+            result.name = "format tri";
+            result.triangles = triangles;
+            result.seconds = best_of(repeat, [&]() {
+                parallel_for(ranges.size(), t, [&](size_t r, unsigned) {
+                    texts[r].clear();
+                    format_tri_range(scene, ranges[r], texts[r]);
+                });
+                return true;
+            });
+            text_bytes = 0;
+            for (size_t r = 0; r < texts.size(); ++r)
+                text_bytes += texts[r].size();
+            result.amount = text_bytes / 1048576.0;
+            result.unit = "MB/s";
+            runs.push_back(result);
+
+            WriteOptions write_options;
+            write_options.threads = t;
+            string path = base + ".trb";
+            result.name = "write trb";
+            result.seconds = best_of(repeat, [&]() { return write_trb(scene, ranges, path, write_options); });
+            result.amount = file_size(path) / 1048576.0;
+            runs.push_back(result);
+            remove(path.c_str());
+
+            result.name = "transform";
+            result.triangles = world_count;
+            result.seconds = best_of(repeat, [&]() {
+                place_triangles(scene, world_ranges, worlds, t, placed);
+                return true;
+            });
+            result.amount = 3 * world_count / 1e6;
+            result.unit = "Mverts/s";
+            runs.push_back(result);
+
+            IndexedTriangles welded;
+            result.name = "weld";
+            result.seconds = best_of(repeat, [&]() { return weld_triangles(placed, welded, t); });
+            runs.push_back(result);
+
+            for (size_t f = 0; f < formats.size(); ++f) {
+                string output = base + "." + formats[f];
+                ExportOptions options;
+                options.write.threads = t;
+                ostringstream log;
+                result.name = "export " + formats[f];
+                result.triangles = triangles;
+                // Without --clean or --merge-coplanar, the scene is left as is.
+                result.seconds = best_of(repeat, [&]() { return export_scene(scene, output, options, log, &error); });
+                result.amount = triangles / 1e6;
+                result.unit = "Mtri/s";
+                remove(output.c_str());
+                if (result.seconds < 0.0) {
+                    cerr << "Error : " << error << endl;
+                    status = 1;
+                    continue;
+                }
+                runs.push_back(result);
+            }
+
+            for (size_t r = 0; r < runs.size(); ++r) {
+                char line[256];
+                snprintf(line, sizeof(line), "  %-12s %2u thread(s) : %10.3f s %12.1f %s", runs[r].name.c_str(),
+                         runs[r].threads, runs[r].seconds, runs[r].amount / runs[r].seconds, runs[r].unit.c_str());
+                table << line << endl;
+                results.push_back(runs[r]);
+            }
+            if (t >= threads)
+                break;
+        }
+    }
+
+    if (!json.empty()) {
+        if (json == "-")
+            write_results_json(cout, threads, scene_fields, results);
+        else {
+            ofstream out(json.c_str());
+            write_results_json(out, threads, scene_fields, results);
+            out.close();
+            if (out.fail()) {
+                cerr << "Error : file " << json << " impossible to write" << endl;
+                return 1;
+            }
+        }
+    }
+    return status;
+}
@@ -0,0 +1,70 @@
+#include "daemon.h"
+#include <iostream>
+#include <climits>
+
+using namespace std;
+
+// Requests a conversion, or the status, of a skp2tri --daemon and prints its
+// answer, the JSON object of daemon.h.
+
+void display_usage(int argc, char** argv) {
+    cout << "Usage is :" << endl;
+    cout << argv[0] << " <socket> <input-skp-file> <output-file> [options]" << endl;
+    cout << argv[0] << " <socket> --status" << endl;
+    cout << "The options are skp2tri's conversion options, for this conversion only, e.g." << endl;
+    cout << "  --synthetic <fields> (the input then given as -), --clean, --index, -t <n>." << endl;
+    cout << "The input and output are relative to the current directory, paths in the options" << endl;
+    cout << "to the daemon's." << endl;
+    cout << "Exits with 0 once converted, 1 on failure, 2 when the daemon is busy." << endl;
+}
+
+// `path` relative to the current directory made absolute, as the daemon
+// runs from its own.
+string absolute_path(const string& path) {
+    if (path.empty() || path == "-" || path[0] == '/')
+        return path;
+    char directory[PATH_MAX];
+    if (getcwd(directory, sizeof(directory)) == 0)
+        return path;
+    return string(directory) + "/" + path;
+}
+
+int main(int argc, char** argv) {
+
+    vector<string> request;
+    if (argc == 3 && string(argv[2]) == "--status")
+        request.push_back("status");
+    else if (argc >= 4 && (argv[2][0] != '-' || string(argv[2]) == "-")) {
+        request.push_back("convert");
+        request.push_back(absolute_path(argv[2]));
+        request.push_back(absolute_path(argv[3]));
+        request.insert(request.end(), argv + 4, argv + argc);
+    }
+    else {
+        display_usage(argc, argv);
+        return 1;
+    }
+
+    string error;
+    int connection = connect_daemon(argv[1], &error);
+    if (connection < 0) {
+        cerr << "Error : " << error << endl;
+        return 1;
+    }
+    // A daemon serving too many connections already answers "busy" and
+    // closes this one without reading the request : its answer is read even
+    // when the request could not be sent.
+    ignore_broken_pipes();
+    write_frame(connection, join_fields(request));
+    string answer;
+    bool answered = read_frame(connection, answer);
+    ::close(connection);
+    if (!answered) {
+        cerr << "Error : the daemon ended the connection without answering" << endl;
+        return 1;
+    }
+    cout << answer;
+    if (answer.find("\"status\": \"ok\"") != string::npos)
+        return 0;
+    return answer.find("\"status\": \"busy\"") != string::npos ? 2 : 1;
+}
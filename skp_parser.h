@@ -10,10 +10,19 @@
 #include <slapi/model/group.h>
 #include <slapi/model/vertex.h>
 #include <slapi/model/mesh_helper.h>
+#include <slapi/model/drawing_element.h>
+#include <slapi/model/material.h>
+#include <slapi/model/layer.h>
+#include <slapi/model/texture.h>
+#include <slapi/model/entity.h>
 #include <vector>
+#include <map>
 #include <iostream>
 #include <string>
 #include <fstream>
+#include <sstream>
+#include "scene.h"
+#include "scene_source.h"
 
 const double INCH_IN_MM = 24.5;
 
@@ -109,3 +118,312 @@ std::ostream& operator<<(std::ostream& os, const SUEntitiesRef &entities) {
     }
     return os;
 }
+
+// Returns the UTF-8 value of a string attribute, e.g.
+// su_string(group, SUGroupGetName).
+template <class Ref>
+std::string su_string(Ref ref, SUResult (*getter)(Ref, SUStringRef*)) {
+    std::string value;
+    SUStringRef string_ref = SU_INVALID;
+    SUStringCreate(&string_ref);
+    if (getter(ref, &string_ref) == SU_ERROR_NONE) {
+        size_t length = 0;
+        SUStringGetUTF8Length(string_ref, &length);
+        std::vector<char> buffer(length + 1);
+        SUStringGetUTF8(string_ref, buffer.size(), &buffer[0], &length);
+        value.assign(&buffer[0], length);
+    }
+    SUStringRelease(&string_ref);
+    return value;
+}
+
+// Serial SLAPI pass filling a Scene. Every entities collection is tessellated
+// once, however many instances of its definition the model contains.
+class SceneBuilder {
+public:
+    SceneBuilder(Scene& scene, const SceneOptions& options) : scene_(scene), options_(options) {}
+
+    size_t add_node(SceneNode::Kind kind, const std::string& name, const std::string& mesh_name, SUEntityRef entity,
+                    SUEntitiesRef entities, const SUTransformation& transform, size_t material, size_t layer) {
+        size_t index = scene_.nodes.size();
+        scene_.nodes.push_back(SceneNode());
+        scene_.nodes[index].kind = kind;
+        scene_.nodes[index].name = name;
+        scene_.nodes[index].entity_id = 0;
+        if (!SUIsInvalid(entity))
+            SUEntityGetID(entity, &scene_.nodes[index].entity_id);
+        scene_.nodes[index].mesh = mesh_for(entities, mesh_name);
+        scene_.nodes[index].material = material;
+        scene_.nodes[index].layer = layer;
+        scene_.nodes[index].transform = transform;
+        PROFILE_COUNT(kind == SceneNode::GROUP ? COUNT_GROUPS : COUNT_INSTANCES, kind != SceneNode::ROOT);
+
+        std::vector<size_t> children;
+        size_t num_groups = 0;
+        SUEntitiesGetNumGroups(entities, &num_groups);
+        if (num_groups > 0) {
+            std::vector<SUGroupRef> groups(num_groups);
+            SUEntitiesGetGroups(entities, num_groups, &groups[0], &num_groups);
+            for (size_t g = 0; g < num_groups; g++) {
+                SUGroupRef group = groups[g];
+                SUEntitiesRef group_entities = SU_INVALID;
+                SUGroupGetEntities(group, &group_entities);
+                SUTransformation group_transform = identity_transform();
+                SUGroupGetTransform(group, &group_transform);
+                std::string group_name = su_string(group, SUGroupGetName);
+                children.push_back(add_node(SceneNode::GROUP, group_name, group_name, SUGroupToEntity(group),
+                                            group_entities, group_transform,
+                                            inherited_material(SUGroupToDrawingElement(group), material),
+                                            inherited_layer(SUGroupToDrawingElement(group), layer)));
+            }
+        }
+
+        size_t num_instance = 0;
+        SUEntitiesGetNumInstances(entities, &num_instance);
+        if (num_instance > 0) {
+            std::vector<SUComponentInstanceRef> instances(num_instance);
+            SUEntitiesGetInstances(entities, num_instance, &instances[0], &num_instance);
+            for (size_t i = 0; i < num_instance; ++i) {
+                SUComponentInstanceRef instance = instances[i];
+                SUComponentDefinitionRef definition = SU_INVALID;
+                SUComponentInstanceGetDefinition(instance, &definition);
+                SUEntitiesRef instance_entities = SU_INVALID;
+                SUComponentDefinitionGetEntities(definition, &instance_entities);
+                SUTransformation instance_transform = identity_transform();
+                SUComponentInstanceGetTransform(instance, &instance_transform);
+                std::string definition_name = su_string(definition, SUComponentDefinitionGetName);
+                std::string instance_name = su_string(instance, SUComponentInstanceGetName);
+                if (instance_name.empty())
+                    instance_name = definition_name;
+                SUDrawingElementRef element = SUComponentInstanceToDrawingElement(instance);
+                children.push_back(add_node(SceneNode::INSTANCE, instance_name, definition_name,
+                                            SUComponentInstanceToEntity(instance), instance_entities,
+                                            instance_transform, inherited_material(element, material),
+                                            inherited_layer(element, layer)));
+            }
+        }
+        scene_.nodes[index].children.swap(children);
+        return index;
+    }
+
+private:
+    size_t mesh_for(SUEntitiesRef entities, const std::string& name) {
+        std::map<void*, size_t>::const_iterator cached = meshes_.find(entities.ptr);
+        if (cached != meshes_.end()) {
+            PROFILE_COUNT(COUNT_MESH_CACHE_HITS, 1);
+            return cached->second;
+        }
+        PROFILE_COUNT(COUNT_DEFINITIONS, 1);
+
+        size_t index = scene_.meshes.size();
+        scene_.meshes.push_back(SceneMesh());
+        scene_.meshes[index].name = name;
+        meshes_[entities.ptr] = index;
+
+        size_t faceCount = 0;
+        SUEntitiesGetNumFaces(entities, &faceCount);
+        TRACE_SCOPE(TRACE_DEFINITION, index, faceCount);
+        if (faceCount > 0) {
+            std::vector<SUFaceRef> faces(faceCount);
+            SUEntitiesGetFaces(entities, faceCount, &faces[0], &faceCount);
+            for (size_t i = 0; i < faceCount; i++)
+                append_face(scene_.meshes[index], faces[i]);
+        }
+        return index;
+    }
+
+    // Appends the tessellation of `face` to `mesh`, vertices and triangles in
+    // the same order as operator<< writes them.
+    void append_face(SceneMesh& mesh, SUFaceRef face) {
+        SceneFace scene_face;
+        scene_face.first_vertex = mesh.vertices.size();
+        scene_face.vertex_count = 0;
+        scene_face.first_triangle = mesh.triangle_count();
+        scene_face.triangle_count = 0;
+        SUMaterialRef front = SU_INVALID;
+        scene_face.material = SUFaceGetFrontMaterial(face, &front) == SU_ERROR_NONE ? material_for(front) : NO_MATERIAL;
+        scene_face.layer = inherited_layer(SUFaceToDrawingElement(face), NO_LAYER);
+
+        PROFILE_SCOPE(STAGE_TESSELLATE);
+        PROFILE_COUNT(COUNT_FACES, 1);
+        SUMeshHelperRef mesh_ref = SU_INVALID;
+        if (SUMeshHelperCreate(&mesh_ref, face) == SU_ERROR_NONE) {
+            size_t num_vertices = 0;
+            SUMeshHelperGetNumVertices(mesh_ref, &num_vertices);
+            if (num_vertices > 0) {
+                size_t base = mesh.vertices.size();
+                mesh.vertices.resize(base + num_vertices);
+                SUMeshHelperGetVertices(mesh_ref, num_vertices, &mesh.vertices[base], &num_vertices);
+                scene_face.vertex_count = num_vertices;
+
+                if (options_.normals) {
+                    size_t count = 0;
+                    mesh.normals.resize(base + num_vertices);
+                    SUMeshHelperGetNormals(mesh_ref, num_vertices, &mesh.normals[base], &count);
+                }
+                if (options_.uvs) {
+                    size_t count = 0;
+                    std::vector<SUPoint3D> stq(num_vertices);
+                    SUMeshHelperGetFrontSTQCoords(mesh_ref, num_vertices, &stq[0], &count);
+                    for (size_t i = 0; i < num_vertices; i++) {
+                        SUPoint2D uv = { 0.0, 0.0 };
+                        if (stq[i].z != 0.0) {
+                            uv.x = stq[i].x / stq[i].z;
+                            uv.y = stq[i].y / stq[i].z;
+                        }
+                        mesh.uvs.push_back(uv);
+                    }
+                }
+
+                size_t num_triangles = 0;
+                SUMeshHelperGetNumTriangles(mesh_ref, &num_triangles);
+                if (num_triangles > 0) {
+                    size_t num_retrieved = 0;
+                    std::vector<size_t> indices(3 * num_triangles);
+                    SUMeshHelperGetVertexIndices(mesh_ref, indices.size(), &indices[0], &num_retrieved);
+                    for (size_t i = 0; i < indices.size(); i++)
+                        mesh.indices.push_back((uint32_t)(base + indices[i]));
+                    scene_face.triangle_count = num_triangles;
+                    PROFILE_COUNT(COUNT_TRIANGLES, num_triangles);
+                }
+            }
+            SUMeshHelperRelease(&mesh_ref);
+        }
+        mesh.faces.push_back(scene_face);
+    }
+
+    size_t inherited_material(SUDrawingElementRef element, size_t parent_material) {
+        SUMaterialRef material = SU_INVALID;
+        if (SUDrawingElementGetMaterial(element, &material) != SU_ERROR_NONE || SUIsInvalid(material))
+            return parent_material;
+        return material_for(material);
+    }
+
+    // Entities on Layer0 follow the layer of the group or instance they are
+    // in, as SketchUp shows them.
+    size_t inherited_layer(SUDrawingElementRef element, size_t parent_layer) {
+        SULayerRef layer = SU_INVALID;
+        if (SUDrawingElementGetLayer(element, &layer) != SU_ERROR_NONE || SUIsInvalid(layer))
+            return parent_layer;
+        std::map<void*, size_t>::const_iterator cached = layers_.find(layer.ptr);
+        if (cached != layers_.end()) {
+            PROFILE_COUNT(COUNT_LAYER_CACHE_HITS, 1);
+            return cached->second == NO_LAYER ? parent_layer : cached->second;
+        }
+
+        std::string name = su_string(layer, SULayerGetName);
+        size_t index = NO_LAYER;
+        if (name != "Layer0") {
+            index = scene_.layers.size();
+            scene_.layers.push_back(name);
+        }
+        layers_[layer.ptr] = index;
+        return index == NO_LAYER ? parent_layer : index;
+    }
+
+    size_t material_for(SUMaterialRef material) {
+        if (SUIsInvalid(material))
+            return NO_MATERIAL;
+        std::map<void*, size_t>::const_iterator cached = materials_.find(material.ptr);
+        if (cached != materials_.end()) {
+            PROFILE_COUNT(COUNT_MATERIAL_CACHE_HITS, 1);
+            return cached->second;
+        }
+
+        PROFILE_SCOPE(STAGE_MATERIALS);
+        SceneMaterial scene_material;
+        scene_material.name = su_string(material, SUMaterialGetName);
+        SUColor white = { 255, 255, 255, 255 };
+        scene_material.color = white;
+        SUMaterialGetColor(material, &scene_material.color);
+        scene_material.opacity = 1.0;
+        SUMaterialGetOpacity(material, &scene_material.opacity);
+        scene_material.use_opacity = false;
+        SUMaterialGetUseOpacity(material, &scene_material.use_opacity);
+        scene_material.s_scale = 1.0;
+        scene_material.t_scale = 1.0;
+
+        SUTextureRef texture = SU_INVALID;
+        if (!options_.texture_prefix.empty() && SUMaterialGetTexture(material, &texture) == SU_ERROR_NONE) {
+            std::string file_name = su_string(texture, SUTextureGetFileName);
+            size_t slash = file_name.find_last_of("/\\");
+            if (slash != std::string::npos)
+                file_name = file_name.substr(slash + 1);
+            if (file_name.empty())
+                file_name = "texture.png";
+            // Different materials may use images with the same file name.
+            std::ostringstream path_stream;
+            path_stream << options_.texture_prefix << scene_.materials.size() << "_" << file_name;
+            std::string path = path_stream.str();
+            size_t width = 0, height = 0;
+            SUTextureGetDimensions(texture, &width, &height, &scene_material.s_scale, &scene_material.t_scale);
+            if (SUTextureWriteToFile(texture, path.c_str()) == SU_ERROR_NONE) {
+                scene_material.texture = path;
+                PROFILE_COUNT(COUNT_TEXTURES, 1);
+            }
+        }
+
+        size_t index = scene_.materials.size();
+        scene_.materials.push_back(scene_material);
+        materials_[material.ptr] = index;
+        return index;
+    }
+
+    Scene& scene_;
+    SceneOptions options_;
+    std::map<void*, size_t> meshes_;
+    std::map<void*, size_t> materials_;
+    std::map<void*, size_t> layers_;
+};
+
+void build_scene(SUEntitiesRef entities, Scene& scene, const SceneOptions& options = SceneOptions()) {
+    scene.materials.clear();
+    scene.layers.clear();
+    scene.meshes.clear();
+    scene.nodes.clear();
+    SceneBuilder builder(scene, options);
+    SUEntityRef no_entity = SU_INVALID;
+    builder.add_node(SceneNode::ROOT, "", "", no_entity, entities, identity_transform(), NO_MATERIAL, NO_LAYER);
+}
+
+// A .skp file read through the SDK, which the caller has initialized
+// (SUInitialize) for the whole run.
+class SkpSource : public SceneSource {
+public:
+    explicit SkpSource(const std::string& path, bool merge_coplanar = false)
+        : path_(path), merge_coplanar_(merge_coplanar) {}
+
+    bool load(const SceneOptions& options, Scene& scene, std::string* error) {
+        SUModelRef model = SU_INVALID;
+        SUResult opened;
+        {
+            PROFILE_SCOPE(STAGE_OPEN);
+            opened = SUModelCreateFromFile(&model, path_.c_str());
+        }
+        if (opened != SU_ERROR_NONE) {
+            if (error)
+                *error = "file " + path_ + " impossible to open";
+            return false;
+        }
+        // The SDK's own merge, within its rules, before anything is read.
+        if (merge_coplanar_) {
+            PROFILE_SCOPE(STAGE_SDK_MERGE);
+            if (SUModelMergeCoplanarFaces(model) != SU_ERROR_NONE)
+                std::cerr << "Warning : the coplanar faces of " << path_ << " could not be merged" << "\n";
+        }
+        SUEntitiesRef entities = SU_INVALID;
+        SUModelGetEntities(model, &entities);
+        {
+            PROFILE_SCOPE(STAGE_TRAVERSE);
+            build_scene(entities, scene, options);
+        }
+        SUModelRelease(&model);
+        return true;
+    }
+
+    std::string name() const { return path_; }
+
+private:
+    std::string path_;
+    bool merge_coplanar_;
+};
@@ -0,0 +1,107 @@
+#ifndef SKP2TRI_SYNTHETIC_TRIANGLES_H
+#define SKP2TRI_SYNTHETIC_TRIANGLES_H
+
+#include <cmath>
+#include <algorithm>
+#include <stdint.h>
+#include "parallel.h"
+#include "tri_reader.h"
+
+// Reproducible triangles for the benchmarks: triangle i only depends on i,
+// so any range can be generated on its own.
+
+namespace synthetic_detail {
+
+inline uint64_t mix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+} // namespace synthetic_detail
+
+// Triangle i: a corner anywhere in a 400 foot site, the two others within
+// ten feet of it, rounded to 1/64 inch as SketchUp geometry often is.
+inline void synthetic_triangle(uint64_t i, double* corners) {
+    uint64_t state = synthetic_detail::mix(i);
+    double origin[3];
+    for (int k = 0; k < 3; ++k) {
+        state = synthetic_detail::mix(state);
+        origin[k] = ((double)(state >> 11) / 9007199254740992.0 - 0.5) * 4800.0;
+    }
+    for (int c = 0; c < 3; ++c) {
+        for (int k = 0; k < 3; ++k) {
+            double value = origin[k];
+            if (c > 0) {
+                state = synthetic_detail::mix(state);
+                value += ((double)(state >> 11) / 9007199254740992.0 - 0.5) * 240.0;
+            }
+            corners[3 * c + k] = std::floor(value * 64.0 + 0.5) / 64.0;
+        }
+    }
+}
+
+// Triangles [0, count) of the sequence above.
+inline void synthetic_triangles(size_t count, TriangleArrays& triangles, unsigned threads) {
+    triangles.resize(count);
+    parallel_for((count + 65535) / 65536, threads, [&](size_t task, unsigned) {
+        for (size_t i = task * 65536; i < std::min(count, (task + 1) * 65536); ++i) {
+            double corners[9];
+            synthetic_triangle(i, corners);
+            float values[9];
+            for (int k = 0; k < 9; ++k)
+                values[k] = (float)corners[k];
+            triangles.set(i, values);
+        }
+    });
+}
+
+// A city for the ray casting benchmark: a square grid of 50 foot blocks,
+// each with its ground (two triangles) and a box building of random
+// footprint and height (four walls and a roof, ten triangles), rather than
+// the heavily overlapping triangles above. About `count` triangles, a
+// multiple of twelve.
+inline void synthetic_city(size_t count, TriangleArrays& triangles, unsigned threads) {
+    const size_t per_block = 12;
+    const float block = 600.0f;
+    size_t blocks = std::max((size_t)1, count / per_block);
+    size_t side = (size_t)std::ceil(std::sqrt((double)blocks));
+    triangles.resize(blocks * per_block);
+    parallel_for((blocks + 4095) / 4096, threads, [&](size_t task, unsigned) {
+        for (size_t b = task * 4096; b < std::min(blocks, (task + 1) * 4096); ++b) {
+            uint64_t state = synthetic_detail::mix(b);
+            float random[4];
+            for (int k = 0; k < 4; ++k) {
+                state = synthetic_detail::mix(state);
+                random[k] = (float)((double)(state >> 11) / 9007199254740992.0);
+            }
+            float x = (float)(b % side) * block, y = (float)(b / side) * block;
+            float x0 = x + 20.0f + 100.0f * random[0], y0 = y + 20.0f + 100.0f * random[1];
+            float x1 = x + block - 20.0f - 100.0f * random[2], y1 = y + block - 20.0f - 100.0f * random[3];
+            float height = 120.0f + 2400.0f * random[0] * random[1] * random[2];
+            // Corners of the ground square and of the building's top and
+            // bottom, the quads as pairs of triangles.
+            float ground[4][3] = { { x, y, 0 }, { x + block, y, 0 }, { x + block, y + block, 0 }, { x, y + block, 0 } };
+            float low[4][3] = { { x0, y0, 0 }, { x1, y0, 0 }, { x1, y1, 0 }, { x0, y1, 0 } };
+            float high[4][3] = { { x0, y0, height }, { x1, y0, height }, { x1, y1, height }, { x0, y1, height } };
+            const float* quads[6][4] = {
+                { ground[0], ground[1], ground[2], ground[3] }, { high[0], high[1], high[2], high[3] },
+                { low[0], low[1], high[1], high[0] },           { low[1], low[2], high[2], high[1] },
+                { low[2], low[3], high[3], high[2] },           { low[3], low[0], high[0], high[3] },
+            };
+            for (int q = 0; q < 6; ++q) {
+                float values[9];
+                for (int half = 0; half < 2; ++half) {
+                    int corners[3] = { 0, half == 0 ? 1 : 2, half == 0 ? 2 : 3 };
+                    for (int c = 0; c < 3; ++c)
+                        for (int k = 0; k < 3; ++k)
+                            values[3 * c + k] = quads[q][corners[c]][k];
+                    triangles.set(b * per_block + 2 * q + half, values);
+                }
+            }
+        }
+    });
+}
+
+#endif // SKP2TRI_SYNTHETIC_TRIANGLES_H
@@ -0,0 +1,91 @@
+#!/bin/sh
+# Smoke test of skp2tri --daemon and skp2tri_client, on synthetic scenes:
+# a conversion, a request turned down by a full queue, a report written to
+# the standard output of the worker, a clean stop, a conversion killed past
+# --timeout, and connections past --connections turned down.
+#
+#   daemon_smoke.sh <skp2tri> <skp2tri_client>
+
+skp2tri=$1
+client=$2
+dir=$(mktemp -d)
+daemon=
+
+fail() {
+    echo "FAIL : $*"
+    [ -n "$daemon" ] && kill "$daemon" 2>/dev/null
+    cat "$dir/daemon.log"
+    rm -rf "$dir"
+    exit 1
+}
+
+# Waits until the status of the daemon contains $1.
+wait_status() {
+    for i in $(seq 100); do
+        "$client" "$dir/d.sock" --status 2>/dev/null | grep -q "$1" && return 0
+        sleep 0.1
+    done
+    fail "status never reached $1"
+}
+
+# One worker, one conversion waiting at most.
+"$skp2tri" --daemon "$dir/d.sock" -j 1 --queue 1 > "$dir/daemon.log" 2>&1 &
+daemon=$!
+wait_status '"workers": 1'
+
+"$client" "$dir/d.sock" - "$dir/ok.trb" --synthetic instances=10 > "$dir/ok.json" \
+    || fail "conversion : $(cat "$dir/ok.json")"
+grep -q '"status": "ok"' "$dir/ok.json" && [ -s "$dir/ok.trb" ] || fail "conversion : $(cat "$dir/ok.json")"
+
+# The worker blocks writing to a fifo until it is read, the next conversion
+# waits in the queue, so the one after is turned down.
+mkfifo "$dir/held.tri"
+"$client" "$dir/d.sock" - "$dir/held.tri" --synthetic instances=10 > "$dir/held.json" &
+held=$!
+wait_status '"running": 1'
+"$client" "$dir/d.sock" - "$dir/queued.trb" --synthetic instances=10 > "$dir/queued.json" &
+queued=$!
+wait_status '"queued": 1'
+"$client" "$dir/d.sock" - "$dir/busy.trb" --synthetic instances=10 > "$dir/busy.json"
+[ $? -eq 2 ] && grep -q '"status": "busy"' "$dir/busy.json" || fail "full queue : $(cat "$dir/busy.json")"
+cat "$dir/held.tri" > /dev/null
+wait $held || fail "held conversion : $(cat "$dir/held.json")"
+wait $queued || fail "queued conversion : $(cat "$dir/queued.json")"
+
+# A report to "-" goes to the daemon's log, not into the answers.
+"$client" "$dir/d.sock" - "$dir/report.trb" --synthetic instances=10 --report - > "$dir/report.json" \
+    || fail "--report - : $(cat "$dir/report.json")"
+grep -q '"non_finite"' "$dir/daemon.log" || fail "--report - : no report in the log"
+"$client" "$dir/d.sock" - "$dir/after.trb" --synthetic instances=10 > "$dir/after.json" \
+    || fail "conversion after --report - : $(cat "$dir/after.json")"
+grep -q '"worker": 0' "$dir/after.json" || fail "conversion after --report - : $(cat "$dir/after.json")"
+"$client" "$dir/d.sock" --status | grep -q '"accepted": 5, "rejected": 1, "converted": 5, "failed": 0' \
+    || fail "counts : $("$client" "$dir/d.sock" --status)"
+
+kill -TERM $daemon
+wait $daemon || fail "daemon exit status"
+daemon=
+[ -e "$dir/d.sock" ] && fail "socket left behind"
+
+# A conversion stuck on a fifo nobody reads fails once its time is up, and
+# the next one has a new worker. While it waits, its connection is the only
+# one served, others are turned down.
+"$skp2tri" --daemon "$dir/d.sock" -j 1 --timeout 2 --connections 1 >> "$dir/daemon.log" 2>&1 &
+daemon=$!
+wait_status '"workers": 1'
+[ "$(ls -l "$dir/d.sock" | cut -c1-10)" = "srw-------" ] || fail "socket mode : $(ls -l "$dir/d.sock")"
+mkfifo "$dir/stuck.tri"
+"$client" "$dir/d.sock" - "$dir/stuck.tri" --synthetic instances=10 > "$dir/stuck.json" &
+stuck=$!
+wait_status 'too many connections'
+"$client" "$dir/d.sock" - "$dir/extra.trb" --synthetic instances=10 > "$dir/extra.json"
+[ $? -eq 2 ] && grep -q 'too many connections' "$dir/extra.json" || fail "connections : $(cat "$dir/extra.json")"
+wait $stuck
+[ $? -eq 1 ] && grep -q 'timed out' "$dir/stuck.json" || fail "timeout : $(cat "$dir/stuck.json")"
+"$client" "$dir/d.sock" - "$dir/next.trb" --synthetic instances=10 > "$dir/next.json" \
+    || fail "conversion after a timeout : $(cat "$dir/next.json")"
+kill -TERM $daemon
+wait $daemon || fail "daemon exit status after a timeout"
+daemon=
+rm -rf "$dir"
+echo "daemon smoke test passed"
@@ -0,0 +1,239 @@
+#include "../scene_output.h"
+#include "../scene_synthetic.h"
+#include "../tri_reader.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+using namespace std;
+
+// The reader against the writers and the text parser against its edge
+// cases: a synthetic scene is written in every format the reader takes,
+// read back whole and span by span through the .idx sidecar, and compared
+// with the scene's own corners; then .tri text held in memory goes through
+// parse_tri_text with chunks small enough to cut lines.
+//
+//   reader_test [<file prefix>]
+
+int failures = 0;
+
+void check(bool condition, const string& what) {
+    if (!condition) {
+        cout << "FAIL : " << what << endl;
+        ++failures;
+    }
+}
+
+// .tri numbers are printed with "%g", so six significant digits.
+bool same_value(float a, float b, bool text) {
+    if (a == b || (a != a && b != b))
+        return true;
+    return text && fabs(a - b) <= 1e-5 * max(fabs(a), fabs(b));
+}
+
+// Compares triangles [0, expected.size()) of `expected` with `read` from
+// triangle `first` on.
+bool same_triangles(const TriangleArrays& expected, const TriangleArrays& read, size_t first, bool text) {
+    if (first + expected.size() > read.size())
+        return false;
+    for (size_t i = 0; i < expected.size(); ++i)
+        for (int k = 0; k < 3; ++k)
+            if (!same_value(expected.x[k][i], read.x[k][first + i], text)
+                || !same_value(expected.y[k][i], read.y[k][first + i], text)
+                || !same_value(expected.z[k][i], read.z[k][first + i], text))
+                return false;
+    return true;
+}
+
+// The corners the writers write: the mesh vertices of every range, as floats.
+void scene_triangles(const Scene& scene, const vector<SceneRange>& ranges, TriangleArrays& triangles) {
+    triangles.resize((size_t)ranges_triangle_count(ranges));
+    for (size_t r = 0; r < ranges.size(); ++r) {
+        const SceneRange& range = ranges[r];
+        const SceneMesh& mesh = scene.meshes[scene.nodes[range.node].mesh];
+        for (size_t t = 0; t < range.triangle_count; ++t) {
+            float corners[9];
+            for (int k = 0; k < 3; ++k) {
+                const SUPoint3D& point = mesh.vertices[mesh.indices[3 * (range.first_triangle + t) + k]];
+                corners[3 * k] = (float)point.x;
+                corners[3 * k + 1] = (float)point.y;
+                corners[3 * k + 2] = (float)point.z;
+            }
+            triangles.set((size_t)range.output_triangle + t, corners);
+        }
+    }
+}
+
+// The triangle starting at byte `offset` of a .tri file.
+size_t text_triangle_at(const string& path, uint64_t offset) {
+    ifstream in(path.c_str(), ios::binary);
+    string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    size_t triangle = 0;
+    for (size_t p = 0; p < offset && p < text.size();) {
+        size_t eol = text.find('\n', p);
+        if (eol == string::npos)
+            eol = text.size();
+        if (eol > p && text[p] != '\r')
+            ++triangle;
+        p = eol + 1;
+    }
+    return triangle;
+}
+
+void test_formats(const string& prefix) {
+    SyntheticOptions synthetic;
+    synthetic.definitions = 5;
+    synthetic.instances = 40;
+    synthetic.faces = 54;
+    synthetic.depth = 3;
+    synthetic.branching = 3;
+    Scene scene;
+    build_synthetic_scene(synthetic, SceneOptions(), scene);
+    vector<SceneRange> ranges = flatten_scene(scene);
+    TriangleArrays expected;
+    scene_triangles(scene, ranges, expected);
+    check(expected.size() > 0, "synthetic scene without triangles");
+
+    const char* extensions[] = { ".tri", ".trb", ".stl", ".ply" };
+    for (size_t e = 0; e < sizeof(extensions) / sizeof(extensions[0]); ++e) {
+        string extension = extensions[e];
+        string path = prefix + extension;
+        bool text = extension == ".tri";
+        WriteOptions write;
+        write.index = true;
+        if (!write_scene_output(scene, 0, true, path, extension, write)) {
+            check(false, path + " not written");
+            continue;
+        }
+
+        for (unsigned threads = 1; threads <= 4; threads += 3) {
+            TriReadOptions options;
+            options.threads = threads;
+            options.chunk_size = 1024;
+            TriangleArrays read;
+            string error;
+            check(read_triangles(path, read, options, &error), path + " : " + error);
+            check(read.size() == expected.size(), path + " : triangle count");
+            check(same_triangles(expected, read, 0, text), path + " : triangles differ from the scene");
+        }
+        if (extension == ".ply")
+            continue;
+
+        TriIndexHeader header;
+        vector<TriIndexEntry> entries;
+        string error;
+        check(read_tri_index(path + ".idx", header, entries, &error), path + ".idx : " + error);
+        uint64_t top_level = 0;
+        for (size_t i = 0; i < entries.size(); ++i)
+            if (entries[i].parent == TRI_INDEX_NO_PARENT)
+                top_level += entries[i].triangle_count;
+        check(top_level == expected.size(), path + ".idx : the top level entries are not the whole model");
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const TriIndexEntry& entry = entries[i];
+            TriangleArrays span;
+            ostringstream what;
+            what << path << " : span of entry " << i;
+            if (!read_tri_span(path, header.format, entry.offset, entry.length, span, TriReadOptions(), &error)) {
+                check(false, what.str() + " : " + error);
+                continue;
+            }
+            check(span.size() == entry.triangle_count, what.str() + " : triangle count");
+            size_t first = text ? text_triangle_at(path, entry.offset)
+                : (size_t)((entry.offset - (extension == ".trb" ? TRB_HEADER_SIZE : STL_HEADER_SIZE))
+                           / (extension == ".trb" ? TRB_TRIANGLE_SIZE : STL_TRIANGLE_SIZE));
+            TriangleArrays whole;
+            whole.resize(span.size());
+            for (size_t t = 0; t < span.size() && first + t < expected.size(); ++t)
+                for (int k = 0; k < 3; ++k) {
+                    whole.x[k][t] = expected.x[k][first + t];
+                    whole.y[k][t] = expected.y[k][first + t];
+                    whole.z[k][t] = expected.z[k][first + t];
+                }
+            check(same_triangles(whole, span, 0, text), what.str() + " : triangles differ from the scene");
+        }
+        remove((path + ".idx").c_str());
+        remove(path.c_str());
+    }
+    remove((prefix + ".ply").c_str());
+}
+
+// Parses `text` with 1 and 4 threads and the smallest chunks.
+bool parse_text(const string& text, TriangleArrays& triangles, string* error) {
+    TriReadOptions options;
+    options.chunk_size = 1024;
+    TriangleArrays single;
+    options.threads = 1;
+    if (!parse_tri_text(text.data(), text.size(), single, options, error))
+        return false;
+    options.threads = 4;
+    if (!parse_tri_text(text.data(), text.size(), triangles, options, error))
+        return false;
+    if (!same_triangles(single, triangles, 0, false) || single.size() != triangles.size()) {
+        *error = "1 and 4 threads disagree";
+        return false;
+    }
+    return true;
+}
+
+void test_text() {
+    TriangleArrays read;
+    string error;
+
+    // Exponents, signed zeros, non-finite values, CRLF and an empty line.
+    string text = "1e3 -2.5E-2 +3 0.000125 1e-07 -0 0 .5 5.\r\n"
+                  "\r\n"
+                  "inf -inf nan 1.17549e-38 3.40282e+38 -1.5e+10 123456789 0.1 -7\n";
+    check(parse_text(text, read, &error), "edge cases : " + error);
+    check(read.size() == 2, "edge cases : triangle count");
+    if (read.size() == 2) {
+        check(read.x[0][0] == 1000.0f && read.y[0][0] == -0.025f && read.z[0][0] == 3.0f, "edge cases : exponents");
+        check(read.x[1][0] == 0.000125f && read.y[1][0] == 1e-07f, "edge cases : small values");
+        check(read.z[1][0] == 0.0f && signbit(read.z[1][0]) && !signbit(read.x[2][0]), "edge cases : -0");
+        check(read.y[2][0] == 0.5f && read.z[2][0] == 5.0f, "edge cases : no digit on one side of the point");
+        check(isinf(read.x[0][1]) && read.x[0][1] > 0 && isinf(read.y[0][1]) && read.y[0][1] < 0,
+              "edge cases : inf");
+        check(isnan(read.z[0][1]), "edge cases : nan");
+        check(read.x[1][1] == 1.17549e-38f && read.y[1][1] == 3.40282e+38f && read.z[1][1] == -1.5e+10f,
+              "edge cases : range of the floats");
+        check(read.x[2][1] == 123456789.0f, "edge cases : more than eight digits");
+    }
+
+    // Lines across the chunk boundaries, a final line without its end of
+    // line.
+    string lines;
+    const char* line = "-12.5 3.25e1 0.0625 17 -4e-3 1 2 3 4";
+    size_t count = 0;
+    for (; lines.size() < 5000; ++count)
+        lines += line + string(count % 3 == 0 ? "\r\n" : "\n") + (count % 7 == 0 ? "\n" : "");
+    lines += line;
+    ++count;
+    check(parse_text(lines, read, &error), "chunks : " + error);
+    check(read.size() == count, "chunks : triangle count");
+    bool same = true;
+    for (size_t i = 0; i < read.size(); ++i)
+        same = same && read.x[0][i] == -12.5f && read.y[0][i] == 32.5f && read.z[2][i] == 4.0f;
+    check(same, "chunks : values");
+
+    // A truncated final line is an error, with its line number.
+    string truncated = lines + "\n1 2 3 4 5";
+    check(!parse_text(truncated, read, &error), "truncated line : accepted");
+    ostringstream expected;
+    expected << "line " << std::count(lines.begin(), lines.end(), '\n') + 2 << ": expected nine numbers";
+    check(error == expected.str(), "truncated line : " + error + " instead of " + expected.str());
+    check(!parse_text("1 2 3 4 5 6 7 8 9x\n", read, &error), "garbage after a number : accepted");
+}
+
+int main(int argc, char** argv) {
+    string prefix = argc > 1 ? argv[1] : "reader_test";
+    test_formats(prefix);
+    test_text();
+    if (failures > 0) {
+        cout << failures << " checks failed" << endl;
+        return 1;
+    }
+    cout << "reader test passed" << endl;
+    return 0;
+}
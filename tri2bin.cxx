@@ -0,0 +1,220 @@
+#include "tri_reader.h"
+#include "tri_weld.h"
+#include "tri_writer.h"
+#include "tri_format.h"
+#include "mapped_file.h"
+#include "buffered_writer.h"
+#include "parallel.h"
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+using namespace std;
+
+// Converts existing text .tri files to .trb (see tri_format.h), several
+// files at a time. Each file is parsed by the chunked parallel reader a
+// window at a time and written through a large-block writer, so memory
+// stays bounded whatever the file size; --weld needs the whole file to
+// share vertices and reads it at once.
+
+const uint64_t WINDOW_SIZE = 256 << 20;
+const size_t WRITE_BLOCK_SIZE = 16 << 20;
+
+void display_usage(int argc, char** argv) {
+    cout << "Usage is :" << endl;
+    cout << argv[0] << " [options] <input-tri-file>..." << endl;
+    cout << "Writes <input-name>.trb next to each input." << endl;
+    cout << "Options :" << endl;
+    cout << "  -o <output-file>    output file name (single input only)" << endl;
+    cout << "  -t, --threads <n>   worker threads (default: one per core)" << endl;
+    cout << "  --weld              share identical vertices (indexed .trb)" << endl;
+}
+
+struct Conversion {
+    string input;
+    string output;
+    uint64_t input_size;
+    uint64_t triangle_count;
+    uint64_t vertex_count;    // 0 when not welded
+    double seconds;
+    bool converted;
+    string error;
+};
+
+string trb_name(const string& path) {
+    size_t dot = path.find_last_of(".");
+    size_t slash = path.find_last_of("/\\");
+    if (dot == string::npos || (slash != string::npos && dot < slash))
+        return path + ".trb";
+    return path.substr(0, dot) + ".trb";
+}
+
+// The header is written first with a zero count and completed at the end.
+bool patch_header(const string& path, const TrbHeader& header) {
+    FILE* file = fopen(path.c_str(), "r+b");
+    if (file == 0)
+        return false;
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    return (fclose(file) == 0) && written;
+}
+
+bool convert_soup(const MappedInput& input, Conversion& conversion, unsigned threads) {
+    BufferedWriter writer(WRITE_BLOCK_SIZE);
+    if (!writer.open(conversion.output)) {
+        conversion.error = "cannot write " + conversion.output;
+        return false;
+    }
+    TrbHeader header = make_trb_header(0);
+    writer.write((const char*)&header, sizeof(header));
+
+    TriReadOptions options;
+    options.threads = threads;
+    TriangleArrays triangles;
+    const char* begin = input.data();
+    const char* end = input.data() + input.size();
+    uint64_t line = 1;
+    while (begin < end) {
+        const char* next = begin + min(WINDOW_SIZE, (uint64_t)(end - begin));
+        if (next < end) {
+            const char* eol = (const char*)memchr(next, '\n', (size_t)(end - next));
+            next = eol ? eol + 1 : end;
+        }
+        if (!parse_tri_text(begin, (uint64_t)(next - begin), triangles, options, &conversion.error, line))
+            return false;
+        write_trb_records(triangles, writer, threads);
+        header.triangle_count += triangles.size();
+        line += (uint64_t)count(begin, next, '\n');
+        begin = next;
+    }
+    if (!writer.close() || !patch_header(conversion.output, header)) {
+        conversion.error = "cannot write " + conversion.output;
+        return false;
+    }
+    conversion.triangle_count = header.triangle_count;
+    return true;
+}
+
+bool convert_welded(const MappedInput& input, Conversion& conversion, unsigned threads) {
+    TriReadOptions options;
+    options.threads = threads;
+    TriangleArrays triangles;
+    if (!parse_tri_text(input.data(), input.size(), triangles, options, &conversion.error))
+        return false;
+    IndexedTriangles mesh;
+    if (!weld_triangles(triangles, mesh, threads)) {
+        conversion.error = "too many triangles for 32-bit vertex indices, convert without --weld";
+        return false;
+    }
+    triangles.clear();
+
+    BufferedWriter writer(WRITE_BLOCK_SIZE);
+    if (!writer.open(conversion.output)) {
+        conversion.error = "cannot write " + conversion.output;
+        return false;
+    }
+    TrbHeader header = make_indexed_trb_header(mesh.triangle_count(), mesh.vertex_count());
+    writer.write((const char*)&header, sizeof(header));
+    if (!mesh.positions.empty()) {
+        writer.write((const char*)&mesh.positions[0], mesh.positions.size() * sizeof(float));
+        writer.write((const char*)&mesh.indices[0], mesh.indices.size() * sizeof(uint32_t));
+    }
+    if (!writer.close()) {
+        conversion.error = "cannot write " + conversion.output;
+        return false;
+    }
+    conversion.triangle_count = mesh.triangle_count();
+    conversion.vertex_count = mesh.vertex_count();
+    return true;
+}
+
+bool convert(Conversion& conversion, bool weld, unsigned threads) {
+    MappedInput input;
+    if (!input.open(conversion.input)) {
+        conversion.error = "cannot open " + conversion.input;
+        return false;
+    }
+    if (detect_tri_format(input.data(), input.size(), conversion.input) != TRI_FILE_TEXT) {
+        conversion.error = "not a text .tri file";
+        return false;
+    }
+    return weld ? convert_welded(input, conversion, threads) : convert_soup(input, conversion, threads);
+}
+
+int main(int argc, char** argv) {
+
+    unsigned threads = 0;
+    bool weld = false;
+    string output;
+    vector<string> inputs;
+    for (int i = 1; i < argc; ++i) {
+        string arg(argv[i]);
+        if (arg == "-h" || arg == "--help") {
+            display_usage(argc, argv);
+            return 0;
+        }
+        else if ((arg == "-t" || arg == "--threads") && i + 1 < argc)
+            threads = (unsigned)atoi(argv[++i]);
+        else if (arg == "-o" && i + 1 < argc)
+            output = argv[++i];
+        else if (arg == "--weld")
+            weld = true;
+        else if (!arg.empty() && arg[0] == '-') {
+            display_usage(argc, argv);
+            return 1;
+        }
+        else
+            inputs.push_back(arg);
+    }
+    if (inputs.empty() || (!output.empty() && inputs.size() > 1)) {
+        display_usage(argc, argv);
+        return 1;
+    }
+    if (threads == 0)
+        threads = default_thread_count();
+
+    vector<Conversion> conversions(inputs.size());
+    for (size_t f = 0; f < inputs.size(); ++f) {
+        Conversion& conversion = conversions[f];
+        conversion.input = inputs[f];
+        conversion.output = output.empty() ? trb_name(inputs[f]) : output;
+        MappedInput probe;
+        conversion.input_size = probe.open(inputs[f]) ? probe.size() : 0;
+        conversion.triangle_count = conversion.vertex_count = 0;
+        conversion.seconds = 0.0;
+        conversion.converted = false;
+    }
+
+    // Files run concurrently, biggest first, and share the threads: with
+    // fewer files than threads each file's parser gets the remainder.
+    vector<size_t> order(conversions.size());
+    for (size_t f = 0; f < order.size(); ++f)
+        order[f] = f;
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return conversions[a].input_size > conversions[b].input_size;
+    });
+    unsigned jobs = min(threads, (unsigned)conversions.size());
+    unsigned file_threads = max(1u, threads / jobs);
+    parallel_for(order.size(), jobs, [&](size_t i, unsigned) {
+        Conversion& conversion = conversions[order[i]];
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        conversion.converted = convert(conversion, weld, file_threads);
+        conversion.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    });
+
+    int status = 0;
+    for (size_t f = 0; f < conversions.size(); ++f) {
+        const Conversion& conversion = conversions[f];
+        if (!conversion.converted) {
+            cerr << "Error : " << conversion.input << " : " << conversion.error << endl;
+            status = 1;
+            continue;
+        }
+        cout << conversion.input << " -> " << conversion.output << " : " << conversion.triangle_count << " triangles";
+        if (weld)
+            cout << ", " << conversion.vertex_count << " vertices";
+        cout << " in " << conversion.seconds << " s" << endl;
+    }
+    return status;
+}
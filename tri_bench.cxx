@@ -0,0 +1,206 @@
+#include "tri_reader.h"
+#include "tri_format.h"
+#include "parallel.h"
+#include "buffered_writer.h"
+#include "synthetic_triangles.h"
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+// Throughput of the reader on synthetic files: a text .tri of the requested
+// size, with coordinates spread like a building model in inches, and the
+// same triangles as .trb and .stl. Every file is read back and checked
+// against the generator.
+
+const size_t TRIANGLES_PER_TASK = 65536;
+
+void display_usage(int argc, char** argv) {
+    cout << "Usage is :" << endl;
+    cout << argv[0] << " [options]" << endl;
+    cout << "Options :" << endl;
+    cout << "  --size-mb <n>       size of the generated text file (default: 2048)" << endl;
+    cout << "  --file <path>       base name of the generated files (default: tri_bench)" << endl;
+    cout << "  -t, --threads <n>   reader threads (default: one per core)" << endl;
+    cout << "  --baseline          also time istream >> double on the first 64 MB" << endl;
+    cout << "  --keep              keep the generated files" << endl;
+}
+
+double seconds_since(const chrono::steady_clock::time_point& start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Writes triangles until the text reaches `size` bytes, and the same ones
+// in the binary formats. Returns the triangle count.
+uint64_t generate(const string& base, uint64_t size, unsigned threads) {
+    BufferedWriter text, trb, stl;
+    if (!text.open(base + ".tri") || !trb.open(base + ".trb") || !stl.open(base + ".stl"))
+        return 0;
+    // Counts are patched in once known.
+    TrbHeader header = make_trb_header(0);
+    trb.write((const char*)&header, sizeof(header));
+    char stl_header[84] = "binary STL written by tri_bench";
+    stl.write(stl_header, sizeof(stl_header));
+
+    if (threads == 0)
+        threads = default_thread_count();
+    vector<string> texts(threads), trbs(threads), stls(threads);
+    uint64_t triangle_count = 0;
+    while (text.offset() < size) {
+        parallel_for(threads, threads, [&](size_t task, unsigned) {
+            texts[task].clear();
+            trbs[task].clear();
+            stls[task].clear();
+            char line[256];
+            for (size_t t = 0; t < TRIANGLES_PER_TASK; ++t) {
+                double c[9];
+                synthetic_triangle(triangle_count + task * TRIANGLES_PER_TASK + t, c);
+                int length = snprintf(line, sizeof(line), "%g %g %g %g %g %g %g %g %g\n",
+                                      c[0], c[1], c[2], c[3], c[4], c[5], c[6], c[7], c[8]);
+                texts[task].append(line, length);
+                float record[13] = { 0.0f, 0.0f, 0.0f };
+                for (int k = 0; k < 9; ++k)
+                    record[3 + k] = (float)c[k];
+                trbs[task].append((const char*)(record + 3), 36);
+                stls[task].append((const char*)record, 50);
+            }
+        });
+        for (unsigned task = 0; task < threads; ++task) {
+            text.write(texts[task]);
+            trb.write(trbs[task]);
+            stl.write(stls[task]);
+        }
+        triangle_count += (uint64_t)threads * TRIANGLES_PER_TASK;
+    }
+    bool written = text.close() && trb.close() && stl.close();
+
+    header.triangle_count = triangle_count;
+    uint32_t count = (uint32_t)triangle_count;
+    FILE* file = fopen((base + ".trb").c_str(), "r+b");
+    written = written && file && fwrite(&header, sizeof(header), 1, file) == 1;
+    if (file)
+        fclose(file);
+    file = fopen((base + ".stl").c_str(), "r+b");
+    written = written && file && fseek(file, 80, SEEK_SET) == 0 && fwrite(&count, 4, 1, file) == 1;
+    if (file)
+        fclose(file);
+    return written ? triangle_count : 0;
+}
+
+// Worst relative difference between what was read and the generator.
+double check(const TriangleArrays& triangles, uint64_t triangle_count, unsigned threads) {
+    if (triangles.size() != triangle_count)
+        return 1.0;
+    vector<double> worst(threads > 0 ? threads : default_thread_count(), 0.0);
+    size_t tasks = (size_t)((triangle_count + TRIANGLES_PER_TASK - 1) / TRIANGLES_PER_TASK);
+    parallel_for(tasks, (unsigned)worst.size(), [&](size_t task, unsigned worker) {
+        size_t end = (size_t)min(triangle_count, (uint64_t)(task + 1) * TRIANGLES_PER_TASK);
+        for (size_t i = task * TRIANGLES_PER_TASK; i < end; ++i) {
+            double c[9];
+            synthetic_triangle(i, c);
+            for (int k = 0; k < 3; ++k) {
+                double read[3] = { triangles.x[k][i], triangles.y[k][i], triangles.z[k][i] };
+                for (int j = 0; j < 3; ++j) {
+                    double error = fabs(read[j] - c[3 * k + j]) / max(1.0, fabs(c[3 * k + j]));
+                    if (!(error <= worst[worker]))
+                        worst[worker] = std::isnan(error) ? 1.0 : error;
+                }
+            }
+        }
+    });
+    return *max_element(worst.begin(), worst.end());
+}
+
+bool bench(const string& name, const string& path, uint64_t triangle_count, const TriReadOptions& options) {
+    ifstream probe(path.c_str(), ios::binary | ios::ate);
+    double megabytes = (double)probe.tellg() / (1024.0 * 1024.0);
+
+    TriangleArrays triangles;
+    string error;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    bool read = read_triangles(path, triangles, options, &error);
+    double seconds = seconds_since(start);
+    if (!read) {
+        cerr << name << " : " << error << endl;
+        return false;
+    }
+    double worst = check(triangles, triangle_count, options.threads);
+    printf("%-6s %10.1f MB %8.3f s %10.1f MB/s %10.2f Mtri/s   max rel. error %.2g\n", name.c_str(),
+           megabytes, seconds, megabytes / seconds, triangles.size() / seconds / 1e6, worst);
+    // The text has six significant digits.
+    return worst < 1e-5;
+}
+
+int main(int argc, char** argv) {
+
+    uint64_t size_mb = 2048;
+    string base = "tri_bench";
+    TriReadOptions options;
+    bool baseline = false, keep = false;
+    for (int i = 1; i < argc; ++i) {
+        string arg(argv[i]);
+        if (arg == "-h" || arg == "--help") {
+            display_usage(argc, argv);
+            return 0;
+        }
+        else if (arg == "--size-mb" && i + 1 < argc)
+            size_mb = strtoull(argv[++i], 0, 10);
+        else if (arg == "--file" && i + 1 < argc)
+            base = argv[++i];
+        else if ((arg == "-t" || arg == "--threads") && i + 1 < argc)
+            options.threads = (unsigned)atoi(argv[++i]);
+        else if (arg == "--baseline")
+            baseline = true;
+        else if (arg == "--keep")
+            keep = true;
+        else {
+            display_usage(argc, argv);
+            return 1;
+        }
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    uint64_t triangle_count = generate(base, size_mb << 20, options.threads);
+    if (triangle_count == 0) {
+        cerr << "Error : cannot write " << base << ".tri/.trb/.stl" << endl;
+        return 1;
+    }
+    printf("generated %llu triangles in %.1f s, reading with %u threads\n", (unsigned long long)triangle_count,
+           seconds_since(start), options.threads > 0 ? options.threads : default_thread_count());
+
+    bool ok = bench(".tri", base + ".tri", triangle_count, options);
+    ok = bench(".trb", base + ".trb", triangle_count, options) && ok;
+    ok = bench(".stl", base + ".stl", triangle_count, options) && ok;
+
+    if (baseline) {
+        // What the consumers did so far, on a prefix of the file.
+        ifstream input((base + ".tri").c_str());
+        const uint64_t limit = 64 << 20;
+        uint64_t values = 0;
+        double value, sum = 0.0;
+        start = chrono::steady_clock::now();
+        while ((values % 4096 != 0 || (uint64_t)input.tellg() < limit) && input >> value) {
+            sum += value;
+            ++values;
+        }
+        double seconds = seconds_since(start);
+        printf("%-6s %10.1f MB %8.3f s %10.1f MB/s   (istream >> double, one thread, checksum %g)\n", "base",
+               limit / (1024.0 * 1024.0), seconds, limit / (1024.0 * 1024.0) / seconds, sum);
+    }
+
+    if (!keep) {
+        remove((base + ".tri").c_str());
+        remove((base + ".trb").c_str());
+        remove((base + ".stl").c_str());
+    }
+    if (!ok) {
+        cerr << "Error : the files read back differ from what was generated" << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,486 @@
+#ifndef SKP2TRI_TRI_BVH_H
+#define SKP2TRI_TRI_BVH_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <stdint.h>
+#include "parallel.h"
+#include "tri_reader.h"
+#include "tri_format.h"
+#include "mapped_file.h"
+#include "buffered_writer.h"
+
+// Bounding volume hierarchy over a triangle set, built top-down with the
+// binned surface area heuristic, and its sidecar file (layout in
+// tri_format.h). Triangles with a non finite coordinate are left out.
+
+struct BvhOptions {
+    unsigned threads;       // 0: one per core
+    unsigned leaf_size;     // most triangles per leaf (at most 65535)
+    unsigned bins;          // SAH candidate splits per axis are bins - 1 (at most 64)
+    double traversal_cost;  // cost of visiting a node, a triangle test costing 1
+    unsigned packet_width;  // triangles the consumer tests at once (see tri_ray.h)
+
+    BvhOptions() : threads(0), leaf_size(8), bins(16), traversal_cost(1.0), packet_width(1) {}
+};
+
+struct Bvh {
+    std::vector<TriBvhNode> nodes;
+    std::vector<uint32_t> triangles; // triangle number of each leaf entry
+};
+
+namespace bvh_detail {
+
+const unsigned MAX_BINS = 64;
+// Nodes above this size bin on several threads and build their two
+// children concurrently.
+const size_t PARALLEL_SIZE = 1 << 16;
+
+// Boxes are updated four lanes at a time (GCC vector extensions, loaded
+// and stored with memcpy so nothing needs to be aligned); the fourth lane
+// is padding.
+typedef float Lanes __attribute__((vector_size(16)));
+
+inline Lanes load_lanes(const float* values) {
+    Lanes lanes;
+    std::memcpy(&lanes, values, sizeof(lanes));
+    return lanes;
+}
+
+inline void store_lanes(float* values, Lanes lanes) {
+    std::memcpy(values, &lanes, sizeof(lanes));
+}
+
+inline Lanes lanes_min(Lanes a, Lanes b) { return a < b ? a : b; }
+inline Lanes lanes_max(Lanes a, Lanes b) { return a > b ? a : b; }
+
+// Half the surface area of the box [low, high].
+inline float lanes_area(Lanes low, Lanes high) {
+    Lanes size = high - low;
+    return size[0] * size[1] + size[1] * size[2] + size[2] * size[0];
+}
+
+// A triangle's bounds: partitioning moves these (and the triangle numbers
+// alongside), so the builder never goes back to the corner arrays.
+struct Reference {
+    float min[4];
+    float max[4];
+};
+
+struct Box {
+    float min[4];
+    float max[4];
+
+    Box() {
+        for (int d = 0; d < 4; ++d) {
+            min[d] = FLT_MAX;
+            max[d] = -FLT_MAX;
+        }
+    }
+
+    void grow(Lanes low, Lanes high) {
+        store_lanes(min, lanes_min(load_lanes(min), low));
+        store_lanes(max, lanes_max(load_lanes(max), high));
+    }
+
+    void grow(const float* low, const float* high) { grow(load_lanes(low), load_lanes(high)); }
+    void grow(const Box& other) { grow(other.min, other.max); }
+    void grow(const Reference& reference) { grow(reference.min, reference.max); }
+
+    // Half the surface area, which is all the heuristic needs.
+    double area() const {
+        if (min[0] > max[0])
+            return 0.0;
+        double x = max[0] - min[0], y = max[1] - min[1], z = max[2] - min[2];
+        return x * y + y * z + z * x;
+    }
+};
+
+// Twice the centre of the reference's bounds.
+inline Lanes center(const Reference& reference) {
+    return load_lanes(reference.min) + load_lanes(reference.max);
+}
+
+// Cost of testing `count` triangles, `width` at a time.
+inline double test_cost(size_t count, unsigned width) {
+    return (double)((count + width - 1) / width);
+}
+
+// Plain storage, so that a Binning on the stack costs nothing to create:
+// only the first `count` bins of each axis are used and cleared.
+struct Bin {
+    float min[4];
+    float max[4];
+    uint32_t count;
+};
+
+struct Binning {
+    Bin bins[3][MAX_BINS];
+
+    void clear(unsigned count) {
+        for (int axis = 0; axis < 3; ++axis)
+            for (unsigned b = 0; b < count; ++b) {
+                Bin& bin = bins[axis][b];
+                for (int d = 0; d < 4; ++d) {
+                    bin.min[d] = FLT_MAX;
+                    bin.max[d] = -FLT_MAX;
+                }
+                bin.count = 0;
+            }
+    }
+};
+
+struct Split {
+    int axis;
+    unsigned bin;   // references in bins <= bin go to the first child
+    double cost;
+    Box bounds[2];
+    Box centers[2];
+
+    Split() : axis(-1), bin(0), cost(DBL_MAX) {}
+};
+
+// Bins of a centre for the centre box `centers`, shared by the binning
+// and the partition so both agree to the last bit.
+struct BinMapping {
+    Lanes origin;
+    Lanes scale;
+    int bins;
+
+    BinMapping(const Box& centers, unsigned count) : bins((int)count) {
+        float scales[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        for (int d = 0; d < 3; ++d) {
+            float extent = centers.max[d] - centers.min[d];
+            scales[d] = extent > 0.0f ? (float)count * 0.99999f / extent : 0.0f;
+        }
+        origin = load_lanes(centers.min);
+        scale = load_lanes(scales);
+    }
+
+    void bin(Lanes twice_center, int* out) const {
+        Lanes position = (twice_center - origin) * scale;
+        for (int d = 0; d < 3; ++d)
+            out[d] = std::max(0, std::min(bins - 1, (int)position[d]));
+    }
+
+    int bin(Lanes twice_center, int axis) const {
+        Lanes position = (twice_center - origin) * scale;
+        return std::max(0, std::min(bins - 1, (int)position[axis]));
+    }
+};
+
+inline void bin_references(const Reference* references, size_t begin, size_t end, const BinMapping& mapping,
+                           Binning& binning) {
+    for (size_t i = begin; i < end; ++i) {
+        const Reference& reference = references[i];
+        Lanes low = load_lanes(reference.min), high = load_lanes(reference.max);
+        int b[3];
+        mapping.bin(low + high, b);
+        for (int axis = 0; axis < 3; ++axis) {
+            Bin& bin = binning.bins[axis][b[axis]];
+            store_lanes(bin.min, lanes_min(load_lanes(bin.min), low));
+            store_lanes(bin.max, lanes_max(load_lanes(bin.max), high));
+            ++bin.count;
+        }
+    }
+}
+
+// Best SAH split of [begin, end), without the centre boxes of the
+// children. axis stays -1 when every centre is the same point.
+inline Split find_split(const Reference* references, size_t begin, size_t end, const Box& bounds,
+                        const BinMapping& mapping, const BvhOptions& options, unsigned threads) {
+    unsigned bin_count = (unsigned)mapping.bins;
+    Binning binning;
+    binning.clear(bin_count);
+    size_t count = end - begin;
+    if (threads > 1 && count > PARALLEL_SIZE) {
+        size_t chunks = std::min((size_t)threads * 4, (count + PARALLEL_SIZE - 1) / PARALLEL_SIZE);
+        std::vector<Binning> partial(chunks);
+        parallel_for(chunks, threads, [&](size_t c, unsigned) {
+            partial[c].clear(bin_count);
+            bin_references(references, begin + count * c / chunks, begin + count * (c + 1) / chunks, mapping,
+                           partial[c]);
+        });
+        for (size_t c = 0; c < chunks; ++c)
+            for (int axis = 0; axis < 3; ++axis)
+                for (unsigned b = 0; b < bin_count; ++b) {
+                    Bin& bin = binning.bins[axis][b];
+                    const Bin& other = partial[c].bins[axis][b];
+                    store_lanes(bin.min, lanes_min(load_lanes(bin.min), load_lanes(other.min)));
+                    store_lanes(bin.max, lanes_max(load_lanes(bin.max), load_lanes(other.max)));
+                    bin.count += other.count;
+                }
+    }
+    else
+        bin_references(references, begin, end, mapping, binning);
+
+    // Sweep each axis from the right, then evaluate the planes from the left.
+    Split best;
+    double parent = std::max(bounds.area(), 1e-300);
+    for (int axis = 0; axis < 3; ++axis) {
+        if (mapping.scale[axis] == 0.0f)
+            continue;
+        const Bin* bins = binning.bins[axis];
+        float right_area[MAX_BINS];
+        Box empty;
+        Lanes low = load_lanes(empty.min), high = load_lanes(empty.max);
+        for (unsigned b = bin_count - 1; b > 0; --b) {
+            low = lanes_min(low, load_lanes(bins[b].min));
+            high = lanes_max(high, load_lanes(bins[b].max));
+            right_area[b] = lanes_area(low, high);
+        }
+        low = load_lanes(empty.min);
+        high = load_lanes(empty.max);
+        size_t left_count = 0;
+        for (unsigned b = 0; b + 1 < bin_count; ++b) {
+            low = lanes_min(low, load_lanes(bins[b].min));
+            high = lanes_max(high, load_lanes(bins[b].max));
+            left_count += bins[b].count;
+            size_t right_count = count - left_count;
+            if (left_count == 0 || right_count == 0)
+                continue;
+            double cost = options.traversal_cost
+                + ((double)lanes_area(low, high) * test_cost(left_count, options.packet_width)
+                   + (double)right_area[b + 1] * test_cost(right_count, options.packet_width)) / parent;
+            if (cost < best.cost) {
+                best.axis = axis;
+                best.bin = b;
+                best.cost = cost;
+            }
+        }
+    }
+    if (best.axis >= 0)
+        for (unsigned b = 0; b < bin_count; ++b)
+            best.bounds[b <= best.bin ? 0 : 1].grow(binning.bins[best.axis][b].min, binning.bins[best.axis][b].max);
+    return best;
+}
+
+// Moves the references of the first child (and their triangle numbers)
+// in front, gathering the centre box of each side on the way. Returns the
+// start of the second child. Each reference is copied to the front or the
+// back of `scratch` and the range copied back: no branch depends on the
+// side, which is as good as random.
+inline size_t partition_references(Reference* references, uint32_t* numbers, Reference* scratch,
+                                   uint32_t* scratch_numbers, size_t begin, size_t end, const BinMapping& mapping,
+                                   Split& split) {
+    Box empty;
+    Lanes low[2] = { load_lanes(empty.min), load_lanes(empty.min) };
+    Lanes high[2] = { load_lanes(empty.max), load_lanes(empty.max) };
+    size_t first = begin, last = end;
+    for (size_t i = begin; i < end; ++i) {
+        Lanes twice = center(references[i]);
+        int side = mapping.bin(twice, split.axis) > (int)split.bin;
+        size_t target = side ? --last : first++;
+        scratch[target] = references[i];
+        scratch_numbers[target] = numbers[i];
+        low[side] = lanes_min(low[side], twice);
+        high[side] = lanes_max(high[side], twice);
+    }
+    std::memcpy(references + begin, scratch + begin, (end - begin) * sizeof(Reference));
+    std::memcpy(numbers + begin, scratch_numbers + begin, (end - begin) * sizeof(uint32_t));
+    for (int side = 0; side < 2; ++side) {
+        store_lanes(split.centers[side].min, low[side]);
+        store_lanes(split.centers[side].max, high[side]);
+    }
+    return first;
+}
+
+// Builds the subtree of [begin, end) at the end of `nodes`; its second
+// children are indices into `nodes`.
+inline void build_node(Reference* references, uint32_t* numbers, Reference* scratch, uint32_t* scratch_numbers,
+                       size_t begin, size_t end, const Box& bounds,
+                       const Box& centers, const BvhOptions& options, unsigned threads,
+                       std::vector<TriBvhNode>& nodes) {
+    size_t self = nodes.size();
+    TriBvhNode node;
+    for (int d = 0; d < 3; ++d) {
+        node.min[d] = bounds.min[d];
+        node.max[d] = bounds.max[d];
+    }
+    node.first = (uint32_t)begin;
+    node.count = (uint16_t)(end - begin);
+    node.axis = 0;
+    nodes.push_back(node);
+
+    size_t count = end - begin;
+    if (count <= 1)
+        return;
+    // Small nodes have fewer candidate planes than the big ones.
+    BinMapping mapping(centers, (unsigned)std::min((size_t)options.bins, std::max((size_t)4, count)));
+    Split split = find_split(references, begin, end, bounds, mapping, options, threads);
+    if (count <= options.leaf_size && (split.axis < 0 || split.cost >= test_cost(count, options.packet_width)))
+        return;
+
+    size_t middle;
+    if (split.axis >= 0)
+        middle = partition_references(references, numbers, scratch, scratch_numbers, begin, end, mapping, split);
+    else {
+        // All the centres coincide: halve the list.
+        middle = begin + count / 2;
+        split.axis = 0;
+        for (size_t i = begin; i < end; ++i) {
+            int side = i < middle ? 0 : 1;
+            Lanes twice = center(references[i]);
+            split.bounds[side].grow(references[i]);
+            split.centers[side].grow(twice, twice);
+        }
+    }
+    nodes[self].count = 0;
+    nodes[self].axis = (uint16_t)split.axis;
+
+    if (threads > 1 && count > PARALLEL_SIZE) {
+        std::vector<TriBvhNode> second;
+        parallel_for(2, 2, [&](size_t side, unsigned) {
+            if (side == 0)
+                build_node(references, numbers, scratch, scratch_numbers, begin, middle, split.bounds[0],
+                           split.centers[0], options, threads / 2, nodes);
+            else
+                build_node(references, numbers, scratch, scratch_numbers, middle, end, split.bounds[1],
+                           split.centers[1], options, threads - threads / 2, second);
+        });
+        uint32_t base = (uint32_t)nodes.size();
+        nodes[self].first = base;
+        for (size_t n = 0; n < second.size(); ++n) {
+            if (second[n].count == 0)
+                second[n].first += base;
+            nodes.push_back(second[n]);
+        }
+    }
+    else {
+        build_node(references, numbers, scratch, scratch_numbers, begin, middle, split.bounds[0], split.centers[0],
+                   options, 1, nodes);
+        nodes[self].first = (uint32_t)nodes.size();
+        build_node(references, numbers, scratch, scratch_numbers, middle, end, split.bounds[1], split.centers[1],
+                   options, 1, nodes);
+    }
+}
+
+} // namespace bvh_detail
+
+// The tree only depends on the triangles and the options, not on the
+// thread count: every split is chosen from the same merged bins.
+inline void build_bvh(const TriangleArrays& triangles, const BvhOptions& options, Bvh& bvh) {
+    using namespace bvh_detail;
+    BvhOptions checked = options;
+    checked.threads = options.threads > 0 ? options.threads : default_thread_count();
+    checked.leaf_size = std::max(1u, std::min(65535u, options.leaf_size));
+    checked.bins = std::max(2u, std::min(MAX_BINS, options.bins));
+    checked.packet_width = std::max(1u, options.packet_width);
+
+    size_t count = triangles.size();
+    std::vector<Reference> references(count);
+    std::vector<uint8_t> finite(count);
+    parallel_for((count + PARALLEL_SIZE - 1) / PARALLEL_SIZE, checked.threads, [&](size_t task, unsigned) {
+        for (size_t i = task * PARALLEL_SIZE; i < std::min(count, (task + 1) * PARALLEL_SIZE); ++i) {
+            Reference& reference = references[i];
+            float sum = 0.0f;
+            for (int d = 0; d < 3; ++d) {
+                const std::vector<float>* axis = d == 0 ? triangles.x : d == 1 ? triangles.y : triangles.z;
+                reference.min[d] = std::min(axis[0][i], std::min(axis[1][i], axis[2][i]));
+                reference.max[d] = std::max(axis[0][i], std::max(axis[1][i], axis[2][i]));
+                sum += axis[0][i] + axis[1][i] + axis[2][i];
+            }
+            reference.min[3] = reference.max[3] = 0.0f;
+            finite[i] = sum - sum == 0.0f;
+        }
+    });
+    bvh.nodes.clear();
+    bvh.triangles.clear();
+    size_t kept = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (!finite[i])
+            continue;
+        references[kept++] = references[i];
+        bvh.triangles.push_back((uint32_t)i);
+    }
+    references.resize(kept);
+    if (kept == 0)
+        return;
+
+    Box bounds, centers;
+    for (size_t i = 0; i < kept; ++i) {
+        Lanes twice = center(references[i]);
+        bounds.grow(references[i]);
+        centers.grow(twice, twice);
+    }
+    bvh.nodes.reserve(2 * kept / std::max(1u, checked.leaf_size / 2));
+    std::vector<Reference> scratch(kept);
+    std::vector<uint32_t> scratch_numbers(kept);
+    build_node(&references[0], &bvh.triangles[0], &scratch[0], &scratch_numbers[0], 0, kept, bounds, centers, checked,
+               checked.threads, bvh.nodes);
+}
+
+// Expected cost of a random ray query relative to testing every triangle,
+// as estimated by the heuristic: for comparing builds.
+inline double bvh_sah_cost(const Bvh& bvh, double traversal_cost = 1.0) {
+    if (bvh.nodes.empty())
+        return 0.0;
+    bvh_detail::Box root;
+    root.grow(bvh.nodes[0].min, bvh.nodes[0].max);
+    double cost = 0.0;
+    for (size_t n = 0; n < bvh.nodes.size(); ++n) {
+        bvh_detail::Box box;
+        box.grow(bvh.nodes[n].min, bvh.nodes[n].max);
+        cost += box.area() * (bvh.nodes[n].count == 0 ? traversal_cost : (double)bvh.nodes[n].count);
+    }
+    return cost / std::max(root.area(), 1e-300);
+}
+
+// Writes the sidecar; `data_size` is the size of the triangle file.
+inline bool write_bvh(const std::string& path, const Bvh& bvh, uint64_t data_size) {
+    BufferedWriter writer;
+    if (!writer.open(path))
+        return false;
+    TriBvhHeader header = make_tri_bvh_header((uint32_t)bvh.nodes.size(), bvh.triangles.size(), data_size);
+    writer.write((const char*)&header, sizeof(header));
+    if (!bvh.nodes.empty()) {
+        writer.write((const char*)&bvh.nodes[0], bvh.nodes.size() * sizeof(TriBvhNode));
+        writer.write((const char*)&bvh.triangles[0], bvh.triangles.size() * sizeof(uint32_t));
+    }
+    return writer.close();
+}
+
+// A sidecar mapped read-only, to traverse in place.
+class MappedBvh {
+public:
+    MappedBvh() : header_(0) {}
+
+    // `data_size`, when not 0, is checked against the size recorded.
+    bool open(const std::string& path, uint64_t data_size = 0, std::string* error = 0) {
+        header_ = 0;
+        if (!file_.open(path))
+            return fail(error, "cannot open " + path);
+        if (file_.size() < TRI_BVH_HEADER_SIZE)
+            return fail(error, "not a .bvh file");
+        const TriBvhHeader* header = (const TriBvhHeader*)file_.data();
+        if (!is_tri_bvh_header(*header) || tri_bvh_file_size(*header) != file_.size())
+            return fail(error, "not a .bvh file, or truncated");
+        if (data_size != 0 && header->data_size != data_size)
+            return fail(error, "the hierarchy does not match its data file");
+        header_ = header;
+        return true;
+    }
+
+    const TriBvhHeader& header() const { return *header_; }
+    const TriBvhNode* nodes() const { return (const TriBvhNode*)(file_.data() + TRI_BVH_HEADER_SIZE); }
+    const uint32_t* triangles() const {
+        return (const uint32_t*)(file_.data() + TRI_BVH_HEADER_SIZE + header_->node_count * TRI_BVH_NODE_SIZE);
+    }
+
+private:
+    bool fail(std::string* error, const std::string& message) {
+        if (error)
+            *error = message;
+        file_.close();
+        return false;
+    }
+
+    MappedInput file_;
+    const TriBvhHeader* header_;
+};
+
+#endif // SKP2TRI_TRI_BVH_H
@@ -0,0 +1,368 @@
+#ifndef SKP2TRI_TRI_CLEAN_H
+#define SKP2TRI_TRI_CLEAN_H
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <stdint.h>
+#include "parallel.h"
+#include "tri_reader.h"
+
+// Validation and cleaning of triangle soups: triangles with a non finite
+// coordinate, triangles of zero area (collinear or repeated corners) and
+// repeated triangles are flagged, then dropped. The same code serves the
+// exporter (--clean, on the scene meshes, in double) and triclean (on the
+// files, in float), through a structure of arrays view of the corners.
+
+enum CleanFlag {
+    CLEAN_KEEP = 0,
+    CLEAN_NON_FINITE = 1,
+    CLEAN_ZERO_AREA = 2,
+    CLEAN_DUPLICATE = 3,  // same corners, same winding as an earlier triangle
+    CLEAN_FLIPPED = 4     // same corners, opposite winding
+};
+
+struct CleanOptions {
+    bool degenerate;   // drop non finite and zero area triangles
+    bool duplicates;   // drop repeated triangles
+    double tolerance;  // a triangle whose sine of its corner angle is below this has zero area
+
+    CleanOptions() : degenerate(true), duplicates(true), tolerance(1e-7) {}
+};
+
+struct CleanStats {
+    uint64_t input;
+    uint64_t non_finite;
+    uint64_t zero_area;
+    uint64_t duplicates;
+    uint64_t flipped;
+
+    CleanStats() : input(0), non_finite(0), zero_area(0), duplicates(0), flipped(0) {}
+
+    uint64_t removed() const { return non_finite + zero_area + duplicates + flipped; }
+
+    void add(const CleanStats& other) {
+        input += other.input;
+        non_finite += other.non_finite;
+        zero_area += other.zero_area;
+        duplicates += other.duplicates;
+        flipped += other.flipped;
+    }
+
+    void count(const std::vector<uint8_t>& flags) {
+        input += flags.size();
+        for (size_t i = 0; i < flags.size(); ++i) {
+            non_finite += flags[i] == CLEAN_NON_FINITE;
+            zero_area += flags[i] == CLEAN_ZERO_AREA;
+            duplicates += flags[i] == CLEAN_DUPLICATE;
+            flipped += flags[i] == CLEAN_FLIPPED;
+        }
+    }
+};
+
+// Corner k of triangle i is (x[k][i], y[k][i], z[k][i]).
+template <class T>
+struct TriangleView {
+    const T* x[3];
+    const T* y[3];
+    const T* z[3];
+    size_t count;
+};
+
+// 32 byte vectors (GCC vector extensions): eight floats or four doubles per
+// operation, compiled to whatever the target has (two SSE registers on
+// plain x86-64, one AVX register with -mavx).
+template <class T>
+struct CleanLanes {
+    typedef T Vector __attribute__((vector_size(32)));
+    enum { WIDTH = 32 / sizeof(T) };
+};
+
+// The flag of one triangle of corners c as far as its area goes, the same
+// test as the vector lanes below.
+template <class T>
+inline uint8_t clean_degenerate_flag(const T* c, T tolerance2) {
+    T finite = 0;
+    for (int k = 0; k < 9; ++k)
+        finite += c[k] - c[k];
+    T ux = c[3] - c[0], uy = c[4] - c[1], uz = c[5] - c[2];
+    T vx = c[6] - c[0], vy = c[7] - c[1], vz = c[8] - c[2];
+    T nx = uy * vz - uz * vy, ny = uz * vx - ux * vz, nz = ux * vy - uy * vx;
+    T cross2 = nx * nx + ny * ny + nz * nz;
+    T limit2 = (ux * ux + uy * uy + uz * uz) * (vx * vx + vy * vy + vz * vz) * tolerance2;
+    if (finite != finite)
+        return CLEAN_NON_FINITE;
+    return cross2 <= limit2 ? CLEAN_ZERO_AREA : CLEAN_KEEP;
+}
+
+// Flags the non finite and zero area triangles of [begin, end) in `flags`,
+// leaving the others untouched. Zero area means |e1 x e2| <= tolerance *
+// |e1| * |e2|, which does not depend on the scale of the model; repeated
+// corners give zero edges and so zero area too.
+template <class T>
+void flag_degenerate(const TriangleView<T>& view, size_t begin, size_t end, T tolerance, uint8_t* flags) {
+    typedef typename CleanLanes<T>::Vector Vector;
+    const size_t width = CleanLanes<T>::WIDTH;
+    const T tolerance2 = tolerance * tolerance;
+
+    size_t i = begin;
+    for (; i + width <= end; i += width) {
+        Vector c[9];
+        for (int k = 0; k < 3; ++k) {
+            std::memcpy(&c[3 * k], view.x[k] + i, sizeof(Vector));
+            std::memcpy(&c[3 * k + 1], view.y[k] + i, sizeof(Vector));
+            std::memcpy(&c[3 * k + 2], view.z[k] + i, sizeof(Vector));
+        }
+        // x - x is NaN exactly when x is NaN or infinite.
+        Vector finite = c[0] - c[0];
+        for (int k = 1; k < 9; ++k)
+            finite += c[k] - c[k];
+        Vector ux = c[3] - c[0], uy = c[4] - c[1], uz = c[5] - c[2];
+        Vector vx = c[6] - c[0], vy = c[7] - c[1], vz = c[8] - c[2];
+        Vector nx = uy * vz - uz * vy, ny = uz * vx - ux * vz, nz = ux * vy - uy * vx;
+        Vector cross2 = nx * nx + ny * ny + nz * nz;
+        Vector limit2 = (ux * ux + uy * uy + uz * uz) * (vx * vx + vy * vy + vz * vz) * tolerance2;
+        typedef __typeof__(cross2 <= limit2) Mask;
+        Mask non_finite = finite != finite;
+        Mask zero_area = cross2 <= limit2;
+        for (size_t l = 0; l < width; ++l) {
+            if (non_finite[l])
+                flags[i + l] = CLEAN_NON_FINITE;
+            else if (zero_area[l])
+                flags[i + l] = CLEAN_ZERO_AREA;
+        }
+    }
+
+    for (; i < end; ++i) {
+        T c[9];
+        for (int k = 0; k < 3; ++k) {
+            c[3 * k] = view.x[k][i];
+            c[3 * k + 1] = view.y[k][i];
+            c[3 * k + 2] = view.z[k][i];
+        }
+        uint8_t flag = clean_degenerate_flag(c, tolerance2);
+        if (flag != CLEAN_KEEP)
+            flags[i] = flag;
+    }
+}
+
+// Corners of a triangle sorted by their bit patterns (-0 folded into +0),
+// so that every rotation and reflection gives the same key.
+template <class T>
+struct CleanKey {
+    T corners[9];
+
+    bool operator==(const CleanKey& other) const {
+        return std::memcmp(corners, other.corners, sizeof(corners)) == 0;
+    }
+};
+
+// The bits of a coordinate, -0 folded into +0 like the keys.
+template <class T>
+inline uint64_t clean_bits(T value) {
+    value += T(0);
+    uint64_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(value));
+    return bits;
+}
+
+// Hash of one corner, each coordinate mixed in turn. Round coordinates only
+// differ in their high bits, which each step folds into the low ones.
+template <class T>
+inline uint64_t clean_corner_hash(T x, T y, T z) {
+    uint64_t h = clean_bits(x) * 0x9E3779B97F4A7C15ULL;
+    h = ((h ^ (h >> 29)) ^ clean_bits(y)) * 0xBF58476D1CE4E5B9ULL;
+    h = ((h ^ (h >> 29)) ^ clean_bits(z)) * 0x94D049BB133111EBULL;
+    return h ^ (h >> 32);
+}
+
+// Hash of a triangle from the hashes of its corners, the same for every
+// rotation and reflection of them (a symmetric function), so that the
+// corners need no sorting: the keys are only built to confirm a match.
+inline uint32_t clean_triangle_hash(uint64_t a, uint64_t b, uint64_t c) {
+    uint64_t h = (a + b + c) ^ ((a ^ b ^ c) * 0x94D049BB133111EBULL);
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+// Hash of triangle i of `view`.
+template <class T>
+inline uint32_t clean_hash(const TriangleView<T>& view, size_t i) {
+    return clean_triangle_hash(clean_corner_hash(view.x[0][i], view.y[0][i], view.z[0][i]),
+                               clean_corner_hash(view.x[1][i], view.y[1][i], view.z[1][i]),
+                               clean_corner_hash(view.x[2][i], view.y[2][i], view.z[2][i]));
+}
+
+// Sorts the corners of a key, and tells whether that flipped its winding.
+template <class T>
+void sort_clean_key(CleanKey<T>& key, bool& odd) {
+    // Three element sorting network; each swap flips the winding.
+    odd = false;
+    static const int pairs[3][2] = { { 0, 1 }, { 1, 2 }, { 0, 1 } };
+    for (int s = 0; s < 3; ++s) {
+        T* a = key.corners + 3 * pairs[s][0];
+        T* b = key.corners + 3 * pairs[s][1];
+        if (std::memcmp(a, b, 3 * sizeof(T)) > 0) {
+            for (int k = 0; k < 3; ++k)
+                std::swap(a[k], b[k]);
+            odd = !odd;
+        }
+    }
+}
+
+// Key of a triangle of corners c, and whether sorting them flipped its
+// winding.
+template <class T>
+CleanKey<T> clean_key(const T* c, bool& odd) {
+    CleanKey<T> key;
+    for (int k = 0; k < 9; ++k)
+        key.corners[k] = c[k] + T(0);
+    sort_clean_key(key, odd);
+    return key;
+}
+
+// Key of triangle i of `view`.
+template <class T>
+CleanKey<T> clean_key(const TriangleView<T>& view, size_t i, bool& odd) {
+    T c[9];
+    for (int k = 0; k < 3; ++k) {
+        c[3 * k] = view.x[k][i];
+        c[3 * k + 1] = view.y[k][i];
+        c[3 * k + 2] = view.z[k][i];
+    }
+    return clean_key(c, odd);
+}
+
+const uint64_t CLEAN_EMPTY_SLOT = ~0ULL;
+
+// Open addressing table of (hash << 32 | triangle) for the duplicate search,
+// its storage reused from one search to the next.
+class CleanTable {
+public:
+    void reset(size_t members) {
+        bits_ = 4;
+        while (((size_t)1 << bits_) < 4 * members)
+            ++bits_;
+        shift_ = bits_ < 32 ? 32 - bits_ : 0;
+        slots_.assign((size_t)1 << bits_, CLEAN_EMPTY_SLOT);
+    }
+
+    // The earlier triangle that `same` says triangle i repeats, or i itself
+    // once recorded.
+    template <class Same>
+    uint32_t insert(uint32_t hash, uint32_t i, Same same) {
+        const size_t mask = slots_.size() - 1;
+        for (size_t slot = (size_t)((hash * 0x9E3779B9u) >> shift_) & mask;; slot = (slot + 1) & mask) {
+            if (slots_[slot] == CLEAN_EMPTY_SLOT) {
+                slots_[slot] = ((uint64_t)hash << 32) | i;
+                return i;
+            }
+            uint32_t earlier = (uint32_t)slots_[slot];
+            if ((uint32_t)(slots_[slot] >> 32) == hash && same(earlier))
+                return earlier;
+        }
+    }
+
+private:
+    std::vector<uint64_t> slots_;
+    int bits_;
+    int shift_;
+};
+
+// Flags every triangle of `view` (flags must have view.count entries, set
+// to CLEAN_KEEP, and there must be less than 2^32 triangles). The first of
+// several repeated triangles is kept.
+template <class T>
+void flag_triangles(const TriangleView<T>& view, const CleanOptions& options, unsigned threads,
+                    std::vector<uint8_t>& flags) {
+    const size_t block = 65536;
+    size_t blocks = (view.count + block - 1) / block;
+    if (options.degenerate) {
+        parallel_for(blocks, threads, [&](size_t b, unsigned) {
+            flag_degenerate<T>(view, b * block, std::min(view.count, (b + 1) * block), (T)options.tolerance,
+                               &flags[0]);
+        });
+    }
+    if (!options.duplicates)
+        return;
+
+    // Each worker deduplicates its own hash partition of the triangles. With
+    // a single partition (as clean_scene runs, one mesh per worker), the
+    // hashes are computed as the table is filled instead.
+    if (threads == 0)
+        threads = default_thread_count();
+    unsigned partitions = (unsigned)std::min<size_t>(threads, std::max<size_t>(blocks, 1));
+    std::vector<uint32_t> hashes(partitions > 1 ? view.count : 0);
+    if (partitions > 1) {
+        parallel_for(blocks, threads, [&](size_t b, unsigned) {
+            for (size_t i = b * block; i < std::min(view.count, (b + 1) * block); ++i)
+                hashes[i] = clean_hash(view, i);
+        });
+    }
+    // The partition of a hash by multiply and shift: a division per triangle
+    // would cost as much as its hash.
+    auto partition_of = [partitions](uint32_t hash) { return (size_t)(((uint64_t)hash * partitions) >> 32); };
+    parallel_for(partitions, partitions, [&](size_t partition, unsigned) {
+        size_t members = partitions > 1 ? 0 : view.count;
+        for (size_t i = 0; i < hashes.size(); ++i)
+            members += partition_of(hashes[i]) == partition;
+        CleanTable table;
+        table.reset(members);
+        for (size_t i = 0; i < view.count; ++i) {
+            if (flags[i] != CLEAN_KEEP)
+                continue;
+            uint32_t hash = partitions > 1 ? hashes[i] : clean_hash(view, i);
+            if (partition_of(hash) != partition)
+                continue;
+            CleanKey<T> key;
+            bool built = false, odd = false, first_odd = false;
+            uint32_t first = table.insert(hash, (uint32_t)i, [&](uint32_t earlier) {
+                if (!built) {
+                    key = clean_key(view, i, odd);
+                    built = true;
+                }
+                return clean_key(view, earlier, first_odd) == key;
+            });
+            if (first != i)
+                flags[i] = first_odd == odd ? CLEAN_DUPLICATE : CLEAN_FLIPPED;
+        }
+    });
+}
+
+inline TriangleView<float> triangle_view(const TriangleArrays& triangles) {
+    TriangleView<float> view;
+    for (int k = 0; k < 3; ++k) {
+        view.x[k] = triangles.x[k].empty() ? 0 : &triangles.x[k][0];
+        view.y[k] = triangles.y[k].empty() ? 0 : &triangles.y[k][0];
+        view.z[k] = triangles.z[k].empty() ? 0 : &triangles.z[k][0];
+    }
+    view.count = triangles.size();
+    return view;
+}
+
+// Flags the triangles and drops the bad ones, keeping the order of the
+// others.
+inline CleanStats clean_triangles(TriangleArrays& triangles, const CleanOptions& options, unsigned threads) {
+    std::vector<uint8_t> flags(triangles.size(), CLEAN_KEEP);
+    if (!flags.empty())
+        flag_triangles(triangle_view(triangles), options, threads, flags);
+    CleanStats stats;
+    stats.count(flags);
+
+    size_t kept = 0;
+    for (size_t i = 0; i < flags.size(); ++i) {
+        if (flags[i] != CLEAN_KEEP)
+            continue;
+        if (kept != i) {
+            for (int k = 0; k < 3; ++k) {
+                triangles.x[k][kept] = triangles.x[k][i];
+                triangles.y[k][kept] = triangles.y[k][i];
+                triangles.z[k][kept] = triangles.z[k][i];
+            }
+        }
+        ++kept;
+    }
+    triangles.resize(kept);
+    return stats;
+}
+
+#endif // SKP2TRI_TRI_CLEAN_H
@@ -0,0 +1,401 @@
+#ifndef SKP2TRI_TRI_DECIMATE_H
+#define SKP2TRI_TRI_DECIMATE_H
+
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+
+// Mesh simplification by edge collapse under the quadric error metric
+// (Garland and Heckbert): each vertex carries the sum of the squared
+// distances to the planes of its triangles, every edge is priced by the
+// error of collapsing it to the point minimizing that sum, and the
+// cheapest edges go first. Open borders and the seams between triangle
+// groups (materials) add planes across the edge so that they hold their
+// shape. A collapse that would flip a triangle is refused.
+//
+// One run produces every level of detail: the collapses go on from one
+// target to the next, and the state is copied out at each.
+
+struct DecimateOptions {
+    double border_weight; // of the planes along borders and seams, relative to the triangles'
+
+    DecimateOptions() : border_weight(100.0) {}
+};
+
+// A level of detail of the input: the input triangles still standing, in
+// input order, and where every input vertex has moved.
+struct DecimateLevel {
+    std::vector<uint32_t> triangles;
+    std::vector<double> positions; // 3 per input vertex
+};
+
+namespace decimate_detail {
+
+// Symmetric 4x4 matrix of a sum of squared plane distances.
+struct Quadric {
+    double a[10]; // xx xy xz xw yy yz yw zz zw ww
+
+    Quadric() {
+        for (int i = 0; i < 10; ++i)
+            a[i] = 0.0;
+    }
+
+    // Plane n.p + d = 0 with |n| = 1, weighted.
+    void add_plane(const double* n, double d, double weight) {
+        a[0] += weight * n[0] * n[0];
+        a[1] += weight * n[0] * n[1];
+        a[2] += weight * n[0] * n[2];
+        a[3] += weight * n[0] * d;
+        a[4] += weight * n[1] * n[1];
+        a[5] += weight * n[1] * n[2];
+        a[6] += weight * n[1] * d;
+        a[7] += weight * n[2] * n[2];
+        a[8] += weight * n[2] * d;
+        a[9] += weight * d * d;
+    }
+
+    void add(const Quadric& other) {
+        for (int i = 0; i < 10; ++i)
+            a[i] += other.a[i];
+    }
+
+    double error(const double* p) const {
+        double x = p[0], y = p[1], z = p[2];
+        return a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x + a[4] * y * y
+            + 2 * a[5] * y * z + 2 * a[6] * y + a[7] * z * z + 2 * a[8] * z + a[9];
+    }
+
+    // The point of least error, when the system is well conditioned.
+    bool minimum(double* p) const {
+        double det = a[0] * (a[4] * a[7] - a[5] * a[5]) - a[1] * (a[1] * a[7] - a[5] * a[2])
+            + a[2] * (a[1] * a[5] - a[4] * a[2]);
+        double scale = (a[0] + a[4] + a[7]) / 3.0;
+        if (!(std::fabs(det) > 1e-10 * scale * scale * scale))
+            return false;
+        double b[3] = { -a[3], -a[6], -a[8] };
+        double inverse = 1.0 / det;
+        p[0] = inverse * (b[0] * (a[4] * a[7] - a[5] * a[5]) - a[1] * (b[1] * a[7] - a[5] * b[2])
+                          + a[2] * (b[1] * a[5] - a[4] * b[2]));
+        p[1] = inverse * (a[0] * (b[1] * a[7] - b[2] * a[5]) - b[0] * (a[1] * a[7] - a[5] * a[2])
+                          + a[2] * (a[1] * b[2] - b[1] * a[2]));
+        p[2] = inverse * (a[0] * (a[4] * b[2] - a[5] * b[1]) - a[1] * (a[1] * b[2] - b[1] * a[2])
+                          + b[0] * (a[1] * a[5] - a[4] * a[2]));
+        return true;
+    }
+};
+
+inline void cross(const double* u, const double* v, double* out) {
+    out[0] = u[1] * v[2] - u[2] * v[1];
+    out[1] = u[2] * v[0] - u[0] * v[2];
+    out[2] = u[0] * v[1] - u[1] * v[0];
+}
+
+inline double dot(const double* u, const double* v) { return u[0] * v[0] + u[1] * v[1] + u[2] * v[2]; }
+
+struct Candidate {
+    double cost;
+    uint32_t a, b;             // b collapses into a
+    uint32_t version_a, version_b;
+    double position[3];
+
+    bool operator<(const Candidate& other) const { return cost > other.cost; } // cheapest on top
+};
+
+class Decimator {
+public:
+    Decimator(const std::vector<double>& positions, const std::vector<uint32_t>& indices,
+              const std::vector<uint32_t>& groups, const DecimateOptions& options);
+
+    size_t live() const { return live_; }
+
+    // Collapses edges until at most `target` triangles are left, or no
+    // edge can go. Returns false in the latter case.
+    bool reduce(size_t target);
+
+    void level(DecimateLevel& out);
+
+private:
+    uint32_t find(uint32_t v) {
+        while (parent_[v] != v) {
+            parent_[v] = parent_[parent_[v]];
+            v = parent_[v];
+        }
+        return v;
+    }
+
+    void push(uint32_t a, uint32_t b);
+    bool flips(uint32_t moved, uint32_t other, const double* position) const;
+    void collapse(const Candidate& candidate);
+
+    std::vector<double> positions_;
+    std::vector<uint32_t> corners_;              // 3 per triangle, current vertices
+    std::vector<bool> alive_;
+    std::vector<std::vector<uint32_t> > around_; // triangles of each vertex (dead ones skipped)
+    std::vector<Quadric> quadrics_;
+    std::vector<uint32_t> versions_;
+    std::vector<uint32_t> parent_;
+    std::priority_queue<Candidate> queue_;
+    double center_[3];
+    size_t live_;
+};
+
+inline Decimator::Decimator(const std::vector<double>& positions, const std::vector<uint32_t>& indices,
+                            const std::vector<uint32_t>& groups, const DecimateOptions& options)
+    : positions_(positions), corners_(indices), live_(0) {
+    size_t vertex_count = positions.size() / 3, count = indices.size() / 3;
+
+    // Work around the centre of the bounds: the quadrics of a part far from
+    // the model's origin lose less precision.
+    for (int d = 0; d < 3; ++d) {
+        double low = HUGE_VAL, high = -HUGE_VAL;
+        for (size_t v = 0; v < vertex_count; ++v) {
+            low = std::min(low, positions_[3 * v + d]);
+            high = std::max(high, positions_[3 * v + d]);
+        }
+        center_[d] = vertex_count > 0 ? 0.5 * (low + high) : 0.0;
+        for (size_t v = 0; v < vertex_count; ++v)
+            positions_[3 * v + d] -= center_[d];
+    }
+
+    alive_.assign(count, false);
+    around_.resize(vertex_count);
+    quadrics_.resize(vertex_count);
+    versions_.assign(vertex_count, 0);
+    parent_.resize(vertex_count);
+    for (size_t v = 0; v < vertex_count; ++v)
+        parent_[v] = (uint32_t)v;
+
+    // Triangle planes, weighted by area. Triangles with repeated corners or
+    // no area are dropped right away.
+    std::vector<double> normals(3 * count, 0.0);
+    for (size_t t = 0; t < count; ++t) {
+        const uint32_t* c = &corners_[3 * t];
+        if (c[0] == c[1] || c[1] == c[2] || c[2] == c[0])
+            continue;
+        const double *p0 = &positions_[3 * c[0]], *p1 = &positions_[3 * c[1]], *p2 = &positions_[3 * c[2]];
+        double u[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+        double v[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+        double* n = &normals[3 * t];
+        cross(u, v, n);
+        double length = std::sqrt(dot(n, n));
+        if (!(length > 0.0))
+            continue;
+        for (int d = 0; d < 3; ++d)
+            n[d] /= length;
+        alive_[t] = true;
+        ++live_;
+        for (int k = 0; k < 3; ++k) {
+            quadrics_[c[k]].add_plane(n, -dot(n, p0), 0.5 * length);
+            around_[c[k]].push_back((uint32_t)t);
+        }
+    }
+
+    // Edges as (low vertex, high vertex, triangle), sorted: an edge with a
+    // single triangle is a border, one whose triangles are in different
+    // groups a seam. Both get a plane through the edge, across the
+    // triangle.
+    std::vector<std::pair<uint64_t, uint32_t> > edges;
+    edges.reserve(3 * live_);
+    for (size_t t = 0; t < count; ++t) {
+        if (!alive_[t])
+            continue;
+        for (int k = 0; k < 3; ++k) {
+            uint32_t a = corners_[3 * t + k], b = corners_[3 * t + (k + 1) % 3];
+            uint64_t key = ((uint64_t)std::min(a, b) << 32) | std::max(a, b);
+            edges.push_back(std::make_pair(key, (uint32_t)t));
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+    for (size_t e = 0; e < edges.size();) {
+        size_t end = e + 1;
+        while (end < edges.size() && edges[end].first == edges[e].first)
+            ++end;
+        uint32_t a = (uint32_t)(edges[e].first >> 32), b = (uint32_t)edges[e].first;
+        bool seam = end - e == 1;
+        for (size_t f = e + 1; f < end && !seam; ++f)
+            seam = groups[edges[f].second] != groups[edges[e].second];
+        if (seam) {
+            for (size_t f = e; f < end; ++f) {
+                const double* n = &normals[3 * edges[f].second];
+                const double *pa = &positions_[3 * a], *pb = &positions_[3 * b];
+                double edge[3] = { pb[0] - pa[0], pb[1] - pa[1], pb[2] - pa[2] };
+                double across[3];
+                cross(edge, n, across);
+                double length = std::sqrt(dot(across, across));
+                if (!(length > 0.0))
+                    continue;
+                for (int d = 0; d < 3; ++d)
+                    across[d] /= length;
+                double weight = options.border_weight * dot(edge, edge);
+                quadrics_[a].add_plane(across, -dot(across, pa), weight);
+                quadrics_[b].add_plane(across, -dot(across, pa), weight);
+            }
+        }
+        push(a, b);
+        e = end;
+    }
+}
+
+// Prices the collapse of edge (a, b): the best point if the quadric is
+// well conditioned, else the best of the ends and the middle.
+inline void Decimator::push(uint32_t a, uint32_t b) {
+    Quadric sum = quadrics_[a];
+    sum.add(quadrics_[b]);
+    Candidate candidate;
+    candidate.a = a;
+    candidate.b = b;
+    candidate.version_a = versions_[a];
+    candidate.version_b = versions_[b];
+    if (!sum.minimum(candidate.position)) {
+        const double *pa = &positions_[3 * a], *pb = &positions_[3 * b];
+        double middle[3] = { 0.5 * (pa[0] + pb[0]), 0.5 * (pa[1] + pb[1]), 0.5 * (pa[2] + pb[2]) };
+        const double* choices[3] = { pa, pb, middle };
+        double best = HUGE_VAL;
+        for (int c = 0; c < 3; ++c) {
+            double error = sum.error(choices[c]);
+            if (error < best) {
+                best = error;
+                for (int d = 0; d < 3; ++d)
+                    candidate.position[d] = choices[c][d];
+            }
+        }
+    }
+    candidate.cost = std::max(0.0, sum.error(candidate.position));
+    queue_.push(candidate);
+}
+
+// Whether moving `moved` to `position` turns over one of its triangles
+// (those shared with `other` disappear and do not count).
+inline bool Decimator::flips(uint32_t moved, uint32_t other, const double* position) const {
+    const std::vector<uint32_t>& triangles = around_[moved];
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        uint32_t t = triangles[i];
+        if (!alive_[t])
+            continue;
+        const uint32_t* c = &corners_[3 * t];
+        if (c[0] == other || c[1] == other || c[2] == other)
+            continue;
+        const double* before[3];
+        const double* after[3];
+        for (int k = 0; k < 3; ++k) {
+            before[k] = &positions_[3 * c[k]];
+            after[k] = c[k] == moved ? position : before[k];
+        }
+        double u[3], v[3], n0[3], n1[3];
+        for (int d = 0; d < 3; ++d) {
+            u[d] = before[1][d] - before[0][d];
+            v[d] = before[2][d] - before[0][d];
+        }
+        cross(u, v, n0);
+        for (int d = 0; d < 3; ++d) {
+            u[d] = after[1][d] - after[0][d];
+            v[d] = after[2][d] - after[0][d];
+        }
+        cross(u, v, n1);
+        // Turned over, or folded to (almost) nothing.
+        if (dot(n0, n1) <= 1e-3 * std::sqrt(dot(n0, n0) * dot(n1, n1)))
+            return true;
+    }
+    return false;
+}
+
+inline void Decimator::collapse(const Candidate& candidate) {
+    uint32_t a = candidate.a, b = candidate.b;
+    for (int d = 0; d < 3; ++d)
+        positions_[3 * a + d] = candidate.position[d];
+    quadrics_[a].add(quadrics_[b]);
+    parent_[b] = a;
+    ++versions_[a];
+    ++versions_[b];
+
+    // b's triangles move to a, those of the edge vanish.
+    std::vector<uint32_t> kept;
+    kept.reserve(around_[a].size() + around_[b].size());
+    for (int side = 0; side < 2; ++side) {
+        const std::vector<uint32_t>& triangles = around_[side == 0 ? a : b];
+        for (size_t i = 0; i < triangles.size(); ++i) {
+            uint32_t t = triangles[i];
+            if (!alive_[t])
+                continue;
+            uint32_t* c = &corners_[3 * t];
+            bool has_a = c[0] == a || c[1] == a || c[2] == a;
+            bool has_b = c[0] == b || c[1] == b || c[2] == b;
+            if (has_a && has_b) {
+                alive_[t] = false;
+                --live_;
+                continue;
+            }
+            for (int k = 0; k < 3; ++k)
+                if (c[k] == b)
+                    c[k] = a;
+            kept.push_back(t);
+        }
+    }
+    around_[a].swap(kept);
+    std::vector<uint32_t>().swap(around_[b]);
+
+    // The edges around a have new prices.
+    std::vector<uint32_t> neighbours;
+    for (size_t i = 0; i < around_[a].size(); ++i)
+        for (int k = 0; k < 3; ++k) {
+            uint32_t v = corners_[3 * around_[a][i] + k];
+            if (v != a)
+                neighbours.push_back(v);
+        }
+    std::sort(neighbours.begin(), neighbours.end());
+    neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+    for (size_t i = 0; i < neighbours.size(); ++i)
+        push(a, neighbours[i]);
+}
+
+inline bool Decimator::reduce(size_t target) {
+    while (live_ > target) {
+        if (queue_.empty())
+            return false;
+        Candidate candidate = queue_.top();
+        queue_.pop();
+        if (candidate.version_a != versions_[candidate.a] || candidate.version_b != versions_[candidate.b])
+            continue; // an end has moved since
+        if (flips(candidate.a, candidate.b, candidate.position)
+            || flips(candidate.b, candidate.a, candidate.position))
+            continue;
+        collapse(candidate);
+    }
+    return true;
+}
+
+inline void Decimator::level(DecimateLevel& out) {
+    out.triangles.clear();
+    for (size_t t = 0; t < alive_.size(); ++t)
+        if (alive_[t])
+            out.triangles.push_back((uint32_t)t);
+    size_t vertex_count = parent_.size();
+    out.positions.resize(3 * vertex_count);
+    for (size_t v = 0; v < vertex_count; ++v) {
+        uint32_t root = find((uint32_t)v);
+        for (int d = 0; d < 3; ++d)
+            out.positions[3 * v + d] = positions_[3 * root + d] + center_[d];
+    }
+}
+
+} // namespace decimate_detail
+
+// Simplifies the mesh (vertex v at positions[3v .. 3v + 2], triangle i on
+// vertices indices[3i .. 3i + 2], in group groups[i]) to each of the
+// triangle counts of `targets`, largest first, one level per target. A
+// level stops short of its target when no edge can collapse any more.
+inline void decimate_mesh(const std::vector<double>& positions, const std::vector<uint32_t>& indices,
+                          const std::vector<uint32_t>& groups, const std::vector<size_t>& targets,
+                          std::vector<DecimateLevel>& levels,
+                          const DecimateOptions& options = DecimateOptions()) {
+    decimate_detail::Decimator decimator(positions, indices, groups, options);
+    levels.resize(targets.size());
+    for (size_t l = 0; l < targets.size(); ++l) {
+        decimator.reduce(targets[l]);
+        decimator.level(levels[l]);
+    }
+}
+
+#endif // SKP2TRI_TRI_DECIMATE_H
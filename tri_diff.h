@@ -0,0 +1,492 @@
+#ifndef SKP2TRI_TRI_DIFF_H
+#define SKP2TRI_TRI_DIFF_H
+
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <unordered_map>
+#include <cmath>
+#include <cfloat>
+#include <stdint.h>
+#include "tri_reader.h"
+#include "parallel.h"
+
+// Geometric comparison of two triangle sets, for regression checks of the
+// exporter. Triangles are matched one to one when their corners agree
+// within a tolerance, whatever their order in the files and whichever
+// corner comes first (the winding must agree). The triangles left over are
+// paired as "moved" when one is a translated copy of the other, the others
+// are removed (only in the first set) or added (only in the second), and
+// all the changes are grouped into spatial regions.
+
+struct DiffOptions {
+    double epsilon;      // absolute tolerance per coordinate
+    double relative;     // plus this much of the coordinate (text files keep six digits)
+    double region_size;  // cell size used to group changes, 0: 1/64 of the model size
+    bool moves;          // look for translated triangles
+    unsigned threads;
+
+    DiffOptions() : epsilon(1e-3), relative(1e-5), region_size(0.0), moves(true), threads(0) {}
+};
+
+enum DiffStatus { DIFF_CHANGED = 0, DIFF_MATCHED = 1, DIFF_MOVED = 2 };
+
+struct DiffRegion {
+    double min[3];
+    double max[3];
+    uint64_t removed;
+    uint64_t added;
+    uint64_t moved;   // moved triangles are counted at both their positions
+
+    uint64_t changes() const { return removed + added + moved; }
+};
+
+struct DiffResult {
+    uint64_t matched;
+    uint64_t moved;
+    uint64_t removed;
+    uint64_t added;
+    double tolerance;              // largest tolerance used, for the report
+    std::vector<uint8_t> status_a; // DiffStatus of each triangle of the first set
+    std::vector<uint8_t> status_b;
+    std::vector<uint32_t> moved_to; // for moved triangles of the first set, their counterpart
+    std::vector<DiffRegion> regions; // biggest first
+
+    bool identical() const { return moved == 0 && removed == 0 && added == 0; }
+};
+
+// Points bucketed by grid cell: the cells are hashed to the slots of a flat
+// table and the points sorted by slot (LSD radix sort, stable, so points
+// stay in index order within a slot and the results do not depend on the
+// thread count). A slot may hold points of other cells, so candidates are
+// always checked by the caller.
+class DiffCellIndex {
+public:
+    // Indexes with the same cell and `table_size` hash every cell to the same
+    // slot, so lookups walk both in step.
+    void build(const std::vector<float>* coordinates, double cell, unsigned threads, size_t table_size = 0) {
+        cell_ = cell;
+        size_t count = coordinates[0].size();
+        bits_ = 4;
+        while (((size_t)1 << bits_) < std::max(count, table_size))
+            ++bits_;
+        size_t slots = (size_t)1 << bits_;
+
+        // slot << 32 | point
+        std::vector<uint64_t> keys(count), sorted(count);
+        parallel_for((count + 65535) / 65536, threads, [&](size_t task, unsigned) {
+            for (size_t i = task * 65536; i < std::min(count, (task + 1) * 65536); ++i) {
+                int64_t c[3];
+                for (int k = 0; k < 3; ++k)
+                    c[k] = cell_of(coordinates[k][i]);
+                keys[i] = ((uint64_t)slot(c) << 32) | (uint64_t)i;
+            }
+        });
+        for (int shift = 32; shift < 32 + bits_; shift += 8) {
+            size_t offsets[257] = { 0 };
+            for (size_t i = 0; i < count; ++i)
+                ++offsets[((keys[i] >> shift) & 0xff) + 1];
+            for (int b = 0; b < 256; ++b)
+                offsets[b + 1] += offsets[b];
+            for (size_t i = 0; i < count; ++i)
+                sorted[offsets[(keys[i] >> shift) & 0xff]++] = keys[i];
+            keys.swap(sorted);
+        }
+
+        start_.assign(slots + 1, 0);
+        items_.resize(count);
+        positions_.resize(count);
+        for (size_t n = 0; n < count; ++n) {
+            items_[n] = (uint32_t)keys[n];
+            positions_[items_[n]] = (uint32_t)n;
+            ++start_[(keys[n] >> 32) + 1];
+        }
+        for (size_t s = 0; s < slots; ++s)
+            start_[s + 1] += start_[s];
+    }
+
+    // Points in slot order: position n holds point item(n), and point i is
+    // at position(i).
+    size_t size() const { return items_.size(); }
+    uint32_t item(size_t n) const { return items_[n]; }
+    uint32_t position(size_t i) const { return positions_[i]; }
+
+    // Calls fn(n) for the position of every point in the cells within
+    // `reach` of p, until fn returns true.
+    template <class Fn>
+    bool find(const double* p, double reach, Fn fn) const {
+        int64_t low[3], high[3];
+        for (int k = 0; k < 3; ++k) {
+            if (!(std::fabs(p[k]) < DBL_MAX))
+                return false;
+            low[k] = cell_of(p[k] - reach);
+            high[k] = cell_of(p[k] + reach);
+        }
+        int64_t c[3];
+        for (c[0] = low[0]; c[0] <= high[0]; ++c[0])
+            for (c[1] = low[1]; c[1] <= high[1]; ++c[1])
+                for (c[2] = low[2]; c[2] <= high[2]; ++c[2]) {
+                    uint32_t s = slot(c);
+                    for (uint32_t n = start_[s]; n < start_[s + 1]; ++n)
+                        if (fn(n))
+                            return true;
+                }
+        return false;
+    }
+
+private:
+    int64_t cell_of(double value) const {
+        double c = std::floor(value / cell_);
+        return c > -9e18 && c < 9e18 ? (int64_t)c : 0;
+    }
+
+    uint32_t slot(const int64_t* c) const {
+        uint64_t h = (uint64_t)c[0] * 0x9E3779B97F4A7C15ULL;
+        h = (h ^ (h >> 29) ^ (uint64_t)c[1]) * 0xBF58476D1CE4E5B9ULL;
+        h = (h ^ (h >> 32) ^ (uint64_t)c[2]) * 0x94D049BB133111EBULL;
+        return (uint32_t)((h ^ (h >> 31)) >> (64 - bits_));
+    }
+
+    double cell_;
+    int bits_;
+    std::vector<uint32_t> start_;
+    std::vector<uint32_t> items_;
+    std::vector<uint32_t> positions_;
+};
+
+namespace diff_detail {
+
+inline void corner(const TriangleArrays& t, size_t i, int k, double* p) {
+    p[0] = t.x[k][i];
+    p[1] = t.y[k][i];
+    p[2] = t.z[k][i];
+}
+
+// The nine coordinates of triangle i, corner by corner.
+inline void corners(const TriangleArrays& t, size_t i, float* c) {
+    for (int k = 0; k < 3; ++k) {
+        c[3 * k] = t.x[k][i];
+        c[3 * k + 1] = t.y[k][i];
+        c[3 * k + 2] = t.z[k][i];
+    }
+}
+
+inline bool within(double a, double b, const DiffOptions& options, double scale) {
+    return std::fabs(a - b) <= scale * (options.epsilon + options.relative * std::max(std::fabs(a), std::fabs(b)));
+}
+
+// Whether triangle q is triangle p moved by `shift`, for one of the three
+// rotations of its corners. `scale` widens the tolerance.
+inline bool same_triangle(const float* p, const float* q, const double* shift, const DiffOptions& options,
+                          double scale) {
+    for (int r = 0; r < 3; ++r) {
+        bool same = true;
+        for (int k = 0; k < 3 && same; ++k) {
+            const float* from = p + 3 * ((k + r) % 3);
+            for (int d = 0; d < 3 && same; ++d)
+                same = within(from[d] + shift[d], q[3 * k + d], options, scale);
+        }
+        if (same)
+            return true;
+    }
+    return false;
+}
+
+// Triangles copied in the order of an index, so that the candidates of a
+// cell are read from consecutive memory.
+inline void pack_triangles(const TriangleArrays& t, const DiffCellIndex& index, std::vector<float>& packed,
+                           unsigned threads) {
+    packed.resize(9 * index.size());
+    parallel_for((index.size() + 65535) / 65536, threads, [&](size_t task, unsigned) {
+        for (size_t i = task * 65536; i < std::min(index.size(), (task + 1) * 65536); ++i)
+            corners(t, i, &packed[9 * index.position(i)]);
+    });
+}
+
+inline void centroid(const float* c, double* center) {
+    center[0] = (c[0] + c[3] + c[6]) / 3.0f;
+    center[1] = (c[1] + c[4] + c[7]) / 3.0f;
+    center[2] = (c[2] + c[5] + c[8]) / 3.0f;
+}
+
+// Same rounding as centroid().
+inline void centroids(const TriangleArrays& t, std::vector<float>* out, unsigned threads) {
+    for (int d = 0; d < 3; ++d)
+        out[d].resize(t.size());
+    parallel_for((t.size() + 65535) / 65536, threads, [&](size_t task, unsigned) {
+        for (size_t i = task * 65536; i < std::min(t.size(), (task + 1) * 65536); ++i) {
+            out[0][i] = (t.x[0][i] + t.x[1][i] + t.x[2][i]) / 3.0f;
+            out[1][i] = (t.y[0][i] + t.y[1][i] + t.y[2][i]) / 3.0f;
+            out[2][i] = (t.z[0][i] + t.z[1][i] + t.z[2][i]) / 3.0f;
+        }
+    });
+}
+
+// Sorted edge lengths: the same for a triangle and its translated copies.
+inline void edge_lengths(const TriangleArrays& t, size_t i, double* lengths) {
+    for (int k = 0; k < 3; ++k) {
+        double p[3], q[3];
+        corner(t, i, k, p);
+        corner(t, i, (k + 1) % 3, q);
+        lengths[k] = std::sqrt((p[0] - q[0]) * (p[0] - q[0]) + (p[1] - q[1]) * (p[1] - q[1])
+                               + (p[2] - q[2]) * (p[2] - q[2]));
+    }
+    std::sort(lengths, lengths + 3);
+}
+
+// Largest coordinate magnitude of both sets, for the tolerance.
+inline double magnitude(const TriangleArrays& t) {
+    double largest = 0.0;
+    for (int k = 0; k < 3; ++k)
+        for (size_t i = 0; i < t.size(); ++i) {
+            double m = std::max(std::fabs(t.x[k][i]), std::max(std::fabs(t.y[k][i]), std::fabs(t.z[k][i])));
+            if (m > largest && m < DBL_MAX)
+                largest = m;
+        }
+    return largest;
+}
+
+inline uint32_t find_root(std::vector<uint32_t>& parent, uint32_t n) {
+    while (parent[n] != n) {
+        parent[n] = parent[parent[n]];
+        n = parent[n];
+    }
+    return n;
+}
+
+struct CellKey {
+    int64_t c[3];
+    bool operator==(const CellKey& o) const { return c[0] == o.c[0] && c[1] == o.c[1] && c[2] == o.c[2]; }
+};
+
+struct CellKeyHash {
+    size_t operator()(const CellKey& key) const {
+        uint64_t h = (uint64_t)key.c[0] * 0x9E3779B97F4A7C15ULL;
+        h = (h ^ (h >> 29) ^ (uint64_t)key.c[1]) * 0xBF58476D1CE4E5B9ULL;
+        h = (h ^ (h >> 32) ^ (uint64_t)key.c[2]) * 0x94D049BB133111EBULL;
+        return (size_t)(h ^ (h >> 31));
+    }
+};
+
+} // namespace diff_detail
+
+// Compares `a` (before) with `b` (after).
+inline void diff_triangles(const TriangleArrays& a, const TriangleArrays& b, const DiffOptions& options,
+                           DiffResult& result) {
+    using namespace diff_detail;
+    unsigned threads = options.threads > 0 ? options.threads : default_thread_count();
+    result.status_a.assign(a.size(), DIFF_CHANGED);
+    result.status_b.assign(b.size(), DIFF_CHANGED);
+    result.moved_to.assign(a.size(), 0xffffffff);
+    result.regions.clear();
+
+    // Centroids of matching triangles are within one tolerance per axis.
+    double largest = std::max(magnitude(a), magnitude(b));
+    double tolerance = options.epsilon + options.relative * largest;
+    result.tolerance = tolerance;
+    // Centroids and edge lengths are computed in float: allow for that.
+    double slack = 1e-6 * largest;
+    double cell = std::max(16.0 * tolerance, 1e-30);
+
+    // Both sets are copied in cell order and a is walked cell by cell, so
+    // that consecutive lookups read neighbouring memory of b.
+    std::vector<float> centers_a[3], centers_b[3];
+    centroids(a, centers_a, threads);
+    centroids(b, centers_b, threads);
+    DiffCellIndex index_a, index_b;
+    size_t table_size = std::max(a.size(), b.size());
+    index_a.build(centers_a, cell, threads, table_size);
+    index_b.build(centers_b, cell, threads, table_size);
+    std::vector<float> packed_a, packed_b;
+    pack_triangles(a, index_a, packed_a, threads);
+    pack_triangles(b, index_b, packed_b, threads);
+
+    // A triangle of b is claimed by one triangle of a only; the claims are
+    // the statuses of b, in cell order.
+    std::vector<std::atomic<uint8_t> > claimed(b.size());
+    for (size_t n = 0; n < b.size(); ++n)
+        claimed[n].store(DIFF_CHANGED, std::memory_order_relaxed);
+    const double no_shift[3] = { 0.0, 0.0, 0.0 };
+    parallel_for((a.size() + 16383) / 16384, threads, [&](size_t task, unsigned) {
+        for (size_t m = task * 16384; m < std::min(a.size(), (task + 1) * 16384); ++m) {
+            const float* p = &packed_a[9 * m];
+            double center[3];
+            centroid(p, center);
+            index_b.find(center, tolerance + slack, [&](uint32_t n) {
+                if (claimed[n].load(std::memory_order_relaxed) != DIFF_CHANGED
+                    || !same_triangle(p, &packed_b[9 * n], no_shift, options, 1.0))
+                    return false;
+                if (claimed[n].exchange(DIFF_MATCHED) != DIFF_CHANGED)
+                    return false;
+                result.status_a[index_a.item(m)] = DIFF_MATCHED;
+                return true;
+            });
+        }
+    });
+
+    if (options.moves) {
+        // Leftovers of b indexed by shape; a leftover of a with the same
+        // shape whose corners all move by the same vector has moved. Both
+        // sides are rounded, so the tolerances double.
+        std::vector<uint32_t> left_b;
+        for (size_t n = 0; n < b.size(); ++n)
+            if (claimed[n].load(std::memory_order_relaxed) == DIFF_CHANGED)
+                left_b.push_back((uint32_t)n);
+        std::vector<float> shapes[3];
+        for (int d = 0; d < 3; ++d)
+            shapes[d].resize(left_b.size());
+        for (size_t l = 0; l < left_b.size(); ++l) {
+            double lengths[3];
+            edge_lengths(b, index_b.item(left_b[l]), lengths);
+            for (int d = 0; d < 3; ++d)
+                shapes[d][l] = (float)lengths[d];
+        }
+        // Each corner is off by up to two tolerances per axis, so an edge
+        // by up to 4 * sqrt(3) of them.
+        double reach = 7.0 * tolerance + slack;
+        DiffCellIndex index_shapes;
+        index_shapes.build(shapes, std::max(2.0 * reach, 1e-30), threads);
+
+        parallel_for((a.size() + 16383) / 16384, threads, [&](size_t task, unsigned) {
+            for (size_t i = task * 16384; i < std::min(a.size(), (task + 1) * 16384); ++i) {
+                if (result.status_a[i] != DIFF_CHANGED)
+                    continue;
+                float p[9];
+                corners(a, i, p);
+                double lengths[3];
+                edge_lengths(a, i, lengths);
+                index_shapes.find(lengths, reach, [&](uint32_t s) {
+                    uint32_t n = left_b[index_shapes.item(s)];
+                    if (claimed[n].load(std::memory_order_relaxed) != DIFF_CHANGED)
+                        return false;
+                    uint32_t j = index_b.item(n);
+                    double shift[3] = { (double)centers_b[0][j] - centers_a[0][i],
+                                        (double)centers_b[1][j] - centers_a[1][i],
+                                        (double)centers_b[2][j] - centers_a[2][i] };
+                    if (!same_triangle(p, &packed_b[9 * n], shift, options, 2.0)
+                        || claimed[n].exchange(DIFF_MOVED) != DIFF_CHANGED)
+                        return false;
+                    result.status_a[i] = DIFF_MOVED;
+                    result.moved_to[i] = j;
+                    return true;
+                });
+            }
+        });
+    }
+    for (size_t n = 0; n < b.size(); ++n)
+        result.status_b[index_b.item(n)] = claimed[n].load(std::memory_order_relaxed);
+
+    result.matched = result.moved = result.removed = result.added = 0;
+    for (size_t i = 0; i < a.size(); ++i) {
+        result.matched += result.status_a[i] == DIFF_MATCHED;
+        result.moved += result.status_a[i] == DIFF_MOVED;
+        result.removed += result.status_a[i] == DIFF_CHANGED;
+    }
+    for (size_t j = 0; j < b.size(); ++j)
+        result.added += result.status_b[j] == DIFF_CHANGED;
+    if (result.identical())
+        return;
+
+    // Regions: the occupied cells of a coarse grid holding the changes
+    // (moved triangles count at both ends), merged with their 26
+    // neighbours.
+    double region = options.region_size;
+    if (region <= 0.0) {
+        double low[3] = { DBL_MAX, DBL_MAX, DBL_MAX }, high[3] = { -DBL_MAX, -DBL_MAX, -DBL_MAX };
+        for (int d = 0; d < 3; ++d) {
+            for (size_t i = 0; i < a.size(); ++i) {
+                low[d] = std::min(low[d], (double)centers_a[d][i]);
+                high[d] = std::max(high[d], (double)centers_a[d][i]);
+            }
+            for (size_t j = 0; j < b.size(); ++j) {
+                low[d] = std::min(low[d], (double)centers_b[d][j]);
+                high[d] = std::max(high[d], (double)centers_b[d][j]);
+            }
+        }
+        double size = std::max(high[0] - low[0], std::max(high[1] - low[1], high[2] - low[2]));
+        region = std::max(size / 64.0, cell);
+        if (!(region < DBL_MAX))
+            region = 1.0;
+    }
+
+    std::unordered_map<CellKey, uint32_t, CellKeyHash> cells;
+    std::vector<DiffRegion> boxes;
+    auto add_change = [&](const TriangleArrays& t, size_t i, const std::vector<float>* centers, int kind) {
+        CellKey key;
+        for (int d = 0; d < 3; ++d)
+            key.c[d] = (int64_t)std::floor(centers[d][i] / region);
+        std::pair<std::unordered_map<CellKey, uint32_t, CellKeyHash>::iterator, bool> inserted =
+            cells.insert(std::make_pair(key, (uint32_t)boxes.size()));
+        if (inserted.second) {
+            DiffRegion box;
+            for (int d = 0; d < 3; ++d) {
+                box.min[d] = DBL_MAX;
+                box.max[d] = -DBL_MAX;
+            }
+            box.removed = box.added = box.moved = 0;
+            boxes.push_back(box);
+        }
+        DiffRegion& box = boxes[inserted.first->second];
+        for (int k = 0; k < 3; ++k) {
+            double p[3];
+            corner(t, i, k, p);
+            for (int d = 0; d < 3; ++d) {
+                box.min[d] = std::min(box.min[d], p[d]);
+                box.max[d] = std::max(box.max[d], p[d]);
+            }
+        }
+        (kind == 0 ? box.removed : kind == 1 ? box.added : box.moved) += 1;
+    };
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (result.status_a[i] == DIFF_CHANGED)
+            add_change(a, i, centers_a, 0);
+        else if (result.status_a[i] == DIFF_MOVED)
+            add_change(a, i, centers_a, 2);
+    }
+    for (size_t j = 0; j < b.size(); ++j) {
+        if (result.status_b[j] == DIFF_CHANGED)
+            add_change(b, j, centers_b, 1);
+        else if (result.status_b[j] == DIFF_MOVED)
+            add_change(b, j, centers_b, 2);
+    }
+
+    std::vector<uint32_t> parent(boxes.size());
+    for (size_t n = 0; n < parent.size(); ++n)
+        parent[n] = (uint32_t)n;
+    for (std::unordered_map<CellKey, uint32_t, CellKeyHash>::const_iterator it = cells.begin(); it != cells.end(); ++it) {
+        CellKey next;
+        for (int dx = -1; dx <= 1; ++dx)
+            for (int dy = -1; dy <= 1; ++dy)
+                for (int dz = -1; dz <= 1; ++dz) {
+                    next.c[0] = it->first.c[0] + dx;
+                    next.c[1] = it->first.c[1] + dy;
+                    next.c[2] = it->first.c[2] + dz;
+                    std::unordered_map<CellKey, uint32_t, CellKeyHash>::const_iterator other = cells.find(next);
+                    if (other != cells.end())
+                        parent[find_root(parent, it->second)] = find_root(parent, other->second);
+                }
+    }
+
+    std::vector<int64_t> region_of(boxes.size(), -1);
+    for (size_t n = 0; n < boxes.size(); ++n) {
+        uint32_t root = find_root(parent, (uint32_t)n);
+        if (region_of[root] < 0) {
+            region_of[root] = (int64_t)result.regions.size();
+            result.regions.push_back(boxes[n]);
+            continue;
+        }
+        DiffRegion& merged = result.regions[(size_t)region_of[root]];
+        for (int d = 0; d < 3; ++d) {
+            merged.min[d] = std::min(merged.min[d], boxes[n].min[d]);
+            merged.max[d] = std::max(merged.max[d], boxes[n].max[d]);
+        }
+        merged.removed += boxes[n].removed;
+        merged.added += boxes[n].added;
+        merged.moved += boxes[n].moved;
+    }
+    std::stable_sort(result.regions.begin(), result.regions.end(), [](const DiffRegion& x, const DiffRegion& y) {
+        return x.changes() > y.changes();
+    });
+}
+
+#endif // SKP2TRI_TRI_DIFF_H
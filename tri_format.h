@@ -0,0 +1,322 @@
+#ifndef SKP2TRI_TRI_FORMAT_H
+#define SKP2TRI_TRI_FORMAT_H
+
+#include <stdint.h>
+#include <cstring>
+
+// Binary counterpart of the text .tri format (.trb).
+//
+// The file is a 32 byte header followed by `triangle_count` records of nine
+// little-endian float32: the three corners of each triangle, in the same
+// order and units as the lines of the text format. Records have a fixed
+// size, so triangle i lives at TRB_HEADER_SIZE + 36 * i and the file can be
+// mapped and used in place.
+//
+// Indexed files (flag TRB_INDEXED, written by tri2bin --weld) hold instead
+// `vertex_count` vertices of three float32, then `triangle_count` triples
+// of uint32 vertex indices.
+
+// The end of the lines of the text .tri format: CRLF on Windows, as the text
+// mode streams skp2tri first wrote it with, so the files written there are
+// the same as before the binary mode writers.
+#ifdef _WIN32
+#define TRI_LINE_END "\r\n"
+#else
+#define TRI_LINE_END "\n"
+#endif
+
+const uint32_t TRB_VERSION = 1;
+const uint64_t TRB_HEADER_SIZE = 32;
+const uint64_t TRB_TRIANGLE_SIZE = 9 * sizeof(float);
+const uint64_t TRB_VERTEX_SIZE = 3 * sizeof(float);
+const uint64_t TRB_INDICES_SIZE = 3 * sizeof(uint32_t);
+
+const uint32_t TRB_INDEXED = 1;
+
+struct TrbHeader {
+    char magic[4];           // "TRB\0"
+    uint32_t version;
+    uint32_t flags;          // TRB_INDEXED or 0
+    uint32_t reserved;
+    uint64_t triangle_count;
+    uint64_t vertex_count;   // 0: triangle soup
+};
+
+static_assert(sizeof(TrbHeader) == TRB_HEADER_SIZE, "unexpected TrbHeader padding");
+
+inline TrbHeader make_trb_header(uint64_t triangle_count) {
+    TrbHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "TRB", 4);
+    header.version = TRB_VERSION;
+    header.triangle_count = triangle_count;
+    return header;
+}
+
+inline TrbHeader make_indexed_trb_header(uint64_t triangle_count, uint64_t vertex_count) {
+    TrbHeader header = make_trb_header(triangle_count);
+    header.flags = TRB_INDEXED;
+    header.vertex_count = vertex_count;
+    return header;
+}
+
+inline uint64_t trb_file_size(const TrbHeader& header) {
+    if (header.flags & TRB_INDEXED)
+        return TRB_HEADER_SIZE + header.vertex_count * TRB_VERTEX_SIZE + header.triangle_count * TRB_INDICES_SIZE;
+    return TRB_HEADER_SIZE + header.triangle_count * TRB_TRIANGLE_SIZE;
+}
+
+inline bool is_trb_header(const TrbHeader& header) {
+    return std::memcmp(header.magic, "TRB", 4) == 0 && header.version == TRB_VERSION;
+}
+
+// Sidecar index (<output>.idx) of a .tri, .trb or .stl file.
+//
+// A 32 byte header followed by `entry_count` entries of 64 bytes, in the
+// order the entities appear in the data file. Each group and instance has an
+// entry spanning its whole subtree; the faces directly inside a node (the
+// model root included) get a FACES entry right after the node's own entry.
+// Spans are [offset, offset + length) in the data file, so one object can
+// be read with a single pread without scanning the rest.
+
+const uint32_t TRI_INDEX_VERSION = 1;
+
+enum TriIndexFormat { TRI_INDEX_TEXT = 0, TRI_INDEX_TRB = 1, TRI_INDEX_STL = 2 };
+enum TriIndexKind { TRI_INDEX_GROUP = 1, TRI_INDEX_INSTANCE = 2, TRI_INDEX_FACES = 3 };
+
+const uint32_t TRI_INDEX_NO_PARENT = 0xffffffff;
+
+struct TriIndexHeader {
+    char magic[4];          // "TIDX"
+    uint32_t version;
+    uint32_t format;        // TriIndexFormat of the data file
+    uint32_t reserved;
+    uint64_t entry_count;
+    uint64_t data_size;     // size of the data file, to detect a stale index
+};
+
+struct TriIndexEntry {
+    int32_t entity_id;      // SUEntityGetID of the group / instance (0 for the model)
+    uint16_t kind;          // TriIndexKind
+    uint16_t depth;         // nesting level, 0 for the model's own faces
+    uint32_t parent;        // entry of the enclosing group / instance
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t length;
+    uint64_t triangle_count;
+    float min[3];           // bounds, in data file coordinates
+    float max[3];
+};
+
+static_assert(sizeof(TriIndexHeader) == 32, "unexpected TriIndexHeader padding");
+static_assert(sizeof(TriIndexEntry) == 64, "unexpected TriIndexEntry padding");
+
+inline TriIndexHeader make_tri_index_header(uint32_t format, uint64_t entry_count, uint64_t data_size) {
+    TriIndexHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "TIDX", 4);
+    header.version = TRI_INDEX_VERSION;
+    header.format = format;
+    header.entry_count = entry_count;
+    header.data_size = data_size;
+    return header;
+}
+
+inline bool is_tri_index_header(const TriIndexHeader& header) {
+    return std::memcmp(header.magic, "TIDX", 4) == 0 && header.version == TRI_INDEX_VERSION;
+}
+
+// Sidecar bounding volume hierarchy (<data-file>.bvh) of a .tri, .trb,
+// .stl or .ply file, written by tribvh.
+//
+// A 32 byte header, `node_count` nodes of 32 bytes, then `triangle_count`
+// uint32: the triangle numbers of the data file (in file order, from 0) in
+// the order the leaves refer to them. Nodes are in depth first order: the
+// first child of an inner node is the next node and `first` is the second
+// one; a leaf holds the triangles [first, first + count) of that list. The
+// whole file can be mapped and traversed in place.
+
+const uint32_t TRI_BVH_VERSION = 1;
+const uint64_t TRI_BVH_HEADER_SIZE = 32;
+const uint64_t TRI_BVH_NODE_SIZE = 32;
+
+struct TriBvhHeader {
+    char magic[4];           // "TBVH"
+    uint32_t version;
+    uint32_t node_count;
+    uint32_t reserved;
+    uint64_t triangle_count;
+    uint64_t data_size;      // size of the data file, to detect a stale hierarchy
+};
+
+struct TriBvhNode {
+    float min[3];
+    uint32_t first;          // leaf: first entry of the triangle list, inner: second child
+    float max[3];
+    uint16_t count;          // leaf: triangle count, inner: 0
+    uint16_t axis;           // inner: split axis (0 x, 1 y, 2 z), the first child is on the low side
+};
+
+static_assert(sizeof(TriBvhHeader) == TRI_BVH_HEADER_SIZE, "unexpected TriBvhHeader padding");
+static_assert(sizeof(TriBvhNode) == TRI_BVH_NODE_SIZE, "unexpected TriBvhNode padding");
+
+inline TriBvhHeader make_tri_bvh_header(uint32_t node_count, uint64_t triangle_count, uint64_t data_size) {
+    TriBvhHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "TBVH", 4);
+    header.version = TRI_BVH_VERSION;
+    header.node_count = node_count;
+    header.triangle_count = triangle_count;
+    header.data_size = data_size;
+    return header;
+}
+
+inline bool is_tri_bvh_header(const TriBvhHeader& header) {
+    return std::memcmp(header.magic, "TBVH", 4) == 0 && header.version == TRI_BVH_VERSION;
+}
+
+inline uint64_t tri_bvh_file_size(const TriBvhHeader& header) {
+    return TRI_BVH_HEADER_SIZE + (uint64_t)header.node_count * TRI_BVH_NODE_SIZE + header.triangle_count * 4;
+}
+
+// Sidecar uniform grid (<data-file>.grid) of a .tri, .trb, .stl or .ply
+// file, written by trigrid.
+//
+// A 72 byte header, then the (cell_count + 1) uint32 offsets of the cell
+// lists, then `reference_count` uint32: the triangle numbers of the data
+// file listed by each cell, cell after cell. Cell (i, j, k) is number
+// i + resolution[0] * (j + resolution[1] * k) and spans
+// [min + (i, j, k) * cell, min + (i + 1, j + 1, k + 1) * cell); its
+// triangles are [offsets[n], offsets[n + 1]) of the lists, in increasing
+// order. A triangle is listed by every cell its plane crosses within its
+// bounds.
+
+const uint32_t TRI_GRID_VERSION = 1;
+const uint64_t TRI_GRID_HEADER_SIZE = 72;
+
+struct TriGridHeader {
+    char magic[4];           // "TGRD"
+    uint32_t version;
+    uint32_t resolution[3];  // cells along x, y and z
+    uint32_t reserved;
+    float min[3];            // corner of cell (0, 0, 0)
+    float cell[3];           // cell size along x, y and z
+    uint64_t triangle_count; // of the data file
+    uint64_t reference_count;
+    uint64_t data_size;      // size of the data file, to detect a stale grid
+};
+
+static_assert(sizeof(TriGridHeader) == TRI_GRID_HEADER_SIZE, "unexpected TriGridHeader padding");
+
+// The magic and version, everything else 0.
+inline TriGridHeader make_tri_grid_header() {
+    TriGridHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "TGRD", 4);
+    header.version = TRI_GRID_VERSION;
+    return header;
+}
+
+inline uint64_t tri_grid_cell_count(const TriGridHeader& header) {
+    return (uint64_t)header.resolution[0] * header.resolution[1] * header.resolution[2];
+}
+
+inline bool is_tri_grid_header(const TriGridHeader& header) {
+    return std::memcmp(header.magic, "TGRD", 4) == 0 && header.version == TRI_GRID_VERSION;
+}
+
+inline uint64_t tri_grid_file_size(const TriGridHeader& header) {
+    return TRI_GRID_HEADER_SIZE + (tri_grid_cell_count(header) + 1) * 4 + header.reference_count * 4;
+}
+
+// Voxel occupancy grid (.vox), written by trivox and skp2tri --voxelize.
+//
+// A 64 byte header, then one bit per voxel, little-endian uint64 words.
+// Voxel (i, j, k) spans [min + (i, j, k) * size, min + (i + 1, j + 1,
+// k + 1) * size) in the units of the triangles. Each row of voxels along x
+// starts a new word: row (j, k) is row j + resolution[1] * k, and takes
+// (resolution[0] + 63) / 64 words, voxel i being bit i % 64 of its word
+// i / 64. The voxels the surface crosses are set, and with TRI_VOXEL_SOLID
+// those inside closed shells too.
+
+const uint32_t TRI_VOXEL_VERSION = 1;
+const uint64_t TRI_VOXEL_HEADER_SIZE = 64;
+
+const uint32_t TRI_VOXEL_SOLID = 1;
+
+struct TriVoxelHeader {
+    char magic[4];          // "TVOX"
+    uint32_t version;
+    uint32_t resolution[3]; // voxels along x, y and z
+    uint32_t flags;         // TRI_VOXEL_SOLID or 0
+    double min[3];          // corner of voxel (0, 0, 0), a multiple of size
+    double size;            // edge of a voxel
+    uint64_t occupied;      // voxels set
+};
+
+static_assert(sizeof(TriVoxelHeader) == TRI_VOXEL_HEADER_SIZE, "unexpected TriVoxelHeader padding");
+
+// The magic and version, everything else 0.
+inline TriVoxelHeader make_tri_voxel_header() {
+    TriVoxelHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "TVOX", 4);
+    header.version = TRI_VOXEL_VERSION;
+    return header;
+}
+
+inline bool is_tri_voxel_header(const TriVoxelHeader& header) {
+    return std::memcmp(header.magic, "TVOX", 4) == 0 && header.version == TRI_VOXEL_VERSION;
+}
+
+inline uint64_t tri_voxel_row_words(const TriVoxelHeader& header) { return ((uint64_t)header.resolution[0] + 63) / 64; }
+
+inline uint64_t tri_voxel_file_size(const TriVoxelHeader& header) {
+    return TRI_VOXEL_HEADER_SIZE
+        + tri_voxel_row_words(header) * header.resolution[1] * header.resolution[2] * sizeof(uint64_t);
+}
+
+// Triangle adjacency buffer (<data-file>.adj), written by tritopo and
+// skp2tri --adjacency.
+//
+// A 32 byte header, then three uint32 per triangle of the data file (in
+// file order, from 0): entry k of triangle t is the triangle across its
+// edge from corner k to corner (k + 1) % 3, TRI_ADJACENCY_BOUNDARY when no
+// other triangle has that edge, or TRI_ADJACENCY_NON_MANIFOLD when more
+// than one does. Corners are matched by their exact coordinates.
+
+const uint32_t TRI_ADJACENCY_VERSION = 1;
+const uint64_t TRI_ADJACENCY_HEADER_SIZE = 32;
+
+const uint32_t TRI_ADJACENCY_BOUNDARY = 0xffffffff;
+const uint32_t TRI_ADJACENCY_NON_MANIFOLD = 0xfffffffe;
+
+struct TriAdjacencyHeader {
+    char magic[4];           // "TADJ"
+    uint32_t version;
+    uint64_t triangle_count;
+    uint64_t data_size;      // size of the data file, to detect a stale buffer
+    uint64_t reserved;
+};
+
+static_assert(sizeof(TriAdjacencyHeader) == TRI_ADJACENCY_HEADER_SIZE, "unexpected TriAdjacencyHeader padding");
+
+inline TriAdjacencyHeader make_tri_adjacency_header(uint64_t triangle_count, uint64_t data_size) {
+    TriAdjacencyHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "TADJ", 4);
+    header.version = TRI_ADJACENCY_VERSION;
+    header.triangle_count = triangle_count;
+    header.data_size = data_size;
+    return header;
+}
+
+inline bool is_tri_adjacency_header(const TriAdjacencyHeader& header) {
+    return std::memcmp(header.magic, "TADJ", 4) == 0 && header.version == TRI_ADJACENCY_VERSION;
+}
+
+inline uint64_t tri_adjacency_file_size(const TriAdjacencyHeader& header) {
+    return TRI_ADJACENCY_HEADER_SIZE + 12 * header.triangle_count;
+}
+
+#endif // SKP2TRI_TRI_FORMAT_H
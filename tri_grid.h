@@ -0,0 +1,765 @@
+#ifndef SKP2TRI_TRI_GRID_H
+#define SKP2TRI_TRI_GRID_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include "parallel.h"
+#include "tri_reader.h"
+#include "tri_format.h"
+#include "mapped_file.h"
+#include "buffered_writer.h"
+
+// Uniform grid over a triangle set, and its sidecar file (layout in
+// tri_format.h), for proximity queries: the nearest triangle to a point,
+// the triangles within a distance of a point, and those crossing a box,
+// one at a time or in batches on all cores. Triangles with a non finite
+// coordinate are left out.
+
+const uint32_t GRID_NO_HIT = 0xffffffffu;
+
+struct GridOptions {
+    unsigned threads; // 0: one per core
+    double density;   // cells per triangle
+    size_t max_cells;
+
+    GridOptions() : threads(0), density(1.0), max_cells(1 << 26) {}
+};
+
+struct Grid {
+    TriGridHeader header;
+    std::vector<uint32_t> offsets;   // cell_count + 1
+    std::vector<uint32_t> triangles; // triangle numbers of the cell lists
+};
+
+struct GridHit {
+    uint32_t triangle; // triangle number in the export, GRID_NO_HIT when none is close enough
+    float distance;
+    float point[3];    // closest point of the triangle
+};
+
+namespace grid_detail {
+
+const size_t PARALLEL_SIZE = 1 << 16;
+
+// The corners of triangle i, from the arrays or from 9 consecutive floats.
+inline void corners_of(const TriangleArrays& triangles, size_t i, double v[3][3]) {
+    for (int c = 0; c < 3; ++c) {
+        v[c][0] = triangles.x[c][i];
+        v[c][1] = triangles.y[c][i];
+        v[c][2] = triangles.z[c][i];
+    }
+}
+
+inline void corners_of(const float* corners, double v[3][3]) {
+    for (int c = 0; c < 3; ++c)
+        for (int d = 0; d < 3; ++d)
+            v[c][d] = corners[3 * c + d];
+}
+
+inline double dot(const double* u, const double* v) { return u[0] * v[0] + u[1] * v[1] + u[2] * v[2]; }
+
+inline void cross(const double* u, const double* v, double* out) {
+    out[0] = u[1] * v[2] - u[2] * v[1];
+    out[1] = u[2] * v[0] - u[0] * v[2];
+    out[2] = u[0] * v[1] - u[1] * v[0];
+}
+
+// Cells of a header. Every triangle lies within the cells (the bounds are
+// floats, and the cells are a little larger than needed); points beyond
+// them belong to the closest cell on the side.
+struct Cells {
+    double min[3], size[3], inverse[3];
+    int resolution[3];
+
+    explicit Cells(const TriGridHeader& header) {
+        for (int d = 0; d < 3; ++d) {
+            min[d] = header.min[d];
+            size[d] = header.cell[d];
+            inverse[d] = 1.0 / header.cell[d];
+            resolution[d] = (int)header.resolution[d];
+        }
+    }
+
+    int cell_of(double value, int d) const {
+        double c = std::floor((value - min[d]) * inverse[d]);
+        return c < 0.0 ? 0 : c >= resolution[d] - 1 ? resolution[d] - 1 : (int)c;
+    }
+
+    size_t number(int i, int j, int k) const {
+        return (size_t)i + resolution[0] * ((size_t)j + (size_t)resolution[1] * k);
+    }
+
+    // Distance along axis d from `value` to cell i.
+    double gap(double value, int i, int d) const {
+        double low = min[d] + i * size[d];
+        return value < low ? low - value : value > low + size[d] ? value - low - size[d] : 0.0;
+    }
+};
+
+// Calls fn(cell) for the cells within the triangle's bounds that its plane
+// crosses (with some slack, so rounding never loses one).
+template <class Fn>
+void for_each_cell(const Cells& cells, const double v[3][3], Fn fn) {
+    int low[3], high[3];
+    for (int d = 0; d < 3; ++d) {
+        low[d] = cells.cell_of(std::min(v[0][d], std::min(v[1][d], v[2][d])), d);
+        high[d] = cells.cell_of(std::max(v[0][d], std::max(v[1][d], v[2][d])), d);
+    }
+    double u[3] = { v[1][0] - v[0][0], v[1][1] - v[0][1], v[1][2] - v[0][2] };
+    double w[3] = { v[2][0] - v[0][0], v[2][1] - v[0][1], v[2][2] - v[0][2] };
+    double n[3];
+    cross(u, w, n);
+    double reach = 0.0;
+    for (int d = 0; d < 3; ++d)
+        reach += std::fabs(n[d]) * 0.5 * cells.size[d] * 1.001;
+    bool single = low[0] == high[0] && low[1] == high[1] && low[2] == high[2];
+    for (int k = low[2]; k <= high[2]; ++k)
+        for (int j = low[1]; j <= high[1]; ++j)
+            for (int i = low[0]; i <= high[0]; ++i) {
+                if (!single) {
+                    int index[3] = { i, j, k };
+                    double offset[3];
+                    for (int d = 0; d < 3; ++d)
+                        offset[d] = cells.min[d] + (index[d] + 0.5) * cells.size[d] - v[0][d];
+                    if (std::fabs(dot(n, offset)) > reach)
+                        continue;
+                }
+                fn(cells.number(i, j, k));
+            }
+}
+
+// Squared distance from p to the bounds of triangle v, which no point of
+// the triangle is closer than.
+inline double box_distance(const double* p, const double v[3][3]) {
+    double distance = 0.0;
+    for (int d = 0; d < 3; ++d) {
+        double low = std::min(v[0][d], std::min(v[1][d], v[2][d]));
+        double high = std::max(v[0][d], std::max(v[1][d], v[2][d]));
+        double gap = p[d] < low ? low - p[d] : p[d] > high ? p[d] - high : 0.0;
+        distance += gap * gap;
+    }
+    return distance;
+}
+
+// The point of triangle v closest to p (Ericson, Real-Time Collision
+// Detection, 5.1.5), and its squared distance.
+inline double closest_point(const double* p, const double v[3][3], double* q) {
+    double ab[3], ac[3], ap[3];
+    for (int d = 0; d < 3; ++d) {
+        ab[d] = v[1][d] - v[0][d];
+        ac[d] = v[2][d] - v[0][d];
+        ap[d] = p[d] - v[0][d];
+    }
+    double weights[3]; // of the corners
+    double d1 = dot(ab, ap), d2 = dot(ac, ap);
+    double bp[3], cp[3];
+    for (int d = 0; d < 3; ++d) {
+        bp[d] = p[d] - v[1][d];
+        cp[d] = p[d] - v[2][d];
+    }
+    double d3 = dot(ab, bp), d4 = dot(ac, bp), d5 = dot(ab, cp), d6 = dot(ac, cp);
+    double va = d3 * d6 - d5 * d4, vb = d5 * d2 - d1 * d6, vc = d1 * d4 - d3 * d2;
+    if (d1 <= 0.0 && d2 <= 0.0) {
+        weights[0] = 1.0, weights[1] = 0.0, weights[2] = 0.0;
+    }
+    else if (d3 >= 0.0 && d4 <= d3) {
+        weights[0] = 0.0, weights[1] = 1.0, weights[2] = 0.0;
+    }
+    else if (vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0) {
+        double t = d1 / (d1 - d3);
+        weights[0] = 1.0 - t, weights[1] = t, weights[2] = 0.0;
+    }
+    else if (d6 >= 0.0 && d5 <= d6) {
+        weights[0] = 0.0, weights[1] = 0.0, weights[2] = 1.0;
+    }
+    else if (vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0) {
+        double t = d2 / (d2 - d6);
+        weights[0] = 1.0 - t, weights[1] = 0.0, weights[2] = t;
+    }
+    else if (va <= 0.0 && d4 - d3 >= 0.0 && d5 - d6 >= 0.0) {
+        double t = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+        weights[0] = 0.0, weights[1] = 1.0 - t, weights[2] = t;
+    }
+    else {
+        double sum = va + vb + vc;
+        if (!(sum > 0.0)) // no area: the closest of the corners will do
+            sum = 1.0, va = 1.0, vb = vc = 0.0;
+        weights[0] = va / sum, weights[1] = vb / sum, weights[2] = vc / sum;
+    }
+    double distance = 0.0;
+    for (int d = 0; d < 3; ++d) {
+        q[d] = weights[0] * v[0][d] + weights[1] * v[1][d] + weights[2] * v[2][d];
+        distance += (p[d] - q[d]) * (p[d] - q[d]);
+    }
+    return distance;
+}
+
+// Whether triangle v crosses the box of the given centre and half sizes
+// (separating axes, Akenine-Möller).
+inline bool crosses_box(const double* center, const double* half, const double v[3][3]) {
+    double t[3][3];
+    for (int c = 0; c < 3; ++c)
+        for (int d = 0; d < 3; ++d)
+            t[c][d] = v[c][d] - center[d];
+    // The box's faces.
+    for (int d = 0; d < 3; ++d) {
+        if (std::min(t[0][d], std::min(t[1][d], t[2][d])) > half[d]
+            || std::max(t[0][d], std::max(t[1][d], t[2][d])) < -half[d])
+            return false;
+    }
+    // The triangle's plane.
+    double edges[3][3];
+    for (int d = 0; d < 3; ++d) {
+        edges[0][d] = t[1][d] - t[0][d];
+        edges[1][d] = t[2][d] - t[1][d];
+        edges[2][d] = t[0][d] - t[2][d];
+    }
+    double n[3];
+    cross(edges[0], edges[1], n);
+    if (std::fabs(dot(n, t[0])) > std::fabs(n[0]) * half[0] + std::fabs(n[1]) * half[1] + std::fabs(n[2]) * half[2])
+        return false;
+    // The box's axes crossed with the edges.
+    for (int e = 0; e < 3; ++e)
+        for (int a = 0; a < 3; ++a) {
+            double unit[3] = { 0.0, 0.0, 0.0 }, axis[3];
+            unit[a] = 1.0;
+            cross(unit, edges[e], axis);
+            double p0 = dot(axis, t[0]), p1 = dot(axis, t[1]), p2 = dot(axis, t[2]);
+            double reach = std::fabs(axis[0]) * half[0] + std::fabs(axis[1]) * half[1] + std::fabs(axis[2]) * half[2];
+            if (std::min(p0, std::min(p1, p2)) > reach || std::max(p0, std::max(p1, p2)) < -reach)
+                return false;
+        }
+    return true;
+}
+
+// Spreads the 21 low bits of x to every third bit.
+inline uint64_t spread_bits(uint64_t x) {
+    x &= 0x1fffff;
+    x = (x | x << 32) & 0x1f00000000ffffULL;
+    x = (x | x << 16) & 0x1f0000ff0000ffULL;
+    x = (x | x << 8) & 0x100f00f00f00f00fULL;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+    x = (x | x << 2) & 0x1249249249249249ULL;
+    return x;
+}
+
+// The queries at `points` (`stride` floats apart) in the Morton order of
+// their cells: queries that follow each other read the same parts of the
+// grid and of the triangles, instead of missing the cache every time.
+inline void query_order(const TriGridHeader& header, const float* points, size_t stride, size_t count,
+                        unsigned threads, std::vector<size_t>& order) {
+    Cells cells(header);
+    std::vector<std::pair<uint64_t, size_t> > keys(count);
+    parallel_for((count + PARALLEL_SIZE - 1) / PARALLEL_SIZE, threads, [&](size_t task, unsigned) {
+        for (size_t i = task * PARALLEL_SIZE; i < std::min(count, (task + 1) * PARALLEL_SIZE); ++i) {
+            const float* p = points + stride * i;
+            uint64_t code = 0;
+            for (int d = 0; d < 3; ++d)
+                code |= spread_bits((uint64_t)cells.cell_of(p[d], d)) << d;
+            keys[i] = std::make_pair(code, i);
+        }
+    });
+    std::sort(keys.begin(), keys.end());
+    order.resize(count);
+    for (size_t i = 0; i < count; ++i)
+        order[i] = keys[i].second;
+}
+
+// Runs fn(i, out) for every query i of `order`, in that order, in batches
+// on all cores, and lists what each appended to `out`: query i found
+// found[offsets[i] .. offsets[i + 1]).
+template <class Fn>
+void gather(const std::vector<size_t>& order, unsigned threads, Fn fn, std::vector<size_t>& offsets,
+            std::vector<uint32_t>& found) {
+    const size_t batch = 1024;
+    size_t count = order.size(), tasks = (count + batch - 1) / batch;
+    std::vector<std::vector<uint32_t> > results(tasks);
+    std::vector<size_t> starts(count);
+    offsets.assign(count + 1, 0);
+    parallel_for(tasks, threads, [&](size_t task, unsigned) {
+        for (size_t s = task * batch; s < std::min(count, (task + 1) * batch); ++s) {
+            size_t i = order[s];
+            starts[i] = results[task].size();
+            fn(i, results[task]);
+            offsets[i + 1] = results[task].size() - starts[i];
+        }
+    });
+    for (size_t i = 0; i < count; ++i)
+        offsets[i + 1] += offsets[i];
+    found.resize(offsets[count]);
+    parallel_for(tasks, threads, [&](size_t task, unsigned) {
+        for (size_t s = task * batch; s < std::min(count, (task + 1) * batch); ++s) {
+            size_t i = order[s];
+            if (offsets[i + 1] > offsets[i])
+                std::memcpy(&found[offsets[i]], &results[task][starts[i]],
+                            (offsets[i + 1] - offsets[i]) * sizeof(uint32_t));
+        }
+        std::vector<uint32_t>().swap(results[task]);
+    });
+}
+
+} // namespace grid_detail
+
+// About `density` cells per triangle, cubic but for flat models (which get
+// a single layer), in at most `max_cells`. Every cell lists its triangles
+// in increasing order, so the grid does not depend on the thread count.
+// Fails when the lists would exceed 2^32 entries.
+inline bool build_grid(const TriangleArrays& triangles, const GridOptions& options, Grid& grid,
+                       std::string* error = 0) {
+    using namespace grid_detail;
+    unsigned threads = options.threads > 0 ? options.threads : default_thread_count();
+    size_t count = triangles.size();
+    grid.header = make_tri_grid_header();
+    grid.header.triangle_count = count;
+    grid.offsets.clear();
+    grid.triangles.clear();
+
+    // Bounds of the finite triangles.
+    size_t tasks = (count + PARALLEL_SIZE - 1) / PARALLEL_SIZE;
+    std::vector<uint8_t> finite(count);
+    std::vector<double> task_bounds(6 * tasks);
+    std::vector<size_t> task_kept(tasks, 0);
+    parallel_for(tasks, threads, [&](size_t task, unsigned) {
+        double* bounds = &task_bounds[6 * task];
+        for (int d = 0; d < 3; ++d) {
+            bounds[d] = HUGE_VAL;
+            bounds[3 + d] = -HUGE_VAL;
+        }
+        for (size_t i = task * PARALLEL_SIZE; i < std::min(count, (task + 1) * PARALLEL_SIZE); ++i) {
+            double v[3][3];
+            corners_of(triangles, i, v);
+            double sum = 0.0;
+            for (int c = 0; c < 3; ++c)
+                sum += v[c][0] + v[c][1] + v[c][2];
+            finite[i] = sum - sum == 0.0;
+            if (!finite[i])
+                continue;
+            ++task_kept[task];
+            for (int c = 0; c < 3; ++c)
+                for (int d = 0; d < 3; ++d) {
+                    bounds[d] = std::min(bounds[d], v[c][d]);
+                    bounds[3 + d] = std::max(bounds[3 + d], v[c][d]);
+                }
+        }
+    });
+    double low[3] = { HUGE_VAL, HUGE_VAL, HUGE_VAL }, high[3] = { -HUGE_VAL, -HUGE_VAL, -HUGE_VAL };
+    size_t kept = 0;
+    for (size_t task = 0; task < tasks; ++task) {
+        kept += task_kept[task];
+        for (int d = 0; d < 3; ++d) {
+            low[d] = std::min(low[d], task_bounds[6 * task + d]);
+            high[d] = std::max(high[d], task_bounds[6 * task + 3 + d]);
+        }
+    }
+
+    // Resolution: cubic cells over the axes the model really spans.
+    double extent[3], largest = 0.0;
+    for (int d = 0; d < 3; ++d) {
+        extent[d] = kept > 0 ? high[d] - low[d] : 0.0;
+        largest = std::max(largest, extent[d]);
+    }
+    double target = std::max(1.0, std::min((double)std::max((size_t)1, options.max_cells), options.density * kept));
+    double volume = 1.0;
+    int spanned = 0;
+    for (int d = 0; d < 3; ++d)
+        if (extent[d] > 1e-3 * largest) {
+            volume *= extent[d];
+            ++spanned;
+        }
+    double side = spanned > 0 ? std::pow(volume / target, 1.0 / spanned) : 1.0;
+    double resolution[3];
+    for (int d = 0; d < 3; ++d)
+        resolution[d] = extent[d] > 1e-3 * largest ? std::min(65536.0, std::ceil(extent[d] / side)) : 1.0;
+    while (resolution[0] * resolution[1] * resolution[2] > (double)std::max((size_t)1, options.max_cells))
+        for (int d = 0; d < 3; ++d)
+            resolution[d] = std::max(1.0, std::floor(resolution[d] * 0.9));
+    for (int d = 0; d < 3; ++d) {
+        grid.header.resolution[d] = (uint32_t)resolution[d];
+        grid.header.min[d] = kept > 0 ? (float)low[d] : 0.0f;
+        double cell = extent[d] / resolution[d] * (1.0 + 1e-6);
+        grid.header.cell[d] = cell > 0.0 ? (float)cell : 1.0f;
+    }
+
+    // Count the entries of every cell, place them, then sort each list.
+    Cells cells(grid.header);
+    size_t cell_count = (size_t)tri_grid_cell_count(grid.header);
+    std::vector<std::atomic<uint32_t> > counts(cell_count);
+    std::vector<uint64_t> task_entries(tasks, 0);
+    parallel_for(tasks, threads, [&](size_t task, unsigned) {
+        for (size_t i = task * PARALLEL_SIZE; i < std::min(count, (task + 1) * PARALLEL_SIZE); ++i) {
+            if (!finite[i])
+                continue;
+            double v[3][3];
+            corners_of(triangles, i, v);
+            for_each_cell(cells, v, [&](size_t cell) {
+                counts[cell].fetch_add(1, std::memory_order_relaxed);
+                ++task_entries[task];
+            });
+        }
+    });
+    uint64_t entries = 0;
+    for (size_t task = 0; task < tasks; ++task)
+        entries += task_entries[task];
+    if (entries >= 0xffffffffULL) {
+        if (error)
+            *error = "more than 2^32 grid entries, lower the density";
+        return false;
+    }
+    grid.header.reference_count = entries;
+    grid.offsets.resize(cell_count + 1);
+    grid.offsets[0] = 0;
+    for (size_t c = 0; c < cell_count; ++c) {
+        grid.offsets[c + 1] = grid.offsets[c] + counts[c].load(std::memory_order_relaxed);
+        counts[c].store(grid.offsets[c], std::memory_order_relaxed);
+    }
+    grid.triangles.resize(entries);
+    parallel_for(tasks, threads, [&](size_t task, unsigned) {
+        for (size_t i = task * PARALLEL_SIZE; i < std::min(count, (task + 1) * PARALLEL_SIZE); ++i) {
+            if (!finite[i])
+                continue;
+            double v[3][3];
+            corners_of(triangles, i, v);
+            for_each_cell(cells, v, [&](size_t cell) {
+                grid.triangles[counts[cell].fetch_add(1, std::memory_order_relaxed)] = (uint32_t)i;
+            });
+        }
+    });
+    size_t cell_tasks = (cell_count + PARALLEL_SIZE - 1) / PARALLEL_SIZE;
+    parallel_for(cell_tasks, threads, [&](size_t task, unsigned) {
+        for (size_t c = task * PARALLEL_SIZE; c < std::min(cell_count, (task + 1) * PARALLEL_SIZE); ++c)
+            std::sort(grid.triangles.begin() + grid.offsets[c], grid.triangles.begin() + grid.offsets[c + 1]);
+    });
+    return true;
+}
+
+// Writes the sidecar; `data_size` is the size of the triangle file.
+inline bool write_grid(const std::string& path, const Grid& grid, uint64_t data_size) {
+    BufferedWriter writer;
+    if (!writer.open(path))
+        return false;
+    TriGridHeader header = grid.header;
+    header.data_size = data_size;
+    writer.write((const char*)&header, sizeof(header));
+    if (!grid.offsets.empty())
+        writer.write((const char*)&grid.offsets[0], grid.offsets.size() * sizeof(uint32_t));
+    if (!grid.triangles.empty())
+        writer.write((const char*)&grid.triangles[0], grid.triangles.size() * sizeof(uint32_t));
+    return writer.close();
+}
+
+// A sidecar mapped read-only, to query in place.
+class MappedGrid {
+public:
+    MappedGrid() : header_(0) {}
+
+    // `data_size`, when not 0, is checked against the size recorded.
+    bool open(const std::string& path, uint64_t data_size = 0, std::string* error = 0) {
+        header_ = 0;
+        if (!file_.open(path))
+            return fail(error, "cannot open " + path);
+        if (file_.size() < TRI_GRID_HEADER_SIZE)
+            return fail(error, "not a .grid file");
+        const TriGridHeader* header = (const TriGridHeader*)file_.data();
+        if (!is_tri_grid_header(*header) || tri_grid_file_size(*header) != file_.size())
+            return fail(error, "not a .grid file, or truncated");
+        if (data_size != 0 && header->data_size != data_size)
+            return fail(error, "the grid does not match its data file");
+        header_ = header;
+        return true;
+    }
+
+    const TriGridHeader& header() const { return *header_; }
+    const uint32_t* offsets() const { return (const uint32_t*)(file_.data() + TRI_GRID_HEADER_SIZE); }
+    const uint32_t* triangles() const { return offsets() + tri_grid_cell_count(*header_) + 1; }
+
+private:
+    bool fail(std::string* error, const std::string& message) {
+        if (error)
+            *error = message;
+        file_.close();
+        return false;
+    }
+
+    MappedInput file_;
+    const TriGridHeader* header_;
+};
+
+// Queries on a grid, built or mapped, which must outlive the index. The
+// corners of each triangle are copied next to each other: a query reads
+// one or two cache lines per triangle rather than nine.
+class GridIndex {
+public:
+    GridIndex() : ready_(false), offsets_(0), numbers_(0) { header_ = make_tri_grid_header(); }
+
+    // `offsets` and `numbers` as in a Grid or a MappedGrid. Fails when the
+    // grid does not fit the triangles.
+    bool build(const TriangleArrays& triangles, const TriGridHeader& header, const uint32_t* offsets,
+               const uint32_t* numbers, unsigned threads = 0, std::string* error = 0);
+
+    bool build(const TriangleArrays& triangles, const Grid& grid, unsigned threads = 0, std::string* error = 0) {
+        return build(triangles, grid.header, grid.offsets.empty() ? 0 : &grid.offsets[0],
+                     grid.triangles.empty() ? 0 : &grid.triangles[0], threads, error);
+    }
+
+    bool build(const TriangleArrays& triangles, const MappedGrid& grid, unsigned threads = 0,
+               std::string* error = 0) {
+        return build(triangles, grid.header(), grid.offsets(), grid.triangles(), threads, error);
+    }
+
+    // The triangle closest to `point`, if one is within `max_distance`;
+    // `hit` is filled either way.
+    bool nearest(const float* point, float max_distance, GridHit& hit) const;
+
+    // Appends the triangles within `radius` of `point`, in increasing order.
+    void within(const float* point, float radius, std::vector<uint32_t>& found) const;
+
+    // Appends the triangles crossing the box [low, high], in increasing
+    // order.
+    void overlapping(const float* low, const float* high, std::vector<uint32_t>& found) const;
+
+    const TriGridHeader& header() const { return header_; }
+
+private:
+    // The cells [low, high] along each axis, clamped.
+    void cell_range(const double* low, const double* high, int* first, int* last) const {
+        grid_detail::Cells cells(header_);
+        for (int d = 0; d < 3; ++d) {
+            first[d] = cells.cell_of(low[d], d);
+            last[d] = cells.cell_of(high[d], d);
+        }
+    }
+
+    bool ready_;
+    std::vector<float> corners_; // 9 per triangle
+    TriGridHeader header_;
+    const uint32_t* offsets_;
+    const uint32_t* numbers_;
+};
+
+inline bool GridIndex::build(const TriangleArrays& triangles, const TriGridHeader& header, const uint32_t* offsets,
+                             const uint32_t* numbers, unsigned threads, std::string* error) {
+    ready_ = false;
+    uint64_t cell_count = tri_grid_cell_count(header);
+    bool fits = header.triangle_count == triangles.size() && cell_count > 0 && offsets != 0 && offsets[0] == 0
+        && offsets[cell_count] == header.reference_count;
+    for (int d = 0; d < 3 && fits; ++d)
+        fits = header.cell[d] > 0.0f && header.min[d] - header.min[d] == 0.0f;
+    for (uint64_t c = 0; c < cell_count && fits; ++c)
+        fits = offsets[c] <= offsets[c + 1];
+    for (uint64_t n = 0; n < header.reference_count && fits; ++n)
+        fits = numbers[n] < triangles.size();
+    if (!fits) {
+        if (error)
+            *error = "the grid does not match the triangles";
+        return false;
+    }
+    size_t count = triangles.size();
+    corners_.resize(9 * count);
+    const size_t task_size = grid_detail::PARALLEL_SIZE;
+    parallel_for((count + task_size - 1) / task_size, threads, [&](size_t task, unsigned) {
+        for (size_t i = task * task_size; i < std::min(count, (task + 1) * task_size); ++i)
+            for (int c = 0; c < 3; ++c) {
+                corners_[9 * i + 3 * c] = triangles.x[c][i];
+                corners_[9 * i + 3 * c + 1] = triangles.y[c][i];
+                corners_[9 * i + 3 * c + 2] = triangles.z[c][i];
+            }
+    });
+    ready_ = true;
+    header_ = header;
+    offsets_ = offsets;
+    numbers_ = numbers;
+    return true;
+}
+
+// The cells are visited in shells of growing distance (in cells) around
+// the one of the point. No cell of a shell is closer than the closest of
+// the shell inside it, so the search stops at the first shell whose every
+// cell is farther than the best triangle so far. Layers and rows of a shell
+// farther than that are skipped whole, and rows are walked from the
+// point's column outwards until the cells get too far.
+inline bool GridIndex::nearest(const float* point, float max_distance, GridHit& hit) const {
+    using namespace grid_detail;
+    hit.triangle = GRID_NO_HIT;
+    hit.distance = max_distance;
+    if (!ready_)
+        return false;
+    Cells cells(header_);
+    double p[3] = { point[0], point[1], point[2] };
+    int center[3], reach = 0;
+    for (int d = 0; d < 3; ++d) {
+        center[d] = cells.cell_of(p[d], d);
+        reach = std::max(reach, std::max(center[d], cells.resolution[d] - 1 - center[d]));
+    }
+    double best = (double)max_distance * max_distance;
+    // Tests the triangles of cell (i, j, k) when it is within reach, and
+    // tells whether it was.
+    auto visit = [&](int i, int j, int k, double partial) {
+        double gx = cells.gap(p[0], i, 0);
+        if (partial + gx * gx > best)
+            return false;
+        size_t cell = cells.number(i, j, k);
+        for (uint32_t n = offsets_[cell]; n < offsets_[cell + 1]; ++n) {
+            double v[3][3], q[3];
+            corners_of(&corners_[9 * (size_t)numbers_[n]], v);
+            if (box_distance(p, v) > best)
+                continue;
+            double squared = closest_point(p, v, q);
+            if (squared < best || (squared == best && hit.triangle == GRID_NO_HIT)) {
+                best = squared;
+                hit.triangle = numbers_[n];
+                for (int d = 0; d < 3; ++d)
+                    hit.point[d] = (float)q[d];
+            }
+        }
+        return true;
+    };
+    for (int shell = 0; shell <= reach; ++shell) {
+        int first[3], last[3];
+        for (int d = 0; d < 3; ++d) {
+            first[d] = std::max(0, center[d] - shell);
+            last[d] = std::min(cells.resolution[d] - 1, center[d] + shell);
+        }
+        bool open = false;
+        for (int k = first[2]; k <= last[2]; ++k) {
+            double gz = cells.gap(p[2], k, 2);
+            if (gz * gz > best)
+                continue;
+            for (int j = first[1]; j <= last[1]; ++j) {
+                double gy = cells.gap(p[1], j, 1), partial = gy * gy + gz * gz;
+                if (partial > best)
+                    continue;
+                if (std::abs(k - center[2]) == shell || std::abs(j - center[1]) == shell) {
+                    // A face of the shell: the whole row.
+                    for (int i = center[0]; i <= last[0] && visit(i, j, k, partial); ++i)
+                        open = true;
+                    for (int i = center[0] - 1; i >= first[0] && visit(i, j, k, partial); --i)
+                        open = true;
+                }
+                else if (shell > 0) {
+                    // Inside the shell: only its two ends.
+                    if (center[0] + shell <= last[0] && visit(center[0] + shell, j, k, partial))
+                        open = true;
+                    if (center[0] - shell >= first[0] && visit(center[0] - shell, j, k, partial))
+                        open = true;
+                }
+            }
+        }
+        if (!open)
+            break;
+    }
+    if (hit.triangle == GRID_NO_HIT)
+        return false;
+    hit.distance = (float)std::sqrt(best);
+    return true;
+}
+
+inline void GridIndex::within(const float* point, float radius, std::vector<uint32_t>& found) const {
+    using namespace grid_detail;
+    if (!ready_ || !(radius >= 0.0f))
+        return;
+    Cells cells(header_);
+    double p[3] = { point[0], point[1], point[2] };
+    double low[3] = { p[0] - radius, p[1] - radius, p[2] - radius };
+    double high[3] = { p[0] + radius, p[1] + radius, p[2] + radius };
+    int first[3], last[3];
+    cell_range(low, high, first, last);
+    double limit = (double)radius * radius;
+    size_t start = found.size();
+    for (int k = first[2]; k <= last[2]; ++k)
+        for (int j = first[1]; j <= last[1]; ++j)
+            for (int i = first[0]; i <= last[0]; ++i) {
+                double gx = cells.gap(p[0], i, 0), gy = cells.gap(p[1], j, 1), gz = cells.gap(p[2], k, 2);
+                if (gx * gx + gy * gy + gz * gz > limit)
+                    continue;
+                size_t cell = cells.number(i, j, k);
+                for (uint32_t n = offsets_[cell]; n < offsets_[cell + 1]; ++n) {
+                    double v[3][3], q[3];
+                    corners_of(&corners_[9 * (size_t)numbers_[n]], v);
+                    if (closest_point(p, v, q) <= limit)
+                        found.push_back(numbers_[n]);
+                }
+            }
+    std::sort(found.begin() + start, found.end());
+    found.erase(std::unique(found.begin() + start, found.end()), found.end());
+}
+
+inline void GridIndex::overlapping(const float* low, const float* high, std::vector<uint32_t>& found) const {
+    using namespace grid_detail;
+    if (!ready_ || !(low[0] <= high[0] && low[1] <= high[1] && low[2] <= high[2]))
+        return;
+    double lower[3] = { low[0], low[1], low[2] }, upper[3] = { high[0], high[1], high[2] };
+    double center[3], half[3];
+    for (int d = 0; d < 3; ++d) {
+        center[d] = 0.5 * (lower[d] + upper[d]);
+        half[d] = 0.5 * (upper[d] - lower[d]);
+    }
+    int first[3], last[3];
+    cell_range(lower, upper, first, last);
+    Cells cells(header_);
+    size_t start = found.size();
+    for (int k = first[2]; k <= last[2]; ++k)
+        for (int j = first[1]; j <= last[1]; ++j)
+            for (int i = first[0]; i <= last[0]; ++i) {
+                size_t cell = cells.number(i, j, k);
+                for (uint32_t n = offsets_[cell]; n < offsets_[cell + 1]; ++n) {
+                    double v[3][3];
+                    corners_of(&corners_[9 * (size_t)numbers_[n]], v);
+                    if (crosses_box(center, half, v))
+                        found.push_back(numbers_[n]);
+                }
+            }
+    std::sort(found.begin() + start, found.end());
+    found.erase(std::unique(found.begin() + start, found.end()), found.end());
+}
+
+// Nearest triangles of `count` points (3 floats each) on all cores; returns
+// how many found one within `max_distance`. The points are taken in the
+// order of their cells.
+inline size_t nearest_triangles(const GridIndex& index, const float* points, size_t count, float max_distance,
+                                GridHit* hits, unsigned threads = 0) {
+    std::vector<size_t> order;
+    grid_detail::query_order(index.header(), points, 3, count, threads, order);
+    const size_t batch = 1024;
+    size_t tasks = (count + batch - 1) / batch;
+    std::vector<size_t> found(tasks, 0);
+    parallel_for(tasks, threads, [&](size_t task, unsigned) {
+        for (size_t s = task * batch; s < std::min(count, (task + 1) * batch); ++s) {
+            size_t i = order[s];
+            found[task] += index.nearest(points + 3 * i, max_distance, hits[i]);
+        }
+    });
+    size_t total = 0;
+    for (size_t t = 0; t < tasks; ++t)
+        total += found[t];
+    return total;
+}
+
+// The triangles within `radius` of each of `count` points, on all cores:
+// point i has found[offsets[i] .. offsets[i + 1]).
+inline void triangles_within(const GridIndex& index, const float* points, size_t count, float radius,
+                             std::vector<size_t>& offsets, std::vector<uint32_t>& found, unsigned threads = 0) {
+    std::vector<size_t> order;
+    grid_detail::query_order(index.header(), points, 3, count, threads, order);
+    grid_detail::gather(order, threads, [&](size_t i, std::vector<uint32_t>& out) {
+        index.within(points + 3 * i, radius, out);
+    }, offsets, found);
+}
+
+// The triangles crossing each of `count` boxes (6 floats each: the low
+// corner, then the high one), on all cores: box i has found[offsets[i] ..
+// offsets[i + 1]).
+inline void triangles_overlapping(const GridIndex& index, const float* boxes, size_t count,
+                                  std::vector<size_t>& offsets, std::vector<uint32_t>& found, unsigned threads = 0) {
+    std::vector<size_t> order;
+    grid_detail::query_order(index.header(), boxes, 6, count, threads, order);
+    grid_detail::gather(order, threads, [&](size_t i, std::vector<uint32_t>& out) {
+        index.overlapping(boxes + 6 * i, boxes + 6 * i + 3, out);
+    }, offsets, found);
+}
+
+#endif // SKP2TRI_TRI_GRID_H
@@ -0,0 +1,260 @@
+#ifndef SKP2TRI_TRI_HALFEDGE_H
+#define SKP2TRI_TRI_HALFEDGE_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <ostream>
+#include <stdint.h>
+#include "parallel.h"
+#include "json.h"
+#include "tri_format.h"
+#include "buffered_writer.h"
+
+// Half-edge connectivity of indexed triangles, and what it says about the
+// surface: its boundary and non-manifold edges, the edges whose two
+// triangles disagree on the orientation, and its connected components.
+//
+// Half-edge h = 3t + k runs from corner k to corner (k + 1) % 3 of
+// triangle t; its twin is the half-edge of the other triangle on the same
+// edge. The half-edges are matched by hashing their edge: each worker owns
+// a hash partition of the edges and matches its own, so the result does not
+// depend on the thread count. Triangles with a repeated corner are left
+// out (their half-edges have no twin and do not count as boundary).
+
+const uint32_t HALF_EDGE_BOUNDARY = TRI_ADJACENCY_BOUNDARY;
+const uint32_t HALF_EDGE_NON_MANIFOLD = TRI_ADJACENCY_NON_MANIFOLD;
+
+struct TopologyStats {
+    uint64_t triangles;
+    uint64_t degenerate;   // triangles with a repeated corner, left out
+    uint64_t edges;        // distinct edges of the other triangles
+    uint64_t boundary;     // edges of a single triangle
+    uint64_t non_manifold; // edges of more than two triangles
+    uint64_t inconsistent; // edges whose two triangles run them the same way
+    uint64_t components;   // triangles connected through their edges
+
+    TopologyStats()
+        : triangles(0), degenerate(0), edges(0), boundary(0), non_manifold(0), inconsistent(0), components(0) {}
+
+    // A closed, consistently oriented 2-manifold: what volumes need.
+    bool closed() const { return triangles > degenerate && boundary == 0 && non_manifold == 0 && inconsistent == 0; }
+
+    void add(const TopologyStats& other) {
+        triangles += other.triangles;
+        degenerate += other.degenerate;
+        edges += other.edges;
+        boundary += other.boundary;
+        non_manifold += other.non_manifold;
+        inconsistent += other.inconsistent;
+        components += other.components;
+    }
+};
+
+struct HalfEdges {
+    std::vector<uint32_t> twin;      // per half-edge: its twin, HALF_EDGE_BOUNDARY or HALF_EDGE_NON_MANIFOLD
+    std::vector<uint32_t> component; // per triangle, numbered in order of first triangle
+
+    size_t triangle_count() const { return twin.size() / 3; }
+
+    static uint32_t next(uint32_t h) { return h % 3 == 2 ? h - 2 : h + 1; }
+
+    // The triangle across edge k of triangle t, HALF_EDGE_BOUNDARY or
+    // HALF_EDGE_NON_MANIFOLD: the adjacency buffer entry.
+    uint32_t neighbor(size_t t, int k) const {
+        uint32_t h = twin[3 * t + k];
+        return h >= HALF_EDGE_NON_MANIFOLD ? h : h / 3;
+    }
+};
+
+namespace halfedge_detail {
+
+const size_t PARALLEL_SIZE = 1 << 16;
+
+inline uint64_t edge_key(uint32_t a, uint32_t b) {
+    return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+}
+
+inline uint32_t edge_hash(uint64_t key) {
+    key = (key ^ (key >> 31)) * 0x7FB5D329728EA185ULL;
+    key = (key ^ (key >> 27)) * 0x81DADEF4BC2DD44DULL;
+    return (uint32_t)(key ^ (key >> 33));
+}
+
+inline uint32_t find(std::vector<uint32_t>& parent, uint32_t i) {
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+inline void join(std::vector<uint32_t>& parent, uint32_t a, uint32_t b) {
+    a = find(parent, a);
+    b = find(parent, b);
+    if (a != b)
+        parent[std::max(a, b)] = std::min(a, b);
+}
+
+} // namespace halfedge_detail
+
+// Builds the half-edges of `triangle_count` triangles whose corners are
+// `indices` (3 per triangle) and reports on them. Returns false when there
+// are too many triangles for 32-bit half-edge numbers.
+inline bool build_half_edges(const uint32_t* indices, size_t triangle_count, unsigned threads, HalfEdges& mesh,
+                             TopologyStats& stats) {
+    using namespace halfedge_detail;
+    stats = TopologyStats();
+    stats.triangles = triangle_count;
+    if (3 * (uint64_t)triangle_count >= HALF_EDGE_NON_MANIFOLD)
+        return false;
+    if (threads == 0)
+        threads = default_thread_count();
+    size_t half_edges = 3 * triangle_count;
+    mesh.twin.assign(half_edges, HALF_EDGE_BOUNDARY);
+    mesh.component.assign(triangle_count, 0);
+
+    std::vector<uint32_t> hashes(half_edges);
+    std::vector<char> used(triangle_count);
+    parallel_for((triangle_count + PARALLEL_SIZE - 1) / PARALLEL_SIZE, threads, [&](size_t task, unsigned) {
+        size_t end = std::min(triangle_count, (task + 1) * PARALLEL_SIZE);
+        for (size_t t = task * PARALLEL_SIZE; t < end; ++t) {
+            const uint32_t* c = &indices[3 * t];
+            used[t] = c[0] != c[1] && c[1] != c[2] && c[2] != c[0];
+            for (int k = 0; k < 3; ++k)
+                hashes[3 * t + k] = edge_hash(edge_key(c[k], c[(k + 1) % 3]));
+        }
+    });
+    for (size_t t = 0; t < triangle_count; ++t)
+        stats.degenerate += !used[t];
+
+    // Each partition chains the half-edges of every edge (last[key] is the
+    // latest one, previous[] goes back), then resolves the chains.
+    unsigned partitions = (unsigned)std::min<size_t>(threads, std::max<size_t>(half_edges / PARALLEL_SIZE, 1));
+    std::vector<uint32_t> previous(half_edges, HALF_EDGE_BOUNDARY);
+    std::vector<TopologyStats> partial(partitions);
+    std::vector<std::vector<std::pair<uint32_t, uint32_t> > > joins(partitions);
+    parallel_for(partitions, partitions, [&](size_t partition, unsigned) {
+        std::unordered_map<uint64_t, uint32_t> last;
+        for (size_t h = 0; h < half_edges; ++h) {
+            if (hashes[h] % partitions != partition || !used[h / 3])
+                continue;
+            const uint32_t* c = &indices[h - h % 3];
+            std::pair<std::unordered_map<uint64_t, uint32_t>::iterator, bool> inserted =
+                last.insert(std::make_pair(edge_key(c[h % 3], c[(h % 3 + 1) % 3]), (uint32_t)h));
+            if (!inserted.second) {
+                previous[h] = inserted.first->second;
+                inserted.first->second = (uint32_t)h;
+            }
+        }
+        TopologyStats& counts = partial[partition];
+        for (std::unordered_map<uint64_t, uint32_t>::const_iterator e = last.begin(); e != last.end(); ++e) {
+            ++counts.edges;
+            uint32_t b = e->second, a = previous[b];
+            if (a == HALF_EDGE_BOUNDARY) {
+                ++counts.boundary;
+                continue;
+            }
+            if (previous[a] == HALF_EDGE_BOUNDARY) {
+                mesh.twin[a] = b;
+                mesh.twin[b] = a;
+                joins[partition].push_back(std::make_pair(a / 3, b / 3));
+                // Twins run their edge in opposite directions.
+                counts.inconsistent += indices[a] == indices[b];
+                continue;
+            }
+            ++counts.non_manifold;
+            for (uint32_t h = b; h != HALF_EDGE_BOUNDARY; h = previous[h]) {
+                mesh.twin[h] = HALF_EDGE_NON_MANIFOLD;
+                if (h != b)
+                    joins[partition].push_back(std::make_pair(h / 3, b / 3));
+            }
+        }
+    });
+    for (size_t p = 0; p < partial.size(); ++p)
+        stats.add(partial[p]);
+
+    // Components, numbered by their first triangle.
+    std::vector<uint32_t> parent(triangle_count);
+    for (size_t t = 0; t < triangle_count; ++t)
+        parent[t] = (uint32_t)t;
+    for (size_t p = 0; p < joins.size(); ++p)
+        for (size_t j = 0; j < joins[p].size(); ++j)
+            join(parent, joins[p][j].first, joins[p][j].second);
+    std::vector<uint32_t> number(triangle_count, HALF_EDGE_BOUNDARY);
+    for (size_t t = 0; t < triangle_count; ++t) {
+        uint32_t root = find(parent, (uint32_t)t);
+        if (!used[t] && root == t) {
+            mesh.component[t] = HALF_EDGE_BOUNDARY; // left out, in no component
+            continue;
+        }
+        if (number[root] == HALF_EDGE_BOUNDARY)
+            number[root] = (uint32_t)stats.components++;
+        mesh.component[t] = number[root];
+    }
+    return true;
+}
+
+// A part of the report: a definition, or a top-level group / instance.
+struct TopologyGroup {
+    std::string name;
+    std::string kind;
+    int32_t entity_id;
+    uint64_t instances; // times the part is in the output
+    TopologyStats stats;
+
+    TopologyGroup() : entity_id(0), instances(1) {}
+};
+
+inline void write_topology_counts(std::ostream& out, const TopologyStats& stats) {
+    out << "\"triangles\": " << stats.triangles << ", \"degenerate\": " << stats.degenerate
+        << ", \"edges\": " << stats.edges << ", \"boundary_edges\": " << stats.boundary
+        << ", \"non_manifold_edges\": " << stats.non_manifold << ", \"inconsistent_edges\": " << stats.inconsistent
+        << ", \"components\": " << stats.components << ", \"closed\": " << (stats.closed() ? "true" : "false");
+}
+
+// Writes the report: the totals over the output (each part counted as
+// many times as it is in it), then one entry per part.
+inline void write_topology_json(std::ostream& out, const std::vector<TopologyGroup>& groups) {
+    TopologyStats total;
+    bool closed = !groups.empty();
+    for (size_t g = 0; g < groups.size(); ++g) {
+        for (uint64_t i = 0; i < groups[g].instances; ++i)
+            total.add(groups[g].stats);
+        closed = closed && (groups[g].stats.closed() || groups[g].instances == 0);
+    }
+    out << "{\n  ";
+    write_topology_counts(out, total);
+    out << ",\n  \"all_closed\": " << (closed ? "true" : "false") << ",\n  \"groups\": [";
+    for (size_t g = 0; g < groups.size(); ++g) {
+        const TopologyGroup& group = groups[g];
+        out << (g > 0 ? "," : "") << "\n    {\"name\": " << json_string(group.name)
+            << ", \"kind\": " << json_string(group.kind) << ", \"entity_id\": " << group.entity_id
+            << ", \"instances\": " << group.instances << ", ";
+        write_topology_counts(out, group.stats);
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+// Writes the adjacency buffer (<data-file>.adj, see tri_format.h).
+inline bool write_adjacency(const std::string& path, const HalfEdges& mesh, uint64_t data_size) {
+    BufferedWriter writer;
+    if (!writer.open(path))
+        return false;
+    TriAdjacencyHeader header = make_tri_adjacency_header(mesh.triangle_count(), data_size);
+    writer.write((const char*)&header, sizeof(header));
+    std::vector<uint32_t> block;
+    for (size_t first = 0; first < mesh.triangle_count(); first += halfedge_detail::PARALLEL_SIZE) {
+        size_t end = std::min(mesh.triangle_count(), first + halfedge_detail::PARALLEL_SIZE);
+        block.clear();
+        for (size_t t = first; t < end; ++t)
+            for (int k = 0; k < 3; ++k)
+                block.push_back(mesh.neighbor(t, k));
+        writer.write((const char*)&block[0], block.size() * sizeof(uint32_t));
+    }
+    return writer.close();
+}
+
+#endif // SKP2TRI_TRI_HALFEDGE_H
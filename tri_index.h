@@ -0,0 +1,148 @@
+#ifndef SKP2TRI_TRI_INDEX_H
+#define SKP2TRI_TRI_INDEX_H
+
+#include <string>
+#include <vector>
+#include <cfloat>
+#include "scene.h"
+#include "parallel.h"
+#include "buffered_writer.h"
+#include "tri_format.h"
+
+// Builds the sidecar index (see tri_format.h) of a flattened output from the
+// byte offset of every range, as recorded by the writer: offsets[r] is where
+// range r starts and offsets[ranges.size()] is the end of the data.
+class TriIndexBuilder {
+public:
+    TriIndexBuilder(const Scene& scene, const std::vector<SceneRange>& ranges,
+                    const std::vector<uint64_t>& offsets, unsigned threads)
+        : scene_(scene), ranges_(ranges), offsets_(offsets), cursor_(0) {
+        // Bounds of each range, computed by the workers.
+        bounds_.resize(ranges.size());
+        parallel_for(ranges.size(), threads, [&](size_t r, unsigned) {
+            const SceneRange& range = ranges_[r];
+            const SceneMesh& mesh = scene_.meshes[scene_.nodes[range.node].mesh];
+            Bounds& box = bounds_[r];
+            for (int k = 0; k < 3; ++k) {
+                box.min[k] = FLT_MAX;
+                box.max[k] = -FLT_MAX;
+            }
+            for (size_t i = 3 * range.first_triangle; i < 3 * (range.first_triangle + range.triangle_count); ++i) {
+                const SUPoint3D& point = mesh.vertices[mesh.indices[i]];
+                float p[3] = { (float)point.x, (float)point.y, (float)point.z };
+                for (int k = 0; k < 3; ++k) {
+                    if (p[k] < box.min[k]) box.min[k] = p[k];
+                    if (p[k] > box.max[k]) box.max[k] = p[k];
+                }
+            }
+        });
+    }
+
+    // Walks the subtree below `root` in the order flatten_scene used.
+    const std::vector<TriIndexEntry>& build(size_t root, bool recursive) {
+        entries_.clear();
+        cursor_ = 0;
+        add_node(root, recursive, 0, TRI_INDEX_NO_PARENT);
+        return entries_;
+    }
+
+private:
+    struct Bounds {
+        float min[3];
+        float max[3];
+    };
+
+    void fill(TriIndexEntry& entry, size_t first, size_t end) {
+        entry.offset = offsets_[first];
+        entry.length = offsets_[end] - offsets_[first];
+        entry.triangle_count = 0;
+        Bounds box;
+        for (int k = 0; k < 3; ++k) {
+            box.min[k] = FLT_MAX;
+            box.max[k] = -FLT_MAX;
+        }
+        for (size_t r = first; r < end; ++r) {
+            entry.triangle_count += ranges_[r].triangle_count;
+            for (int k = 0; k < 3; ++k) {
+                if (bounds_[r].min[k] < box.min[k]) box.min[k] = bounds_[r].min[k];
+                if (bounds_[r].max[k] > box.max[k]) box.max[k] = bounds_[r].max[k];
+            }
+        }
+        for (int k = 0; k < 3; ++k) {
+            entry.min[k] = entry.triangle_count > 0 ? box.min[k] : 0.0f;
+            entry.max[k] = entry.triangle_count > 0 ? box.max[k] : 0.0f;
+        }
+    }
+
+    TriIndexEntry make_entry(const SceneNode& node, uint16_t kind, uint16_t depth, uint32_t parent) {
+        TriIndexEntry entry;
+        std::memset(&entry, 0, sizeof(entry));
+        entry.entity_id = node.entity_id;
+        entry.kind = kind;
+        entry.depth = depth;
+        entry.parent = parent;
+        return entry;
+    }
+
+    void add_node(size_t node_index, bool recursive, uint16_t depth, uint32_t parent) {
+        const SceneNode& node = scene_.nodes[node_index];
+        size_t subtree_first = cursor_;
+        uint32_t self = parent;
+        if (node.kind != SceneNode::ROOT) {
+            self = (uint32_t)entries_.size();
+            entries_.push_back(make_entry(node, node.kind == SceneNode::GROUP ? TRI_INDEX_GROUP : TRI_INDEX_INSTANCE,
+                                          depth, parent));
+        }
+
+        size_t faces_first = cursor_;
+        while (cursor_ < ranges_.size() && ranges_[cursor_].node == node_index)
+            ++cursor_;
+        if (cursor_ > faces_first) {
+            TriIndexEntry faces = make_entry(node, TRI_INDEX_FACES, depth, self);
+            fill(faces, faces_first, cursor_);
+            entries_.push_back(faces);
+        }
+
+        if (recursive) {
+            for (size_t c = 0; c < node.children.size(); ++c)
+                add_node(node.children[c], recursive, depth + 1, self);
+        }
+        if (self != parent)
+            fill(entries_[self], subtree_first, cursor_);
+    }
+
+    const Scene& scene_;
+    const std::vector<SceneRange>& ranges_;
+    const std::vector<uint64_t>& offsets_;
+    std::vector<Bounds> bounds_;
+    std::vector<TriIndexEntry> entries_;
+    size_t cursor_;
+};
+
+// Byte offsets of the ranges in a format with fixed size triangle records.
+inline std::vector<uint64_t> fixed_range_offsets(const std::vector<SceneRange>& ranges,
+                                                 uint64_t header_size, uint64_t triangle_size) {
+    std::vector<uint64_t> offsets(ranges.size() + 1);
+    for (size_t r = 0; r < ranges.size(); ++r)
+        offsets[r] = header_size + ranges[r].output_triangle * triangle_size;
+    offsets[ranges.size()] = header_size + ranges_triangle_count(ranges) * triangle_size;
+    return offsets;
+}
+
+inline bool write_tri_index(const Scene& scene, size_t root, bool recursive, const std::vector<SceneRange>& ranges,
+                            const std::vector<uint64_t>& offsets, uint32_t format,
+                            const std::string& path, unsigned threads) {
+    TriIndexBuilder builder(scene, ranges, offsets, threads);
+    const std::vector<TriIndexEntry>& entries = builder.build(root, recursive);
+
+    BufferedWriter writer;
+    if (!writer.open(path))
+        return false;
+    TriIndexHeader header = make_tri_index_header(format, entries.size(), offsets.back());
+    writer.write((const char*)&header, sizeof(header));
+    if (!entries.empty())
+        writer.write((const char*)&entries[0], entries.size() * sizeof(TriIndexEntry));
+    return writer.close();
+}
+
+#endif // SKP2TRI_TRI_INDEX_H
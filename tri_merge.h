@@ -0,0 +1,519 @@
+#ifndef SKP2TRI_TRI_MERGE_H
+#define SKP2TRI_TRI_MERGE_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cmath>
+#include <stdint.h>
+#include "tri_reader.h"
+#include "tri_format.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include "json.h"
+
+// Merge of many exports (.tri, .trb, .stl or .ply) into one instanced glTF
+// binary. Each input is cut into objects, its top-level groups and
+// instances when it has a sidecar index (<file>.idx) and else the whole
+// file, and every object is moved to the origin of its bounds and hashed,
+// so that the same geometry anywhere in any input is stored once and
+// placed by as many nodes as it has copies.
+//
+// Two passes keep the memory bounded whatever the number of inputs: the
+// first reads the objects one at a time per worker and keeps only their
+// hash and placement, the second maps the output at its final size and
+// reads back one copy of each distinct geometry, written in place.
+
+struct MergeInput {
+    std::string path;
+    double transform[16]; // placement in the merged scene, column major like glTF
+
+    MergeInput() {
+        for (int i = 0; i < 16; ++i)
+            transform[i] = (i % 5 == 0) ? 1.0 : 0.0;
+    }
+};
+
+struct MergeOptions {
+    unsigned threads;  // 0: one per core
+    double tolerance;  // coordinates closer than this, relative to the object origin, are the same
+    bool use_index;    // cut the inputs by their sidecar index
+
+    MergeOptions() : threads(0), tolerance(1e-3), use_index(true) {}
+};
+
+struct MergeObject {
+    uint32_t input;
+    uint32_t mesh;           // distinct geometry, in first use order
+    int32_t entity_id;       // of the top-level entry, 0 for the model's faces or a whole file
+    uint16_t kind;           // TriIndexKind, 0 for a whole file
+    uint64_t offset;         // span of the input (whole file when kind is 0)
+    uint64_t length;
+    uint64_t triangle_count;
+    double origin[3];        // low corner of the bounds, where the geometry is placed
+    float min[3];            // bounds of the geometry, relative to the origin
+    float max[3];
+    uint64_t key[2];
+};
+
+struct MergeMesh {
+    uint32_t object;   // first object with this geometry, read back to write it
+    uint64_t positions; // byte offsets in the binary chunk
+    uint64_t normals;
+};
+
+struct MergePlan {
+    std::vector<MergeInput> inputs;
+    std::vector<uint32_t> formats; // TriIndexFormat of the indexed inputs
+    std::vector<MergeObject> objects;
+    std::vector<MergeMesh> meshes;
+    uint64_t bin_size;
+
+    MergePlan() : bin_size(0) {}
+
+    uint64_t triangle_count() const {
+        uint64_t count = 0;
+        for (size_t o = 0; o < objects.size(); ++o)
+            count += objects[o].triangle_count;
+        return count;
+    }
+
+    uint64_t stored_triangle_count() const {
+        uint64_t count = 0;
+        for (size_t m = 0; m < meshes.size(); ++m)
+            count += objects[meshes[m].object].triangle_count;
+        return count;
+    }
+};
+
+namespace merge_detail {
+
+inline uint64_t mix(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+struct KeyHash {
+    size_t operator()(const std::pair<uint64_t, uint64_t>& key) const { return (size_t)(key.first ^ key.second); }
+};
+
+inline bool read_object(const MergePlan& plan, const MergeObject& object, unsigned threads,
+                        TriangleArrays& triangles, std::string* error) {
+    TriReadOptions options;
+    options.threads = threads;
+    const std::string& path = plan.inputs[object.input].path;
+    if (object.kind == 0)
+        return read_triangles(path, triangles, options, error);
+    return read_tri_span(path, plan.formats[object.input], object.offset, object.length, triangles, options, error);
+}
+
+// A coordinate snapped to the tolerance, as an integer for the key. NaN
+// gives 0; infinities and values past 2^62 units are clamped, since the
+// conversion of an out of range double is undefined.
+inline int64_t snap(float value, double tolerance) {
+    double snapped = tolerance > 0.0 ? std::floor(value / tolerance + 0.5) : (double)value;
+    const double limit = 4611686018427387904.0; // 2^62
+    if (snapped != snapped)
+        return 0;
+    return (int64_t)std::max(-limit, std::min(limit, snapped));
+}
+
+// Whether two objects with the same key may share a mesh: their triangle
+// counts and bounds, known without reading them again, must agree too.
+inline bool same_shape(const MergeObject& a, const MergeObject& b, double tolerance) {
+    if (a.triangle_count != b.triangle_count)
+        return false;
+    for (int d = 0; d < 3; ++d) {
+        if (snap(a.min[d], tolerance) != snap(b.min[d], tolerance)
+            || snap(a.max[d], tolerance) != snap(b.max[d], tolerance))
+            return false;
+    }
+    return true;
+}
+
+inline void relative_corner(const TriangleArrays& triangles, size_t i, int c, const double* origin, float* out) {
+    out[0] = (float)((double)triangles.x[c][i] - origin[0]);
+    out[1] = (float)((double)triangles.y[c][i] - origin[1]);
+    out[2] = (float)((double)triangles.z[c][i] - origin[2]);
+}
+
+// Origin, relative bounds and geometry key of an object read in full.
+inline void describe(const TriangleArrays& triangles, double tolerance, MergeObject& object) {
+    object.triangle_count = triangles.size();
+    for (int d = 0; d < 3; ++d) {
+        object.origin[d] = 0.0;
+        object.min[d] = object.max[d] = 0.0f;
+    }
+    float low[3] = { HUGE_VALF, HUGE_VALF, HUGE_VALF };
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        for (int c = 0; c < 3; ++c) {
+            low[0] = std::min(low[0], triangles.x[c][i]);
+            low[1] = std::min(low[1], triangles.y[c][i]);
+            low[2] = std::min(low[2], triangles.z[c][i]);
+        }
+    }
+    if (triangles.size() > 0 && low[0] - low[0] == 0.0f && low[1] - low[1] == 0.0f && low[2] - low[2] == 0.0f) {
+        for (int d = 0; d < 3; ++d)
+            object.origin[d] = low[d];
+    }
+
+    // The key is over the corners snapped to the tolerance, in file order:
+    // the copies of a definition are written in the same order.
+    uint64_t h0 = mix(triangles.size()), h1 = mix(~(uint64_t)triangles.size());
+    for (int d = 0; d < 3; ++d) {
+        object.min[d] = HUGE_VALF;
+        object.max[d] = -HUGE_VALF;
+    }
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        for (int c = 0; c < 3; ++c) {
+            float p[3];
+            relative_corner(triangles, i, c, object.origin, p);
+            for (int d = 0; d < 3; ++d) {
+                object.min[d] = std::min(object.min[d], p[d]);
+                object.max[d] = std::max(object.max[d], p[d]);
+                int64_t q = snap(p[d], tolerance);
+                h0 = mix(h0 + (uint64_t)q);
+                h1 = mix(h1 ^ ((uint64_t)q * 0x9E3779B97F4A7C15ULL));
+            }
+        }
+    }
+    if (triangles.size() == 0) {
+        for (int d = 0; d < 3; ++d)
+            object.min[d] = object.max[d] = 0.0f;
+    }
+    object.key[0] = h0;
+    object.key[1] = h1;
+}
+
+inline void put_u32(char* out, uint32_t value) { std::memcpy(out, &value, 4); }
+
+inline std::string matrix_json(const double* values) {
+    std::string json("[");
+    for (int i = 0; i < 16; ++i) {
+        if (i > 0)
+            json += ",";
+        json += json_number(values[i], 17);
+    }
+    return json + "]";
+}
+
+inline std::string base_name(const std::string& path) {
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+} // namespace merge_detail
+
+// Reads a list of inputs, one per line: the path, then nothing, a
+// translation (3 numbers) or a full matrix (16 numbers, column major).
+// Empty lines and lines starting with # are skipped.
+inline bool read_merge_list(const std::string& path, std::vector<MergeInput>& inputs, std::string* error = 0) {
+    std::ifstream in(path.c_str());
+    if (!in) {
+        if (error)
+            *error = "cannot open " + path;
+        return false;
+    }
+    std::string line;
+    for (size_t number = 1; std::getline(in, line); ++number) {
+        std::istringstream fields(line);
+        MergeInput input;
+        if (!(fields >> input.path) || input.path[0] == '#')
+            continue;
+        std::vector<double> values;
+        double value;
+        while (fields >> value)
+            values.push_back(value);
+        if (!fields.eof() || (values.size() != 0 && values.size() != 3 && values.size() != 16)) {
+            if (error) {
+                std::ostringstream message;
+                message << path << ":" << number << " : expected a path, then 3 or 16 numbers";
+                *error = message.str();
+            }
+            return false;
+        }
+        if (values.size() == 3) {
+            for (int d = 0; d < 3; ++d)
+                input.transform[12 + d] = values[d];
+        }
+        else if (values.size() == 16)
+            std::copy(values.begin(), values.end(), input.transform);
+        inputs.push_back(input);
+    }
+    return true;
+}
+
+// First pass: cuts the inputs into objects and gives each distinct
+// geometry its mesh and its place in the binary chunk.
+inline bool plan_merge(const std::vector<MergeInput>& inputs, const MergeOptions& options, MergePlan& plan,
+                       std::string* error = 0) {
+    unsigned threads = options.threads > 0 ? options.threads : default_thread_count();
+    plan = MergePlan();
+    plan.inputs = inputs;
+    plan.formats.assign(inputs.size(), 0);
+    std::vector<std::vector<MergeObject> > found(inputs.size());
+    std::vector<std::string> errors(inputs.size());
+
+    // Inputs run concurrently, biggest first, and share the threads.
+    std::vector<uint64_t> sizes(inputs.size(), 0);
+    for (size_t f = 0; f < inputs.size(); ++f) {
+        MappedInput probe;
+        if (probe.open(inputs[f].path))
+            sizes[f] = probe.size();
+    }
+    std::vector<size_t> order(inputs.size());
+    for (size_t f = 0; f < order.size(); ++f)
+        order[f] = f;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+    unsigned jobs = std::max(1u, std::min(threads, (unsigned)inputs.size()));
+    unsigned input_threads = std::max(1u, threads / jobs);
+
+    parallel_for(order.size(), jobs, [&](size_t i, unsigned) {
+        size_t f = order[i];
+        const std::string& path = inputs[f].path;
+        std::vector<MergeObject>& objects = found[f];
+        MergeObject whole;
+        std::memset(&whole, 0, sizeof(whole));
+        whole.input = (uint32_t)f;
+
+        TriIndexHeader header;
+        std::vector<TriIndexEntry> entries;
+        MappedInput probe;
+        bool indexed = options.use_index && probe.open(path + ".idx") && read_tri_index(path + ".idx", header, entries)
+            && header.data_size == sizes[f];
+        probe.close();
+        if (indexed) {
+            plan.formats[f] = header.format;
+            for (size_t e = 0; e < entries.size(); ++e) {
+                const TriIndexEntry& entry = entries[e];
+                if (entry.parent != TRI_INDEX_NO_PARENT || entry.triangle_count == 0)
+                    continue;
+                MergeObject object = whole;
+                object.entity_id = entry.entity_id;
+                object.kind = entry.kind;
+                object.offset = entry.offset;
+                object.length = entry.length;
+                objects.push_back(object);
+            }
+        }
+        else
+            objects.push_back(whole);
+
+        // One object in memory at a time.
+        for (size_t o = 0; o < objects.size(); ++o) {
+            TriangleArrays triangles;
+            MergeObject& object = objects[o];
+            if (!merge_detail::read_object(plan, object, input_threads, triangles, &errors[f]))
+                return;
+            merge_detail::describe(triangles, options.tolerance, object);
+        }
+    });
+    for (size_t f = 0; f < inputs.size(); ++f) {
+        if (!errors[f].empty()) {
+            if (error)
+                *error = inputs[f].path + " : " + errors[f];
+            return false;
+        }
+    }
+
+    // Meshes in input order, so the output does not depend on the threads.
+    std::unordered_map<std::pair<uint64_t, uint64_t>, uint32_t, merge_detail::KeyHash> meshes;
+    for (size_t f = 0; f < inputs.size(); ++f) {
+        for (size_t o = 0; o < found[f].size(); ++o) {
+            MergeObject object = found[f][o];
+            if (object.triangle_count == 0)
+                continue;
+            std::pair<std::unordered_map<std::pair<uint64_t, uint64_t>, uint32_t, merge_detail::KeyHash>::iterator,
+                      bool> inserted = meshes.insert(std::make_pair(std::make_pair(object.key[0], object.key[1]),
+                                                                    (uint32_t)plan.meshes.size()));
+            object.mesh = inserted.first->second;
+            // A key shared by a different shape is a collision: store that
+            // object as a mesh of its own.
+            bool collision = !inserted.second
+                && !merge_detail::same_shape(object, plan.objects[plan.meshes[object.mesh].object], options.tolerance);
+            if (collision)
+                object.mesh = (uint32_t)plan.meshes.size();
+            if (inserted.second || collision) {
+                MergeMesh mesh;
+                mesh.object = (uint32_t)plan.objects.size();
+                mesh.positions = plan.bin_size;
+                mesh.normals = plan.bin_size + 36 * object.triangle_count;
+                plan.bin_size += 72 * object.triangle_count;
+                plan.meshes.push_back(mesh);
+            }
+            plan.objects.push_back(object);
+        }
+        std::vector<MergeObject>().swap(found[f]);
+    }
+    return true;
+}
+
+// Second pass: the glTF binary of a plan. A root node converts inches / Z
+// up to meters / Y up, below it one node per input with its transform,
+// and below those one node per object, translated to its origin.
+inline bool write_merged_glb(const MergePlan& plan, const std::string& path, const MergeOptions& options,
+                             std::string* error = 0) {
+    std::ostringstream json;
+    json << "{\"asset\":{\"version\":\"2.0\",\"generator\":\"skp2tri trimerge\"}";
+    json << ",\"scene\":0,\"scenes\":[{\"nodes\":[0]}]";
+    json << ",\"nodes\":[{\"matrix\":[0.0254,0,0,0,0,0,-0.0254,0,0,0.0254,0,0,0,0,0,1]";
+    if (!plan.inputs.empty()) {
+        json << ",\"children\":[";
+        for (size_t f = 0; f < plan.inputs.size(); ++f)
+            json << (f > 0 ? "," : "") << 1 + f;
+        json << "]";
+    }
+    json << "}";
+    std::vector<std::vector<size_t> > children(plan.inputs.size());
+    for (size_t o = 0; o < plan.objects.size(); ++o)
+        children[plan.objects[o].input].push_back(1 + plan.inputs.size() + o);
+    for (size_t f = 0; f < plan.inputs.size(); ++f) {
+        const MergeInput& input = plan.inputs[f];
+        json << ",{\"name\":" << json_string(merge_detail::base_name(input.path));
+        MergeInput identity;
+        if (std::memcmp(identity.transform, input.transform, sizeof(identity.transform)) != 0)
+            json << ",\"matrix\":" << merge_detail::matrix_json(input.transform);
+        if (!children[f].empty()) {
+            json << ",\"children\":[";
+            for (size_t c = 0; c < children[f].size(); ++c)
+                json << (c > 0 ? "," : "") << children[f][c];
+            json << "]";
+        }
+        json << "}";
+    }
+    for (size_t o = 0; o < plan.objects.size(); ++o) {
+        const MergeObject& object = plan.objects[o];
+        json << ",{";
+        if (object.kind == TRI_INDEX_FACES)
+            json << "\"name\":\"model\",";
+        else if (object.kind != 0)
+            json << "\"name\":\"" << (object.kind == TRI_INDEX_GROUP ? "group " : "instance ") << object.entity_id
+                 << "\",";
+        json << "\"translation\":[" << json_number(object.origin[0], 17) << "," << json_number(object.origin[1], 17)
+             << "," << json_number(object.origin[2], 17) << "],\"mesh\":" << object.mesh << "}";
+    }
+    json << "]";
+
+    if (!plan.meshes.empty()) {
+        std::ostringstream meshes, accessors, views;
+        for (size_t m = 0; m < plan.meshes.size(); ++m) {
+            const MergeMesh& mesh = plan.meshes[m];
+            const MergeObject& object = plan.objects[mesh.object];
+            uint64_t vertices = 3 * object.triangle_count;
+            const char* separator = m > 0 ? "," : "";
+            meshes << separator << "{\"primitives\":[{\"attributes\":{\"POSITION\":" << 2 * m << ",\"NORMAL\":"
+                   << 2 * m + 1 << "}}]}";
+            accessors << separator << "{\"bufferView\":" << 2 * m << ",\"componentType\":5126,\"count\":" << vertices
+                      << ",\"type\":\"VEC3\",\"min\":[" << json_number(object.min[0]) << ","
+                      << json_number(object.min[1]) << "," << json_number(object.min[2]) << "],\"max\":["
+                      << json_number(object.max[0]) << "," << json_number(object.max[1]) << ","
+                      << json_number(object.max[2]) << "]},{\"bufferView\":" << 2 * m + 1
+                      << ",\"componentType\":5126,\"count\":" << vertices << ",\"type\":\"VEC3\"}";
+            views << separator << "{\"buffer\":0,\"byteOffset\":" << mesh.positions << ",\"byteLength\":"
+                  << 12 * vertices << ",\"target\":34962},{\"buffer\":0,\"byteOffset\":" << mesh.normals
+                  << ",\"byteLength\":" << 12 * vertices << ",\"target\":34962}";
+        }
+        json << ",\"meshes\":[" << meshes.str() << "],\"accessors\":[" << accessors.str() << "],\"bufferViews\":["
+             << views.str() << "],\"buffers\":[{\"byteLength\":" << plan.bin_size << "}]";
+    }
+    json << "}";
+    std::string text = json.str();
+    while (text.size() % 4 != 0)
+        text += ' ';
+
+    uint64_t total = 12 + 8 + text.size();
+    if (plan.bin_size > 0)
+        total += 8 + plan.bin_size;
+    if (total > 0xffffffffULL) {
+        if (error)
+            *error = "more than 4 GB of distinct geometry, over the glTF binary limit";
+        return false;
+    }
+    MappedFile file;
+    if (!file.create(path, total)) {
+        if (error)
+            *error = "cannot write " + path;
+        return false;
+    }
+    char* out = file.data();
+    merge_detail::put_u32(out, 0x46546C67); // "glTF"
+    merge_detail::put_u32(out + 4, 2);
+    merge_detail::put_u32(out + 8, (uint32_t)total);
+    merge_detail::put_u32(out + 12, (uint32_t)text.size());
+    merge_detail::put_u32(out + 16, 0x4E4F534A); // "JSON"
+    std::memcpy(out + 20, text.data(), text.size());
+    if (plan.bin_size == 0)
+        return file.close();
+    uint64_t bin = 20 + text.size() + 8;
+    merge_detail::put_u32(out + bin - 8, (uint32_t)plan.bin_size);
+    merge_detail::put_u32(out + bin - 4, 0x004E4942); // "BIN"
+
+    // One copy of each geometry, biggest first, flushed once written.
+    unsigned threads = options.threads > 0 ? options.threads : default_thread_count();
+    std::vector<size_t> order(plan.meshes.size());
+    for (size_t m = 0; m < order.size(); ++m)
+        order[m] = m;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return plan.objects[plan.meshes[a].object].triangle_count > plan.objects[plan.meshes[b].object].triangle_count;
+    });
+    unsigned jobs = std::max(1u, std::min(threads, (unsigned)order.size()));
+    unsigned mesh_threads = std::max(1u, threads / jobs);
+    std::vector<std::string> errors(plan.meshes.size());
+    parallel_for(order.size(), jobs, [&](size_t i, unsigned) {
+        const MergeMesh& mesh = plan.meshes[order[i]];
+        const MergeObject& object = plan.objects[mesh.object];
+        TriangleArrays triangles;
+        if (!merge_detail::read_object(plan, object, mesh_threads, triangles, &errors[order[i]]))
+            return;
+        if (triangles.size() != object.triangle_count) {
+            errors[order[i]] = plan.inputs[object.input].path + " changed while merging";
+            return;
+        }
+        float* positions = (float*)(out + bin + mesh.positions);
+        float* normals = (float*)(out + bin + mesh.normals);
+        for (size_t t = 0; t < triangles.size(); ++t) {
+            float p[3][3];
+            for (int c = 0; c < 3; ++c)
+                merge_detail::relative_corner(triangles, t, c, object.origin, p[c]);
+            double u[3], v[3];
+            for (int d = 0; d < 3; ++d) {
+                u[d] = (double)p[1][d] - p[0][d];
+                v[d] = (double)p[2][d] - p[0][d];
+            }
+            double n[3] = { u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0] };
+            double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            if (!(length > 0.0) || length - length != 0.0) {
+                n[0] = n[1] = 0.0;
+                n[2] = length = 1.0;
+            }
+            for (int c = 0; c < 3; ++c) {
+                for (int d = 0; d < 3; ++d) {
+                    *positions++ = p[c][d];
+                    *normals++ = (float)(n[d] / length);
+                }
+            }
+        }
+        file.flush_range(bin + mesh.positions, 72 * object.triangle_count);
+    });
+    for (size_t m = 0; m < errors.size(); ++m) {
+        if (!errors[m].empty()) {
+            if (error)
+                *error = errors[m];
+            file.close();
+            return false;
+        }
+    }
+    if (!file.close()) {
+        if (error)
+            *error = "cannot write " + path;
+        return false;
+    }
+    return true;
+}
+
+#endif // SKP2TRI_TRI_MERGE_H
@@ -0,0 +1,458 @@
+#ifndef SKP2TRI_TRI_RAY_H
+#define SKP2TRI_TRI_RAY_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include "parallel.h"
+#include "tri_reader.h"
+#include "tri_format.h"
+#include "tri_bvh.h"
+
+// Ray queries against an export and its hierarchy (tri_bvh.h, built or
+// mapped from a .bvh sidecar): closest hit and any hit. The binary tree is
+// collapsed into nodes of four children whose boxes a ray crosses in one
+// go, and the triangles of each leaf are repacked in groups of 4 or 8,
+// tested at once too (Möller–Trumbore); both on GCC vector extensions.
+// Batches of rays run on all cores.
+
+const uint32_t RAY_NO_HIT = 0xffffffffu;
+
+struct Ray {
+    float origin[3];
+    float direction[3]; // need not be normalized, t is in its units
+    float tmin, tmax;   // only hits with tmin <= t < tmax count
+};
+
+struct RayHit {
+    uint32_t triangle; // triangle number in the export, RAY_NO_HIT on a miss
+    float t;
+    float u, v;        // the hit is (1 - u - v) * corner0 + u * corner1 + v * corner2
+};
+
+enum RayQuery { RAY_CLOSEST_HIT, RAY_ANY_HIT };
+
+namespace ray_detail {
+
+// Pending nodes kept on the stack of a query; deeper trees fall back on
+// the heap.
+const size_t STACK_SIZE = 128;
+
+template <int W>
+struct RayLanes {
+    typedef float Vector __attribute__((vector_size(W * sizeof(float))));
+    typedef int32_t Mask __attribute__((vector_size(W * sizeof(float))));
+};
+
+// W triangles as their first corner and two edges, one lane each. Unused
+// lanes are zero, which no ray hits (the determinant is 0).
+template <int W>
+struct Packet {
+    float corner[3][W];
+    float edge1[3][W];
+    float edge2[3][W];
+    uint32_t triangle[W];
+};
+
+// Through a reference: returning a 32 byte vector by value without AVX
+// changes the ABI, which GCC warns about.
+template <class Vector>
+inline void load(Vector& vector, const float* values) {
+    std::memcpy(&vector, values, sizeof(vector));
+}
+
+// Tests the ray against the W triangles of `packet`. Returns the lane of
+// the closest hit in [tmin, tmax), and lowers tmax to it, or -1.
+template <int W>
+inline int intersect_packet(const Packet<W>& packet, const float* origin, const float* direction, float tmin,
+                            float& tmax, float& hit_u, float& hit_v) {
+    typedef typename RayLanes<W>::Vector Vector;
+    typedef typename RayLanes<W>::Mask Mask;
+    const Vector zero = Vector{};
+    Vector e1x, e1y, e1z, e2x, e2y, e2z, cx, cy, cz;
+    load(e1x, packet.edge1[0]), load(e1y, packet.edge1[1]), load(e1z, packet.edge1[2]);
+    load(e2x, packet.edge2[0]), load(e2y, packet.edge2[1]), load(e2z, packet.edge2[2]);
+    load(cx, packet.corner[0]), load(cy, packet.corner[1]), load(cz, packet.corner[2]);
+    Vector dx = zero + direction[0], dy = zero + direction[1], dz = zero + direction[2];
+
+    Vector px = dy * e2z - dz * e2y, py = dz * e2x - dx * e2z, pz = dx * e2y - dy * e2x;
+    Vector det = e1x * px + e1y * py + e1z * pz;
+    Vector inverse = (zero + 1.0f) / det;
+    Vector sx = origin[0] - cx, sy = origin[1] - cy, sz = origin[2] - cz;
+    Vector u = (sx * px + sy * py + sz * pz) * inverse;
+    Vector qx = sy * e1z - sz * e1y, qy = sz * e1x - sx * e1z, qz = sx * e1y - sy * e1x;
+    Vector v = (dx * qx + dy * qy + dz * qz) * inverse;
+    Vector t = (e2x * qx + e2y * qy + e2z * qz) * inverse;
+    // A zero determinant gives infinities or NaNs, which fail these.
+    Mask hit = (u >= 0.0f) & (v >= 0.0f) & (u + v <= 1.0f) & (t >= tmin) & (t < tmax);
+
+    int best = -1;
+    for (int k = 0; k < W; ++k)
+        if (hit[k] && t[k] < tmax) {
+            tmax = t[k];
+            best = k;
+        }
+    if (best >= 0) {
+        hit_u = u[best];
+        hit_v = v[best];
+    }
+    return best;
+}
+
+// Four children, their boxes one lane each. A child is a node when its
+// count is 0, else a leaf of `count` packets from packet `child`. Unused
+// lanes have an empty box, which no ray crosses.
+struct RayNode {
+    float min[3][4];
+    float max[3][4];
+    uint32_t child[4];
+    uint16_t count[4];
+    uint32_t padding[2];
+
+    RayNode() {
+        for (int d = 0; d < 3; ++d)
+            for (int k = 0; k < 4; ++k) {
+                min[d][k] = INFINITY;
+                max[d][k] = -INFINITY;
+            }
+        for (int k = 0; k < 4; ++k) {
+            child[k] = 0;
+            count[k] = 0;
+        }
+        padding[0] = padding[1] = 0;
+    }
+};
+
+struct Pending {
+    uint32_t child;
+    uint32_t count;
+    float entry;
+};
+
+} // namespace ray_detail
+
+// The hierarchy as nodes of four children, with the leaves pointing at
+// packets of triangles instead of triangle numbers. Queries are const, so
+// one scene serves any number of threads.
+class RayScene {
+public:
+    RayScene() : width_(8), depth_(0) {}
+
+    // `nodes` and `numbers` as in a Bvh or a MappedBvh; `width` is 4 or 8.
+    // Fails when the hierarchy does not fit the triangles.
+    bool build(const TriangleArrays& triangles, const TriBvhNode* nodes, size_t node_count, const uint32_t* numbers,
+               size_t number_count, unsigned width = 8, unsigned threads = 0, std::string* error = 0);
+
+    bool build(const TriangleArrays& triangles, const Bvh& bvh, unsigned width = 8, unsigned threads = 0,
+               std::string* error = 0) {
+        return build(triangles, bvh.nodes.empty() ? 0 : &bvh.nodes[0], bvh.nodes.size(),
+                     bvh.triangles.empty() ? 0 : &bvh.triangles[0], bvh.triangles.size(), width, threads, error);
+    }
+
+    // Returns whether the ray hits; `hit` is filled either way. An any hit
+    // query stops at the first triangle found, which need not be the
+    // closest.
+    bool intersect(const Ray& ray, RayQuery query, RayHit& hit) const {
+        return width_ == 4 ? traverse<4>(ray, query, hit) : traverse<8>(ray, query, hit);
+    }
+
+    unsigned width() const { return width_; }
+    size_t node_count() const { return nodes_.size(); }
+
+private:
+    template <int W>
+    bool traverse(const Ray& ray, RayQuery query, RayHit& hit) const;
+
+    void collapse(const TriBvhNode* nodes, const std::vector<uint32_t>& leaf_of, const std::vector<uint32_t>& first);
+
+    template <int W>
+    void pack(const TriangleArrays& triangles, const TriBvhNode* nodes, const uint32_t* numbers,
+              const std::vector<uint32_t>& leaves, const std::vector<uint32_t>& first, unsigned threads,
+              std::vector<ray_detail::Packet<W> >& packets);
+
+    const std::vector<ray_detail::Packet<4> >& packets_of(ray_detail::Packet<4>*) const { return packets4_; }
+    const std::vector<ray_detail::Packet<8> >& packets_of(ray_detail::Packet<8>*) const { return packets8_; }
+
+    unsigned width_;
+    size_t depth_; // of the four child tree
+    std::vector<ray_detail::RayNode> nodes_;
+    std::vector<ray_detail::Packet<4> > packets4_;
+    std::vector<ray_detail::Packet<8> > packets8_;
+};
+
+inline bool RayScene::build(const TriangleArrays& triangles, const TriBvhNode* nodes, size_t node_count,
+                            const uint32_t* numbers, size_t number_count, unsigned width, unsigned threads,
+                            std::string* error) {
+    width_ = width == 4 ? 4 : 8;
+    depth_ = 0;
+    nodes_.clear();
+    packets4_.clear();
+    packets8_.clear();
+
+    // Checks the links (a file may be damaged) and lists the leaves, in
+    // depth first order.
+    std::vector<uint32_t> leaves, stack;
+    std::vector<uint32_t> leaf_of(node_count, 0);
+    if (node_count > 0)
+        stack.push_back(0);
+    size_t visited = 0;
+    while (!stack.empty()) {
+        uint32_t n = stack.back();
+        stack.pop_back();
+        ++visited;
+        const TriBvhNode& node = nodes[n];
+        bool sound;
+        if (node.count == 0) {
+            sound = node.first > n + 1 && node.first < node_count;
+            if (sound) {
+                stack.push_back(node.first);
+                stack.push_back(n + 1);
+            }
+        }
+        else {
+            sound = (uint64_t)node.first + node.count <= number_count;
+            for (uint32_t e = node.first; sound && e < node.first + node.count; ++e)
+                sound = numbers[e] < triangles.size();
+            leaf_of[n] = (uint32_t)leaves.size();
+            leaves.push_back(n);
+        }
+        if (!sound || visited > node_count) {
+            if (error)
+                *error = "the hierarchy does not match the triangles";
+            return false;
+        }
+    }
+    if (node_count == 0)
+        return true;
+
+    // Leaf l gets packets [first[l], first[l + 1]).
+    std::vector<uint32_t> first(leaves.size() + 1, 0);
+    for (size_t l = 0; l < leaves.size(); ++l)
+        first[l + 1] = first[l] + (nodes[leaves[l]].count + width_ - 1) / width_;
+    if (width_ == 4)
+        pack<4>(triangles, nodes, numbers, leaves, first, threads, packets4_);
+    else
+        pack<8>(triangles, nodes, numbers, leaves, first, threads, packets8_);
+    collapse(nodes, leaf_of, first);
+    return true;
+}
+
+// Each binary node becomes a node of up to four children: its own two,
+// then the biggest inner child replaced by its two, and so on.
+inline void RayScene::collapse(const TriBvhNode* nodes, const std::vector<uint32_t>& leaf_of,
+                               const std::vector<uint32_t>& first) {
+    using namespace ray_detail;
+    struct Work {
+        uint32_t node, target, depth;
+    };
+    std::vector<Work> work;
+    Work root = { 0, 0, 1 };
+    nodes_.push_back(RayNode());
+    work.push_back(root);
+    while (!work.empty()) {
+        Work item = work.back();
+        work.pop_back();
+        depth_ = std::max(depth_, (size_t)item.depth);
+        uint32_t lanes[4];
+        int used = 0;
+        if (nodes[item.node].count > 0)
+            lanes[used++] = item.node;
+        else {
+            lanes[used++] = item.node + 1;
+            lanes[used++] = nodes[item.node].first;
+        }
+        while (used < 4) {
+            int open = -1;
+            double biggest = -1.0;
+            for (int k = 0; k < used; ++k) {
+                const TriBvhNode& node = nodes[lanes[k]];
+                if (node.count > 0)
+                    continue;
+                double x = node.max[0] - node.min[0], y = node.max[1] - node.min[1], z = node.max[2] - node.min[2];
+                double area = x * y + y * z + z * x;
+                if (area > biggest) {
+                    biggest = area;
+                    open = k;
+                }
+            }
+            if (open < 0)
+                break;
+            uint32_t n = lanes[open];
+            lanes[open] = n + 1;
+            lanes[used++] = nodes[n].first;
+        }
+        for (int k = 0; k < used; ++k) {
+            const TriBvhNode& node = nodes[lanes[k]];
+            uint32_t child;
+            uint16_t count = 0;
+            if (node.count > 0) {
+                uint32_t l = leaf_of[lanes[k]];
+                child = first[l];
+                count = (uint16_t)(first[l + 1] - first[l]);
+            }
+            else {
+                child = (uint32_t)nodes_.size();
+                nodes_.push_back(RayNode());
+                Work next = { lanes[k], child, item.depth + 1 };
+                work.push_back(next);
+            }
+            RayNode& target = nodes_[item.target];
+            for (int d = 0; d < 3; ++d) {
+                target.min[d][k] = node.min[d];
+                target.max[d][k] = node.max[d];
+            }
+            target.child[k] = child;
+            target.count[k] = count;
+        }
+    }
+}
+
+template <int W>
+void RayScene::pack(const TriangleArrays& triangles, const TriBvhNode* nodes, const uint32_t* numbers,
+                    const std::vector<uint32_t>& leaves, const std::vector<uint32_t>& first, unsigned threads,
+                    std::vector<ray_detail::Packet<W> >& packets) {
+    using namespace ray_detail;
+    packets.assign(first.back(), Packet<W>());
+    const size_t batch = 4096;
+    parallel_for((leaves.size() + batch - 1) / batch, threads, [&](size_t task, unsigned) {
+        for (size_t l = task * batch; l < std::min(leaves.size(), (task + 1) * batch); ++l) {
+            const TriBvhNode& leaf = nodes[leaves[l]];
+            for (uint32_t e = 0; e < leaf.count; ++e) {
+                Packet<W>& packet = packets[first[l] + e / W];
+                unsigned k = e % W;
+                uint32_t i = numbers[leaf.first + e];
+                const std::vector<float>* axes[3] = { triangles.x, triangles.y, triangles.z };
+                for (int d = 0; d < 3; ++d) {
+                    packet.corner[d][k] = axes[d][0][i];
+                    packet.edge1[d][k] = axes[d][1][i] - axes[d][0][i];
+                    packet.edge2[d][k] = axes[d][2][i] - axes[d][0][i];
+                }
+                packet.triangle[k] = i;
+            }
+            for (uint32_t e = leaf.count; e % W != 0; ++e)
+                packets[first[l] + e / W].triangle[e % W] = RAY_NO_HIT;
+        }
+    });
+}
+
+template <int W>
+bool RayScene::traverse(const Ray& ray, RayQuery query, RayHit& hit) const {
+    using namespace ray_detail;
+    typedef RayLanes<4>::Vector Vector;
+    typedef RayLanes<4>::Mask Mask;
+    const std::vector<Packet<W> >& packets = packets_of((Packet<W>*)0);
+    hit.triangle = RAY_NO_HIT;
+    hit.t = ray.tmax;
+    hit.u = hit.v = 0.0f;
+    if (nodes_.empty())
+        return false;
+
+    // Tiny instead of zero direction components keep the box tests free of
+    // 0 * infinity.
+    const Vector zero = Vector{};
+    Vector origin[3], inverse[3];
+    bool negative[3];
+    for (int d = 0; d < 3; ++d) {
+        float direction = std::fabs(ray.direction[d]) > 1e-30f ? ray.direction[d]
+                                                                : (ray.direction[d] < 0.0f ? -1e-30f : 1e-30f);
+        origin[d] = zero + ray.origin[d];
+        inverse[d] = zero + 1.0f / direction;
+        negative[d] = direction < 0.0f;
+    }
+    Pending local[STACK_SIZE];
+    std::vector<Pending> heap;
+    Pending* stack = local;
+    if (3 * depth_ > STACK_SIZE) {
+        heap.resize(3 * depth_);
+        stack = &heap[0];
+    }
+    size_t top = 0;
+
+    float tmax = ray.tmax;
+    Pending current = { 0, 0, ray.tmin };
+    for (;;) {
+        if (current.count == 0) {
+            // The four boxes at once; the exit distances are pushed out by
+            // a few ulps so that rounding never loses a triangle lying on a
+            // face of its box.
+            const RayNode& node = nodes_[current.child];
+            Vector entry = zero + ray.tmin, exit = zero + tmax;
+            for (int d = 0; d < 3; ++d) {
+                Vector low, high;
+                load(low, negative[d] ? node.max[d] : node.min[d]);
+                load(high, negative[d] ? node.min[d] : node.max[d]);
+                Vector t0 = (low - origin[d]) * inverse[d];
+                Vector t1 = (high - origin[d]) * inverse[d] * 1.0000004f;
+                entry = t0 > entry ? t0 : entry;
+                exit = t1 < exit ? t1 : exit;
+            }
+            Mask crossed = entry <= exit;
+            // The children crossed, farthest first, the nearest one next
+            // (appended without branches, the lanes crossed are as good
+            // as random).
+            float entries[4];
+            int32_t flags[4];
+            std::memcpy(entries, &entry, sizeof(entries));
+            std::memcpy(flags, &crossed, sizeof(flags));
+            Pending found[4];
+            int count = 0;
+            for (int k = 0; k < 4; ++k) {
+                found[count].child = node.child[k];
+                found[count].count = node.count[k];
+                found[count].entry = entries[k];
+                count += flags[k] & 1;
+            }
+            for (int k = 1; k < count; ++k)
+                for (int j = k; j > 0 && found[j - 1].entry < found[j].entry; --j)
+                    std::swap(found[j - 1], found[j]);
+            if (count > 0) {
+                for (int k = 0; k + 1 < count; ++k)
+                    stack[top++] = found[k];
+                current = found[count - 1];
+                continue;
+            }
+        }
+        else {
+            for (uint32_t p = current.child; p < current.child + current.count; ++p) {
+                int lane = intersect_packet<W>(packets[p], ray.origin, ray.direction, ray.tmin, tmax, hit.u, hit.v);
+                if (lane < 0)
+                    continue;
+                hit.triangle = packets[p].triangle[lane];
+                hit.t = tmax;
+                if (query == RAY_ANY_HIT)
+                    return true;
+            }
+        }
+        // Children pushed before a closer hit was found may now be too far.
+        for (;;) {
+            if (top == 0)
+                return hit.triangle != RAY_NO_HIT;
+            --top;
+            if (stack[top].entry <= tmax)
+                break;
+        }
+        current = stack[top];
+    }
+}
+
+// Intersects rays [0, count) on `threads` threads (0: one per core).
+// Returns the number of hits.
+inline size_t cast_rays(const RayScene& scene, const Ray* rays, size_t count, RayQuery query, RayHit* hits,
+                        unsigned threads = 0) {
+    const size_t batch = 1024;
+    size_t tasks = (count + batch - 1) / batch;
+    std::vector<size_t> found(tasks, 0);
+    parallel_for(tasks, threads, [&](size_t task, unsigned) {
+        for (size_t i = task * batch; i < std::min(count, (task + 1) * batch); ++i)
+            found[task] += scene.intersect(rays[i], query, hits[i]);
+    });
+    size_t total = 0;
+    for (size_t t = 0; t < tasks; ++t)
+        total += found[t];
+    return total;
+}
+
+#endif // SKP2TRI_TRI_RAY_H
@@ -0,0 +1,499 @@
+#include "tri_reader.h"
+#include "fast_float.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include <cstring>
+#include <cstdio>
+#include <sstream>
+#include <algorithm>
+#include <atomic>
+
+using namespace std;
+
+namespace {
+
+const uint64_t STL_HEADER = 84;
+const uint64_t STL_RECORD = 50;
+const size_t RECORDS_PER_TASK = 65536;
+
+bool fail(string* error, const string& message) {
+    if (error)
+        *error = message;
+    return false;
+}
+
+bool is_blank(char c) { return c == ' ' || c == '\t'; }
+
+// Lines holding a triangle: anything but an empty line (skp2tri writes one
+// for a face without triangles).
+bool is_triangle_line(const char* line, const char* end) {
+    return line < end && *line != '\n' && *line != '\r';
+}
+
+uint64_t count_triangle_lines(const char* p, const char* end) {
+    uint64_t count = 0;
+    while (p < end) {
+        const char* eol = (const char*)memchr(p, '\n', (size_t)(end - p));
+        if (eol == 0)
+            eol = end;
+        if (is_triangle_line(p, eol))
+            ++count;
+        p = eol + 1;
+    }
+    return count;
+}
+
+// Parses the lines of [p, end) into triangles [first, ...). Returns the
+// offending line on a syntax error, 0 otherwise.
+const char* parse_lines(const char* p, const char* end, TriangleArrays& triangles, size_t first) {
+    size_t i = first;
+    float corners[9];
+    while (p < end) {
+        const char* eol = (const char*)memchr(p, '\n', (size_t)(end - p));
+        if (eol == 0)
+            eol = end;
+        if (is_triangle_line(p, eol)) {
+            const char* q = p;
+            for (int n = 0; n < 9; ++n) {
+                while (q < eol && is_blank(*q))
+                    ++q;
+                q = parse_float(q, eol, corners[n]);
+                if (q == 0 || (q < eol && !is_blank(*q) && *q != '\r'))
+                    return p;
+            }
+            while (q < eol && (is_blank(*q) || *q == '\r'))
+                ++q;
+            if (q != eol)
+                return p;
+            triangles.set(i++, corners);
+        }
+        p = eol + 1;
+    }
+    return 0;
+}
+
+// Converts `count` fixed size records of nine floats (at `skip` bytes into
+// each record) to the arrays, a block of records per task.
+void convert_records(const char* data, uint64_t count, uint64_t record_size, uint64_t skip,
+                     TriangleArrays& triangles, unsigned threads) {
+    triangles.resize((size_t)count);
+    size_t tasks = (size_t)((count + RECORDS_PER_TASK - 1) / RECORDS_PER_TASK);
+    parallel_for(tasks, threads, [&](size_t task, unsigned) {
+        size_t begin = task * RECORDS_PER_TASK;
+        size_t end = min((size_t)count, begin + RECORDS_PER_TASK);
+        float corners[9];
+        for (size_t i = begin; i < end; ++i) {
+            // STL records are not float aligned.
+            memcpy(corners, data + i * record_size + skip, sizeof(corners));
+            triangles.set(i, corners);
+        }
+    });
+}
+
+bool parse_trb(const char* data, uint64_t size, TriangleArrays& triangles, unsigned threads, string* error) {
+    TrbHeader header;
+    if (size < TRB_HEADER_SIZE)
+        return fail(error, "truncated .trb header");
+    memcpy(&header, data, sizeof(header));
+    if (!is_trb_header(header))
+        return fail(error, "not a .trb file, or an unsupported version");
+    // The counts are untrusted: divide the size rather than multiply them.
+    uint64_t body = size - TRB_HEADER_SIZE;
+    bool truncated = header.flags & TRB_INDEXED
+        ? header.vertex_count > body / TRB_VERTEX_SIZE
+            || header.triangle_count > (body - header.vertex_count * TRB_VERTEX_SIZE) / TRB_INDICES_SIZE
+        : header.triangle_count > body / TRB_TRIANGLE_SIZE;
+    if (truncated)
+        return fail(error, "truncated .trb file");
+    if (!(header.flags & TRB_INDEXED)) {
+        convert_records(data + TRB_HEADER_SIZE, header.triangle_count, TRB_TRIANGLE_SIZE, 0, triangles, threads);
+        return true;
+    }
+
+    // Indexed: expand back to one record per triangle.
+    const char* vertices = data + TRB_HEADER_SIZE;
+    const char* indices = vertices + header.vertex_count * TRB_VERTEX_SIZE;
+    triangles.resize((size_t)header.triangle_count);
+    size_t tasks = (size_t)((header.triangle_count + RECORDS_PER_TASK - 1) / RECORDS_PER_TASK);
+    atomic<bool> bad_index(false);
+    parallel_for(tasks, threads, [&](size_t task, unsigned) {
+        size_t begin = task * RECORDS_PER_TASK;
+        size_t end = min((size_t)header.triangle_count, begin + RECORDS_PER_TASK);
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t corner[3];
+            memcpy(corner, indices + i * TRB_INDICES_SIZE, sizeof(corner));
+            float points[9] = {};
+            for (int k = 0; k < 3; ++k) {
+                if (corner[k] >= header.vertex_count)
+                    bad_index.store(true, memory_order_relaxed);
+                else
+                    memcpy(points + 3 * k, vertices + corner[k] * TRB_VERTEX_SIZE, TRB_VERTEX_SIZE);
+            }
+            triangles.set(i, points);
+        }
+    });
+    if (bad_index)
+        return fail(error, ".trb triangle with a vertex index out of range");
+    return true;
+}
+
+bool parse_stl(const char* data, uint64_t size, TriangleArrays& triangles, unsigned threads, string* error) {
+    if (size < STL_HEADER)
+        return fail(error, "truncated STL header");
+    uint32_t count;
+    memcpy(&count, data + 80, 4);
+    if (count > (size - STL_HEADER) / STL_RECORD)
+        return fail(error, "truncated STL file, or ASCII STL (not supported)");
+    convert_records(data + STL_HEADER, count, STL_RECORD, 12, triangles, threads);
+    return true;
+}
+
+// PLY scalar property types, by name.
+int ply_type_size(const string& type) {
+    if (type == "char" || type == "uchar" || type == "int8" || type == "uint8")
+        return 1;
+    if (type == "short" || type == "ushort" || type == "int16" || type == "uint16")
+        return 2;
+    if (type == "int" || type == "uint" || type == "int32" || type == "uint32" || type == "float" || type == "float32")
+        return 4;
+    if (type == "double" || type == "float64")
+        return 8;
+    return 0;
+}
+
+double ply_value(const char* p, const string& type) {
+    switch (ply_type_size(type)) {
+    case 1:
+        return type[0] == 'u' ? (double)*(const uint8_t*)p : (double)*(const int8_t*)p;
+    case 2: {
+        uint16_t v;
+        memcpy(&v, p, 2);
+        return type[0] == 'u' ? (double)v : (double)(int16_t)v;
+    }
+    case 4: {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        if (type[0] == 'f') {
+            float f;
+            memcpy(&f, &v, 4);
+            return f;
+        }
+        return type[0] == 'u' ? (double)v : (double)(int32_t)v;
+    }
+    case 8: {
+        double d;
+        memcpy(&d, p, 8);
+        return d;
+    }
+    }
+    return 0.0;
+}
+
+struct PlyProperty {
+    string name;
+    string type;        // value type
+    string count_type;  // list length type, empty for a scalar
+};
+
+struct PlyElement {
+    string name;
+    uint64_t count;
+    vector<PlyProperty> properties;
+};
+
+// Binary little endian PLY, as written by skp2tri or any other tool: the
+// positions come from the x, y, z properties of the `vertex` element and
+// the polygons of the `face` element are fanned into triangles.
+bool parse_ply(const char* data, uint64_t size, TriangleArrays& triangles, unsigned threads, string* error) {
+    const char* end_header = 0;
+    for (const char* p = data; p + 11 <= data + size; ++p) {
+        if (memcmp(p, "end_header", 10) == 0 && (p == data || p[-1] == '\n')) {
+            const char* eol = (const char*)memchr(p, '\n', (size_t)(data + size - p));
+            end_header = eol ? eol + 1 : 0;
+            break;
+        }
+    }
+    if (end_header == 0)
+        return fail(error, "PLY header without end_header");
+
+    istringstream header(string(data, end_header));
+    vector<PlyElement> elements;
+    string line;
+    while (getline(header, line)) {
+        istringstream words(line);
+        string keyword;
+        words >> keyword;
+        if (keyword == "format") {
+            string format;
+            words >> format;
+            if (format != "binary_little_endian")
+                return fail(error, "only binary little endian PLY files are supported");
+        }
+        else if (keyword == "element") {
+            PlyElement element;
+            words >> element.name >> element.count;
+            elements.push_back(element);
+        }
+        else if (keyword == "property" && !elements.empty()) {
+            PlyProperty property;
+            string type;
+            words >> type;
+            if (type == "list")
+                words >> property.count_type >> property.type;
+            else
+                property.type = type;
+            words >> property.name;
+            if (ply_type_size(property.type) == 0
+                || (!property.count_type.empty() && ply_type_size(property.count_type) == 0))
+                return fail(error, "unknown PLY property type in: " + line);
+            elements.back().properties.push_back(property);
+        }
+    }
+
+    const char* p = end_header;
+    const char* end = data + size;
+    vector<double> positions;
+    bool has_vertices = false;
+    for (size_t e = 0; e < elements.size(); ++e) {
+        const PlyElement& element = elements[e];
+        bool fixed = true;
+        uint64_t record_size = 0;
+        int xyz[3] = { -1, -1, -1 };
+        vector<uint64_t> offsets;
+        for (size_t k = 0; k < element.properties.size(); ++k) {
+            const PlyProperty& property = element.properties[k];
+            fixed = fixed && property.count_type.empty();
+            offsets.push_back(record_size);
+            record_size += ply_type_size(property.type);
+            if (property.name == "x") xyz[0] = (int)k;
+            if (property.name == "y") xyz[1] = (int)k;
+            if (property.name == "z") xyz[2] = (int)k;
+        }
+
+        if (element.name == "vertex") {
+            if (!fixed || xyz[0] < 0 || xyz[1] < 0 || xyz[2] < 0)
+                return fail(error, "PLY vertices need scalar x, y and z properties");
+            if (element.count > (uint64_t)(end - p) / record_size)
+                return fail(error, "truncated PLY vertex data");
+            positions.resize((size_t)(3 * element.count));
+            size_t tasks = (size_t)((element.count + RECORDS_PER_TASK - 1) / RECORDS_PER_TASK);
+            parallel_for(tasks, threads, [&](size_t task, unsigned) {
+                size_t begin = task * RECORDS_PER_TASK;
+                size_t last = min((size_t)element.count, begin + RECORDS_PER_TASK);
+                for (size_t v = begin; v < last; ++v)
+                    for (int k = 0; k < 3; ++k)
+                        positions[3 * v + k] = ply_value(p + v * record_size + offsets[xyz[k]],
+                                                         element.properties[xyz[k]].type);
+            });
+            p += element.count * record_size;
+            has_vertices = true;
+        }
+        else if (element.name == "face") {
+            if (element.properties.size() != 1 || element.properties[0].count_type.empty())
+                return fail(error, "PLY faces need a single vertex index list");
+            if (!has_vertices)
+                return fail(error, "PLY faces come before the vertices");
+            const PlyProperty& list = element.properties[0];
+            uint64_t count_size = ply_type_size(list.count_type);
+            uint64_t index_size = ply_type_size(list.type);
+
+            // Faces have a variable size: find where each block of them
+            // starts, and how many triangles it gives, with one quick pass.
+            vector<const char*> block_start;
+            vector<uint64_t> block_first(1, 0);
+            for (uint64_t f = 0; f < element.count; ++f) {
+                if (f % RECORDS_PER_TASK == 0) {
+                    block_start.push_back(p);
+                    if (f > 0)
+                        block_first.push_back(block_first.back());
+                }
+                if ((uint64_t)(end - p) < count_size)
+                    return fail(error, "truncated PLY face data");
+                uint64_t corners = (uint64_t)ply_value(p, list.count_type);
+                p += count_size;
+                if (corners > (uint64_t)(end - p) / index_size)
+                    return fail(error, "truncated PLY face data");
+                p += corners * index_size;
+                if (corners >= 3)
+                    block_first.back() += corners - 2;
+            }
+            uint64_t triangle_count = block_first.empty() ? 0 : block_first.back();
+            for (size_t b = block_first.size(); b-- > 1;)
+                block_first[b] = block_first[b - 1];
+            if (!block_first.empty())
+                block_first[0] = 0;
+
+            uint64_t vertex_count = positions.size() / 3;
+            if (triangle_count > 0 && vertex_count == 0)
+                return fail(error, "PLY faces without vertices");
+            triangles.resize((size_t)triangle_count);
+            atomic<bool> bad_index(false);
+            parallel_for(block_start.size(), threads, [&](size_t b, unsigned) {
+                const char* q = block_start[b];
+                size_t i = (size_t)block_first[b];
+                uint64_t last = min(element.count, (uint64_t)(b + 1) * RECORDS_PER_TASK);
+                for (uint64_t f = (uint64_t)b * RECORDS_PER_TASK; f < last; ++f) {
+                    uint64_t corners = (uint64_t)ply_value(q, list.count_type);
+                    q += count_size;
+                    uint64_t first = corners >= 3 ? (uint64_t)ply_value(q, list.type) : 0;
+                    for (uint64_t c = 1; c + 1 < corners; ++c) {
+                        uint64_t fan[3] = { first, (uint64_t)ply_value(q + c * index_size, list.type),
+                                            (uint64_t)ply_value(q + (c + 1) * index_size, list.type) };
+                        float points[9] = {};
+                        for (int k = 0; k < 3; ++k) {
+                            if (fan[k] >= vertex_count) {
+                                bad_index.store(true, memory_order_relaxed);
+                                continue;
+                            }
+                            for (int j = 0; j < 3; ++j)
+                                points[3 * k + j] = (float)positions[3 * fan[k] + j];
+                        }
+                        triangles.set(i++, points);
+                    }
+                    q += corners * index_size;
+                }
+            });
+            if (bad_index)
+                return fail(error, "PLY face with a vertex index out of range");
+            return true;
+        }
+        else {
+            if (!fixed)
+                return fail(error, "unsupported PLY element with a list: " + element.name);
+            if (record_size > 0 && element.count > (uint64_t)(end - p) / record_size)
+                return fail(error, "truncated PLY file");
+            p += element.count * record_size;
+        }
+        if (p > end)
+            return fail(error, "truncated PLY file");
+    }
+    triangles.clear();
+    return true;
+}
+
+bool parse_file(const char* data, uint64_t size, TriFileFormat format, TriangleArrays& triangles,
+                const TriReadOptions& options, string* error) {
+    switch (format) {
+    case TRI_FILE_TEXT:
+        return parse_tri_text(data, size, triangles, options, error);
+    case TRI_FILE_TRB:
+        return parse_trb(data, size, triangles, options.threads, error);
+    case TRI_FILE_STL:
+        return parse_stl(data, size, triangles, options.threads, error);
+    case TRI_FILE_PLY:
+        return parse_ply(data, size, triangles, options.threads, error);
+    default:
+        return fail(error, "unknown file format");
+    }
+}
+
+} // namespace
+
+TriFileFormat detect_tri_format(const char* data, uint64_t size, const string& path) {
+    if (size >= TRB_HEADER_SIZE && memcmp(data, "TRB", 4) == 0)
+        return TRI_FILE_TRB;
+    if (size >= 4 && memcmp(data, "ply\n", 4) == 0)
+        return TRI_FILE_PLY;
+    if (size >= STL_HEADER) {
+        uint32_t count;
+        memcpy(&count, data + 80, 4);
+        if (size == STL_HEADER + (uint64_t)count * STL_RECORD)
+            return TRI_FILE_STL;
+    }
+    string extension = lower_extension(path);
+    if (extension == ".trb")
+        return TRI_FILE_TRB;
+    if (extension == ".stl")
+        return TRI_FILE_STL;
+    if (extension == ".ply")
+        return TRI_FILE_PLY;
+    return TRI_FILE_TEXT;
+}
+
+bool parse_tri_text(const char* data, uint64_t size, TriangleArrays& triangles,
+                    const TriReadOptions& options, string* error, uint64_t first_line) {
+    // Chunk boundaries, moved forward to the next line start.
+    size_t chunk_size = max(options.chunk_size, (size_t)1024);
+    const char* end = data + size;
+    vector<const char*> bounds(1, data);
+    while (bounds.back() < end) {
+        const char* next = bounds.back() + min((uint64_t)chunk_size, (uint64_t)(end - bounds.back()));
+        if (next < end) {
+            const char* eol = (const char*)memchr(next, '\n', (size_t)(end - next));
+            next = eol ? eol + 1 : end;
+        }
+        bounds.push_back(next);
+    }
+    size_t chunks = bounds.size() - 1;
+
+    // Count the lines of every chunk, place them, then parse in place.
+    vector<uint64_t> first(chunks + 1, 0);
+    parallel_for(chunks, options.threads, [&](size_t c, unsigned) {
+        first[c + 1] = count_triangle_lines(bounds[c], bounds[c + 1]);
+    });
+    for (size_t c = 0; c < chunks; ++c)
+        first[c + 1] += first[c];
+    triangles.resize((size_t)first[chunks]);
+
+    vector<const char*> bad(chunks, (const char*)0);
+    parallel_for(chunks, options.threads, [&](size_t c, unsigned) {
+        bad[c] = parse_lines(bounds[c], bounds[c + 1], triangles, (size_t)first[c]);
+    });
+    for (size_t c = 0; c < chunks; ++c) {
+        if (bad[c] == 0)
+            continue;
+        uint64_t line = first_line + (uint64_t)count(data, bad[c], '\n');
+        ostringstream message;
+        message << "line " << line << ": expected nine numbers";
+        triangles.clear();
+        return fail(error, message.str());
+    }
+    return true;
+}
+
+bool read_triangles(const string& path, TriangleArrays& triangles, const TriReadOptions& options, string* error) {
+    MappedInput input;
+    if (!input.open(path))
+        return fail(error, "cannot open " + path);
+    TriFileFormat format = detect_tri_format(input.data(), input.size(), path);
+    return parse_file(input.data(), input.size(), format, triangles, options, error);
+}
+
+bool read_tri_index(const string& path, TriIndexHeader& header, vector<TriIndexEntry>& entries, string* error) {
+    MappedInput input;
+    if (!input.open(path))
+        return fail(error, "cannot open " + path);
+    if (input.size() < sizeof(TriIndexHeader))
+        return fail(error, "truncated index header");
+    memcpy(&header, input.data(), sizeof(header));
+    if (!is_tri_index_header(header))
+        return fail(error, "not a .idx file, or an unsupported version");
+    if (header.entry_count > (input.size() - sizeof(TriIndexHeader)) / sizeof(TriIndexEntry))
+        return fail(error, "truncated index");
+    entries.resize((size_t)header.entry_count);
+    if (!entries.empty())
+        memcpy(&entries[0], input.data() + sizeof(TriIndexHeader), entries.size() * sizeof(TriIndexEntry));
+    return true;
+}
+
+bool read_tri_span(const string& path, uint32_t format, uint64_t offset, uint64_t length,
+                   TriangleArrays& triangles, const TriReadOptions& options, string* error) {
+    MappedInput input;
+    if (!input.open(path))
+        return fail(error, "cannot open " + path);
+    if (offset > input.size() || length > input.size() - offset)
+        return fail(error, "span past the end of " + path + " (stale index?)");
+    const char* data = input.data() + offset;
+    switch (format) {
+    case TRI_INDEX_TEXT:
+        return parse_tri_text(data, length, triangles, options, error);
+    case TRI_INDEX_TRB:
+        convert_records(data, length / TRB_TRIANGLE_SIZE, TRB_TRIANGLE_SIZE, 0, triangles, options.threads);
+        return true;
+    case TRI_INDEX_STL:
+        convert_records(data, length / STL_RECORD, STL_RECORD, 12, triangles, options.threads);
+        return true;
+    default:
+        return fail(error, "unknown index format");
+    }
+}
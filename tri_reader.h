@@ -0,0 +1,101 @@
+#ifndef SKP2TRI_TRI_READER_H
+#define SKP2TRI_TRI_READER_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "tri_format.h"
+
+// Reader for the files written by skp2tri (.tri, .trb, .stl and .ply), for
+// the Linux programs consuming them. It does not depend on the SketchUp API
+// and is built as the static library `trireader`.
+//
+// Files are mapped, never copied. Text files are cut into line aligned
+// chunks that the worker threads parse concurrently (numbers go through
+// fast_float.h); binary files are converted a block of records per task.
+
+enum TriFileFormat {
+    TRI_FILE_UNKNOWN,
+    TRI_FILE_TEXT,
+    TRI_FILE_TRB,
+    TRI_FILE_STL,
+    TRI_FILE_PLY
+};
+
+// Triangles as a structure of arrays: corner k of triangle i is
+// (x[k][i], y[k][i], z[k][i]), so a loop over triangles reads each
+// coordinate contiguously.
+struct TriangleArrays {
+    std::vector<float> x[3];
+    std::vector<float> y[3];
+    std::vector<float> z[3];
+
+    size_t size() const { return x[0].size(); }
+
+    void resize(size_t count) {
+        for (int k = 0; k < 3; ++k) {
+            x[k].resize(count);
+            y[k].resize(count);
+            z[k].resize(count);
+        }
+    }
+
+    void clear() { resize(0); }
+
+    void set(size_t i, const float* corners) {
+        for (int k = 0; k < 3; ++k) {
+            x[k][i] = corners[3 * k];
+            y[k][i] = corners[3 * k + 1];
+            z[k][i] = corners[3 * k + 2];
+        }
+    }
+};
+
+struct TriReadOptions {
+    unsigned threads;   // 0: one per core
+    size_t chunk_size;  // bytes of text per parsing task
+
+    TriReadOptions() : threads(0), chunk_size(4 << 20) {}
+};
+
+// The extension of `path`, dot included, in lower case ("" when none), for
+// the reader and the exporter alike.
+inline std::string lower_extension(const std::string& path) {
+    size_t dot = path.find_last_of(".");
+    size_t slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return "";
+    std::string extension = path.substr(dot);
+    for (size_t i = 0; i < extension.size(); ++i)
+        if (extension[i] >= 'A' && extension[i] <= 'Z')
+            extension[i] = (char)(extension[i] - 'A' + 'a');
+    return extension;
+}
+
+// Format of a file from its first bytes, and its size for the binary STL
+// (whose header is free text). `path` is only used for the extension when
+// the content is not conclusive.
+TriFileFormat detect_tri_format(const char* data, uint64_t size, const std::string& path);
+
+// Reads every triangle of the file at `path`. On failure `error`, when
+// given, says why (with the line number for text files).
+bool read_triangles(const std::string& path, TriangleArrays& triangles,
+                    const TriReadOptions& options = TriReadOptions(), std::string* error = 0);
+
+// Parses .tri text held in memory. `first_line` is the line number of
+// `data` in its file, for the error message.
+bool parse_tri_text(const char* data, uint64_t size, TriangleArrays& triangles,
+                    const TriReadOptions& options = TriReadOptions(), std::string* error = 0,
+                    uint64_t first_line = 1);
+
+// Reads the sidecar index written with --index.
+bool read_tri_index(const std::string& path, TriIndexHeader& header, std::vector<TriIndexEntry>& entries,
+                    std::string* error = 0);
+
+// Reads only the triangles of one index entry: [offset, offset + length) of
+// a data file whose format is `format` (a TriIndexFormat).
+bool read_tri_span(const std::string& path, uint32_t format, uint64_t offset, uint64_t length,
+                   TriangleArrays& triangles, const TriReadOptions& options = TriReadOptions(),
+                   std::string* error = 0);
+
+#endif // SKP2TRI_TRI_READER_H
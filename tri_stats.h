@@ -0,0 +1,221 @@
+#ifndef SKP2TRI_TRI_STATS_H
+#define SKP2TRI_TRI_STATS_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <stdint.h>
+#include "parallel.h"
+#include "tri_reader.h"
+#include "json.h"
+
+// Geometry statistics of triangle sets for the QA of exports: counts,
+// bounds, surface area and the distribution of edge lengths. They are
+// reductions: batches of triangles are summed on the workers and the
+// partial results merged. The exporter (--report) sums the ranges it is
+// writing anyway, tristats the triangles of a file.
+
+// Edge lengths are counted in quarter octave bins from 2^EDGE_MIN_EXPONENT
+// to 2^EDGE_MAX_EXPONENT (about 1e-6 to 1.7e7 model units); the first bin
+// also gets the shorter edges and the last one the longer.
+const int EDGE_MIN_EXPONENT = -20;
+const int EDGE_MAX_EXPONENT = 24;
+const int EDGE_BINS_PER_OCTAVE = 4;
+const int EDGE_BIN_COUNT = (EDGE_MAX_EXPONENT - EDGE_MIN_EXPONENT) * EDGE_BINS_PER_OCTAVE + 2;
+
+inline int edge_bin(double length) {
+    int exponent;
+    double mantissa = 2.0 * std::frexp(length, &exponent); // [1, 2)
+    --exponent;
+    if (!(length > 0.0) || exponent < EDGE_MIN_EXPONENT)
+        return 0;
+    if (exponent >= EDGE_MAX_EXPONENT)
+        return EDGE_BIN_COUNT - 1;
+    int quarter = (mantissa >= 1.189207115002721) + (mantissa >= 1.4142135623730951) + (mantissa >= 1.681792830507429);
+    return 1 + (exponent - EDGE_MIN_EXPONENT) * EDGE_BINS_PER_OCTAVE + quarter;
+}
+
+// Shortest length counted in `bin` (0 for the first one).
+inline double edge_bin_start(int bin) {
+    if (bin <= 0)
+        return 0.0;
+    return std::pow(2.0, EDGE_MIN_EXPONENT + (double)(bin - 1) / EDGE_BINS_PER_OCTAVE);
+}
+
+// Edge length counts. They add up in any order, so each worker keeps one.
+struct EdgeHistogram {
+    uint64_t counts[EDGE_BIN_COUNT];
+
+    EdgeHistogram() { std::fill(counts, counts + EDGE_BIN_COUNT, (uint64_t)0); }
+
+    void add(const EdgeHistogram& other) {
+        for (int b = 0; b < EDGE_BIN_COUNT; ++b)
+            counts[b] += other.counts[b];
+    }
+};
+
+// Totals of a batch of triangles. Triangles with a non finite coordinate
+// are only counted as such. Batches are merged in order, so the sums do
+// not depend on the number of threads.
+struct TriStats {
+    uint64_t triangles;
+    uint64_t non_finite;
+    uint64_t zero_area;
+    double area;
+    double min[3];
+    double max[3];
+    double edge_min;
+    double edge_max;
+    double edge_sum;
+
+    TriStats() : triangles(0), non_finite(0), zero_area(0), area(0.0), edge_min(DBL_MAX), edge_max(0.0), edge_sum(0.0) {
+        for (int d = 0; d < 3; ++d) {
+            min[d] = DBL_MAX;
+            max[d] = -DBL_MAX;
+        }
+    }
+
+    uint64_t finite() const { return triangles - non_finite; }
+    bool has_bounds() const { return finite() > 0; }
+
+    void add(const double* a, const double* b, const double* c, EdgeHistogram& edges) {
+        ++triangles;
+        double sum = 0.0;
+        for (int d = 0; d < 3; ++d)
+            sum += a[d] + b[d] + c[d];
+        if (!(std::fabs(sum) <= DBL_MAX)) {
+            ++non_finite;
+            return;
+        }
+        const double* corners[3] = { a, b, c };
+        for (int k = 0; k < 3; ++k) {
+            const double* p = corners[k];
+            const double* q = corners[(k + 1) % 3];
+            for (int d = 0; d < 3; ++d) {
+                min[d] = std::min(min[d], p[d]);
+                max[d] = std::max(max[d], p[d]);
+            }
+            double length = std::sqrt((q[0] - p[0]) * (q[0] - p[0]) + (q[1] - p[1]) * (q[1] - p[1])
+                                      + (q[2] - p[2]) * (q[2] - p[2]));
+            edge_min = std::min(edge_min, length);
+            edge_max = std::max(edge_max, length);
+            edge_sum += length;
+            ++edges.counts[edge_bin(length)];
+        }
+        double u[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+        double v[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+        double n[3] = { u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0] };
+        double doubled = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        area += 0.5 * doubled;
+        zero_area += doubled == 0.0;
+    }
+
+    void add(const TriStats& other) {
+        triangles += other.triangles;
+        non_finite += other.non_finite;
+        zero_area += other.zero_area;
+        area += other.area;
+        for (int d = 0; d < 3; ++d) {
+            min[d] = std::min(min[d], other.min[d]);
+            max[d] = std::max(max[d], other.max[d]);
+        }
+        edge_min = std::min(edge_min, other.edge_min);
+        edge_max = std::max(edge_max, other.edge_max);
+        edge_sum += other.edge_sum;
+    }
+};
+
+// One line of the per group table.
+struct TriStatsGroup {
+    std::string name;
+    std::string kind;    // "faces", "group" or "instance"
+    int32_t entity_id;
+    TriStats stats;
+
+    TriStatsGroup() : entity_id(0) {}
+};
+
+const size_t STATS_BATCH_SIZE = 65536;
+
+// Statistics of triangles [first, first + count) of `triangles`, in batches
+// of STATS_BATCH_SIZE on `threads` workers.
+inline void triangle_stats(const TriangleArrays& triangles, size_t first, size_t count, unsigned threads,
+                           TriStats& stats, EdgeHistogram& edges) {
+    if (threads == 0)
+        threads = default_thread_count();
+    size_t batches = (count + STATS_BATCH_SIZE - 1) / STATS_BATCH_SIZE;
+    std::vector<TriStats> partial(batches);
+    std::vector<EdgeHistogram> histograms(std::min((size_t)threads, std::max(batches, (size_t)1)));
+    parallel_for(batches, threads, [&](size_t batch, unsigned worker) {
+        size_t end = std::min(first + count, first + (batch + 1) * STATS_BATCH_SIZE);
+        for (size_t i = first + batch * STATS_BATCH_SIZE; i < end; ++i) {
+            double corners[3][3];
+            for (int k = 0; k < 3; ++k) {
+                corners[k][0] = triangles.x[k][i];
+                corners[k][1] = triangles.y[k][i];
+                corners[k][2] = triangles.z[k][i];
+            }
+            partial[batch].add(corners[0], corners[1], corners[2], histograms[worker]);
+        }
+    });
+    for (size_t batch = 0; batch < batches; ++batch)
+        stats.add(partial[batch]);
+    for (size_t w = 0; w < histograms.size(); ++w)
+        edges.add(histograms[w]);
+}
+
+inline void write_stats_bounds(std::ostream& out, const TriStats& stats) {
+    if (!stats.has_bounds()) {
+        out << "null";
+        return;
+    }
+    out << "{\"min\": [" << json_number(stats.min[0], 17) << ", " << json_number(stats.min[1], 17) << ", "
+        << json_number(stats.min[2], 17) << "], \"max\": [" << json_number(stats.max[0], 17) << ", "
+        << json_number(stats.max[1], 17) << ", " << json_number(stats.max[2], 17) << "]}";
+}
+
+// Writes the report: totals, the edge length histogram (non empty bins
+// only, as [from, to) ranges) and one entry per group.
+inline void write_stats_json(std::ostream& out, const TriStats& total, const EdgeHistogram& edges,
+                             const std::vector<TriStatsGroup>& groups) {
+    uint64_t edge_count = 3 * total.finite();
+    out << "{\n  \"triangles\": " << total.triangles << ",\n"
+        << "  \"non_finite\": " << total.non_finite << ",\n"
+        << "  \"zero_area\": " << total.zero_area << ",\n"
+        << "  \"area\": " << json_number(total.area, 17) << ",\n"
+        << "  \"bounds\": ";
+    write_stats_bounds(out, total);
+    out << ",\n  \"edges\": {\"count\": " << edge_count
+        << ", \"min\": " << json_number(edge_count > 0 ? total.edge_min : 0.0, 17)
+        << ", \"max\": " << json_number(total.edge_max, 17)
+        << ", \"mean\": " << json_number(edge_count > 0 ? total.edge_sum / edge_count : 0.0, 17)
+        << ",\n    \"histogram\": [";
+    bool first = true;
+    for (int b = 0; b < EDGE_BIN_COUNT; ++b) {
+        if (edges.counts[b] == 0)
+            continue;
+        out << (first ? "" : ",") << "\n      {\"from\": " << json_number(edge_bin_start(b), 9) << ", \"to\": ";
+        if (b + 1 < EDGE_BIN_COUNT)
+            out << json_number(edge_bin_start(b + 1), 9);
+        else
+            out << "null";
+        out << ", \"count\": " << edges.counts[b] << "}";
+        first = false;
+    }
+    out << "\n    ]},\n  \"groups\": [";
+    for (size_t g = 0; g < groups.size(); ++g) {
+        const TriStatsGroup& group = groups[g];
+        out << (g > 0 ? "," : "") << "\n    {\"name\": " << json_string(group.name)
+            << ", \"kind\": " << json_string(group.kind) << ", \"entity_id\": " << group.entity_id
+            << ", \"triangles\": " << group.stats.triangles
+            << ", \"area\": " << json_number(group.stats.area, 17) << ", \"bounds\": ";
+        write_stats_bounds(out, group.stats);
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+#endif // SKP2TRI_TRI_STATS_H
@@ -0,0 +1,396 @@
+#ifndef SKP2TRI_TRI_VOXEL_H
+#define SKP2TRI_TRI_VOXEL_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <sstream>
+#include <stdint.h>
+#include "parallel.h"
+#include "tri_reader.h"
+#include "tri_format.h"
+#include "buffered_writer.h"
+
+// Voxelization of a triangle set into a bit packed occupancy grid (layout
+// in tri_format.h): the voxels the surface crosses, found with the
+// triangle / box separating axis test in the form of Schwarz and Seidel
+// (set up once per triangle, a few multiply-adds per voxel), and
+// optionally the voxels inside closed shells, by the parity of the surface
+// crossings along each row. The grid is cut in tiles of rows, each
+// triangle is listed by the tiles it reaches, and the tiles are filled on
+// all cores, each owning its rows. Triangles with a non finite coordinate
+// are left out.
+
+struct VoxelOptions {
+    double size;          // voxel edge, in the units of the triangles
+    bool solid;           // also fill the inside of closed shells
+    unsigned threads;     // 0: one per core
+    uint64_t max_voxels;
+
+    VoxelOptions() : size(0.0), solid(false), threads(0), max_voxels(1ULL << 36) {}
+};
+
+struct VoxelGrid {
+    TriVoxelHeader header;
+    std::vector<uint64_t> words; // rows along x, see tri_format.h
+    uint64_t open_rows;          // rows left unfilled, their surface crossings not pairing up
+
+    VoxelGrid() : open_rows(0) { header = make_tri_voxel_header(); }
+
+    bool occupied(uint32_t i, uint32_t j, uint32_t k) const {
+        uint64_t row = (uint64_t)j + (uint64_t)header.resolution[1] * k;
+        return (words[row * tri_voxel_row_words(header) + i / 64] >> (i % 64)) & 1;
+    }
+};
+
+namespace voxel_detail {
+
+// A tile is TILE_ROWS rows along y by TILE_LAYERS layers along z.
+const uint32_t TILE_ROWS = 64;
+const uint32_t TILE_LAYERS = 8;
+const size_t PARALLEL_SIZE = 1 << 16;
+
+inline void corners_of(const TriangleArrays& triangles, size_t i, double v[3][3]) {
+    for (int c = 0; c < 3; ++c) {
+        v[c][0] = triangles.x[c][i];
+        v[c][1] = triangles.y[c][i];
+        v[c][2] = triangles.z[c][i];
+    }
+}
+
+// Whether a triangle crosses a voxel, given the voxel's low corner: the
+// triangle's plane must separate two opposite corners of the voxel, and in
+// each of the three axis projections the voxel's square must reach inside
+// every edge of the triangle (Schwarz and Seidel, Fast parallel surface
+// and solid voxelization on GPUs, 2010). Equivalent to the 13 separating
+// axes, with the triangle side of every test computed once.
+struct SurfaceTest {
+    double normal[3], d1, d2;
+    double edge_normal[3][3][2]; // projection (xy, yz, zx), edge
+    double edge_d[3][3];
+
+    SurfaceTest(const double v[3][3], double size) {
+        double e[3][3];
+        for (int i = 0; i < 3; ++i)
+            for (int d = 0; d < 3; ++d)
+                e[i][d] = v[(i + 1) % 3][d] - v[i][d];
+        normal[0] = e[0][1] * e[1][2] - e[0][2] * e[1][1];
+        normal[1] = e[0][2] * e[1][0] - e[0][0] * e[1][2];
+        normal[2] = e[0][0] * e[1][1] - e[0][1] * e[1][0];
+        d1 = d2 = 0.0;
+        for (int d = 0; d < 3; ++d) {
+            double critical = normal[d] > 0.0 ? size : 0.0;
+            d1 += normal[d] * (critical - v[0][d]);
+            d2 += normal[d] * (size - critical - v[0][d]);
+        }
+        for (int p = 0; p < 3; ++p) {
+            int a = p, b = (p + 1) % 3, c = (p + 2) % 3; // the projection drops axis c
+            double sign = normal[c] >= 0.0 ? 1.0 : -1.0;
+            for (int i = 0; i < 3; ++i) {
+                double nx = -e[i][b] * sign, ny = e[i][a] * sign;
+                edge_normal[p][i][0] = nx;
+                edge_normal[p][i][1] = ny;
+                edge_d[p][i] = -(nx * v[i][a] + ny * v[i][b]) + std::max(0.0, size * nx) + std::max(0.0, size * ny);
+            }
+        }
+    }
+
+    bool overlaps(const double* p) const {
+        double distance = normal[0] * p[0] + normal[1] * p[1] + normal[2] * p[2];
+        if ((distance + d1) * (distance + d2) > 0.0)
+            return false;
+        for (int q = 0; q < 3; ++q) {
+            int a = q, b = (q + 1) % 3;
+            for (int i = 0; i < 3; ++i)
+                if (edge_normal[q][i][0] * p[a] + edge_normal[q][i][1] * p[b] + edge_d[q][i] < 0.0)
+                    return false;
+        }
+        return true;
+    }
+};
+
+// The triangle seen along x, for the crossings of the rows: which row
+// centres (y, z) it covers, and where along x. Its projection is turned
+// counter clockwise, and a centre on an edge belongs to one side only
+// (like a rasterizer's top-left rule), so that a row through an edge shared
+// by two triangles crosses the surface once.
+struct ParityTest {
+    double corner[3][2]; // (y, z)
+    double normal[3], origin[3];
+    bool valid;
+
+    explicit ParityTest(const double v[3][3]) {
+        double u[3], w[3];
+        for (int d = 0; d < 3; ++d) {
+            u[d] = v[1][d] - v[0][d];
+            w[d] = v[2][d] - v[0][d];
+            origin[d] = v[0][d];
+        }
+        normal[0] = u[1] * w[2] - u[2] * w[1];
+        normal[1] = u[2] * w[0] - u[0] * w[2];
+        normal[2] = u[0] * w[1] - u[1] * w[0];
+        valid = normal[0] != 0.0; // seen edge on along x, no row crosses it
+        bool flip = normal[0] < 0.0;
+        for (int c = 0; c < 3; ++c) {
+            int from = flip && c > 0 ? 3 - c : c;
+            corner[c][0] = v[from][1];
+            corner[c][1] = v[from][2];
+        }
+    }
+
+    bool covers(double y, double z) const {
+        for (int i = 0; i < 3; ++i) {
+            const double* a = corner[i];
+            const double* b = corner[(i + 1) % 3];
+            double du = b[0] - a[0], dv = b[1] - a[1];
+            double side = du * (z - a[1]) - dv * (y - a[0]);
+            if (side < 0.0 || (side == 0.0 && !(dv < 0.0 || (dv == 0.0 && du < 0.0))))
+                return false;
+        }
+        return true;
+    }
+
+    double x_at(double y, double z) const {
+        return origin[0] - (normal[1] * (y - origin[1]) + normal[2] * (z - origin[2])) / normal[0];
+    }
+};
+
+// Voxels [first, last] along axis d covering [low, high].
+inline void voxel_range(const TriVoxelHeader& header, int d, double low, double high, int64_t& first, int64_t& last) {
+    double top = (double)header.resolution[d] - 1.0;
+    first = (int64_t)std::max(0.0, std::min(top, std::floor((low - header.min[d]) / header.size)));
+    last = (int64_t)std::max(0.0, std::min(top, std::floor((high - header.min[d]) / header.size)));
+}
+
+// Calls fn(tile) for the tiles (tiles_y to a layer) that triangle i
+// reaches.
+template <class Fn>
+void for_each_tile(const TriangleArrays& triangles, size_t i, const TriVoxelHeader& header, uint32_t tiles_y, Fn fn) {
+    double v[3][3];
+    corners_of(triangles, i, v);
+    int64_t first[3], last[3];
+    for (int d = 1; d < 3; ++d)
+        voxel_range(header, d, std::min(v[0][d], std::min(v[1][d], v[2][d])),
+                    std::max(v[0][d], std::max(v[1][d], v[2][d])), first[d], last[d]);
+    for (int64_t z = first[2] / TILE_LAYERS; z <= last[2] / TILE_LAYERS; ++z)
+        for (int64_t y = first[1] / TILE_ROWS; y <= last[1] / TILE_ROWS; ++y)
+            fn((size_t)y + (size_t)tiles_y * z);
+}
+
+// Running parity of the bits of a word, from bit 0 up, started at `carry`
+// (all ones or all zeros).
+inline uint64_t prefix_parity(uint64_t x, uint64_t carry) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x ^ carry;
+}
+
+} // namespace voxel_detail
+
+// Fails when the size is not positive or the grid would hold more than
+// `max_voxels` voxels.
+inline bool voxelize(const TriangleArrays& triangles, const VoxelOptions& options, VoxelGrid& grid,
+                     std::string* error = 0) {
+    using namespace voxel_detail;
+    unsigned threads = options.threads > 0 ? options.threads : default_thread_count();
+    size_t count = triangles.size();
+    grid.header = make_tri_voxel_header();
+    grid.header.size = options.size;
+    grid.header.flags = options.solid ? TRI_VOXEL_SOLID : 0;
+    grid.words.clear();
+    grid.open_rows = 0;
+    if (!(options.size > 0.0) || !std::isfinite(options.size)) {
+        if (error)
+            *error = "the voxel size must be positive";
+        return false;
+    }
+
+    // Bounds of the finite triangles.
+    size_t tasks = (count + PARALLEL_SIZE - 1) / PARALLEL_SIZE;
+    std::vector<uint8_t> finite(count);
+    std::vector<double> task_bounds(6 * tasks);
+    parallel_for(tasks, threads, [&](size_t task, unsigned) {
+        double* bounds = &task_bounds[6 * task];
+        for (int d = 0; d < 3; ++d) {
+            bounds[d] = HUGE_VAL;
+            bounds[3 + d] = -HUGE_VAL;
+        }
+        for (size_t i = task * PARALLEL_SIZE; i < std::min(count, (task + 1) * PARALLEL_SIZE); ++i) {
+            double v[3][3];
+            corners_of(triangles, i, v);
+            double sum = 0.0;
+            for (int c = 0; c < 3; ++c)
+                sum += v[c][0] + v[c][1] + v[c][2];
+            finite[i] = sum - sum == 0.0;
+            if (!finite[i])
+                continue;
+            for (int c = 0; c < 3; ++c)
+                for (int d = 0; d < 3; ++d) {
+                    bounds[d] = std::min(bounds[d], v[c][d]);
+                    bounds[3 + d] = std::max(bounds[3 + d], v[c][d]);
+                }
+        }
+    });
+    double low[3] = { HUGE_VAL, HUGE_VAL, HUGE_VAL }, high[3] = { -HUGE_VAL, -HUGE_VAL, -HUGE_VAL };
+    for (size_t task = 0; task < tasks; ++task)
+        for (int d = 0; d < 3; ++d) {
+            low[d] = std::min(low[d], task_bounds[6 * task + d]);
+            high[d] = std::max(high[d], task_bounds[6 * task + 3 + d]);
+        }
+    if (!(low[0] <= high[0]))
+        return true; // nothing to voxelize
+
+    // The grid starts on a multiple of the size, so that the grids of
+    // several exports line up.
+    double voxels = 1.0;
+    for (int d = 0; d < 3; ++d) {
+        grid.header.min[d] = std::floor(low[d] / options.size) * options.size;
+        double resolution = std::floor((high[d] - grid.header.min[d]) / options.size) + 1.0;
+        voxels *= resolution;
+        grid.header.resolution[d] = resolution < 4294967296.0 ? (uint32_t)resolution : 0xffffffffu;
+    }
+    if (voxels > (double)options.max_voxels) {
+        if (error) {
+            std::ostringstream message;
+            message << "too many voxels (" << grid.header.resolution[0] << " x " << grid.header.resolution[1]
+                    << " x " << grid.header.resolution[2] << "), use a larger size";
+            *error = message.str();
+        }
+        return false;
+    }
+    const TriVoxelHeader& header = grid.header;
+    uint64_t row_words = tri_voxel_row_words(header);
+    grid.words.assign(row_words * header.resolution[1] * header.resolution[2], 0);
+
+    // Triangles of each tile, listed by counting then filling.
+    uint32_t tiles_y = (header.resolution[1] + TILE_ROWS - 1) / TILE_ROWS;
+    uint32_t tiles_z = (header.resolution[2] + TILE_LAYERS - 1) / TILE_LAYERS;
+    size_t tile_count = (size_t)tiles_y * tiles_z;
+    std::vector<std::atomic<uint64_t> > cursors(tile_count);
+    parallel_for(tasks, threads, [&](size_t task, unsigned) {
+        for (size_t i = task * PARALLEL_SIZE; i < std::min(count, (task + 1) * PARALLEL_SIZE); ++i)
+            if (finite[i])
+                for_each_tile(triangles, i, header, tiles_y,
+                              [&](size_t tile) { cursors[tile].fetch_add(1, std::memory_order_relaxed); });
+    });
+    std::vector<uint64_t> offsets(tile_count + 1, 0);
+    for (size_t t = 0; t < tile_count; ++t) {
+        offsets[t + 1] = offsets[t] + cursors[t].load(std::memory_order_relaxed);
+        cursors[t].store(offsets[t], std::memory_order_relaxed);
+    }
+    std::vector<uint32_t> listed(offsets[tile_count]);
+    parallel_for(tasks, threads, [&](size_t task, unsigned) {
+        for (size_t i = task * PARALLEL_SIZE; i < std::min(count, (task + 1) * PARALLEL_SIZE); ++i)
+            if (finite[i])
+                for_each_tile(triangles, i, header, tiles_y, [&](size_t tile) {
+                    listed[cursors[tile].fetch_add(1, std::memory_order_relaxed)] = (uint32_t)i;
+                });
+    });
+
+    // Each tile: the surface, then the crossings of its rows, then the
+    // inside of the rows whose crossings pair up.
+    std::vector<uint64_t> tile_occupied(tile_count, 0), tile_open(tile_count, 0);
+    uint64_t last_mask = header.resolution[0] % 64 == 0 ? ~0ULL : (1ULL << (header.resolution[0] % 64)) - 1;
+    parallel_for(tile_count, threads, [&](size_t tile, unsigned) {
+        int64_t tile_first[3] = { 0, (int64_t)(tile % tiles_y) * TILE_ROWS, (int64_t)(tile / tiles_y) * TILE_LAYERS };
+        int64_t tile_last[3] = { (int64_t)header.resolution[0] - 1,
+                                 std::min((int64_t)header.resolution[1], tile_first[1] + TILE_ROWS) - 1,
+                                 std::min((int64_t)header.resolution[2], tile_first[2] + TILE_LAYERS) - 1 };
+        int64_t rows = tile_last[1] - tile_first[1] + 1, layers = tile_last[2] - tile_first[2] + 1;
+        std::vector<uint64_t> flips;
+        std::vector<uint8_t> parity;
+        if (options.solid) {
+            flips.assign(row_words * rows * layers, 0);
+            parity.assign(rows * layers, 0);
+        }
+        for (uint64_t n = offsets[tile]; n < offsets[tile + 1]; ++n) {
+            double v[3][3];
+            corners_of(triangles, listed[n], v);
+            int64_t first[3], last[3];
+            for (int d = 0; d < 3; ++d) {
+                voxel_range(header, d, std::min(v[0][d], std::min(v[1][d], v[2][d])),
+                            std::max(v[0][d], std::max(v[1][d], v[2][d])), first[d], last[d]);
+                first[d] = std::max(first[d], tile_first[d]);
+                last[d] = std::min(last[d], tile_last[d]);
+            }
+            SurfaceTest surface(v, header.size);
+            double p[3];
+            for (int64_t k = first[2]; k <= last[2]; ++k) {
+                p[2] = header.min[2] + k * header.size;
+                for (int64_t j = first[1]; j <= last[1]; ++j) {
+                    p[1] = header.min[1] + j * header.size;
+                    uint64_t* row = &grid.words[((uint64_t)j + (uint64_t)header.resolution[1] * k) * row_words];
+                    for (int64_t i = first[0]; i <= last[0]; ++i) {
+                        p[0] = header.min[0] + i * header.size;
+                        if (surface.overlaps(p))
+                            row[i / 64] |= 1ULL << (i % 64);
+                    }
+                }
+            }
+            if (!options.solid)
+                continue;
+            ParityTest crossing(v);
+            if (!crossing.valid)
+                continue;
+            for (int64_t k = first[2]; k <= last[2]; ++k) {
+                double z = header.min[2] + (k + 0.5) * header.size;
+                for (int64_t j = first[1]; j <= last[1]; ++j) {
+                    double y = header.min[1] + (j + 0.5) * header.size;
+                    if (!crossing.covers(y, z))
+                        continue;
+                    // The voxels whose centre is past the crossing change
+                    // sides: flip the first of them.
+                    size_t row = (size_t)((j - tile_first[1]) + rows * (k - tile_first[2]));
+                    parity[row] ^= 1;
+                    double first_inside = std::floor((crossing.x_at(y, z) - header.min[0]) / header.size - 0.5) + 1.0;
+                    if (first_inside < (double)header.resolution[0]) {
+                        uint64_t i = first_inside > 0.0 ? (uint64_t)first_inside : 0;
+                        flips[row * row_words + i / 64] ^= 1ULL << (i % 64);
+                    }
+                }
+            }
+        }
+        for (int64_t k = tile_first[2]; k <= tile_last[2]; ++k)
+            for (int64_t j = tile_first[1]; j <= tile_last[1]; ++j) {
+                uint64_t* row = &grid.words[((uint64_t)j + (uint64_t)header.resolution[1] * k) * row_words];
+                size_t local = (size_t)((j - tile_first[1]) + rows * (k - tile_first[2]));
+                if (options.solid) {
+                    if (parity[local])
+                        ++tile_open[tile];
+                    else {
+                        uint64_t carry = 0;
+                        for (uint64_t w = 0; w < row_words; ++w) {
+                            uint64_t inside = prefix_parity(flips[local * row_words + w], carry);
+                            carry = (inside >> 63) ? ~0ULL : 0;
+                            row[w] |= w + 1 == row_words ? inside & last_mask : inside;
+                        }
+                    }
+                }
+                for (uint64_t w = 0; w < row_words; ++w)
+                    tile_occupied[tile] += (uint64_t)__builtin_popcountll(row[w]);
+            }
+    });
+    for (size_t t = 0; t < tile_count; ++t) {
+        grid.header.occupied += tile_occupied[t];
+        grid.open_rows += tile_open[t];
+    }
+    return true;
+}
+
+inline bool write_voxels(const std::string& path, const VoxelGrid& grid) {
+    BufferedWriter writer;
+    if (!writer.open(path))
+        return false;
+    writer.write((const char*)&grid.header, sizeof(grid.header));
+    if (!grid.words.empty())
+        writer.write((const char*)&grid.words[0], grid.words.size() * sizeof(uint64_t));
+    return writer.close();
+}
+
+#endif // SKP2TRI_TRI_VOXEL_H
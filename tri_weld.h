@@ -0,0 +1,103 @@
+#ifndef SKP2TRI_TRI_WELD_H
+#define SKP2TRI_TRI_WELD_H
+
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <cstring>
+#include <stdint.h>
+#include "tri_reader.h"
+#include "parallel.h"
+
+// Triangles sharing their vertices: vertex v is positions[3v .. 3v + 2] and
+// triangle i uses vertices indices[3i .. 3i + 2].
+struct IndexedTriangles {
+    std::vector<float> positions;
+    std::vector<uint32_t> indices;
+
+    size_t vertex_count() const { return positions.size() / 3; }
+    size_t triangle_count() const { return indices.size() / 3; }
+};
+
+// Bit pattern of a corner, with -0 folded into +0.
+struct WeldKey {
+    uint32_t bits[3];
+
+    bool operator==(const WeldKey& other) const {
+        return bits[0] == other.bits[0] && bits[1] == other.bits[1] && bits[2] == other.bits[2];
+    }
+};
+
+struct WeldKeyHash {
+    size_t operator()(const WeldKey& key) const {
+        uint64_t h = key.bits[0] * 0x9E3779B97F4A7C15ULL;
+        h = (h ^ (h >> 29) ^ key.bits[1]) * 0xBF58476D1CE4E5B9ULL;
+        h = (h ^ (h >> 32) ^ key.bits[2]) * 0x94D049BB133111EBULL;
+        return (size_t)(h ^ (h >> 31));
+    }
+};
+
+inline WeldKey weld_key(float x, float y, float z) {
+    WeldKey key;
+    float values[3] = { x + 0.0f, y + 0.0f, z + 0.0f };
+    std::memcpy(key.bits, values, sizeof(key.bits));
+    return key;
+}
+
+// Merges the corners with exactly the same coordinates. Vertices are
+// numbered in order of first use, so the result does not depend on the
+// thread count. Corners are spread over one hash partition per worker,
+// each deduplicated independently; only the final numbering is serial.
+// Returns false when there are too many corners for 32-bit indices.
+inline bool weld_triangles(const TriangleArrays& triangles, IndexedTriangles& mesh, unsigned threads) {
+    uint64_t corner_count = 3 * (uint64_t)triangles.size();
+    if (corner_count >= 0xffffffffULL)
+        return false;
+    if (threads == 0)
+        threads = default_thread_count();
+    size_t corners = (size_t)corner_count;
+
+    // Corner j is corner j % 3 of triangle j / 3.
+    std::vector<uint32_t> hashes(corners);
+    parallel_for((corners + 65535) / 65536, threads, [&](size_t task, unsigned) {
+        WeldKeyHash hash;
+        size_t end = std::min(corners, (task + 1) * 65536);
+        for (size_t j = task * 65536; j < end; ++j) {
+            size_t i = j / 3, k = j % 3;
+            hashes[j] = (uint32_t)hash(weld_key(triangles.x[k][i], triangles.y[k][i], triangles.z[k][i]));
+        }
+    });
+
+    // first[j]: earliest corner with the same coordinates as corner j.
+    std::vector<uint32_t> first(corners);
+    parallel_for(threads, threads, [&](size_t partition, unsigned) {
+        std::unordered_map<WeldKey, uint32_t, WeldKeyHash> seen;
+        seen.reserve(corners / threads + 1);
+        for (size_t j = 0; j < corners; ++j) {
+            if (hashes[j] % threads != partition)
+                continue;
+            size_t i = j / 3, k = j % 3;
+            std::pair<std::unordered_map<WeldKey, uint32_t, WeldKeyHash>::iterator, bool> inserted =
+                seen.insert(std::make_pair(weld_key(triangles.x[k][i], triangles.y[k][i], triangles.z[k][i]),
+                                           (uint32_t)j));
+            first[j] = inserted.first->second;
+        }
+    });
+
+    mesh.positions.clear();
+    mesh.indices.resize(corners);
+    for (size_t j = 0; j < corners; ++j) {
+        if (first[j] == j) {
+            size_t i = j / 3, k = j % 3;
+            mesh.indices[j] = (uint32_t)(mesh.positions.size() / 3);
+            mesh.positions.push_back(triangles.x[k][i]);
+            mesh.positions.push_back(triangles.y[k][i]);
+            mesh.positions.push_back(triangles.z[k][i]);
+        }
+        else
+            mesh.indices[j] = mesh.indices[first[j]];
+    }
+    return true;
+}
+
+#endif // SKP2TRI_TRI_WELD_H
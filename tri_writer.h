@@ -0,0 +1,130 @@
+#ifndef SKP2TRI_TRI_WRITER_H
+#define SKP2TRI_TRI_WRITER_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cctype>
+#include <algorithm>
+#include "tri_reader.h"
+#include "tri_format.h"
+#include "parallel.h"
+#include "buffered_writer.h"
+
+// Writers for triangles read back with tri_reader.h, for the tools that
+// rewrite files: text .tri, .trb and binary STL, chosen by extension. The
+// records of a block of triangles are built by the workers, then appended
+// in order through a BufferedWriter.
+
+const size_t TRI_WRITE_BLOCK = 65536;
+
+// Appends the .trb records of all the triangles.
+inline void write_trb_records(const TriangleArrays& triangles, BufferedWriter& writer, unsigned threads) {
+    std::vector<float> records(9 * triangles.size());
+    parallel_for((triangles.size() + TRI_WRITE_BLOCK - 1) / TRI_WRITE_BLOCK, threads, [&](size_t task, unsigned) {
+        size_t end = std::min(triangles.size(), (task + 1) * TRI_WRITE_BLOCK);
+        for (size_t i = task * TRI_WRITE_BLOCK; i < end; ++i) {
+            float* record = &records[9 * i];
+            for (int k = 0; k < 3; ++k) {
+                record[3 * k] = triangles.x[k][i];
+                record[3 * k + 1] = triangles.y[k][i];
+                record[3 * k + 2] = triangles.z[k][i];
+            }
+        }
+    });
+    if (!records.empty())
+        writer.write((const char*)&records[0], records.size() * sizeof(float));
+}
+
+// Appends the triangles as text lines, formatted like skp2tri does ("%g").
+inline void write_tri_lines(const TriangleArrays& triangles, BufferedWriter& writer, unsigned threads) {
+    if (threads == 0)
+        threads = default_thread_count();
+    size_t blocks = (triangles.size() + TRI_WRITE_BLOCK - 1) / TRI_WRITE_BLOCK;
+    std::vector<std::string> texts(threads);
+    for (size_t begin = 0; begin < blocks; begin += threads) {
+        size_t count = std::min((size_t)threads, blocks - begin);
+        parallel_for(count, threads, [&](size_t t, unsigned) {
+            std::string& text = texts[t];
+            text.clear();
+            char line[256];
+            size_t first = (begin + t) * TRI_WRITE_BLOCK;
+            size_t end = std::min(triangles.size(), first + TRI_WRITE_BLOCK);
+            for (size_t i = first; i < end; ++i) {
+                int length = std::snprintf(line, sizeof(line), "%g %g %g %g %g %g %g %g %g" TRI_LINE_END,
+                                           triangles.x[0][i], triangles.y[0][i], triangles.z[0][i],
+                                           triangles.x[1][i], triangles.y[1][i], triangles.z[1][i],
+                                           triangles.x[2][i], triangles.y[2][i], triangles.z[2][i]);
+                text.append(line, length);
+            }
+        });
+        for (size_t t = 0; t < count; ++t)
+            writer.write(texts[t]);
+    }
+}
+
+// Appends the binary STL records, with facet normals.
+inline void write_stl_records(const TriangleArrays& triangles, BufferedWriter& writer, unsigned threads) {
+    std::vector<char> records(50 * triangles.size());
+    parallel_for((triangles.size() + TRI_WRITE_BLOCK - 1) / TRI_WRITE_BLOCK, threads, [&](size_t task, unsigned) {
+        size_t end = std::min(triangles.size(), (task + 1) * TRI_WRITE_BLOCK);
+        for (size_t i = task * TRI_WRITE_BLOCK; i < end; ++i) {
+            float c[9] = { triangles.x[0][i], triangles.y[0][i], triangles.z[0][i],
+                           triangles.x[1][i], triangles.y[1][i], triangles.z[1][i],
+                           triangles.x[2][i], triangles.y[2][i], triangles.z[2][i] };
+            double ux = c[3] - c[0], uy = c[4] - c[1], uz = c[5] - c[2];
+            double vx = c[6] - c[0], vy = c[7] - c[1], vz = c[8] - c[2];
+            double nx = uy * vz - uz * vy, ny = uz * vx - ux * vz, nz = ux * vy - uy * vx;
+            double length = std::sqrt(nx * nx + ny * ny + nz * nz);
+            if (length > 0.0) {
+                nx /= length;
+                ny /= length;
+                nz /= length;
+            }
+            float normal[3] = { (float)nx, (float)ny, (float)nz };
+            char* record = &records[50 * i];
+            std::memcpy(record, normal, 12);
+            std::memcpy(record + 12, c, 36);
+            record[48] = record[49] = 0;
+        }
+    });
+    if (!records.empty())
+        writer.write(&records[0], records.size());
+}
+
+// Writes the triangles to `path`: .trb and .stl by extension, text .tri
+// otherwise.
+inline bool write_triangles(const std::string& path, const TriangleArrays& triangles, unsigned threads) {
+    std::string extension;
+    size_t dot = path.find_last_of(".");
+    size_t slash = path.find_last_of("/\\");
+    if (dot != std::string::npos && (slash == std::string::npos || dot > slash))
+        extension = path.substr(dot);
+    for (size_t i = 0; i < extension.size(); ++i)
+        extension[i] = (char)std::tolower((unsigned char)extension[i]);
+
+    BufferedWriter writer(16 << 20);
+    if (!writer.open(path))
+        return false;
+    if (extension == ".trb") {
+        TrbHeader header = make_trb_header(triangles.size());
+        writer.write((const char*)&header, sizeof(header));
+        write_trb_records(triangles, writer, threads);
+    }
+    else if (extension == ".stl") {
+        char header[84];
+        std::memset(header, 0, sizeof(header));
+        std::strncpy(header, "binary STL written by skp2tri", 80);
+        uint32_t count = (uint32_t)triangles.size();
+        std::memcpy(header + 80, &count, 4);
+        writer.write(header, sizeof(header));
+        write_stl_records(triangles, writer, threads);
+    }
+    else
+        write_tri_lines(triangles, writer, threads);
+    return writer.close();
+}
+
+#endif // SKP2TRI_TRI_WRITER_H
@@ -0,0 +1,95 @@
+#include "tri_reader.h"
+#include "tri_bvh.h"
+#include "mapped_file.h"
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+
+using namespace std;
+
+// Builds the bounding volume hierarchy of existing exports (.tri, .trb,
+// .stl or .ply) and writes it next to each of them as <file>.bvh, so that
+// ray casting consumers can map it instead of building their own.
+
+void display_usage(int argc, char** argv) {
+    cout << "Usage is :" << endl;
+    cout << argv[0] << " [options] <input-file>..." << endl;
+    cout << "Writes <input-file>.bvh next to each input." << endl;
+    cout << "Options :" << endl;
+    cout << "  -t, --threads <n>   worker threads (default: one per core)" << endl;
+    cout << "  --leaf <n>          most triangles per leaf (default: 8)" << endl;
+    cout << "  --bins <n>          SAH bins per axis, up to 64 (default: 16)" << endl;
+    cout << "  --packet <n>        leaves sized for n triangles tested at once (tri_ray.h: 4 or 8)" << endl;
+}
+
+int main(int argc, char** argv) {
+
+    BvhOptions options;
+    vector<string> paths;
+    for (int i = 1; i < argc; ++i) {
+        string arg(argv[i]);
+        if (arg == "-h" || arg == "--help") {
+            display_usage(argc, argv);
+            return 0;
+        }
+        else if ((arg == "-t" || arg == "--threads") && i + 1 < argc)
+            options.threads = (unsigned)atoi(argv[++i]);
+        else if (arg == "--leaf" && i + 1 < argc)
+            options.leaf_size = (unsigned)atoi(argv[++i]);
+        else if (arg == "--bins" && i + 1 < argc)
+            options.bins = (unsigned)atoi(argv[++i]);
+        else if (arg == "--packet" && i + 1 < argc)
+            options.packet_width = (unsigned)atoi(argv[++i]);
+        else if (!arg.empty() && arg[0] == '-') {
+            display_usage(argc, argv);
+            return 1;
+        }
+        else
+            paths.push_back(arg);
+    }
+    if (paths.empty()) {
+        display_usage(argc, argv);
+        return 1;
+    }
+
+    int status = 0;
+    for (size_t f = 0; f < paths.size(); ++f) {
+        const string& path = paths[f];
+        TriReadOptions read_options;
+        read_options.threads = options.threads;
+        TriangleArrays triangles;
+        string error;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (!read_triangles(path, triangles, read_options, &error)) {
+            cerr << "Error : " << path << " : " << error << endl;
+            status = 1;
+            continue;
+        }
+        if (triangles.size() >= 0xffffffffULL) {
+            cerr << "Error : " << path << " : more than 2^32 triangles" << endl;
+            status = 1;
+            continue;
+        }
+        chrono::steady_clock::time_point read = chrono::steady_clock::now();
+
+        Bvh bvh;
+        build_bvh(triangles, options, bvh);
+        chrono::steady_clock::time_point built = chrono::steady_clock::now();
+
+        MappedInput data;
+        uint64_t data_size = data.open(path) ? data.size() : 0;
+        data.close();
+        if (!write_bvh(path + ".bvh", bvh, data_size)) {
+            cerr << "Error : file " << path << ".bvh impossible to write" << endl;
+            status = 1;
+            continue;
+        }
+        double seconds = chrono::duration<double>(built - read).count();
+        cout << path << ".bvh : " << bvh.triangles.size() << " triangles, " << bvh.nodes.size()
+             << " nodes, SAH cost " << bvh_sah_cost(bvh, options.traversal_cost) << endl;
+        cout << "  read in " << chrono::duration<double>(read - start).count() << " s, built in " << seconds
+             << " s (" << (triangles.size() > 0 ? 1e9 * seconds / triangles.size() : 0.0)
+             << " ms per million triangles)" << endl;
+    }
+    return status;
+}
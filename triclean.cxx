@@ -0,0 +1,82 @@
+#include "tri_reader.h"
+#include "tri_clean.h"
+#include "tri_writer.h"
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+
+using namespace std;
+
+// Checks a .tri (or .trb, .stl, .ply) file for non finite, zero area and
+// repeated triangles, reports them, and writes the cleaned triangles when
+// an output file is given.
+
+void display_usage(int argc, char** argv) {
+    cout << "Usage is :" << endl;
+    cout << argv[0] << " [options] <input-file> [<output-file>]" << endl;
+    cout << "Without output file, only reports the bad triangles." << endl;
+    cout << "The output format follows its extension : .trb, .stl, or text .tri." << endl;
+    cout << "Options :" << endl;
+    cout << "  -t, --threads <n>     worker threads (default: one per core)" << endl;
+    cout << "  --tolerance <sine>    zero area below this sine of the corner angle (default: 1e-7)" << endl;
+    cout << "  --keep-degenerate     keep the non finite and zero area triangles" << endl;
+    cout << "  --keep-repeated       keep the repeated triangles" << endl;
+}
+
+int main(int argc, char** argv) {
+
+    TriReadOptions read_options;
+    CleanOptions options;
+    vector<string> paths;
+    for (int i = 1; i < argc; ++i) {
+        string arg(argv[i]);
+        if (arg == "-h" || arg == "--help") {
+            display_usage(argc, argv);
+            return 0;
+        }
+        else if ((arg == "-t" || arg == "--threads") && i + 1 < argc)
+            read_options.threads = (unsigned)atoi(argv[++i]);
+        else if (arg == "--tolerance" && i + 1 < argc)
+            options.tolerance = atof(argv[++i]);
+        else if (arg == "--keep-degenerate")
+            options.degenerate = false;
+        else if (arg == "--keep-repeated")
+            options.duplicates = false;
+        else if (!arg.empty() && arg[0] == '-') {
+            display_usage(argc, argv);
+            return 1;
+        }
+        else
+            paths.push_back(arg);
+    }
+    if (paths.size() < 1 || paths.size() > 2) {
+        display_usage(argc, argv);
+        return 1;
+    }
+
+    TriangleArrays triangles;
+    string error;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (!read_triangles(paths[0], triangles, read_options, &error)) {
+        cerr << "Error : " << paths[0] << " : " << error << endl;
+        return 1;
+    }
+    chrono::steady_clock::time_point read = chrono::steady_clock::now();
+    CleanStats stats = clean_triangles(triangles, options, read_options.threads);
+    chrono::steady_clock::time_point cleaned = chrono::steady_clock::now();
+
+    cout << paths[0] << " : " << stats.input << " triangles" << endl;
+    cout << "  non finite       " << stats.non_finite << endl;
+    cout << "  zero area        " << stats.zero_area << endl;
+    cout << "  repeated         " << stats.duplicates << endl;
+    cout << "  flipped repeats  " << stats.flipped << endl;
+    cout << "  kept             " << stats.input - stats.removed() << endl;
+    cout << "read in " << chrono::duration<double>(read - start).count() << " s, checked in "
+         << chrono::duration<double>(cleaned - read).count() << " s" << endl;
+
+    if (paths.size() == 2 && !write_triangles(paths[1], triangles, read_options.threads)) {
+        cerr << "Error : file " << paths[1] << " impossible to write" << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,153 @@
+#include "tri_reader.h"
+#include "tri_diff.h"
+#include "json.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cstdlib>
+
+using namespace std;
+
+// Compares the geometry of two exports (.tri, .trb, .stl or .ply, in any
+// combination) regardless of triangle order, float formatting and which
+// corner comes first. The exit code is 0 when they match, 1 when they
+// differ and 2 on error, like diff.
+
+void display_usage(int argc, char** argv) {
+    cout << "Usage is :" << endl;
+    cout << argv[0] << " [options] <before-file> <after-file>" << endl;
+    cout << "Options :" << endl;
+    cout << "  --eps <d>            absolute tolerance per coordinate (default: 1e-3)" << endl;
+    cout << "  --rel <r>            relative tolerance per coordinate (default: 1e-5)" << endl;
+    cout << "  --region-size <d>    cell size grouping the changes (default: 1/64 of the model)" << endl;
+    cout << "  --no-moves           do not pair translated triangles" << endl;
+    cout << "  --regions <n>        regions listed (default: 20)" << endl;
+    cout << "  --json <file>        write the report as JSON (- for stdout)" << endl;
+    cout << "  -t, --threads <n>    worker threads (default: one per core)" << endl;
+}
+
+string json_box(const DiffRegion& region) {
+    ostringstream out;
+    out << "{\"min\": [" << json_number(region.min[0], 9) << ", " << json_number(region.min[1], 9) << ", "
+        << json_number(region.min[2], 9) << "], \"max\": [" << json_number(region.max[0], 9) << ", "
+        << json_number(region.max[1], 9) << ", " << json_number(region.max[2], 9) << "]}";
+    return out.str();
+}
+
+void write_json(ostream& out, const string& before, const string& after, uint64_t before_count,
+                uint64_t after_count, const DiffResult& result, size_t regions) {
+    out << "{\n  \"before\": {\"file\": " << json_string(before) << ", \"triangles\": " << before_count << "},\n"
+        << "  \"after\": {\"file\": " << json_string(after) << ", \"triangles\": " << after_count << "},\n"
+        << "  \"tolerance\": " << json_number(result.tolerance, 6) << ",\n"
+        << "  \"identical\": " << (result.identical() ? "true" : "false") << ",\n"
+        << "  \"matched\": " << result.matched << ",\n"
+        << "  \"moved\": " << result.moved << ",\n"
+        << "  \"removed\": " << result.removed << ",\n"
+        << "  \"added\": " << result.added << ",\n"
+        << "  \"region_count\": " << result.regions.size() << ",\n"
+        << "  \"regions\": [";
+    for (size_t r = 0; r < result.regions.size() && r < regions; ++r) {
+        const DiffRegion& region = result.regions[r];
+        out << (r > 0 ? "," : "") << "\n    {\"bounds\": " << json_box(region) << ", \"removed\": " << region.removed
+            << ", \"added\": " << region.added << ", \"moved\": " << region.moved << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+int main(int argc, char** argv) {
+
+    DiffOptions options;
+    size_t regions = 20;
+    string json;
+    vector<string> paths;
+    for (int i = 1; i < argc; ++i) {
+        string arg(argv[i]);
+        if (arg == "-h" || arg == "--help") {
+            display_usage(argc, argv);
+            return 0;
+        }
+        else if (arg == "--eps" && i + 1 < argc)
+            options.epsilon = atof(argv[++i]);
+        else if (arg == "--rel" && i + 1 < argc)
+            options.relative = atof(argv[++i]);
+        else if (arg == "--region-size" && i + 1 < argc)
+            options.region_size = atof(argv[++i]);
+        else if (arg == "--no-moves")
+            options.moves = false;
+        else if (arg == "--regions" && i + 1 < argc)
+            regions = (size_t)atoi(argv[++i]);
+        else if (arg == "--json" && i + 1 < argc)
+            json = argv[++i];
+        else if ((arg == "-t" || arg == "--threads") && i + 1 < argc)
+            options.threads = (unsigned)atoi(argv[++i]);
+        else if (!arg.empty() && arg[0] == '-') {
+            display_usage(argc, argv);
+            return 2;
+        }
+        else
+            paths.push_back(arg);
+    }
+    if (paths.size() != 2) {
+        display_usage(argc, argv);
+        return 2;
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    TriReadOptions read_options;
+    read_options.threads = options.threads;
+    TriangleArrays before, after;
+    string error;
+    if (!read_triangles(paths[0], before, read_options, &error)) {
+        cerr << "Error : " << paths[0] << " : " << error << endl;
+        return 2;
+    }
+    if (!read_triangles(paths[1], after, read_options, &error)) {
+        cerr << "Error : " << paths[1] << " : " << error << endl;
+        return 2;
+    }
+    if (before.size() >= 0xffffffffULL || after.size() >= 0xffffffffULL) {
+        cerr << "Error : more than 2^32 triangles" << endl;
+        return 2;
+    }
+    chrono::steady_clock::time_point read = chrono::steady_clock::now();
+
+    DiffResult result;
+    diff_triangles(before, after, options, result);
+    chrono::steady_clock::time_point compared = chrono::steady_clock::now();
+
+    if (json == "-") {
+        write_json(cout, paths[0], paths[1], before.size(), after.size(), result, regions);
+        return result.identical() ? 0 : 1;
+    }
+    if (!json.empty()) {
+        ofstream out(json.c_str());
+        write_json(out, paths[0], paths[1], before.size(), after.size(), result, regions);
+        out.close();
+        if (out.fail()) {
+            cerr << "Error : file " << json << " impossible to write" << endl;
+            return 2;
+        }
+    }
+
+    cout << paths[0] << " : " << before.size() << " triangles" << endl;
+    cout << paths[1] << " : " << after.size() << " triangles" << endl;
+    cout << "tolerance up to " << result.tolerance << endl;
+    cout << "  matched  " << result.matched << endl;
+    cout << "  moved    " << result.moved << endl;
+    cout << "  removed  " << result.removed << endl;
+    cout << "  added    " << result.added << endl;
+    if (!result.regions.empty()) {
+        cout << result.regions.size() << " changed region(s)" << (result.regions.size() > regions ? ", biggest:" : ":")
+             << endl;
+        for (size_t r = 0; r < result.regions.size() && r < regions; ++r) {
+            const DiffRegion& region = result.regions[r];
+            cout << "  (" << region.min[0] << ", " << region.min[1] << ", " << region.min[2] << ") - ("
+                 << region.max[0] << ", " << region.max[1] << ", " << region.max[2] << ") : " << region.removed
+                 << " removed, " << region.added << " added, " << region.moved << " moved" << endl;
+        }
+    }
+    cout << "read in " << chrono::duration<double>(read - start).count() << " s, compared in "
+         << chrono::duration<double>(compared - read).count() << " s" << endl;
+    return result.identical() ? 0 : 1;
+}
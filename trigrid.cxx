@@ -0,0 +1,160 @@
+#include "tri_reader.h"
+#include "tri_grid.h"
+#include "mapped_file.h"
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cstdlib>
+
+using namespace std;
+
+// Builds the uniform grid of existing exports (.tri, .trb, .stl or .ply)
+// and writes it next to each of them as <file>.grid, so that proximity
+// queries can map it instead of building their own. With --nearest, the
+// grid (mapped when up to date, else built) answers the nearest triangle of
+// every point of a text file.
+
+void display_usage(int argc, char** argv) {
+    cout << "Usage is :" << endl;
+    cout << argv[0] << " [options] <input-file>..." << endl;
+    cout << "Writes <input-file>.grid next to each input." << endl;
+    cout << "Options :" << endl;
+    cout << "  -t, --threads <n>   worker threads (default: one per core)" << endl;
+    cout << "  --density <d>       cells per triangle (default: 1)" << endl;
+    cout << "  --nearest <file>    instead, for each point (x y z per line) of <file>, print the nearest" << endl;
+    cout << "                      triangle number, its distance and closest point (-1 when none)" << endl;
+    cout << "  --max-distance <d>  farthest triangle --nearest reports (default: no limit)" << endl;
+}
+
+// Answers --nearest for one export; false on error.
+bool nearest(const string& path, const TriangleArrays& triangles, const string& points_path, float max_distance,
+             unsigned threads) {
+    MappedInput data;
+    uint64_t data_size = data.open(path) ? data.size() : 0;
+    data.close();
+    MappedGrid mapped;
+    Grid built;
+    GridIndex index;
+    string error;
+    if (!mapped.open(path + ".grid", data_size) || !index.build(triangles, mapped, threads)) {
+        GridOptions options;
+        options.threads = threads;
+        if (!build_grid(triangles, options, built, &error) || !index.build(triangles, built, threads, &error)) {
+            cerr << "Error : " << path << " : " << error << endl;
+            return false;
+        }
+    }
+
+    ifstream in(points_path.c_str());
+    if (!in) {
+        cerr << "Error : file " << points_path << " impossible to open" << endl;
+        return false;
+    }
+    vector<float> points;
+    float value;
+    while (in >> value)
+        points.push_back(value);
+    if (!in.eof() || points.size() % 3 != 0) {
+        cerr << "Error : " << points_path << " : expected three coordinates per point" << endl;
+        return false;
+    }
+    size_t count = points.size() / 3;
+    vector<GridHit> hits(count);
+    if (count > 0)
+        nearest_triangles(index, &points[0], count, max_distance, &hits[0], threads);
+    for (size_t i = 0; i < count; ++i) {
+        const GridHit& hit = hits[i];
+        if (hit.triangle == GRID_NO_HIT)
+            cout << -1 << "\n";
+        else
+            cout << hit.triangle << " " << hit.distance << " " << hit.point[0] << " " << hit.point[1] << " "
+                 << hit.point[2] << "\n";
+    }
+    cout.flush();
+    return true;
+}
+
+int main(int argc, char** argv) {
+
+    GridOptions options;
+    string points_path;
+    float max_distance = HUGE_VALF;
+    vector<string> paths;
+    for (int i = 1; i < argc; ++i) {
+        string arg(argv[i]);
+        if (arg == "-h" || arg == "--help") {
+            display_usage(argc, argv);
+            return 0;
+        }
+        else if ((arg == "-t" || arg == "--threads") && i + 1 < argc)
+            options.threads = (unsigned)atoi(argv[++i]);
+        else if (arg == "--density" && i + 1 < argc)
+            options.density = atof(argv[++i]);
+        else if (arg == "--nearest" && i + 1 < argc)
+            points_path = argv[++i];
+        else if (arg == "--max-distance" && i + 1 < argc)
+            max_distance = (float)atof(argv[++i]);
+        else if (!arg.empty() && arg[0] == '-') {
+            display_usage(argc, argv);
+            return 1;
+        }
+        else
+            paths.push_back(arg);
+    }
+    if (paths.empty() || (!points_path.empty() && paths.size() != 1)) {
+        display_usage(argc, argv);
+        return 1;
+    }
+
+    int status = 0;
+    for (size_t f = 0; f < paths.size(); ++f) {
+        const string& path = paths[f];
+        TriReadOptions read_options;
+        read_options.threads = options.threads;
+        TriangleArrays triangles;
+        string error;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (!read_triangles(path, triangles, read_options, &error)) {
+            cerr << "Error : " << path << " : " << error << endl;
+            status = 1;
+            continue;
+        }
+        if (triangles.size() >= 0xffffffffULL) {
+            cerr << "Error : " << path << " : more than 2^32 triangles" << endl;
+            status = 1;
+            continue;
+        }
+        if (!points_path.empty()) {
+            if (!nearest(path, triangles, points_path, max_distance, options.threads))
+                status = 1;
+            continue;
+        }
+        chrono::steady_clock::time_point read = chrono::steady_clock::now();
+
+        Grid grid;
+        if (!build_grid(triangles, options, grid, &error)) {
+            cerr << "Error : " << path << " : " << error << endl;
+            status = 1;
+            continue;
+        }
+        chrono::steady_clock::time_point built = chrono::steady_clock::now();
+
+        MappedInput data;
+        uint64_t data_size = data.open(path) ? data.size() : 0;
+        data.close();
+        if (!write_grid(path + ".grid", grid, data_size)) {
+            cerr << "Error : file " << path << ".grid impossible to write" << endl;
+            status = 1;
+            continue;
+        }
+        double seconds = chrono::duration<double>(built - read).count();
+        cout << path << ".grid : " << triangles.size() << " triangles, " << grid.header.resolution[0] << " x "
+             << grid.header.resolution[1] << " x " << grid.header.resolution[2] << " cells, "
+             << (triangles.size() > 0 ? (double)grid.triangles.size() / triangles.size() : 0.0)
+             << " entries per triangle" << endl;
+        cout << "  read in " << chrono::duration<double>(read - start).count() << " s, built in " << seconds
+             << " s (" << (triangles.size() > 0 ? 1e9 * seconds / triangles.size() : 0.0)
+             << " ms per million triangles)" << endl;
+    }
+    return status;
+}
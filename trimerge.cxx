@@ -0,0 +1,87 @@
+#include "tri_merge.h"
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+
+using namespace std;
+
+// Merges exports (.tri, .trb, .stl or .ply), each placed by an optional
+// transform, into one glTF binary where the objects with the same geometry,
+// in one input or across several, share a single mesh (see tri_merge.h).
+
+void display_usage(int argc, char** argv) {
+    cout << "Usage is :" << endl;
+    cout << argv[0] << " [options] -o <output.glb> <input-file>..." << endl;
+    cout << "Options :" << endl;
+    cout << "  -o <file>            the merged .glb" << endl;
+    cout << "  --list <file>        also merge the inputs listed in <file>, one per line : the path, then" << endl;
+    cout << "                       optionally a translation (x y z) or a column major 4x4 matrix (16 numbers)" << endl;
+    cout << "  -t, --threads <n>    worker threads (default: one per core)" << endl;
+    cout << "  --tolerance <d>      coordinates within d of each other (relative to the object) are the same" << endl;
+    cout << "                       (default: 0.001, 0 for exact)" << endl;
+    cout << "  --no-index           merge whole files, ignoring their sidecar index" << endl;
+}
+
+int main(int argc, char** argv) {
+
+    MergeOptions options;
+    string output;
+    vector<MergeInput> inputs;
+    for (int i = 1; i < argc; ++i) {
+        string arg(argv[i]);
+        if (arg == "-h" || arg == "--help") {
+            display_usage(argc, argv);
+            return 0;
+        }
+        else if (arg == "-o" && i + 1 < argc)
+            output = argv[++i];
+        else if (arg == "--list" && i + 1 < argc) {
+            string error;
+            if (!read_merge_list(argv[++i], inputs, &error)) {
+                cerr << "Error : " << error << endl;
+                return 1;
+            }
+        }
+        else if ((arg == "-t" || arg == "--threads") && i + 1 < argc)
+            options.threads = (unsigned)atoi(argv[++i]);
+        else if (arg == "--tolerance" && i + 1 < argc)
+            options.tolerance = atof(argv[++i]);
+        else if (arg == "--no-index")
+            options.use_index = false;
+        else if (!arg.empty() && arg[0] == '-') {
+            display_usage(argc, argv);
+            return 1;
+        }
+        else {
+            MergeInput input;
+            input.path = arg;
+            inputs.push_back(input);
+        }
+    }
+    if (output.empty() || inputs.empty() || !(options.tolerance >= 0.0)) {
+        display_usage(argc, argv);
+        return 1;
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    MergePlan plan;
+    string error;
+    if (!plan_merge(inputs, options, plan, &error)) {
+        cerr << "Error : " << error << endl;
+        return 1;
+    }
+    chrono::steady_clock::time_point planned = chrono::steady_clock::now();
+    if (!write_merged_glb(plan, output, options, &error)) {
+        cerr << "Error : " << output << " : " << error << endl;
+        return 1;
+    }
+    chrono::steady_clock::time_point written = chrono::steady_clock::now();
+
+    cout << output << " : " << plan.inputs.size() << " inputs, " << plan.objects.size() << " objects, "
+         << plan.meshes.size() << " distinct meshes" << endl;
+    cout << "  " << plan.stored_triangle_count() << " triangles stored for " << plan.triangle_count()
+         << " placed" << endl;
+    cout << "  hashed in " << chrono::duration<double>(planned - start).count() << " s, written in "
+         << chrono::duration<double>(written - planned).count() << " s" << endl;
+    return 0;
+}
@@ -0,0 +1,157 @@
+#include "tri_reader.h"
+#include "tri_stats.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstdlib>
+
+using namespace std;
+
+// Geometry statistics of an existing export (.tri, .trb, .stl or .ply) as
+// JSON. When the file has its sidecar index (<file>.idx, see --index), the
+// top-level groups and instances get their own entry: each one is read on
+// its own from its span of the file, which together cover the file once.
+
+void display_usage(int argc, char** argv) {
+    cout << "Usage is :" << endl;
+    cout << argv[0] << " [options] <input-file>" << endl;
+    cout << "Options :" << endl;
+    cout << "  -o <file>            write the JSON report to a file (default: standard output)" << endl;
+    cout << "  -t, --threads <n>    worker threads (default: one per core)" << endl;
+    cout << "  --no-groups          ignore the sidecar index" << endl;
+}
+
+// Statistics of the top-level entries of the index, in file order.
+bool group_stats(const string& path, const TriIndexHeader& header, const vector<TriIndexEntry>& entries,
+                 unsigned threads, TriStats& total, EdgeHistogram& edges, vector<TriStatsGroup>& groups,
+                 string& error) {
+    vector<size_t> top;
+    for (size_t e = 0; e < entries.size(); ++e)
+        if (entries[e].parent == TRI_INDEX_NO_PARENT)
+            top.push_back(e);
+    groups.assign(top.size(), TriStatsGroup());
+    for (size_t g = 0; g < top.size(); ++g) {
+        const TriIndexEntry& entry = entries[top[g]];
+        groups[g].entity_id = entry.entity_id;
+        groups[g].kind = entry.kind == TRI_INDEX_FACES ? "faces" : entry.kind == TRI_INDEX_GROUP ? "group" : "instance";
+        ostringstream name;
+        if (entry.kind == TRI_INDEX_FACES)
+            name << "model";
+        else
+            name << groups[g].kind << " " << entry.entity_id;
+        groups[g].name = name.str();
+    }
+
+    // Entries run concurrently, biggest first, and share the threads.
+    vector<size_t> order(top.size());
+    for (size_t g = 0; g < order.size(); ++g)
+        order[g] = g;
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return entries[top[a]].length > entries[top[b]].length;
+    });
+    unsigned jobs = max(1u, min(threads, (unsigned)top.size()));
+    unsigned entry_threads = max(1u, threads / jobs);
+    vector<EdgeHistogram> histograms(jobs);
+    vector<string> errors(top.size());
+    parallel_for(order.size(), jobs, [&](size_t i, unsigned worker) {
+        size_t g = order[i];
+        const TriIndexEntry& entry = entries[top[g]];
+        TriReadOptions options;
+        options.threads = entry_threads;
+        TriangleArrays triangles;
+        if (read_tri_span(path, header.format, entry.offset, entry.length, triangles, options, &errors[g]))
+            triangle_stats(triangles, 0, triangles.size(), entry_threads, groups[g].stats, histograms[worker]);
+    });
+    for (size_t g = 0; g < groups.size(); ++g) {
+        if (!errors[g].empty()) {
+            error = errors[g];
+            return false;
+        }
+        total.add(groups[g].stats);
+    }
+    for (size_t w = 0; w < histograms.size(); ++w)
+        edges.add(histograms[w]);
+    return true;
+}
+
+int main(int argc, char** argv) {
+
+    unsigned threads = 0;
+    bool use_groups = true;
+    string output;
+    vector<string> paths;
+    for (int i = 1; i < argc; ++i) {
+        string arg(argv[i]);
+        if (arg == "-h" || arg == "--help") {
+            display_usage(argc, argv);
+            return 0;
+        }
+        else if ((arg == "-t" || arg == "--threads") && i + 1 < argc)
+            threads = (unsigned)atoi(argv[++i]);
+        else if (arg == "-o" && i + 1 < argc)
+            output = argv[++i];
+        else if (arg == "--no-groups")
+            use_groups = false;
+        else if (!arg.empty() && arg[0] == '-') {
+            display_usage(argc, argv);
+            return 1;
+        }
+        else
+            paths.push_back(arg);
+    }
+    if (paths.size() != 1) {
+        display_usage(argc, argv);
+        return 1;
+    }
+    if (threads == 0)
+        threads = default_thread_count();
+    const string& path = paths[0];
+
+    TriIndexHeader header;
+    vector<TriIndexEntry> entries;
+    MappedInput probe;
+    bool indexed = use_groups && probe.open(path + ".idx") && read_tri_index(path + ".idx", header, entries);
+    probe.close();
+    if (indexed && (!probe.open(path) || probe.size() != header.data_size)) {
+        cerr << "Warning : " << path << ".idx does not match " << path << ", ignored" << endl;
+        indexed = false;
+    }
+    probe.close();
+
+    TriStats total;
+    EdgeHistogram edges;
+    vector<TriStatsGroup> groups;
+    string error;
+    if (indexed) {
+        if (!group_stats(path, header, entries, threads, total, edges, groups, error)) {
+            cerr << "Error : " << path << " : " << error << endl;
+            return 1;
+        }
+    }
+    else {
+        TriReadOptions options;
+        options.threads = threads;
+        TriangleArrays triangles;
+        if (!read_triangles(path, triangles, options, &error)) {
+            cerr << "Error : " << path << " : " << error << endl;
+            return 1;
+        }
+        triangle_stats(triangles, 0, triangles.size(), threads, total, edges);
+    }
+
+    if (output.empty()) {
+        write_stats_json(cout, total, edges, groups);
+        return 0;
+    }
+    ofstream out(output.c_str());
+    write_stats_json(out, total, edges, groups);
+    out.close();
+    if (out.fail()) {
+        cerr << "Error : file " << output << " impossible to write" << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,146 @@
+#include "tri_reader.h"
+#include "tri_weld.h"
+#include "tri_halfedge.h"
+#include "mapped_file.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cstdlib>
+
+using namespace std;
+
+// Connectivity of an existing export (.tri, .trb, .stl or .ply): the
+// corners are welded by their exact coordinates, the half-edges built
+// (tri_halfedge.h) and the boundary and non-manifold edges, components and
+// closedness reported as JSON. With its sidecar index (<file>.idx), each
+// top-level group / instance is reported on its own too. --adjacency
+// writes the adjacency buffer <file>.adj.
+
+void display_usage(int argc, char** argv) {
+    cout << "Usage is :" << endl;
+    cout << argv[0] << " [options] <input-file>" << endl;
+    cout << "Options :" << endl;
+    cout << "  -o <file>            write the JSON report to a file (default: standard output)" << endl;
+    cout << "  -t, --threads <n>    worker threads (default: one per core)" << endl;
+    cout << "  --adjacency          also write the adjacency buffer <input-file>.adj" << endl;
+    cout << "  --no-groups          ignore the sidecar index" << endl;
+}
+
+int main(int argc, char** argv) {
+
+    unsigned threads = 0;
+    bool use_groups = true, adjacency = false;
+    string output;
+    vector<string> paths;
+    for (int i = 1; i < argc; ++i) {
+        string arg(argv[i]);
+        if (arg == "-h" || arg == "--help") {
+            display_usage(argc, argv);
+            return 0;
+        }
+        else if ((arg == "-t" || arg == "--threads") && i + 1 < argc)
+            threads = (unsigned)atoi(argv[++i]);
+        else if (arg == "-o" && i + 1 < argc)
+            output = argv[++i];
+        else if (arg == "--adjacency")
+            adjacency = true;
+        else if (arg == "--no-groups")
+            use_groups = false;
+        else if (!arg.empty() && arg[0] == '-') {
+            display_usage(argc, argv);
+            return 1;
+        }
+        else
+            paths.push_back(arg);
+    }
+    if (paths.size() != 1) {
+        display_usage(argc, argv);
+        return 1;
+    }
+    if (threads == 0)
+        threads = default_thread_count();
+    const string& path = paths[0];
+
+    TriReadOptions read_options;
+    read_options.threads = threads;
+    TriangleArrays triangles;
+    string error;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (!read_triangles(path, triangles, read_options, &error)) {
+        cerr << "Error : " << path << " : " << error << endl;
+        return 1;
+    }
+    IndexedTriangles mesh;
+    HalfEdges half_edges;
+    TopologyGroup whole;
+    whole.name = "file";
+    whole.kind = "file";
+    if (!weld_triangles(triangles, mesh, threads)
+        || !build_half_edges(mesh.indices.empty() ? 0 : &mesh.indices[0], mesh.triangle_count(), threads, half_edges,
+                             whole.stats)) {
+        cerr << "Error : " << path << " : too many triangles" << endl;
+        return 1;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    MappedInput probe;
+    uint64_t data_size = probe.open(path) ? probe.size() : 0;
+    probe.close();
+    if (adjacency && !write_adjacency(path + ".adj", half_edges, data_size)) {
+        cerr << "Error : file " << path << ".adj impossible to write" << endl;
+        return 1;
+    }
+
+    // The top-level entries are spans of the file, so of its triangles:
+    // each one is cut out of the welded whole and checked on its own.
+    vector<TopologyGroup> groups;
+    TriIndexHeader header;
+    vector<TriIndexEntry> entries;
+    bool indexed = use_groups && probe.open(path + ".idx") && read_tri_index(path + ".idx", header, entries);
+    probe.close();
+    if (indexed && header.data_size != data_size) {
+        cerr << "Warning : " << path << ".idx does not match " << path << ", ignored" << endl;
+        indexed = false;
+    }
+    if (!indexed)
+        groups.push_back(whole);
+    else {
+        uint64_t first = 0;
+        for (size_t e = 0; e < entries.size(); ++e) {
+            const TriIndexEntry& entry = entries[e];
+            if (entry.parent != TRI_INDEX_NO_PARENT)
+                continue;
+            TopologyGroup group;
+            group.entity_id = entry.entity_id;
+            group.kind = entry.kind == TRI_INDEX_FACES ? "faces" : entry.kind == TRI_INDEX_GROUP ? "group" : "instance";
+            ostringstream name;
+            if (entry.kind == TRI_INDEX_FACES)
+                name << "model";
+            else
+                name << group.kind << " " << entry.entity_id;
+            group.name = name.str();
+            uint64_t count = min<uint64_t>(entry.triangle_count, mesh.triangle_count() - first);
+            HalfEdges part;
+            build_half_edges(count > 0 ? &mesh.indices[3 * first] : 0, (size_t)count, threads, part, group.stats);
+            first += count;
+            groups.push_back(group);
+        }
+    }
+
+    if (output.empty())
+        write_topology_json(cout, groups);
+    else {
+        ofstream out(output.c_str());
+        write_topology_json(out, groups);
+        out.close();
+        if (out.fail()) {
+            cerr << "Error : file " << output << " impossible to write" << endl;
+            return 1;
+        }
+    }
+    cerr << path << " : " << mesh.triangle_count() << " triangles, " << mesh.vertex_count() << " vertices, "
+         << whole.stats.components << " components, " << (whole.stats.closed() ? "closed" : "not closed")
+         << ", read and built in " << seconds << " s" << endl;
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include "tri_reader.h"
+#include "tri_voxel.h"
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+
+using namespace std;
+
+// Voxelizes an existing export (.tri, .trb, .stl or .ply) into the bit
+// packed grid of tri_voxel.h, written as <file>.vox unless an output is
+// given: the voxels the surface crosses and, with --solid, the inside of
+// its closed shells.
+
+void display_usage(int argc, char** argv) {
+    cout << "Usage is :" << endl;
+    cout << argv[0] << " [options] --size <s> <input-file> [<output-file>]" << endl;
+    cout << "Writes <input-file>.vox by default." << endl;
+    cout << "Options :" << endl;
+    cout << "  -t, --threads <n>   worker threads (default: one per core)" << endl;
+    cout << "  --size <s>          voxel edge, in the units of the input" << endl;
+    cout << "  --solid             also fill the inside of the closed shells" << endl;
+}
+
+int main(int argc, char** argv) {
+
+    VoxelOptions options;
+    vector<string> paths;
+    for (int i = 1; i < argc; ++i) {
+        string arg(argv[i]);
+        if (arg == "-h" || arg == "--help") {
+            display_usage(argc, argv);
+            return 0;
+        }
+        else if ((arg == "-t" || arg == "--threads") && i + 1 < argc)
+            options.threads = (unsigned)atoi(argv[++i]);
+        else if (arg == "--size" && i + 1 < argc)
+            options.size = atof(argv[++i]);
+        else if (arg == "--solid")
+            options.solid = true;
+        else if (!arg.empty() && arg[0] == '-') {
+            display_usage(argc, argv);
+            return 1;
+        }
+        else
+            paths.push_back(arg);
+    }
+    if (paths.empty() || paths.size() > 2 || !(options.size > 0.0)) {
+        display_usage(argc, argv);
+        return 1;
+    }
+    const string& path = paths[0];
+    string output_path = paths.size() > 1 ? paths[1] : path + ".vox";
+
+    TriReadOptions read_options;
+    read_options.threads = options.threads;
+    TriangleArrays triangles;
+    string error;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (!read_triangles(path, triangles, read_options, &error)) {
+        cerr << "Error : " << path << " : " << error << endl;
+        return 1;
+    }
+    chrono::steady_clock::time_point read = chrono::steady_clock::now();
+
+    VoxelGrid grid;
+    if (!voxelize(triangles, options, grid, &error)) {
+        cerr << "Error : " << path << " : " << error << endl;
+        return 1;
+    }
+    chrono::steady_clock::time_point built = chrono::steady_clock::now();
+    if (!write_voxels(output_path, grid)) {
+        cerr << "Error : file " << output_path << " impossible to write" << endl;
+        return 1;
+    }
+
+    const TriVoxelHeader& header = grid.header;
+    double seconds = chrono::duration<double>(built - read).count();
+    cout << output_path << " : " << triangles.size() << " triangles, " << header.resolution[0] << " x "
+         << header.resolution[1] << " x " << header.resolution[2] << " voxels of " << header.size << ", "
+         << header.occupied << " occupied" << endl;
+    if (options.solid)
+        cout << "  " << grid.open_rows << " rows left unfilled (surface not closed along them)" << endl;
+    cout << "  read in " << chrono::duration<double>(read - start).count() << " s, voxelized in " << seconds
+         << " s (" << (triangles.size() > 0 ? 1e9 * seconds / triangles.size() : 0.0)
+         << " ms per million triangles)" << endl;
+    return 0;
+}
@@ -0,0 +1,359 @@
+#ifndef SKP2TRI_WORKER_PROCESS_H
+#define SKP2TRI_WORKER_PROCESS_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cerrno>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#endif
+
+// A child process fed lines on its standard input, answering lines on its
+// standard output, its standard error shared with the parent. skp2tri
+// --batch converts in such workers, so a model that crashes the SDK only
+// takes its own worker down.
+
+// In a worker: keeps the standard output for the answers to the parent,
+// returned, and sends whatever else is written to it (a report to "-", the
+// SDK's own messages) to the standard error, so that it cannot be taken for
+// an answer.
+inline std::FILE* take_standard_output() {
+    std::fflush(stdout);
+#ifdef _WIN32
+    int answers = _dup(_fileno(stdout));
+    _dup2(_fileno(stderr), _fileno(stdout));
+    return answers < 0 ? 0 : _fdopen(answers, "w");
+#else
+    int answers = dup(1);
+    dup2(2, 1);
+    return answers < 0 ? 0 : fdopen(answers, "w");
+#endif
+}
+
+// The path of the running program, to start workers of the same build.
+inline std::string current_program(const char* argv0) {
+#ifdef _WIN32
+    char path[MAX_PATH];
+    DWORD length = GetModuleFileNameA(NULL, path, MAX_PATH);
+    if (length > 0 && length < MAX_PATH)
+        return std::string(path, length);
+#elif defined(__linux__)
+    char path[PATH_MAX];
+    ssize_t length = readlink("/proc/self/exe", path, sizeof(path));
+    if (length > 0 && length < (ssize_t)sizeof(path))
+        return std::string(path, (size_t)length);
+#endif
+    return argv0;
+}
+
+#ifdef _WIN32
+// Quotes an argument of a command line the way the C runtime splits it back.
+inline std::string quote_argument(const std::string& arg) {
+    if (!arg.empty() && arg.find_first_of(" \t\"") == std::string::npos)
+        return arg;
+    std::string quoted = "\"";
+    size_t backslashes = 0;
+    for (size_t i = 0; i < arg.size(); ++i) {
+        if (arg[i] == '\\') {
+            ++backslashes;
+            continue;
+        }
+        quoted.append(arg[i] == '"' ? 2 * backslashes + 1 : backslashes, '\\');
+        quoted += arg[i];
+        backslashes = 0;
+    }
+    quoted.append(2 * backslashes, '\\');
+    return quoted + "\"";
+}
+#endif
+
+class WorkerProcess {
+public:
+    WorkerProcess() {
+#ifdef _WIN32
+        process_ = input_ = output_ = NULL;
+#else
+        pid_ = -1;
+        input_ = output_ = -1;
+#endif
+        timed_out_ = false;
+    }
+
+    ~WorkerProcess() { stop(); }
+
+    // Starts `program` with `args` (the program name not included).
+    bool start(const std::string& program, const std::vector<std::string>& args) {
+        stop();
+        // Started one at a time: a worker started concurrently would inherit
+        // the pipes of this one, whose input would then never reach its end.
+        static std::mutex starting;
+        std::lock_guard<std::mutex> lock(starting);
+#ifdef _WIN32
+        SECURITY_ATTRIBUTES inherit = { sizeof(SECURITY_ATTRIBUTES), NULL, TRUE };
+        HANDLE child_input = NULL, child_output = NULL;
+        if (!CreatePipe(&child_input, &input_, &inherit, 0))
+            return false;
+        if (!CreatePipe(&output_, &child_output, &inherit, 0)) {
+            CloseHandle(child_input);
+            CloseHandle(input_);
+            input_ = NULL;
+            return false;
+        }
+        SetHandleInformation(input_, HANDLE_FLAG_INHERIT, 0);
+        SetHandleInformation(output_, HANDLE_FLAG_INHERIT, 0);
+
+        std::string command = quote_argument(program);
+        for (size_t a = 0; a < args.size(); ++a)
+            command += " " + quote_argument(args[a]);
+        std::vector<char> line(command.begin(), command.end());
+        line.push_back('\0');
+        STARTUPINFOA startup;
+        ZeroMemory(&startup, sizeof(startup));
+        startup.cb = sizeof(startup);
+        startup.dwFlags = STARTF_USESTDHANDLES;
+        startup.hStdInput = child_input;
+        startup.hStdOutput = child_output;
+        startup.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+        PROCESS_INFORMATION created;
+        BOOL started = CreateProcessA(NULL, &line[0], NULL, NULL, TRUE, 0, NULL, NULL, &startup, &created);
+        CloseHandle(child_input);
+        CloseHandle(child_output);
+        if (!started) {
+            close_pipes();
+            return false;
+        }
+        CloseHandle(created.hThread);
+        process_ = created.hProcess;
+#else
+        int to_child[2], from_child[2];
+        if (pipe(to_child) != 0)
+            return false;
+        if (pipe(from_child) != 0) {
+            ::close(to_child[0]);
+            ::close(to_child[1]);
+            return false;
+        }
+        std::vector<char*> argv;
+        argv.push_back(const_cast<char*>(program.c_str()));
+        for (size_t a = 0; a < args.size(); ++a)
+            argv.push_back(const_cast<char*>(args[a].c_str()));
+        argv.push_back(0);
+
+        pid_ = fork();
+        if (pid_ == 0) {
+            dup2(to_child[0], 0);
+            dup2(from_child[1], 1);
+            ::close(to_child[0]);
+            ::close(to_child[1]);
+            ::close(from_child[0]);
+            ::close(from_child[1]);
+            execvp(program.c_str(), &argv[0]);
+            _exit(127);
+        }
+        ::close(to_child[0]);
+        ::close(from_child[1]);
+        input_ = to_child[1];
+        output_ = from_child[0];
+        if (pid_ < 0) {
+            close_pipes();
+            return false;
+        }
+        fcntl(input_, F_SETFD, FD_CLOEXEC);
+        fcntl(output_, F_SETFD, FD_CLOEXEC);
+#endif
+        pending_.clear();
+        return true;
+    }
+
+    bool running() const {
+#ifdef _WIN32
+        return process_ != NULL;
+#else
+        return pid_ > 0;
+#endif
+    }
+
+    // Sends one line, the newline added.
+    bool send(const std::string& line) {
+        std::string data = line + "\n";
+        const char* next = data.data();
+        size_t left = data.size();
+        while (left > 0) {
+#ifdef _WIN32
+            DWORD written = 0;
+            if (!WriteFile(input_, next, (DWORD)left, &written, NULL) || written == 0)
+                return false;
+#else
+            ssize_t written = ::write(input_, next, left);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written <= 0)
+                return false;
+#endif
+            next += written;
+            left -= (size_t)written;
+        }
+        return true;
+    }
+
+    // Waits for the next line, without its end of line, `seconds` at most
+    // when over 0. False once the worker's output has ended, i.e. the worker
+    // has, or when the time is up, timed_out() then true.
+    bool receive(std::string& line, double seconds = 0.0) {
+        timed_out_ = false;
+        std::chrono::steady_clock::time_point deadline =
+            std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(std::max(seconds, 0.0)));
+        for (;;) {
+            size_t end = pending_.find('\n');
+            if (end != std::string::npos) {
+                line = pending_.substr(0, end);
+                pending_.erase(0, end + 1);
+                if (!line.empty() && line[line.size() - 1] == '\r')
+                    line.erase(line.size() - 1);
+                return true;
+            }
+            char buffer[4096];
+            double left = std::chrono::duration<double>(deadline - std::chrono::steady_clock::now()).count();
+#ifdef _WIN32
+            // Anonymous pipes cannot be waited on : polled.
+            DWORD available = 0;
+            if (seconds > 0 && !PeekNamedPipe(output_, NULL, 0, NULL, &available, NULL))
+                return false;
+            if (seconds > 0 && available == 0) {
+                if (left <= 0) {
+                    timed_out_ = true;
+                    return false;
+                }
+                Sleep(10);
+                continue;
+            }
+            DWORD count = 0;
+            if (!ReadFile(output_, buffer, sizeof(buffer), &count, NULL) || count == 0)
+                return false;
+#else
+            if (seconds > 0) {
+                pollfd ready = { output_, POLLIN, 0 };
+                int polled = left <= 0 ? 0 : poll(&ready, 1, (int)std::min(left * 1000.0 + 1.0, 1e9));
+                if (polled < 0 && errno == EINTR)
+                    continue;
+                if (polled == 0) {
+                    timed_out_ = true;
+                    return false;
+                }
+            }
+            ssize_t count = ::read(output_, buffer, sizeof(buffer));
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count <= 0)
+                return false;
+#endif
+            pending_.append(buffer, (size_t)count);
+        }
+    }
+
+    // Whether the last receive() ran out of time.
+    bool timed_out() const { return timed_out_; }
+
+    // Ends the worker at once, one stuck in a conversion, and waits for it.
+    std::string kill() {
+        if (running())
+#ifdef _WIN32
+            TerminateProcess(process_, 1);
+#else
+            ::kill(pid_, SIGKILL);
+#endif
+        return stop();
+    }
+
+    // Closes the worker's input, which ends a worker waiting for lines, and
+    // waits for it. Returns how it ended, e.g. "exit code 0" or "signal 11".
+    std::string stop() {
+        if (!running()) {
+            close_pipes();
+            return "";
+        }
+#ifdef _WIN32
+        CloseHandle(input_);
+        input_ = NULL;
+        WaitForSingleObject(process_, INFINITE);
+        DWORD code = 0;
+        GetExitCodeProcess(process_, &code);
+        CloseHandle(process_);
+        process_ = NULL;
+        close_pipes();
+        std::ostringstream status;
+        status << "exit code 0x" << std::hex << code;
+        return status.str();
+#else
+        ::close(input_);
+        input_ = -1;
+        int status = 0;
+        while (waitpid(pid_, &status, 0) < 0 && errno == EINTR) {}
+        pid_ = -1;
+        close_pipes();
+        std::ostringstream ended;
+        if (WIFSIGNALED(status))
+            ended << "signal " << WTERMSIG(status);
+        else
+            ended << "exit code " << WEXITSTATUS(status);
+        return ended.str();
+#endif
+    }
+
+private:
+    WorkerProcess(const WorkerProcess&);
+    WorkerProcess& operator=(const WorkerProcess&);
+
+    void close_pipes() {
+#ifdef _WIN32
+        if (input_ != NULL)
+            CloseHandle(input_);
+        if (output_ != NULL)
+            CloseHandle(output_);
+        input_ = output_ = NULL;
+#else
+        if (input_ >= 0)
+            ::close(input_);
+        if (output_ >= 0)
+            ::close(output_);
+        input_ = output_ = -1;
+#endif
+        pending_.clear();
+    }
+
+#ifdef _WIN32
+    HANDLE process_;
+    HANDLE input_;  // the worker's standard input, our end
+    HANDLE output_; // the worker's standard output, our end
+#else
+    pid_t pid_;
+    int input_;
+    int output_;
+#endif
+    std::string pending_; // received, past the last line returned
+    bool timed_out_;
+};
+
+#endif // SKP2TRI_WORKER_PROCESS_H